@@ -0,0 +1,143 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cmath>
+#include <vector>
+#include "Almanac.h"
+
+namespace almanac {
+
+constexpr double deg = M_PI / 180.0;
+constexpr double j2000 = 2451545.0;             // julian date of 2000-01-01 12:00 UTC
+constexpr double unix_epoch = 2440587.5;        // julian date of 1970-01-01 00:00 UTC
+constexpr double synodic_month = 29.530588853;
+
+/**
+ * sunrise, sunset and civil twilight for several locations and days.
+ *
+ * @param lat           - latitudes in degrees, north is positive
+ * @param lon           - longitudes in degrees, east is positive
+ * @param locations     - number of locations
+ * @param first_day     - the first local date, in days since 1970-01-01
+ * @param days          - number of days
+ * @param result        - locations * days entries, all days of the first location first
+ */
+void sunEvents(const double *lat, const double *lon, size_t locations, int64_t first_day, int days,
+               SunEvents *result)
+{
+    const size_t n = locations * static_cast<size_t>(days);
+    std::vector<double> phi(n), transit(n), rise(n), twilight(n);
+    const double sin_rise = sin(-0.833 * deg), sin_civil = sin(-6.0 * deg);
+    const double sin_obliquity = sin(23.4397 * deg);
+
+    for(size_t i = 0; i < n; i++) {
+        const double l = lon[i / days];
+        phi[i] = lat[i / days] * deg;
+        // mean solar noon, days since J2000
+        transit[i] = static_cast<double>(first_day + static_cast<int64_t>(i % days) - 10957) + 0.0008 - l / 360.0;
+    }
+    for(size_t i = 0; i < n; i++) {
+        const double m = fmod(357.5291 + 0.98560028 * transit[i], 360.0) * deg;
+        const double c = 1.9148 * sin(m) + 0.02 * sin(2 * m) + 0.0003 * sin(3 * m);
+        const double lambda = fmod(m / deg + c + 180.0 + 102.9372, 360.0) * deg;
+        const double sin_dec = sin(lambda) * sin_obliquity;
+        const double cos_dec = sqrt(1.0 - sin_dec * sin_dec);
+        const double sin_phi = sin(phi[i]), cos_phi = cos(phi[i]);
+
+        transit[i] += 0.0053 * sin(m) - 0.0069 * sin(2 * lambda);
+        // cosine of the hour angle, beyond [-1, 1] if the sun does not cross the altitude
+        rise[i] = (sin_rise - sin_phi * sin_dec) / (cos_phi * cos_dec);
+        twilight[i] = (sin_civil - sin_phi * sin_dec) / (cos_phi * cos_dec);
+    }
+    for(size_t i = 0; i < n; i++) {
+        const double t = (transit[i] + j2000 - unix_epoch) * 86400.0;
+        const double h_rise = acos(fmin(1.0, fmax(-1.0, rise[i]))) / (2 * M_PI) * 86400.0;
+        const double h_civil = acos(fmin(1.0, fmax(-1.0, twilight[i]))) / (2 * M_PI) * 86400.0;
+        const bool sun = fabs(rise[i]) <= 1.0, civil = fabs(twilight[i]) <= 1.0;
+        SunEvents& r = result[i];
+
+        r.daylight = rise[i] < -1.0 ? 1 : rise[i] > 1.0 ? -1 : 0;
+        r.sunrise = sun ? static_cast<time_t>(llround(t - h_rise)) : 0;
+        r.sunset = sun ? static_cast<time_t>(llround(t + h_rise)) : 0;
+        r.dawn = civil ? static_cast<time_t>(llround(t - h_civil)) : 0;
+        r.dusk = civil ? static_cast<time_t>(llround(t + h_civil)) : 0;
+    }
+}
+
+SunEvents sunEvents(double lat, double lon, int64_t day)
+{
+    SunEvents result;
+    sunEvents(&lat, &lon, 1, day, 1, &result);
+    return result;
+}
+
+/**
+ * @param t     - unix time
+ * @return      - the moon phase as fraction of the synodic month,
+ *                0 = new moon, 0.5 = full moon
+ */
+double moonPhase(time_t t)
+{
+    const double T = (static_cast<double>(t) / 86400.0 + unix_epoch - j2000) / 36525.0;
+    const double d = fmod(297.8501921 + 445267.1114034 * T, 360.0) * deg;     // mean elongation
+    const double m = fmod(357.5291092 + 35999.0502909 * T, 360.0) * deg;      // sun mean anomaly
+    const double mp = fmod(134.9633964 + 477198.8675055 * T, 360.0) * deg;    // moon mean anomaly
+    const double i = 180.0 - d / deg - 6.289 * sin(mp) + 2.100 * sin(m) - 1.274 * sin(2 * d - mp)
+                     - 0.658 * sin(2 * d) - 0.214 * sin(2 * mp) - 0.110 * sin(d);
+    double phase = fmod(180.0 - i, 360.0) / 360.0;
+    return phase < 0 ? phase + 1.0 : phase;
+}
+
+/**
+ * @return      - the ClimaCell moon phase code (0-7) for a phase from moonPhase()
+ */
+int moonPhaseCode(double phase)
+{
+    return static_cast<int>(floor(phase * 8.0 + 0.5)) % 8;
+}
+
+const char *moonPhaseName(int code)
+{
+    return code >= 0 && code < 8 ? moon_phases[code] : "Unknown";
+}
+
+/**
+ * the coordinates of the configured location, if it is given as latitude
+ * and longitude.
+ *
+ * @return      - false if the location has no valid coordinates.
+ */
+bool coordinates(const CFG& cfg, double& lat, double& lon)
+{
+    char *end_lat = nullptr, *end_lon = nullptr;
+
+    if(cfg.lat.empty() || cfg.lon.empty())
+        return false;
+    lat = strtod(cfg.lat.c_str(), &end_lat);
+    lon = strtod(cfg.lon.c_str(), &end_lon);
+    return *end_lat == 0 && *end_lon == 0 && fabs(lat) <= 90.0 && fabs(lon) <= 180.0;
+}
+
+}
@@ -0,0 +1,68 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_ALMANAC_H_
+#define FETCHWEATHER_SRC_ALMANAC_H_
+
+#include "pch.h"
+#include "options.h"
+
+/*
+ * sun and moon for a location, computed locally instead of asking the
+ * provider.
+ *
+ * Sunrise, sunset and civil twilight follow the sunrise equation (mean
+ * anomaly, equation of center, ecliptic longitude, solar transit and
+ * declination as in the NOAA solar calculations). Between the polar
+ * circles the results are within a minute or two of the provider values.
+ * The moon phase uses the low precision phase angle of Meeus, Astronomical
+ * Algorithms, chapter 48.
+ *
+ * sunEvents() takes arrays of locations and a range of days. Each step is
+ * a loop without branches over all (location, day) pairs, so the compiler
+ * can vectorise it.
+ */
+struct SunEvents {
+    time_t      sunrise = 0, sunset = 0;    // 0 on days without sunrise or sunset
+    time_t      dawn = 0, dusk = 0;         // civil twilight (sun 6° below the horizon), 0 if there is none
+    int         daylight = 0;               // 1 = the sun does not set, -1 = it does not rise
+};
+
+namespace almanac {
+    void        sunEvents(const double *lat, const double *lon, size_t locations, int64_t first_day, int days,
+                          SunEvents *result);
+    SunEvents   sunEvents(double lat, double lon, int64_t day);
+    double      moonPhase(time_t t);
+    int         moonPhaseCode(double phase);
+    const char  *moonPhaseName(int code);
+    bool        coordinates(const CFG& cfg, double& lat, double& lon);
+
+    // ClimaCell moonPhase codes, 0 = new moon, 4 = full moon
+    static constexpr const char *moon_phases[] = { "New Moon", "Waxing Crescent", "First Quarter",
+                                                   "Waxing Gibbous", "Full Moon", "Waning Gibbous",
+                                                   "Last Quarter", "Waning Crescent" };
+}
+
+#endif //FETCHWEATHER_SRC_ALMANAC_H_
@@ -0,0 +1,218 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <sstream>
+#include "Batch.h"
+#include "DataHandler.h"
+#include "EventLoop.h"
+#include "utils.h"
+
+/**
+ * read a batch file. One site per line, NAME LOCATION [TIMEZONE] separated
+ * by white space. Empty lines and lines starting with # are ignored.
+ *
+ * @param path          - the batch file
+ * @return              - false if the file cannot be read or has an invalid line
+ */
+bool Batch::load(const std::string& path)
+{
+    std::ifstream f(path);
+    std::string line;
+    int lineno = 0;
+
+    if(!f) {
+        fprintf(stderr, "Unable to read the batch file %s\n", path.c_str());
+        return false;
+    }
+    while(std::getline(f, line)) {
+        lineno++;
+        utils::trim(line);
+        if(line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string name, location, timezone, extra;
+        fields >> name >> location >> timezone >> extra;
+        if(location.empty() || !extra.empty() || !this->add(name, location, timezone)) {
+            fprintf(stderr, "%s:%d: invalid entry. Expected NAME LOCATION [TIMEZONE]\n", path.c_str(), lineno);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * add a site to the batch. The name is used for the output directory and
+ * the cache files, only letters, digits, '.', '-' and '_' are allowed.
+ *
+ * @param name          - unique name of the site
+ * @param location      - location id or LAT,LON
+ * @param timezone      - time zone of the site, empty = --tz
+ * @return              - false for invalid or duplicate names
+ */
+bool Batch::add(const std::string& name, const std::string& location, const std::string& timezone)
+{
+    bool valid = !name.empty() && name[0] != '.' && !location.empty() &&
+                 std::all_of(name.begin(), name.end(), [](unsigned char ch) {
+                     return std::isalnum(ch) || ch == '.' || ch == '-' || ch == '_';
+                 });
+    if(!valid || std::any_of(this->m_sites.begin(), this->m_sites.end(),
+                             [&name](const CFG& site) { return site.site == name; })) {
+        LOG_F(INFO, "Batch::add(): invalid or duplicate site %s", name.c_str());
+        return false;
+    }
+
+    CFG& cfg = this->m_sites.emplace_back(this->m_base);
+    cfg.site = name;
+    ProgramOptions::setLocation(cfg, location);
+    if(!timezone.empty())
+        cfg.timezone = timezone;
+    cfg.silent = true;
+    cfg.batchFile.clear();
+    cfg.sites.clear();
+    if(cfg.output_file.empty() && cfg.outputProfiles.empty())
+        cfg.output_file = Batch::default_outputs[cfg.format];
+    if(!cfg.output_file.empty())
+        cfg.output_file = name + "/" + cfg.output_file;
+    for(auto& output : cfg.outputProfiles)
+        output.file = name + "/" + output.file;
+    return true;
+}
+
+/**
+ * process all sites.
+ *
+ * @param jobs          - number of sites processed at the same time
+ * @return              - the number of sites which failed
+ */
+int Batch::run(unsigned int jobs)
+{
+    EventLoop&  loop = EventLoop::current();
+    size_t      next = 0;
+    int         failed = 0;
+
+    for(const auto& site : this->m_sites) {
+        std::error_code ec;
+        fs::create_directories(fs::path(this->m_base.data_dir_path) / site.site, ec);
+    }
+    this->computeSun();
+    for(unsigned int i = 0; i < std::min<size_t>(jobs, this->m_sites.size()); i++)
+        loop.spawn(this->worker(next, failed));
+    loop.run();
+    return failed;
+}
+
+/**
+ * process sites until none is left.
+ *
+ * @param next          - index of the next site, shared by all workers
+ * @param failed        - counts the sites which failed
+ */
+Task<void> Batch::worker(size_t& next, int& failed)
+{
+    while(next < this->m_sites.size()) {
+        size_t site = next++;
+        int rc = co_await this->process(site);
+        if(rc != 0)
+            failed++;
+    }
+}
+
+/**
+ * sunrise, sunset and twilight of all sites with coordinates.
+ */
+void Batch::computeSun()
+{
+    std::vector<double> lat, lon;
+
+    this->m_sunRow.assign(this->m_sites.size(), -1);
+    for(size_t i = 0; i < this->m_sites.size(); i++) {
+        double a, b;
+        if(almanac::coordinates(this->m_sites[i], a, b)) {
+            this->m_sunRow[i] = static_cast<long>(lat.size() * Batch::sun_days);
+            lat.push_back(a);
+            lon.push_back(b);
+        }
+    }
+    this->m_sunDay = time(0) / 86400 - 1;
+    this->m_sun.resize(lat.size() * Batch::sun_days);
+    almanac::sunEvents(lat.data(), lon.data(), lat.size(), this->m_sunDay, Batch::sun_days, this->m_sun.data());
+}
+
+/**
+ * fetch one site, write its outputs and record it.
+ *
+ * @param site          - index into m_sites
+ * @return              - 0 on success, -1 otherwise
+ */
+Task<int> Batch::process(size_t site)
+{
+    const CFG& cfg = this->m_sites[site];
+    auto start = std::chrono::steady_clock::now();
+    auto handler = DataHandler::create(cfg);
+
+    if(!handler)
+        co_return -1;
+    if(this->m_sunRow[site] >= 0)
+        handler->setAlmanac(this->m_sunDay, &this->m_sun[this->m_sunRow[site]], Batch::sun_days);
+    int rc = co_await handler->process();
+    LOG_F(INFO, "Batch::process(): %s %s after %ld ms", cfg.site.c_str(), rc == 0 ? "done" : "failed",
+          static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - start).count()));
+    co_return rc;
+}
+
+/**
+ * --batch and --site.
+ *
+ * @return      - 0 if all sites succeeded, -1 otherwise (used as exit code)
+ */
+int Batch::run(const CFG& cfg)
+{
+    Batch batch(cfg);
+
+    if(!cfg.batchFile.empty() && !batch.load(cfg.batchFile))
+        return -1;
+    for(const auto& spec : cfg.sites) {
+        auto eq = spec.find('=');
+        auto at = spec.find('@', eq == std::string::npos ? 0 : eq);
+        if(eq == std::string::npos
+           || !batch.add(spec.substr(0, eq), spec.substr(eq + 1, at == std::string::npos ? at : at - eq - 1),
+                         at == std::string::npos ? "" : spec.substr(at + 1))) {
+            fprintf(stderr, "Invalid --site %s. Expected NAME=LOCATION[@TIMEZONE] with a unique NAME\n",
+                    spec.c_str());
+            return -1;
+        }
+    }
+    if(batch.size() == 0) {
+        fprintf(stderr, "The batch is empty.\n");
+        return -1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int failed = batch.run(cfg.jobs);
+    fprintf(stderr, "%zu locations in %.2f s, %d failed\n", batch.size(),
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), failed);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_BATCH_H_
+#define FETCHWEATHER_SRC_BATCH_H_
+
+#include "pch.h"
+#include "options.h"
+#include "Task.h"
+#include "Almanac.h"
+
+/*
+ * batch mode (--batch FILE, --site NAME=LOCATION): fetch many locations in
+ * one process.
+ *
+ * Every site gets its own copy of the configuration with location, time
+ * zone, cache and output file names adjusted, its handler reads nothing
+ * else. All sites are processed by coroutines on the EventLoop of the
+ * calling thread, --jobs of them in flight at a time. While some sites
+ * wait for the provider, others parse, write their outputs or record into
+ * the history database, which needs no locking that way. Connections to the provider are reused
+ * from one site to the next.
+ *
+ * The outputs of site NAME go to DATA_DIR/NAME/, under the names given with
+ * --output and --outputAs or default_outputs[format] when neither is given.
+ * Nothing is written to stdout.
+ *
+ * Sunrise, sunset and twilight of all sites with coordinates are computed
+ * in one pass before the first request (see Almanac), for sun_days days
+ * around today so every site finds its local date.
+ */
+class Batch {
+  public:
+    explicit Batch(const CFG& cfg) : m_base(cfg) {}
+
+    bool    load(const std::string& path);
+    bool    add(const std::string& name, const std::string& location, const std::string& timezone = "");
+    int     run(unsigned int jobs);
+    size_t  size() const { return m_sites.size(); }
+
+    static int  run(const CFG& cfg);
+
+    static constexpr const char *default_outputs[] = { "weather.txt", "weather.json", "weather.prom",
+                                                       "weather.lp" };
+    static constexpr int    sun_days = 3;           // yesterday to tomorrow (UTC)
+
+  private:
+    Task<void>  worker(size_t& next, int& failed);
+    Task<int>   process(size_t site);
+    void        computeSun();
+
+    const CFG&          m_base;
+    std::vector<CFG>    m_sites;        // one configuration per site, fixed once run() starts
+    std::vector<SunEvents>  m_sun;      // sun_days entries per site with coordinates
+    std::vector<long>   m_sunRow;       // first entry in m_sun per site, -1 = no coordinates
+    int64_t             m_sunDay = 0;   // date of the first entry in days since 1970-01-01
+};
+
+#endif //FETCHWEATHER_SRC_BATCH_H_
@@ -0,0 +1,632 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Benchmark.h"
+#include "utils.h"
+#include "HistoryDB.h"
+#include "TimeSeriesLog.h"
+#include "HistoryIO.h"
+#include "TimeZone.h"
+#include "Almanac.h"
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const char *what, size_t count, double seconds)
+{
+    printf("%-40s %8zu in %8.3f s  %12.0f/s\n", what, count, seconds, seconds > 0 ? count / seconds : 0.0);
+}
+
+/**
+ * synthetic observations, one per minute ending now.
+ */
+static std::vector<DataPoint> makeSeries(size_t count)
+{
+    std::vector<DataPoint> series(count);
+    time_t now = time(0) - count * 60;
+
+    for(size_t i = 0; i < count; i++) {
+        DataPoint& d = series[i];
+        d = DataPoint {};
+        d.valid = true;
+        d.timeRecorded = now + i * 60;
+        d.sunriseTime = d.timeRecorded - 21600;
+        d.sunsetTime = d.timeRecorded + 21600;
+        d.temperature = 10.0 + 8.0 * sin(i / 720.0);
+        d.temperatureApparent = d.temperature - 1.5;
+        d.dewPoint = d.temperature - 4.0;
+        d.humidity = 60 + (i % 30);
+        d.pressureSeaLevel = 1013.0 + (i % 17) * 0.1;
+        d.windSpeed = (i % 40) * 0.5;
+        d.windGust = d.windSpeed * 1.4;
+        d.windDirection = (i * 7) % 360;
+        d.visibility = 10;
+        d.cloudCover = i % 100;
+        d.weatherSymbol = 'a' + i % 26;
+        d.fingerprint = utils::fnv1a(&d.temperature, sizeof(double), i);
+        snprintf(d.conditionAsString, sizeof(d.conditionAsString), "Partly Cloudy");
+        snprintf(d.precipitationTypeAsString, sizeof(d.precipitationTypeAsString), "None");
+    }
+    return series;
+}
+
+/**
+ * recording and range scans with both history backends.
+ */
+static int history()
+{
+    const size_t count = 20000;
+    char dir[] = "/tmp/fetchweather-bench-XXXXXX";
+    std::vector<ForecastPoint> timeline;
+
+    if(!mkdtemp(dir)) {
+        printf("Unable to create a temporary directory\n");
+        return -1;
+    }
+    std::string base(dir);
+    std::vector<DataPoint> series = makeSeries(count);
+    std::vector<HistoryRecord> records;
+    for(const auto& d : series) {
+        records.push_back(HistoryRecord::fromDataPoint(d));
+    }
+    time_t from = series[count / 2].timeRecorded, to = from + 86400;
+    size_t rows = 0;
+    auto counter = [&rows](const HistoryRecord&) { rows++; return true; };
+    int rc = 0;
+
+    {
+        HistoryDB db(base + "/single.sqlite3", "bench", "none");
+        auto start = Clock::now();
+        rc |= db.open() ? 0 : -1;
+        for(const auto& d : series) {
+            if(!db.insert(d, timeline)) {
+                rc = -1;
+                break;
+            }
+        }
+        report("sqlite: insert per observation", count, secondsSince(start));
+    }
+    {
+        HistoryDB db(base + "/bulk.sqlite3", "bench", "none");
+        auto start = Clock::now();
+        rc |= db.open() && db.insertRecords(records.data(), records.size(), db.locationId("bench"),
+                                            db.providerId("none")) ? 0 : -1;
+        report("sqlite: one bulk transaction", count, secondsSince(start));
+
+        start = Clock::now();
+        for(int i = 0; i < 100; i++) {
+            db.scan(from, to, counter);
+        }
+        report("sqlite: 100 scans of one day (rows)", rows, secondsSince(start));
+    }
+    {
+        TimeSeriesLog log(base + "/history.tslog", base + "/log.sqlite3", "bench", "none");
+        auto start = Clock::now();
+        rc |= log.open() ? 0 : -1;
+        for(const auto& r : records) {
+            if(!log.append(r)) {
+                rc = -1;
+                break;
+            }
+        }
+        report("tslog: append per observation", count, secondsSince(start));
+
+        rows = 0;
+        start = Clock::now();
+        for(int i = 0; i < 100; i++) {
+            log.scan(from, to, counter);
+        }
+        report("tslog: 100 scans of one day (rows)", rows, secondsSince(start));
+
+        start = Clock::now();
+        rc |= log.bulkLoad() ? 0 : -1;
+        report("tslog: bulk load into sqlite", count, secondsSince(start));
+    }
+
+    for(const char *name : {"single.sqlite3", "bulk.sqlite3", "log.sqlite3", "history.tslog", "history.tslog.lock"}) {
+        unlink((base + "/" + name).c_str());
+    }
+    rmdir(dir);
+    return rc;
+}
+
+/**
+ * size and scan speed of raw history before and after moving it into the
+ * cold archive. Also verifies that scans return the same records.
+ */
+static int archive()
+{
+    const size_t count = 200000;
+    char dir[] = "/tmp/fetchweather-bench-XXXXXX";
+    int rc = 0;
+
+    if(!mkdtemp(dir)) {
+        printf("Unable to create a temporary directory\n");
+        return -1;
+    }
+    std::string base(dir), db_path = base + "/history.sqlite3", archive_path = base + "/history.archive";
+    std::vector<DataPoint> series = makeSeries(count);
+    std::vector<HistoryRecord> records;
+    for(const auto& d : series) {
+        records.push_back(HistoryRecord::fromDataPoint(d));
+    }
+    auto fileSize = [](const std::string& path) {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        return ec ? 0 : static_cast<double>(size);
+    };
+    size_t rows = 0;
+    double sum = 0;
+    auto reader = [&rows, &sum](const HistoryRecord& r) { rows++; sum += r.temperature + r.pressure; return true; };
+
+    HistoryDB db(db_path, "bench", "none");
+    if(!db.open() || !db.insertRecords(records.data(), records.size(), db.locationId("bench"), db.providerId("none"))) {
+        printf("Unable to create the test database\n");
+        return -1;
+    }
+    auto start = Clock::now();
+    db.scan(0, time(0), reader);
+    report("sqlite only: full scan (rows)", rows, secondsSince(start));
+    printf("database %.1f MB for %zu records\n", fileSize(db_path) / 1048576.0, count);
+    size_t hot_rows = rows;
+    double hot_sum = sum;
+
+    start = Clock::now();
+    rc |= db.compact({ .raw_days = 1, .hourly_days = 0, .daily_days = 0, .archive = true }, true) ? 0 : -1;
+    report("archive export and delete", count, secondsSince(start));
+    sqlite3_exec(db.handle(), "VACUUM", 0, 0, 0);
+
+    rows = 0;
+    sum = 0;
+    start = Clock::now();
+    db.scan(0, time(0), reader);
+    report("archive + sqlite: full scan (rows)", rows, secondsSince(start));
+    printf("database %.1f MB, archive %.1f MB for %zu records\n", fileSize(db_path) / 1048576.0,
+           fileSize(archive_path) / 1048576.0, count);
+    if(rows != hot_rows || sum != hot_sum) {
+        printf("MISMATCH: %zu rows before, %zu after archiving\n", hot_rows, rows);
+        rc = -1;
+    }
+    db.close();
+
+    std::filesystem::remove_all(base);
+    return rc;
+}
+
+/**
+ * export and import speed for CSV and JSON Lines. Every file is imported
+ * twice, the second import must skip all records.
+ */
+static int transfer()
+{
+    const size_t count = 200000;
+    char dir[] = "/tmp/fetchweather-bench-XXXXXX";
+    int rc = 0;
+
+    if(!mkdtemp(dir)) {
+        printf("Unable to create a temporary directory\n");
+        return -1;
+    }
+    std::string base(dir);
+    std::vector<DataPoint> series = makeSeries(count);
+    std::vector<HistoryRecord> records;
+    for(const auto& d : series) {
+        records.push_back(HistoryRecord::fromDataPoint(d));
+    }
+
+    HistoryDB db(base + "/history.sqlite3", "bench", "none");
+    if(!db.open() || !db.insertRecords(records.data(), records.size(), db.locationId("bench"), db.providerId("none"))) {
+        printf("Unable to create the test database\n");
+        return -1;
+    }
+    for(auto format : { HistoryIO::CSV, HistoryIO::JSONL }) {
+        const char *name = format == HistoryIO::CSV ? "csv" : "jsonl";
+        std::string file = base + "/export." + name;
+        char what[64];
+
+        HistoryIO out(db, format);
+        auto start = Clock::now();
+        long n = out.exportTo(file, 0, time(0));
+        snprintf(what, sizeof(what), "%s: export", name);
+        report(what, n, secondsSince(start));
+
+        HistoryDB target(base + "/import." + name + ".sqlite3", "bench", "none");
+        HistoryIO in(target, format);
+        start = Clock::now();
+        long inserted = target.open() ? in.importFrom(file, "bench", "none") : -1;
+        snprintf(what, sizeof(what), "%s: import", name);
+        report(what, inserted, secondsSince(start));
+        long again = in.importFrom(file, "bench", "none");
+        if(n != static_cast<long>(count) || inserted != n || again != 0) {
+            printf("MISMATCH: %ld exported, %ld imported, %ld imported again\n", n, inserted, again);
+            rc = -1;
+        }
+    }
+    std::filesystem::remove_all(base);
+    return rc;
+}
+
+/**
+ * a complete OpenWeatherMap response with the current conditions, 48 hours
+ * and 8 days.
+ */
+static nlohmann::json makeOWMResponse()
+{
+    time_t now = time(0);
+    nlohmann::json r;
+
+    r["timezone"] = "Europe/Vienna";
+    r["current"] = { {"dt", now}, {"sunrise", now - 20000}, {"sunset", now + 20000}, {"temp", 12.5},
+                     {"feels_like", 11.0}, {"pressure", 1015}, {"humidity", 80}, {"dew_point", 9.1},
+                     {"uvi", 2.1}, {"clouds", 40}, {"visibility", 10000}, {"wind_speed", 3.2},
+                     {"wind_deg", 200}, {"wind_gust", 6.0}, {"weather", {{{"id", 802}}}} };
+    for(int i = 0; i < 48; i++) {
+        r["hourly"].push_back({ {"dt", now + i * 3600}, {"temp", 12.0 - i % 10}, {"pop", 0.05},
+                                {"weather", {{{"id", 800}}}} });
+    }
+    for(int i = 0; i < 8; i++) {
+        r["daily"].push_back({ {"dt", now + i * 86400}, {"temp", {{"min", 5}, {"max", 15}}},
+                               {"weather", {{{"id", 800}}}}, {"pop", 0.0} });
+    }
+    return r;
+}
+
+/**
+ * start program for an offline run and wait for it to exit.
+ *
+ * @param first_byte    - receives the ms until the first byte arrived on stdout
+ * @param total         - receives the ms until the program exited
+ * @return              - false if the program failed or wrote nothing
+ */
+static bool timeRun(const std::string& program, char **envp, double& first_byte, double& total)
+{
+    const char *argv[] = { program.c_str(), "-p", "OWM", "-a", "bench", "--loc", "48.2,16.4", "--offline",
+                           nullptr };
+    posix_spawn_file_actions_t actions;
+    int pipefd[2], status = 0;
+    pid_t pid;
+    char buf[4096];
+    ssize_t n;
+
+    if(pipe(pipefd) != 0)
+        return false;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipefd[0]);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    auto start = Clock::now();
+    int rc = posix_spawn(&pid, program.c_str(), &actions, nullptr, const_cast<char **>(argv), envp);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipefd[1]);
+    if(rc != 0) {
+        close(pipefd[0]);
+        return false;
+    }
+    first_byte = -1.0;
+    while((n = read(pipefd[0], buf, sizeof(buf))) > 0) {
+        if(first_byte < 0)
+            first_byte = secondsSince(start) * 1000.0;
+    }
+    close(pipefd[0]);
+    waitpid(pid, &status, 0);
+    total = secondsSince(start) * 1000.0;
+    return first_byte >= 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * exec to first output byte and to exit of fetchweather and
+ * fetchweather-lite (the binaries next to this one), for an offline run
+ * on a synthetic cache.
+ */
+static int startup()
+{
+    const int runs = 20;
+    char dir[] = "/tmp/fetchweather-bench-XXXXXX";
+    char self[PATH_MAX];
+    int rc = 0;
+
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if(len <= 0 || !mkdtemp(dir)) {
+        printf("Unable to locate the binaries or to create a temporary directory\n");
+        return -1;
+    }
+    self[len] = '\0';
+    std::string base(dir), bindir = std::filesystem::path(self).parent_path();
+    std::filesystem::create_directories(base + "/data/fetchweather/cache");
+    std::filesystem::create_directories(base + "/config/fetchweather");
+    std::ofstream(base + "/data/fetchweather/cache/OWM.current.json") << makeOWMResponse().dump();
+
+    // the environment of this process with the data and config directories replaced
+    std::vector<std::string> env = { "XDG_DATA_HOME=" + base + "/data", "XDG_CONFIG_HOME=" + base + "/config" };
+    for(char **e = environ; *e; e++) {
+        if(strncmp(*e, "XDG_DATA_HOME=", 14) != 0 && strncmp(*e, "XDG_CONFIG_HOME=", 16) != 0)
+            env.emplace_back(*e);
+    }
+    std::vector<char *> envp;
+    for(auto& e : env)
+        envp.push_back(e.data());
+    envp.push_back(nullptr);
+
+    printf("%-24s %14s %14s %14s\n", "binary", "first byte ms", "exit ms", "min exit ms");
+    for(const std::string name : { "fetchweather", "fetchweather-lite" }) {
+        std::string program = bindir + "/" + name;
+        std::vector<double> first(runs), total(runs);
+
+        if(access(program.c_str(), X_OK) != 0) {
+            printf("%-24s not found in %s\n", name.c_str(), bindir.c_str());
+            continue;
+        }
+        bool ok = true;
+        for(int i = 0; i < runs && ok; i++)
+            ok = timeRun(program, envp.data(), first[i], total[i]);
+        if(!ok) {
+            printf("%-24s FAILED, no output or non-zero exit\n", name.c_str());
+            rc = -1;
+            continue;
+        }
+        std::sort(first.begin(), first.end());
+        std::sort(total.begin(), total.end());
+        printf("%-24s %14.2f %14.2f %14.2f\n", name.c_str(), first[runs / 2], total[runs / 2], total[0]);
+    }
+    printf("(median of %d offline runs)\n", runs);
+    std::filesystem::remove_all(base);
+    return rc;
+}
+
+/**
+ * ISO-8601 parsing and formatting, utils::parseISO8601() and
+ * utils::formatISO8601() against the GDateTime round trip they replace.
+ * Every timestamp is also checked against glib.
+ */
+static int iso8601()
+{
+    const size_t count = 500000;
+    const int offsets[] = { 0, 3600, 7200, -18000, 19800, -34200 };
+    std::vector<std::string> input;
+    time_t base = time(0) - 10 * 365 * 86400;
+    char buf[32];
+    int rc = 0;
+
+    input.reserve(count);
+    for(size_t i = 0; i < count; i++) {
+        time_t t = base + static_cast<time_t>(i) * 631;
+        utils::formatISO8601(t, buf, sizeof(buf), offsets[i % std::size(offsets)]);
+        input.emplace_back(buf);
+    }
+
+    size_t mismatches = 0;
+    for(size_t i = 0; i < count; i += 97) {
+        GDateTime *g = g_date_time_new_from_iso8601(input[i].c_str(), 0);
+        time_t t = 0;
+        int offset = 0;
+        if(!g || !utils::parseISO8601(input[i].data(), input[i].size(), t, &offset)
+           || t != g_date_time_to_unix(g) || utils::weekday(t, offset) != g_date_time_get_day_of_week(g)) {
+            mismatches++;
+        }
+        if(g) {
+            g_date_time_unref(g);
+        }
+    }
+
+    time_t sum_glib = 0, sum = 0;
+    auto start = Clock::now();
+    for(const auto& s : input) {
+        GDateTime *g = g_date_time_new_from_iso8601(s.c_str(), 0);
+        sum_glib += g_date_time_to_unix(g);
+        g_date_time_unref(g);
+    }
+    report("parse: GDateTime", count, secondsSince(start));
+
+    start = Clock::now();
+    for(const auto& s : input) {
+        time_t t;
+        if(utils::parseISO8601(s.data(), s.size(), t)) {
+            sum += t;
+        }
+    }
+    report("parse: utils::parseISO8601", count, secondsSince(start));
+
+    size_t len = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < count; i++) {
+        GDateTime *g = g_date_time_new_from_unix_utc(base + static_cast<time_t>(i) * 631);
+        gchar *f = g_date_time_format_iso8601(g);
+        len += strlen(f);
+        g_free(f);
+        g_date_time_unref(g);
+    }
+    report("format: GDateTime", count, secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < count; i++) {
+        len += utils::formatISO8601(base + static_cast<time_t>(i) * 631, buf, sizeof(buf));
+    }
+    report("format: utils::formatISO8601", count, secondsSince(start));
+
+    if(mismatches || sum != sum_glib || !len) {
+        printf("MISMATCH: %zu timestamps differ from glib\n", mismatches);
+        rc = -1;
+    }
+    return rc;
+}
+
+/**
+ * TimeZone::toLocal() against localtime_r() with TZ set to the same zone.
+ * Every result is compared, the zones cover both hemispheres, half hour
+ * offsets and zones without DST.
+ */
+static int timezone()
+{
+    const char *zones[] = { "Europe/Vienna", "America/New_York", "Australia/Sydney", "Asia/Kolkata",
+                            "America/St_Johns", "Pacific/Auckland", "Asia/Tokyo", "UTC" };
+    const size_t count = 1000000;
+    const time_t from = 0, step = 4102444800 / count;       // 1970 to 2100
+    const char *saved = getenv("TZ");
+    std::string old_tz = saved ? saved : "";
+    size_t mismatches = 0;
+    char what[64];
+
+    for(const char *name : zones) {
+        const TimeZone *tz = TimeZone::get(name);
+        long sum_tz = 0, sum_libc = 0;
+        tm a, b;
+
+        setenv("TZ", name, 1);
+        tzset();
+        for(size_t i = 0; i < count; i += 7) {
+            time_t t = from + static_cast<time_t>(i) * step;
+            tz->toLocal(t, a);
+            localtime_r(&t, &b);
+            if(a.tm_year != b.tm_year || a.tm_yday != b.tm_yday || a.tm_hour != b.tm_hour || a.tm_min != b.tm_min
+               || a.tm_wday != b.tm_wday || a.tm_isdst != b.tm_isdst || strcmp(a.tm_zone, b.tm_zone) != 0) {
+                if(mismatches++ < 5)
+                    printf("%s: %ld differs (%02d:%02d %s / %02d:%02d %s)\n", name, static_cast<long>(t),
+                           a.tm_hour, a.tm_min, a.tm_zone, b.tm_hour, b.tm_min, b.tm_zone);
+            }
+        }
+
+        auto start = Clock::now();
+        for(size_t i = 0; i < count; i++) {
+            time_t t = from + static_cast<time_t>(i) * step;
+            localtime_r(&t, &b);
+            sum_libc += b.tm_hour;
+        }
+        snprintf(what, sizeof(what), "%s: localtime_r", name);
+        report(what, count, secondsSince(start));
+
+        start = Clock::now();
+        for(size_t i = 0; i < count; i++) {
+            tz->toLocal(from + static_cast<time_t>(i) * step, a);
+            sum_tz += a.tm_hour;
+        }
+        snprintf(what, sizeof(what), "%s: TimeZone::toLocal", name);
+        report(what, count, secondsSince(start));
+        if(sum_tz != sum_libc)
+            mismatches++;
+    }
+    if(saved)
+        setenv("TZ", old_tz.c_str(), 1);
+    else
+        unsetenv("TZ");
+    tzset();
+    if(mismatches) {
+        printf("MISMATCH: %zu local times differ from localtime_r()\n", mismatches);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * sunrise, sunset and twilight for a grid of locations over a year, in one
+ * call and one call per location and day. Between 60°S and 60°N the sun
+ * must rise and set every day.
+ */
+static int sunAndMoon()
+{
+    const size_t locations = 1000;
+    const int days = 365;
+    const int64_t first_day = time(0) / 86400;
+    std::vector<double> lat(locations), lon(locations);
+    std::vector<SunEvents> events(locations * days);
+    size_t invalid = 0;
+
+    for(size_t i = 0; i < locations; i++) {
+        lat[i] = -60.0 + 120.0 * static_cast<double>(i) / locations;
+        lon[i] = -180.0 + 360.0 * static_cast<double>(i * 7 % locations) / locations;
+    }
+    auto start = Clock::now();
+    almanac::sunEvents(lat.data(), lon.data(), locations, first_day, days, events.data());
+    report("sun: locations x days", events.size(), secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < locations; i++) {
+        for(int d = 0; d < days; d++) {
+            SunEvents e = almanac::sunEvents(lat[i], lon[i], first_day + d);
+            const SunEvents& v = events[i * days + d];
+            if(e.sunrise != v.sunrise || e.daylight != 0 || !(e.dawn < e.sunrise && e.sunrise < e.sunset
+               && e.sunset < e.dusk) || e.sunset - e.sunrise > 86400)
+                invalid++;
+        }
+    }
+    report("sun: one call per location and day", events.size(), secondsSince(start));
+
+    double sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < events.size(); i++)
+        sum += almanac::moonPhase(static_cast<time_t>(first_day * 86400 + i * 600));
+    report("moon phase", events.size(), secondsSince(start));
+
+    if(invalid || sum <= 0) {
+        printf("MISMATCH: %zu invalid sun events\n", invalid);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * run the benchmark name.
+ *
+ * @return      - 0 on success, -1 if it failed or does not exist.
+ */
+int run(const std::string& name)
+{
+    LOG_F(INFO, "bench::run(): running benchmark %s", name.c_str());
+    if(name == "history") {
+        return history();
+    }
+    if(name == "archive") {
+        return archive();
+    }
+    if(name == "transfer") {
+        return transfer();
+    }
+    if(name == "startup") {
+        return startup();
+    }
+    if(name == "iso8601") {
+        return iso8601();
+    }
+    if(name == "timezone") {
+        return timezone();
+    }
+    if(name == "almanac") {
+        return sunAndMoon();
+    }
+    printf("Unknown benchmark: %s\n", name.c_str());
+    return -1;
+}
+
+}
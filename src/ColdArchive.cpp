@@ -0,0 +1,548 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "ColdArchive.h"
+
+namespace {
+
+/*
+ * column encoding helpers
+ */
+struct ColumnWriter {
+    std::string     buf;
+
+    void put(uint8_t b) { buf.push_back(static_cast<char>(b)); }
+    void varint(uint64_t v)
+    {
+        while(v >= 0x80) {
+            put(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+        put(static_cast<uint8_t>(v));
+    }
+    void zigzag(int64_t v) { varint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63)); }
+    /*
+     * XOR with the previous value, only the bytes between the leading and
+     * trailing zero bytes of the difference are written.
+     */
+    void xorDouble(double v, uint64_t& prev)
+    {
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        uint64_t x = bits ^ prev;
+        prev = bits;
+        if(x == 0) {
+            put(0);
+            return;
+        }
+        int lead = __builtin_clzll(x) / 8, trail = __builtin_ctzll(x) / 8, n = 8 - lead - trail;
+        put(static_cast<uint8_t>(lead << 4 | n));
+        for(x >>= trail * 8; n > 0; n--, x >>= 8) {
+            put(static_cast<uint8_t>(x));
+        }
+    }
+    void string(const char *s, size_t max, std::string& prev)
+    {
+        size_t len = strnlen(s, max - 1);
+        if(prev.compare(0, std::string::npos, s, len) == 0) {
+            put(0);
+            return;
+        }
+        prev.assign(s, len);
+        varint(len + 1);
+        buf.append(s, len);
+    }
+};
+
+struct ColumnReader {
+    const uint8_t   *p, *end;
+    bool            ok = true;
+
+    uint8_t get()
+    {
+        if(p == end) {
+            ok = false;
+            return 0;
+        }
+        return *p++;
+    }
+    uint64_t varint()
+    {
+        uint64_t v = 0;
+        for(int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = get();
+            v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if(!(b & 0x80))
+                return v;
+        }
+        ok = false;
+        return v;
+    }
+    int64_t zigzag()
+    {
+        uint64_t v = varint();
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+    double xorDouble(uint64_t& prev)
+    {
+        uint8_t control = get();
+        if(control) {
+            int lead = control >> 4, n = control & 0x0f, trail = 8 - lead - n;
+            uint64_t x = 0;
+            if(n > 8 || trail < 0) {
+                ok = false;
+                n = 0;
+            }
+            for(int i = 0; i < n; i++) {
+                x |= static_cast<uint64_t>(get()) << (8 * i);
+            }
+            prev ^= x << (trail * 8);
+        }
+        double v;
+        memcpy(&v, &prev, sizeof(v));
+        return v;
+    }
+    void string(char *s, size_t max, std::string& prev)
+    {
+        uint64_t len = varint();
+        if(len > 0) {
+            len--;
+            if(len > static_cast<uint64_t>(end - p) || len >= max) {
+                ok = false;
+                len = 0;
+            }
+            prev.assign(reinterpret_cast<const char *>(p), len);
+            p += len;
+        }
+        snprintf(s, max, "%s", prev.c_str());
+    }
+};
+
+}
+
+static std::string encodeBlock(const HistoryRecord *records, size_t count)
+{
+    ColumnWriter    w;
+    std::string     prev_string;
+    int64_t         prev = 0, delta = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        int64_t d = records[i].timestamp - prev;
+        w.zigzag(d - delta);
+        delta = d;
+        prev = records[i].timestamp;
+    }
+    for(size_t i = 0; i < count; i++) {
+        w.buf.append(reinterpret_cast<const char *>(&records[i].fingerprint), sizeof(uint64_t));
+    }
+    for(auto member : { &HistoryRecord::sunrise, &HistoryRecord::sunset }) {
+        prev = 0;
+        for(size_t i = 0; i < count; i++) {
+            w.zigzag(records[i].*member - prev);
+            prev = records[i].*member;
+        }
+    }
+    for(auto member : ColdArchive::float_columns) {
+        uint64_t bits = 0;
+        for(size_t i = 0; i < count; i++) {
+            w.xorDouble(records[i].*member, bits);
+        }
+    }
+    for(auto member : { &HistoryRecord::windbearing, &HistoryRecord::moonPhase }) {
+        prev = 0;
+        for(size_t i = 0; i < count; i++) {
+            w.zigzag(static_cast<int64_t>(records[i].*member) - prev);
+            prev = records[i].*member;
+        }
+    }
+    for(size_t i = 0; i < count; i++) {
+        w.put(static_cast<uint8_t>(records[i].icon));
+    }
+    prev_string.clear();
+    for(size_t i = 0; i < count; i++) {
+        w.string(records[i].precip_type, sizeof(records[i].precip_type), prev_string);
+    }
+    prev_string.clear();
+    for(size_t i = 0; i < count; i++) {
+        w.string(records[i].summary, sizeof(records[i].summary), prev_string);
+    }
+    return w.buf;
+}
+
+static bool decodeBlock(const std::string& data, const ColdArchive::BlockHeader& h,
+                        std::vector<HistoryRecord>& records)
+{
+    ColumnReader    r { reinterpret_cast<const uint8_t *>(data.data()),
+                        reinterpret_cast<const uint8_t *>(data.data()) + data.size() };
+    std::string     prev_string;
+    int64_t         prev = 0, delta = 0;
+    const size_t    count = h.count;
+
+    records.assign(count, HistoryRecord {});
+    for(auto& rec : records) {
+        delta += r.zigzag();
+        prev += delta;
+        rec.timestamp = prev;
+        rec.location_id = h.location_id;
+        rec.provider_id = h.provider_id;
+    }
+    if(static_cast<size_t>(r.end - r.p) < count * sizeof(uint64_t))
+        return false;
+    for(auto& rec : records) {
+        memcpy(&rec.fingerprint, r.p, sizeof(uint64_t));
+        r.p += sizeof(uint64_t);
+    }
+    for(auto member : { &HistoryRecord::sunrise, &HistoryRecord::sunset }) {
+        prev = 0;
+        for(auto& rec : records) {
+            prev += r.zigzag();
+            rec.*member = prev;
+        }
+    }
+    for(auto member : ColdArchive::float_columns) {
+        uint64_t bits = 0;
+        for(auto& rec : records) {
+            rec.*member = r.xorDouble(bits);
+        }
+    }
+    for(auto member : { &HistoryRecord::windbearing, &HistoryRecord::moonPhase }) {
+        prev = 0;
+        for(auto& rec : records) {
+            prev += r.zigzag();
+            rec.*member = static_cast<int32_t>(prev);
+        }
+    }
+    for(auto& rec : records) {
+        rec.icon = static_cast<char>(r.get());
+    }
+    prev_string.clear();
+    for(auto& rec : records) {
+        r.string(rec.precip_type, sizeof(rec.precip_type), prev_string);
+    }
+    prev_string.clear();
+    for(auto& rec : records) {
+        r.string(rec.summary, sizeof(rec.summary), prev_string);
+    }
+    return r.ok && r.p == r.end;
+}
+
+/**
+ * open the archive, the block index is read by load().
+ *
+ * @param create    - create the file if it does not exist
+ * @return          - false if the file does not exist (and create is false)
+ *                    or is not an archive.
+ */
+bool ColdArchive::open(bool create)
+{
+    char        header[ColdArchive::file_header_size];
+    struct stat st;
+
+    if(this->m_fd >= 0)
+        return true;
+
+    this->m_fd = ::open(this->m_path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+    if(this->m_fd < 0) {
+        if(create) {
+            LOG_F(INFO, "ColdArchive::open(): unable to open %s (%s)", this->m_path.c_str(), strerror(errno));
+        }
+        this->close();
+        return false;
+    }
+
+    // a new file gets its header under the lock, another process may be creating it as well
+    if(create && (fstat(this->m_fd, &st) != 0 || st.st_size == 0)) {
+        if(!this->lock(true)) {
+            this->close();
+            return false;
+        }
+        if(fstat(this->m_fd, &st) == 0 && st.st_size == 0) {
+            uint32_t values[2] = { ColdArchive::version, ColdArchive::block_records };
+            memset(header, 0, sizeof(header));
+            memcpy(header, "FWARCH1", 8);
+            memcpy(header + 8, values, sizeof(values));
+            if(pwrite(this->m_fd, header, sizeof(header), 0) != sizeof(header)) {
+                this->close();
+                return false;
+            }
+            LOG_F(INFO, "ColdArchive::open(): created %s", this->m_path.c_str());
+        }
+        this->unlock();
+    }
+
+    uint32_t file_version = 0;
+    memset(header, 0, sizeof(header));
+    if(pread(this->m_fd, header, sizeof(header), 0) == sizeof(header)) {
+        memcpy(&file_version, header + 8, sizeof(file_version));
+    }
+    if(memcmp(header, "FWARCH1", 8) != 0 || file_version != ColdArchive::version) {
+        LOG_F(INFO, "ColdArchive::open(): %s is not a history archive", this->m_path.c_str());
+        this->close();
+        return false;
+    }
+    this->m_size = sizeof(header);
+    return true;
+}
+
+/**
+ * lock the archive against other processes. Gives up after lock_attempts
+ * rather than blocking the caller while another process exports.
+ *
+ * @param exclusive - for writing, otherwise shared
+ */
+bool ColdArchive::lock(bool exclusive)
+{
+    for(int i = 0; i < ColdArchive::lock_attempts; i++) {
+        if(flock(this->m_fd, (exclusive ? LOCK_EX : LOCK_SH) | LOCK_NB) == 0)
+            return true;
+        if(errno != EWOULDBLOCK && errno != EINTR)
+            break;
+        usleep(ColdArchive::lock_wait_ms * 1000);
+    }
+    LOG_F(INFO, "ColdArchive::lock(): unable to lock %s (%s), giving up", this->m_path.c_str(), strerror(errno));
+    return false;
+}
+
+void ColdArchive::unlock()
+{
+    flock(this->m_fd, LOCK_UN);
+}
+
+/**
+ * bring the block index up to date with the file, up to limit bytes.
+ * Blocks below the limit never change, they are kept from the last call and
+ * only new ones are read. Blocks beyond the limit are not part of the
+ * archive (an interrupted export), the file is not changed.
+ *
+ * @param limit     - committed size of the archive
+ */
+bool ColdArchive::load(uint64_t limit)
+{
+    Block       block;
+    struct stat st;
+
+    if(this->m_fd < 0 || fstat(this->m_fd, &st) != 0)
+        return false;
+    uint64_t end = std::min<uint64_t>(limit, st.st_size);
+    while(!this->m_blocks.empty() && this->m_blocks.back().offset + sizeof(BlockHeader)
+                                     + this->m_blocks.back().header.stored_size > end) {
+        this->m_blocks.pop_back();
+    }
+
+    uint64_t offset = this->m_blocks.empty() ? ColdArchive::file_header_size
+                                             : this->m_blocks.back().offset + sizeof(BlockHeader)
+                                               + this->m_blocks.back().header.stored_size;
+    while(offset + sizeof(BlockHeader) <= end) {
+        block.offset = offset;
+        if(pread(this->m_fd, &block.header, sizeof(BlockHeader), offset) != sizeof(BlockHeader)
+           || memcmp(block.header.magic, "FWCB", 4) != 0
+           || offset + sizeof(BlockHeader) + block.header.stored_size > end)
+            break;
+        this->m_blocks.push_back(block);
+        offset += sizeof(BlockHeader) + block.header.stored_size;
+    }
+    this->m_size = offset;
+    return true;
+}
+
+void ColdArchive::close()
+{
+    if(this->m_fd >= 0) {
+        ::close(this->m_fd);
+    }
+    this->m_fd = -1;
+    this->m_size = 0;
+    this->m_blocks.clear();
+}
+
+/**
+ * cut the archive back to size bytes, removing all blocks beyond. The
+ * caller holds the exclusive lock.
+ */
+bool ColdArchive::truncate(uint64_t size)
+{
+    size = std::max<uint64_t>(size, ColdArchive::file_header_size);
+    if(this->m_fd < 0 || ftruncate(this->m_fd, size) != 0)
+        return false;
+    while(!this->m_blocks.empty() && this->m_blocks.back().offset >= size) {
+        this->m_blocks.pop_back();
+    }
+    this->m_size = size;
+    return true;
+}
+
+bool ColdArchive::sync()
+{
+    return this->m_fd >= 0 && fsync(this->m_fd) == 0;
+}
+
+/**
+ * append records, which must belong to one location and provider and be
+ * sorted by time. They are split into blocks of block_records.
+ */
+bool ColdArchive::append(const HistoryRecord *records, size_t count)
+{
+    for(size_t i = 0; i < count; i += ColdArchive::block_records) {
+        if(!this->appendBlock(records + i, std::min(ColdArchive::block_records, count - i)))
+            return false;
+    }
+    return true;
+}
+
+bool ColdArchive::appendBlock(const HistoryRecord *records, size_t count)
+{
+    Block       block = { .offset = this->m_size, .header = {} };
+    BlockHeader &h = block.header;
+
+    if(this->m_fd < 0 || count == 0)
+        return false;
+
+    std::string raw = encodeBlock(records, count);
+    uLongf stored_size = compressBound(raw.size());
+    std::string stored(stored_size, '\0');
+    if(compress2(reinterpret_cast<Bytef *>(stored.data()), &stored_size,
+                 reinterpret_cast<const Bytef *>(raw.data()), raw.size(), Z_BEST_COMPRESSION) != Z_OK)
+        return false;
+
+    memcpy(h.magic, "FWCB", 4);
+    h.crc = crc32(0, reinterpret_cast<const Bytef *>(stored.data()), stored_size);
+    h.count = count;
+    h.raw_size = raw.size();
+    h.stored_size = stored_size;
+    h.location_id = records[0].location_id;
+    h.provider_id = records[0].provider_id;
+    h.min_ts = records[0].timestamp;
+    h.max_ts = records[count - 1].timestamp;
+    for(size_t c = 0; c < ColdArchive::float_count; c++) {
+        h.min[c] = h.max[c] = NAN;
+        for(size_t i = 0; i < count; i++) {
+            h.min[c] = fmin(h.min[c], records[i].*ColdArchive::float_columns[c]);
+            h.max[c] = fmax(h.max[c], records[i].*ColdArchive::float_columns[c]);
+        }
+    }
+
+    if(pwrite(this->m_fd, &h, sizeof(h), this->m_size) != sizeof(h)
+       || pwrite(this->m_fd, stored.data(), stored_size, this->m_size + sizeof(h)) != static_cast<ssize_t>(stored_size)) {
+        LOG_F(INFO, "ColdArchive::appendBlock(): write failed (%s)", strerror(errno));
+        return false;
+    }
+    this->m_size += sizeof(h) + stored_size;
+    this->m_blocks.push_back(block);
+    return true;
+}
+
+/**
+ * decompress and decode one block. A legacy block yields no records while
+ * its units are unknown.
+ *
+ * @return      - false if the block is damaged.
+ */
+bool ColdArchive::read(const Block& block, std::vector<HistoryRecord>& records) const
+{
+    const BlockHeader& h = block.header;
+    bool legacy = block.offset < this->m_legacyEnd;
+
+    if(legacy && !this->m_legacyUnits) {
+        records.clear();
+        return true;
+    }
+
+    std::string stored(h.stored_size, '\0'), raw(h.raw_size, '\0');
+    uLongf raw_size = h.raw_size;
+
+    if(pread(this->m_fd, stored.data(), h.stored_size, block.offset + sizeof(BlockHeader))
+       != static_cast<ssize_t>(h.stored_size)
+       || crc32(0, reinterpret_cast<const Bytef *>(stored.data()), h.stored_size) != h.crc
+       || uncompress(reinterpret_cast<Bytef *>(raw.data()), &raw_size,
+                     reinterpret_cast<const Bytef *>(stored.data()), h.stored_size) != Z_OK
+       || raw_size != h.raw_size || !decodeBlock(raw, h, records)) {
+        LOG_F(INFO, "ColdArchive::read(): damaged block at offset %llu", static_cast<unsigned long long>(block.offset));
+        records.clear();
+        return false;
+    }
+    if(legacy) {
+        for(auto& r : records) {
+            for(const auto& column : unit_columns)
+                r.*column.member = this->m_legacyUnits->toMetric(column.quantity, r.*column.member);
+        }
+    }
+    return true;
+}
+
+/**
+ * blocks below end were recorded in the units of an older version.
+ *
+ * @param units     - these units, nullptr while they are unknown
+ */
+void ColdArchive::setLegacy(uint64_t end, const UnitProfile *units)
+{
+    this->m_legacyEnd = end;
+    if(units)
+        this->m_legacyUnits = *units;
+    else
+        this->m_legacyUnits.reset();
+}
+
+/**
+ * a cursor over the records of one location and provider with
+ * from <= timestamp <= to. Blocks outside the range are never read.
+ */
+ColdArchive::Cursor ColdArchive::select(int location_id, int provider_id, time_t from, time_t to) const
+{
+    Cursor cursor(this, from, to);
+
+    for(const auto& block : this->m_blocks) {
+        if(block.header.location_id == location_id && block.header.provider_id == provider_id
+           && block.header.max_ts >= from && block.header.min_ts <= to) {
+            cursor.m_blocks.push_back(&block);
+        }
+    }
+    std::stable_sort(cursor.m_blocks.begin(), cursor.m_blocks.end(),
+                     [](const Block *a, const Block *b) { return a->header.min_ts < b->header.min_ts; });
+    return cursor;
+}
+
+bool ColdArchive::Cursor::next(HistoryRecord& r)
+{
+    for(;;) {
+        while(this->m_pos < this->m_records.size()) {
+            const HistoryRecord& rec = this->m_records[this->m_pos++];
+            if(rec.timestamp >= this->m_from && rec.timestamp <= this->m_to) {
+                r = rec;
+                return true;
+            }
+        }
+        if(this->m_next == this->m_blocks.size())
+            return false;
+        this->m_archive->read(*this->m_blocks[this->m_next++], this->m_records);
+        this->m_pos = 0;
+    }
+}
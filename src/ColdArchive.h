@@ -0,0 +1,147 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_COLDARCHIVE_H_
+#define FETCHWEATHER_SRC_COLDARCHIVE_H_
+
+#include "pch.h"
+#include <optional>
+#include "HistoryBackend.h"
+
+/*
+ * Columnar archive for history records which left the raw retention of
+ * history.sqlite3 (history.archive next to the database).
+ *
+ * The file is a sequence of self-contained blocks. Each block holds up to
+ * block_records records of one location and provider in time order, stored
+ * column by column: timestamps as delta of delta, the other integers as
+ * deltas, floating point values XORed with their predecessor (unchanged
+ * values take a single byte) and strings only when they change. The column
+ * data is deflated with zlib. The uncompressed block header carries the
+ * time range and min/max of every floating point column, readers use it to
+ * skip blocks without decompressing them.
+ *
+ * Blocks are only appended. Which blocks are valid is decided by the
+ * writer (HistoryDB keeps the committed size in its meta table), load()
+ * only indexes blocks up to that size and the writer cuts off anything
+ * beyond it before appending.
+ *
+ * Blocks below legacyEnd() were exported from a database of an older
+ * version and hold values in unknown units (see HistoryDB::convertLegacy()).
+ * read() leaves them out until the units are known, and converts them to
+ * metric afterwards.
+ *
+ * Processes coordinate with flock() on the archive: the writer holds an
+ * exclusive lock for a whole export, readers a shared one while they read.
+ * The index is reloaded after every lock(), it may have grown meanwhile.
+ */
+class ColdArchive {
+  public:
+    /*
+     * the HistoryRecord members stored with XOR encoding and indexed per
+     * block, in file order.
+     */
+    static constexpr double HistoryRecord::*float_columns[] = {
+        &HistoryRecord::temperature, &HistoryRecord::feelslike, &HistoryRecord::dewpoint,
+        &HistoryRecord::humidity, &HistoryRecord::pressure, &HistoryRecord::windspeed,
+        &HistoryRecord::windgust, &HistoryRecord::visibility, &HistoryRecord::precip_probability,
+        &HistoryRecord::precip_intensity, &HistoryRecord::cloudCover, &HistoryRecord::cloudBase,
+        &HistoryRecord::cloudCeiling, &HistoryRecord::uvindex, &HistoryRecord::tempMin,
+        &HistoryRecord::tempMax };
+    static constexpr size_t     float_count = std::size(float_columns);
+
+    struct BlockHeader {
+        char        magic[4];
+        uint32_t    crc;                // crc32 of the compressed column data
+        uint32_t    count;              // records in the block
+        uint32_t    raw_size, stored_size;
+        int32_t     location_id, provider_id;
+        uint32_t    _reserved;
+        int64_t     min_ts, max_ts;
+        double      min[float_count], max[float_count];     // NAN if a column has no values
+    };
+    static_assert(sizeof(BlockHeader) == 304, "BlockHeader is part of the file format");
+
+    struct Block {
+        uint64_t    offset;             // file offset of the header
+        BlockHeader header;
+    };
+
+    /*
+     * reads the records of one location and provider within a time range,
+     * block by block in ascending time order.
+     */
+    class Cursor {
+      public:
+        Cursor() = default;
+        bool next(HistoryRecord& r);
+
+      private:
+        friend class ColdArchive;
+        Cursor(const ColdArchive *archive, time_t from, time_t to) : m_archive(archive), m_from(from), m_to(to) {}
+
+        const ColdArchive           *m_archive = nullptr;
+        time_t                      m_from = 0, m_to = 0;
+        std::vector<const Block *>  m_blocks;
+        size_t                      m_next = 0, m_pos = 0;
+        std::vector<HistoryRecord>  m_records;
+    };
+
+    explicit ColdArchive(const std::string& path) : m_path(path) {}
+    ~ColdArchive() { this->close(); }
+
+    bool        open(bool create);
+    void        close();
+    bool        lock(bool exclusive);
+    void        unlock();
+    bool        load(uint64_t limit);
+    bool        append(const HistoryRecord *records, size_t count);
+    bool        truncate(uint64_t size);
+    bool        sync();
+    Cursor      select(int location_id, int provider_id, time_t from, time_t to) const;
+    bool        read(const Block& block, std::vector<HistoryRecord>& records) const;
+    void        setLegacy(uint64_t end, const UnitProfile *units);
+    uint64_t    legacyEnd() const { return m_legacyEnd; }
+    uint64_t    size() const { return m_size; }
+    const std::vector<Block>&   blocks() const { return m_blocks; }
+
+    static constexpr uint32_t   version = 1;
+    static constexpr size_t     block_records = 4096;
+    static constexpr size_t     file_header_size = 16;
+    static constexpr int        lock_attempts = 50;         // tries to take the lock, ...
+    static constexpr int        lock_wait_ms = 100;         // ... this far apart
+
+  private:
+    bool        appendBlock(const HistoryRecord *records, size_t count);
+
+    std::string         m_path;
+    int                 m_fd = -1;
+    uint64_t            m_size = 0;
+    std::vector<Block>  m_blocks;
+    uint64_t            m_legacyEnd = 0;
+    std::optional<UnitProfile>  m_legacyUnits;      // unknown until converted
+};
+
+#endif //FETCHWEATHER_SRC_COLDARCHIVE_H_
@@ -27,11 +27,17 @@
 #include "options.h"
 #include "DataHandler.h"
 #include "FileDumper.h"
-
-DataHandler::DataHandler() : m_options{ProgramOptions::getInstance()},
-                             m_DataPoint { .valid = false }
+#include "HistoryDB.h"
+#include "TimeSeriesLog.h"
+#include "OutputTemplate.h"
+#include "DataHandler_ImplOWM.h"
+#include "DataHandler_ImplClimaCell.h"
+#include "EventLoop.h"
+
+DataHandler::DataHandler(const CFG& cfg) : m_cfg{cfg},
+                                           m_DataPoint { .valid = false },
+                                           m_daily {}
 {
-    const CFG& cfg = m_options.getConfig();
 
     this->db_path.assign(cfg.data_dir_path);
     this->db_path.append("/history.sqlite3");
@@ -40,6 +46,9 @@ DataHandler::DataHandler() : m_options{ProgramOptions::getInstance()},
     this->m_currentCache.assign(cfg.data_dir_path);
     this->m_currentCache.append("/cache/");
     this->m_currentCache.append(cfg.apiProviderString).append(".");
+    if(!cfg.site.empty()) {
+        this->m_currentCache.append(cfg.site).append(".");
+    }
 
     this->m_ForecastCache.assign(this->m_currentCache);
     this->m_ForecastCache.append("forecast.json");
@@ -47,162 +56,291 @@ DataHandler::DataHandler() : m_options{ProgramOptions::getInstance()},
     LOG_F(INFO, "Current Cache: %s", this->m_currentCache.c_str());
     LOG_F(INFO, "Forecast Cache: %s", this->m_ForecastCache.c_str());
 }
+DataHandler::~DataHandler()
+{
+    this->writeToDB();
+}
+
 /**
- * convert a wind bearing in degrees into a human-readable form (i.e. "SW" for
- * a south-westerly wind).
+ * the DataHandler for the provider selected in cfg.
  *
- * @param wind_direction    - wind bearing in degrees
- * @return                  - wind direction and speed unit as a std::pair
+ * @param cfg   - the configuration, it is referenced by the handler and
+ *                must outlive it.
+ * @return      - nullptr for unsupported providers.
  */
-std::pair<std::string, std::string> DataHandler::degToBearing(unsigned int wind_direction) const
+std::unique_ptr<DataHandler> DataHandler::create(const CFG& cfg)
 {
-    wind_direction = (wind_direction > 360) ? 0 : wind_direction;
-    size_t _val = (size_t) (((double) wind_direction / 22.5) + 0.5);
-    std::string retval;
-    retval.assign(DataHandler::wind_directions[_val % 16]);
-    return std::pair<std::string, std::string>(retval, this->m_options.getConfig().speed_unit);
+    switch(cfg.apiProvider) {
+        case ProgramOptions::API_CLIMACELL:
+            return std::make_unique<DataHandler_ImplClimaCell>(cfg);
+        case ProgramOptions::API_OWM:
+            return std::make_unique<DataHandler_ImplOWM>(cfg);
+        default:
+            return nullptr;
+    }
 }
 
 /**
- * Convert a temperature from metric to imperial, depending on the user's preference.
+ * the history backend selected with --historyBackend, opened on first use.
  *
- * @param temp      - temperature in Celsius
- * @param unit      - destination unit (F or C are allowed)
- * @return          - temperature and its unit as a std::pair
+ * @return      - nullptr if the backend cannot be opened.
+ */
+HistoryBackend* DataHandler::history()
+{
+    const CFG& cfg = this->m_cfg;
+
+    if(!this->m_history) {
+        if(cfg.historyBackend == "tslog") {
+            this->m_history = TimeSeriesLog::get(
+                TimeSeriesLog::pathFor(cfg.data_dir_path, this->locationKey(), cfg.apiProviderString),
+                this->db_path, this->locationKey(), cfg.apiProviderString);
+        } else {
+            this->m_history = std::make_unique<HistoryDB>(this->db_path, this->locationKey(),
+                                                          cfg.apiProviderString);
+        }
+    }
+    return this->m_history->open() ? this->m_history.get() : nullptr;
+}
+
+/**
+ * the setup which does not depend on the weather data: directories,
+ * history database, output templates. Everything here would otherwise
+ * happen lazily on first use. readFromApi() calls it once the requests
+ * are on their way, so it costs no time on the critical path.
  */
-std::pair<double, char> DataHandler::convertTemperature(double temp, char unit) const
+void DataHandler::prepare()
 {
-    double converted_temp = temp;
-    unit = (unit == 'C' || unit == 'F') ? unit : 'C';
-    if (unit == 'F') {
-        converted_temp = (temp * (9.0 / 5.0)) + 32.0;
+    const CFG& cfg = this->m_cfg;
+
+    if(this->m_prepared)
+        return;
+    this->m_prepared = true;
+    ProgramOptions::createDirectories(cfg);
+    if(!cfg.debug) {
+        this->history();
+        this->healthDB();
     }
+    this->layout(cfg.templateFile);
+    for(const auto& output : cfg.outputProfiles)
+        this->layout(output.layout);
+    this->timeZone();
+}
 
-    return std::pair<double, char>(converted_temp, unit);
+/**
+ * the time zone of the location (--tz or the batch file), used for all
+ * local times of the snapshot. Without one, the system time zone applies.
+ */
+const TimeZone& DataHandler::timeZone()
+{
+    if(!this->m_tz)
+        this->m_tz = TimeZone::get(this->m_cfg.timezone);
+    return *this->m_tz;
 }
 
-double DataHandler::convertVis(const double vis) const
+/**
+ * sun events computed in advance, e.g. for all sites of a batch in one
+ * pass. applyAlmanac() computes them itself when the observation falls
+ * on another day.
+ *
+ * @param first_day     - local date of sun[0] in days since 1970-01-01
+ * @param sun           - sun events of days consecutive days
+ */
+void DataHandler::setAlmanac(int64_t first_day, const SunEvents *sun, int days)
 {
-    return this->m_options.getConfig().vis_unit == "mi" ? vis / 1.609 : vis;
+    this->m_sunDay = first_day;
+    this->m_sun.assign(sun, sun + days);
 }
 
-double DataHandler::convertWindspeed(double speed) const
+/**
+ * sunrise, sunset, civil twilight and moon phase of the observation day
+ * and whether it is day at the time of observation. Providers call this
+ * once timeRecorded is set.
+ *
+ * The sun is computed from the coordinates of the location (see Almanac).
+ * When the location has no coordinates, sunriseTime and sunsetTime as
+ * delivered by the provider are used and there is no twilight. The moon
+ * phase only depends on the time and is always computed.
+ */
+void DataHandler::applyAlmanac()
 {
-    const std::string& _unit = m_options.getConfig().speed_unit;
-    if(_unit == "km/h")
-        return speed * 3.6;
-    else if(_unit == "mph")
-        return speed * 2.237;
-    else if(_unit == "kts")
-        return speed * 1.944;
-    else
-        return speed;
+    DataPoint& p = this->m_DataPoint;
+    const TimeZone& tz = this->timeZone();
+    double lat, lon;
+    int daylight = 0;
+    tm local;
+
+    p.dawnTime = p.duskTime = 0;
+    if(almanac::coordinates(this->m_cfg, lat, lon)) {
+        tz.toLocal(p.timeRecorded, local);
+        int64_t day = utils::daysFromCivil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+        SunEvents sun = day >= this->m_sunDay && day - this->m_sunDay < static_cast<int64_t>(this->m_sun.size()) ?
+                        this->m_sun[day - this->m_sunDay] : almanac::sunEvents(lat, lon, day);
+        p.sunriseTime = sun.sunrise;
+        p.sunsetTime = sun.sunset;
+        p.dawnTime = sun.dawn;
+        p.duskTime = sun.dusk;
+        daylight = sun.daylight;
+    }
+    p.is_day = daylight != 0 ? daylight > 0 : p.sunriseTime < p.timeRecorded && p.timeRecorded < p.sunsetTime;
+
+    p.moonPhase = almanac::moonPhaseCode(almanac::moonPhase(p.timeRecorded));
+    snprintf(p.moonPhaseAsString, SIZEOF(p.moonPhaseAsString), "%s", almanac::moonPhaseName(p.moonPhase));
+
+    const std::pair<time_t, char *> times[] = { {p.sunriseTime, p.sunriseTimeAsString},
+                                                {p.sunsetTime, p.sunsetTimeAsString},
+                                                {p.dawnTime, p.dawnTimeAsString},
+                                                {p.duskTime, p.duskTimeAsString} };
+    for(const auto& [t, text] : times) {
+        if(t == 0) {
+            snprintf(text, 20, "%s", "--:--");
+            continue;
+        }
+        tz.toLocal(t, local);
+        snprintf(text, 20, "%02d:%02d", local.tm_hour, local.tm_min);
+    }
 }
 
-// hPa > InHg
-double DataHandler::convertPressure(double hPa) const
+/**
+ * the database holding the provider health. This is history() unless
+ * the history goes to a time series log.
+ *
+ * @return      - nullptr if the database cannot be opened.
+ */
+HistoryDB* DataHandler::healthDB()
 {
-    return m_options.getConfig().pressure_unit == "inhg" ? hPa / 33.863886666667 : hPa;
+    if(this->m_cfg.historyBackend != "tslog")
+        return static_cast<HistoryDB *>(this->history());
+    if(!this->m_healthDB)
+        this->m_healthDB = std::make_unique<HistoryDB>(this->db_path, this->locationKey(),
+                                                       this->m_cfg.apiProviderString);
+    return this->m_healthDB->open() ? this->m_healthDB.get() : nullptr;
 }
 
 /**
- * Output a single temperature value.
+ * readFromApi() with health tracking. The request is not sent while the
+ * circuit breaker of the provider is open. Cancelled requests and debug
+ * runs do not count.
  *
- * @param val       temperature always in metric (Celsius)
- * @param addUnit   add the Unit (°C or °F)
- * @param format    use this format for output. See .h for defaults.
+ * Only the breaker state is read before the request, the database is
+ * opened for writing while the request is in flight. The outcome is
+ * applied to the stored health by saveHealth(), not to the copy read
+ * before the request.
+ *
+ * @return      - true if valid data was read.
  */
-void DataHandler::outputTemperature(FILE *stream, double val, const bool addUnit, const char *format)
+Task<bool> DataHandler::requestApi()
 {
-    char unit[5] = "\xc2\xB0X";    // UTF-8!! c2b0 is the utf8 sequence for ° (degree symbol)
-    char res[129];
+    const CFG&      cfg = this->m_cfg;
+    ProviderHealth  health;
+    time_t          now = time(0);
+
+    if(!cfg.debug && HistoryDB::readHealth(this->db_path, cfg.apiProviderString, health) && !health.allow(now)) {
+        LOG_F(INFO, "DataHandler::requestApi(): circuit for %s is open for another %ld seconds, not requesting",
+              cfg.apiProviderString.c_str(), static_cast<long>(health.open_until - now));
+        co_return false;
+    }
 
-    auto result = this->convertTemperature(val, this->m_options.getConfig().temp_unit).first;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = co_await this->readFromApi();
+    HistoryDB *db = cfg.debug ? nullptr : this->healthDB();
+
+    if(db && !this->m_cancel) {
+        double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if(db->saveHealth(cfg.apiProviderString, ok, latency, time(0), health) && !ok && !health.allow(time(0)))
+            LOG_F(INFO, "DataHandler::requestApi(): %s failed %d times in a row, circuit open for %d seconds",
+                  cfg.apiProviderString.c_str(), health.failures, health.cooldown);
+    }
+    co_return ok;
+}
 
-    unit[2] = this->m_options.getConfig().temp_unit;
+/**
+ * send all requests of the provider at the same time and evaluate the
+ * responses once all have arrived. prepare() runs while they are in flight.
+ *
+ * @return      - true if valid data was read.
+ */
+Task<bool> DataHandler::readFromApi()
+{
+    const CFG&                          cfg = this->m_cfg;
+    EventLoop&                          loop = EventLoop::current();
+    std::vector<ApiRequest>             requests;
+    std::vector<EventLoop::Transfer>    transfers;
 
-    fprintf(stream, "%.1f%s\n", result, addUnit ? unit : "");
+    if(cfg.debug) {
+        printf("Debug Mode: Attempting to fetch weather from %s\n", ProgramOptions::api_readable_names[cfg.apiProvider]);
+    }
+    this->apiRequests(requests);
+    transfers.reserve(requests.size());
+    for(const auto& r : requests)
+        transfers.push_back(loop.fetch(r.url, &this->m_cancel));
+    this->prepare();
+    for(size_t i = 0; i < requests.size(); i++) {
+        auto response = co_await std::move(transfers[i]);
+        requests[i].ok = utils::curl_store(response.code, response.body, *requests[i].result,
+                                           requests[i].cache, cfg.skipcache);
+    }
+    co_return this->readResponses(requests);
 }
 
+/**
+ * convert a wind bearing in degrees into a human-readable form (i.e. "SW" for
+ * a south-westerly wind).
+ *
+ * @param wind_direction    - wind bearing in degrees
+ * @return                  - wind direction, one of wind_directions
+ */
+const char *DataHandler::degToBearing(unsigned int wind_direction)
+{
+    wind_direction = (wind_direction > 360) ? 0 : wind_direction;
+    size_t _val = (size_t) (((double) wind_direction / 22.5) + 0.5);
+    return DataHandler::wind_directions[_val % 16];
+}
+
+/**
+ * @brief DataHandler::doOutput - generate output in the units and layout
+ * given on the command line.
+ * @param stream: target stream for the ouput
+ */
+void DataHandler::doOutput(FILE* stream)
+{
+    const CFG& cfg = this->m_cfg;
+
+    this->doOutput(stream, cfg.units, this->layout(cfg.templateFile), cfg.format);
+}
 
 /**
  * @brief DataHandler::doOutput - generate output
  * @param stream: target stream for the ouput
+ * @param units: the unit profile to render in
+ * @param layout: the output template
+ * @param format: the output format, layout is used for TEXT only
  *
  * This generates all the output - it can either print to the console
  * or to a given FILE.
  */
-void DataHandler::doOutput(FILE* stream)
+void DataHandler::doOutput(FILE* stream, const UnitProfile& units, const OutputTemplate& layout,
+                           OutputFormat::Kind format)
 {
-    const CFG& cfg = this->m_options.getConfig();
-
-    fprintf(stream, "** Begin output **\n");
-    std::
-    fprintf(stream, "%c\n", m_DataPoint.weatherSymbol);
-    this->outputTemperature(stream, m_DataPoint.temperature, true);
-
-    /*
-     * The 3 days of forecast
-     */
-    this->outputDailyForecast(stream, false);
-    this->outputTemperature(stream, m_DataPoint.temperatureApparent, true);                 // 16
-    this->outputTemperature(stream, m_DataPoint.dewPoint, true);                            // 17
-    fprintf(stream, "Humidity: %.1f\n", m_DataPoint.humidity);                               // 18
-    fprintf(stream, cfg.pressure_unit == "hPa" ? "%.0f hPa\n" : "%.2f InHg\n",               // 19
-           m_DataPoint.pressureSeaLevel);
-    fprintf(stream, "%.1f %s\n", m_DataPoint.windSpeed, cfg.speed_unit.c_str());             // 20
-
-    if(m_DataPoint.precipitationIntensity > 0) {
-        fprintf(stream, "%s (%.1fmm/1h)\n", m_DataPoint.precipitationTypeAsString,
-               m_DataPoint.precipitationIntensity);                                 // 21
-    } else {
-        fprintf(stream, "PoP: %.0f%%\n", m_DataPoint.precipitationProbability);              // 21
-    }
-    fprintf(stream, "%.1f %s\n", m_DataPoint.visibility, cfg.vis_unit.c_str());              // 22
+    std::string buffer;
 
-    fprintf(stream, "%s\n", m_DataPoint.sunriseTimeAsString);                                // 23
-    fprintf(stream, "%s\n", m_DataPoint.sunsetTimeAsString);                                 // 24
-
-    fprintf(stream, "%s\n", m_DataPoint.windBearing);                                        // 25
-    fprintf(stream, "%s\n", m_DataPoint.timeRecordedAsText);                                 // 26
-    fprintf(stream, "%s", m_DataPoint.conditionAsString);                                    // 27
-    if(m_DataPoint.cloudCover > 0) {
-        fprintf(stream, " (%.0f%% cov.)\n", m_DataPoint.cloudCover);
-    } else {
-        fprintf(stream, "\n");
-    }
-    fprintf(stream, "%s\n", cfg.timezone.c_str());                                           // 28
-    outputTemperature(stream, m_DataPoint.temperatureMin, true);		                    // 29
-    outputTemperature(stream, m_DataPoint.temperatureMax, true);		                    // 30
-    // not all APIs provide the UV index
-    if(m_DataPoint.haveUVI) {
-        fprintf(stream, "UV: %.1f\n", m_DataPoint.uvIndex);                                  // 31
-    } else {
-        fprintf(stream, " \n");                                                              // 31
-    }
-    fprintf(stream, "** end data **\n");                                          		    // 32
-    fprintf(stream, "%.0f (Clouds)\n", m_DataPoint.cloudCover);
-    fprintf(stream, "%.0f (Cloudbase)\n", m_DataPoint.cloudBase);
-    fprintf(stream, "%.0f (Cloudceil)\n", m_DataPoint.cloudCeiling);
-    fprintf(stream, "%d (Moon)\n", m_DataPoint.moonPhase);
+    OutputFormat::render(format, *this, units, layout, buffer);
+    fwrite(buffer.data(), 1, buffer.size(), stream);
 }
 
 /**
- * output low/high temperature and condition "icon" for one day in the
- * forecast
- *
- * @param day           the JSON data for the forecast day to process
- * param  is_daylight   whether we should use the day or night weather symbol
+ * the compiled template for a --template file, see OutputTemplate::get().
+ * An empty path or a template which fails to load selects the built-in
+ * layout.
  */
-void DataHandler::outputDailyForecast(FILE *stream, const bool is_day)
-
+const OutputTemplate& DataHandler::layout(const std::string& path)
 {
-    for (int i = 0; i < 3; i++) {
-        fprintf(stream, "%c\n", this->m_daily[i].code);
-        outputTemperature(stream, this->m_daily[i].temperatureMin, false, "%.0f%s\n");
-        outputTemperature(stream, this->m_daily[i].temperatureMax, false, "%.0f%s\n");
-        fprintf(stream, "%s\n", this->m_daily[i].weekDay);
-    }
+    if(path.empty())
+        return OutputTemplate::builtin();
+
+    if(const OutputTemplate *layout = OutputTemplate::get(path, this->m_cfg.config_dir_path))
+        return *layout;
+    LOG_F(INFO, "DataHandler::layout(): using the built-in layout instead of %s", path.c_str());
+    return OutputTemplate::builtin();
 }
 
 // TODO - this is incomplete
@@ -216,123 +354,77 @@ void DataHandler::dumpSnapshot()
     printf("Code: %d, Symbol: %c, Condition: %s\n", p.weatherCode, p.weatherSymbol, p.conditionAsString);
 }
 
+/**
+ * the name under which this location is recorded in the history database.
+ * Either the location id / LAT,LON string or LAT,LON built from --lat and
+ * --lon.
+ */
+std::string DataHandler::locationKey() const
+{
+    const CFG& cfg = this->m_cfg;
+
+    if(!cfg.location.empty())
+        return cfg.location;
+    return cfg.lat + "," + cfg.lon;
+}
+
+/**
+ * hash all values of the snapshot and the daily forecast which end up in
+ * the database or the output, excluding the text fields derived from them.
+ */
+uint64_t DataHandler::snapshotHash() const
+{
+    const DataPoint& d = this->m_DataPoint;
+    const double values[] = { d.temperature, d.temperatureApparent, d.temperatureMin, d.temperatureMax,
+                              d.visibility, d.windSpeed, d.windGust, d.cloudCover, d.cloudBase,
+                              d.cloudCeiling, d.precipitationProbability, d.precipitationIntensity,
+                              d.pressureSeaLevel, d.humidity, d.dewPoint, d.uvIndex };
+    const int64_t ivalues[] = { d.timeRecorded, d.sunriseTime, d.sunsetTime, d.weatherCode, d.moonPhase,
+                                d.windDirection, d.precipitationType };
+
+    uint64_t hash = utils::fnv1a(values, sizeof(values));
+    hash = utils::fnv1a(ivalues, sizeof(ivalues), hash);
+    hash = utils::fnv1a(d.conditionAsString, strlen(d.conditionAsString), hash);
+    for(const auto& day : this->m_daily) {
+        const double dvalues[] = { day.temperatureMin, day.temperatureMax, day.pop };
+        hash = utils::fnv1a(dvalues, sizeof(dvalues), hash);
+        hash = utils::fnv1a(&day.code, 1, hash);
+    }
+    return hash;
+}
+
 /**
  * Write the database entry, unless database recording is disabled
+ * Each published snapshot is recorded once, no matter how often this is
+ * called.
  * @author alex (25.02.21)
  */
 void DataHandler::writeToDB()
 {
-    sqlite3         *the_db = 0;
-    sqlite3_stmt    *stmt = 0;
-    char            *err = 0;
     DataPoint&      d = this->m_DataPoint;
 
-    if(!d.valid)
+    if(!d.valid || !this->m_pending)
         return;
 
     // don't modify db in debug mode
-    if(m_options.getConfig().debug) {
+    if(this->m_cfg.debug) {
         LOG_F(INFO, "DataHandler::writeToDB(): skipping DB recording (debug mode is on)");
         return;
     }
 
+    this->m_pending = false;
     LOG_F(INFO, "Flushing DB, attemptint to open: %s", this->db_path.c_str());
-    auto rc = sqlite3_open(this->db_path.c_str(), &the_db);
-    if(rc) {
-        LOG_F(INFO, "Unable to open the SQLite Database at %s. The error message was %s.",
-              this->db_path.c_str(), sqlite3_errmsg(the_db));
-        return;
-    }
-    LOG_F(INFO, "Database openend successfully");
-
-    auto sql = R"(CREATE TABLE IF NOT EXISTS history
-      (
-          id INTEGER PRIMARY KEY AUTOINCREMENT,
-          timestamp INTEGER DEFAULT 0,
-          summary TEXT NOT NULL DEFAULT 'unknown',
-          icon TEXT NOT NULL DEFAULT 'unknown',
-          temperature REAL NOT NULL DEFAULT 0.0,
-          feelslike REAL NOT NULL DEFAULT 0.0,
-          dewpoint REAL DEFAULT 0.0,
-          windbearing INTEGER DEFAULT 0,
-          windspeed REAL DEFAULT 0.0,
-          windgust REAL DEFAULT 0.0,
-          humidity REAL DEFAULT 0.0,
-          visibility REAL DEFAULT 0.0,
-          pressure REAL DEFAULT 1013.0,
-          precip_probability REAL DEFAULT 0.0,
-          precip_intensity REAL DEFAULT 0.0,
-          precip_type TEXT DEFAULT 'none',
-          cloudCover REAL DEFAULT 0.0,
-          cloudBase REAL DEFAULT 0.0,
-          cloudCeiling REAL DEFAULT 0.0,
-          moonPhase INTEGER DEFAULT 0,
-          uvindex INTEGER DEFAULT 0,
-          sunrise INTEGER DEFAULT 0,
-          sunset INTEGER DEFAULT 0,
-          tempMax REAL DEFAULT 0.0,
-          tempMin REAL DEFAULT 0.0
-      )
-    )";
-
-    rc = sqlite3_exec(the_db, sql, utils::sqlite_callback, 0, &err);
-    if(rc != SQLITE_OK) {
-        LOG_F(INFO, "DB error when creating the table: %s", err);
-        sqlite3_free(err);
-    }
-
-    rc = sqlite3_prepare_v2(the_db,
-                            "INSERT INTO history(timestamp, summary, icon, temperature,"
-                            "feelslike, dewpoint, windbearing, windspeed,"
-                            "windgust, humidity, visibility, pressure,"
-                            "precip_probability, precip_intensity, precip_type,"
-                            "uvindex, sunrise, sunset, cloudBase, cloudCover, cloudCeiling, moonPhase,"
-                            "tempMin, tempMax)"
-                            "VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)", -1, &stmt, 0);
-
-    if(SQLITE_OK == rc) {
-        char    tmp[10];
-        LOG_F(INFO, "DataHandler::writeToDB(): sqlite3_prepare_v2() succeeded. Statement compiled");
-        sqlite3_bind_int(stmt, 1, static_cast<int>(d.timeRecorded));
-        sqlite3_bind_text(stmt, 2, d.conditionAsString, -1, 0);
-        tmp[0] = d.weatherSymbol;
-        sqlite3_bind_text(stmt, 3, tmp, -1, 0);
-        sqlite3_bind_double(stmt, 4, d.temperature);
-        sqlite3_bind_double(stmt, 5, d.temperatureApparent);
-        sqlite3_bind_double(stmt, 6, d.dewPoint);
-        sqlite3_bind_int(stmt, 7, d.windDirection);
-        sqlite3_bind_double(stmt, 8, d.windSpeed);
-        sqlite3_bind_double(stmt, 9, d.windGust);
-        sqlite3_bind_double(stmt, 10, d.humidity);
-        sqlite3_bind_double(stmt, 11, d.visibility);
-        sqlite3_bind_double(stmt, 12, d.pressureSeaLevel);
-        sqlite3_bind_double(stmt, 13, d.precipitationProbability);
-        sqlite3_bind_double(stmt, 14, d.precipitationIntensity);
-        sqlite3_bind_text(stmt, 15, d.precipitationTypeAsString, -1, 0);
-        sqlite3_bind_int(stmt, 16, static_cast<int>(d.uvIndex));
-        sqlite3_bind_int(stmt, 17, static_cast<int>(d.sunriseTime));
-        sqlite3_bind_int(stmt, 18, static_cast<int>(d.sunsetTime));
-        sqlite3_bind_double(stmt, 19, d.cloudBase);
-        sqlite3_bind_double(stmt, 20, d.cloudCover);
-        sqlite3_bind_double(stmt, 21, d.cloudCeiling);
-        sqlite3_bind_int(stmt, 22, d.moonPhase);
-        sqlite3_bind_double(stmt, 23, d.temperatureMin);
-        sqlite3_bind_double(stmt, 24, d.temperatureMax);
-
-        rc = sqlite3_step(stmt);
-        if(SQLITE_OK == rc) {
-            LOG_F(INFO, "DataHandler::writeToDB(): sqlite3_step() succeeded. Insert done.");
-            sqlite3_finalize(stmt);
+    const CFG& cfg = this->m_cfg;
+    HistoryBackend *db = this->history();
+    if(db) {
+        if(this->m_unchanged) {
+            LOG_F(INFO, "DataHandler::writeToDB(): observation unchanged, nothing recorded");
         } else {
-            LOG_F(INFO, "DataHandler::writeToDB(): sqlite3_step error: %s", sqlite3_errmsg(the_db));
-            sqlite3_finalize(stmt);
+            db->insert(d, this->m_timeline);
         }
-
+        db->maintenance({ .raw_days = cfg.retainRaw, .hourly_days = cfg.retainHourly,
+                         .daily_days = cfg.retainDaily, .archive = !cfg.noarchive }, cfg.compact);
     }
-    else {
-        LOG_F(INFO, "DataHandler::writeToDB(): prepare stmt, error: %s", sqlite3_errmsg(the_db));
-    }
-    sqlite3_close(the_db);
 }
 
 /**
@@ -343,39 +435,111 @@ void DataHandler::writeToDB()
  */
 int DataHandler::run()
 {
-    const CFG& cfg = m_options.getConfig();
+    return this->fetch() ? this->publish() : -1;
+}
+
+/**
+ * run() as a coroutine on the EventLoop of the calling thread, including
+ * the recording. The loop gets a turn between the stages, so other
+ * coroutines progress while this one writes outputs and the database.
+ *
+ * @return          - 0 if everything ok, -1 otherwise
+ */
+Task<int> DataHandler::process()
+{
+    EventLoop& loop = EventLoop::current();
+
+    if(!co_await this->fetchAsync())
+        co_return -1;
+    co_await loop.yield();
+    int rc = this->publish();
+    co_await loop.yield();
+    this->writeToDB();
+    co_return rc;
+}
+
+/**
+ * fetchAsync() run to completion.
+ *
+ * @param source    - see fetchAsync()
+ * @return          - true if valid data was read.
+ */
+bool DataHandler::fetch(Source source)
+{
+    return EventLoop::current().run(this->fetchAsync(source));
+}
+
+/**
+ * read the weather data.
+ *
+ * @param source    - AUTO follows --offline and --skipcache: the API with the
+ *                    cache as fallback, or the cache only. API and CACHE
+ *                    read from one source only. API requests are skipped
+ *                    while the circuit of the provider is open.
+ * @return          - true if valid data was read.
+ */
+Task<bool> DataHandler::fetchAsync(Source source)
+{
+    const CFG& cfg = this->m_cfg;
+
+    if(source == API)
+        co_return co_await this->requestApi();
+    if(source == CACHE)
+        co_return this->readFromCache();
 
     if(cfg.offline) {
         LOG_F(INFO, "DataHandler::run(): Attempting to read from cache (--offline option present)");
         if(!this->readFromCache()) {
             LOG_F(INFO, "run() Reading from cache failed, giving up.");
-            return -1;
+            co_return false;
         }
     } else {
         LOG_F(INFO, "DataHandler::run(): --offline not specified, attemptingn to fetch from API");
-        if(this->readFromApi() == false) {
+        if(co_await this->requestApi() == false) {
             if(!cfg.skipcache) {
                 LOG_F(INFO, "DataHandler::run(): readFromApi() failed, trying cache");
                 if(this->readFromCache() == false) {
                     LOG_F(INFO, "DataHandler::run(): BOTH readFromApi() and readFromCache() failed, giving up...");
-                    return -1;
+                    co_return false;
                 }
             } else {
                 LOG_F(INFO, "DataHandler::run(): readFromApi() failed, cache opted-out, giving up...");
-                return -1;
+                co_return false;
             }
         }
     }
+    co_return true;
+}
+
+/**
+ * write the snapshot read by fetch() to stdout and all output files. It is
+ * recorded by the next writeToDB().
+ *
+ * @return          - 0 if everything ok, -1 in debug mode.
+ */
+int DataHandler::publish()
+{
+    const CFG& cfg = this->m_cfg;
+
     if(!cfg.debug) {
+        this->m_pending = true;
+        this->m_DataPoint.fingerprint = this->snapshotHash();
+        HistoryBackend *db = this->history();
+        this->m_unchanged = db && db->isDuplicate(this->m_DataPoint);
+
         LOG_F(INFO, "run() - valid data, beginning output");
         if(!cfg.silent) {
             this->doOutput(stdout);
         }
         // dump to a file if --output was given
+        FileDumper dumper(this);
         if(cfg.output_file.length() > 0) {
-            FileDumper dumper(this);
             dumper.dump();
         }
+        // and once for every --outputAs, all rendered from the same snapshot
+        for(const auto& output : cfg.outputProfiles) {
+            dumper.dump(output.file, output.units, this->layout(output.layout), output.format);
+        }
         return 0;
     } else {
         LOG_F(INFO, "run() - valid data, debug mode, no output genereated");
@@ -27,21 +27,27 @@
 
 #include "pch.h"
 #include <time.h>
+#include <atomic>
 #include "options.h"
+#include "UnitProfile.h"
+#include "Task.h"
+#include "TimeZone.h"
+#include "Almanac.h"
 
 
 /*
  * The data point collects and normalizes data from an API provider
  * it is expected that:
  * a) it is completely populated.
- * b) all values are using the metric system (conversion is done for output
- *    purposes only.)
+ * b) all values are using the metric system: °C, m/s, km, hPa, mm/h.
+ *    Conversion is done for output purposes only (see UnitProfile).
  */
 
 struct DataPoint {
     bool            valid = false;
     bool            is_day = true;
     time_t          timeRecorded, sunsetTime, sunriseTime;
+    time_t          dawnTime, duskTime;     // civil twilight, 0 if unknown or there is none
     char            timeRecordedAsText[30];
     char            timeZone[128];
     int             weatherCode;
@@ -59,9 +65,26 @@ struct DataPoint {
     double          precipitationProbability, precipitationIntensity;
     double          pressureSeaLevel, humidity, dewPoint;
     char            sunsetTimeAsString[20], sunriseTimeAsString[20], windBearing[10], windUnit[10];
+    char            dawnTimeAsString[20], duskTimeAsString[20];
     char            conditionAsString[100];
     double          uvIndex;        // the UVI value
     bool            haveUVI;        // the weather provider offers UV index
+    uint64_t        fingerprint;    // hash over all values, detects unchanged observations
+};
+
+/*
+ * one step of a forecast timeline as delivered by the provider. Values are
+ * metric, fields the provider does not deliver are NAN (stored as NULL).
+ */
+struct ForecastPoint {
+    time_t          validTime;
+    int             resolution;     // length of the step in seconds (3600 = hourly, 86400 = daily)
+    int             weatherCode;
+    double          temperature, temperatureMin, temperatureMax;
+    double          pop, precipitationIntensity;
+    double          windSpeed;
+    int             windDirection;
+    double          humidity, pressure, cloudCover;
 };
 
 struct DailyForecast {
@@ -71,24 +94,44 @@ struct DailyForecast {
     double          pop;
 };
 
+class HistoryBackend;
+class HistoryDB;
+class OutputTemplate;
+
 class DataHandler {
   public:
-    DataHandler();
-    ~DataHandler() { writeToDB(); }
+    explicit DataHandler(const CFG& cfg = ProgramOptions::getInstance().getConfig());
+    virtual ~DataHandler();
+
+    static std::unique_ptr<DataHandler> create(const CFG& cfg);
 
     void doOutput(FILE *stream);
+    void doOutput(FILE *stream, const UnitProfile& units, const OutputTemplate& layout,
+                  OutputFormat::Kind format = OutputFormat::TEXT);
+    enum Source { AUTO, API, CACHE };
+
     void dumpSnapshot();
     int  run();
-    std::pair<std::string, std::string> degToBearing        (unsigned int wind_direction) const;
-    std::pair<double, char>             convertTemperature  (double temp, char unit) const;
-    double                              convertWindspeed    (double speed) const;
-    double                              convertVis          (const double vis) const;
-    double                              convertPressure     (double hPa) const;
+    bool fetch(Source source = AUTO);
+    Task<bool> fetchAsync(Source source = AUTO);
+    int  publish();
+    Task<int>  process();
+    void cancel() { m_cancel = true; }
+    void writeToDB();
+    static const char                   *degToBearing       (unsigned int wind_direction);
+    const CFG&                          config              () const { return m_cfg; }
     const DataPoint&                    getDataPoint        () const { return m_DataPoint; }
+    const std::vector<ForecastPoint>&   getTimeline         () const { return m_timeline; }
+    const DailyForecast&                getDaily            (int day) const { return m_daily[day]; }
+    const OutputTemplate&               layout              (const std::string& path);
+    std::string                         locationKey         () const;
+    uint64_t                            snapshotHash        () const;
+    HistoryBackend*                     history             ();
+    HistoryDB*                          healthDB            ();
+    const TimeZone&                     timeZone            ();
+    void                                setAlmanac          (int64_t first_day, const SunEvents *sun, int days);
+    void                                prepare             ();
 
-    void outputTemperature  (FILE *stream, double val, const bool addUnit = false,
-                             const char *format = "%.1f%s\n");
-    void outputDailyForecast(FILE *stream, const bool is_day = true);
 
     static constexpr const char *wind_directions[] =
       {"N", "NNE", "NE",
@@ -103,19 +146,43 @@ class DataHandler {
     static constexpr const char *weekDays[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat",
                                                "Sun", "_invalid"};
   protected:
+    /*
+     * one request of readFromApi(). The response is parsed into result and
+     * written to cache.
+     */
+    struct ApiRequest {
+        std::string     url;
+        nlohmann::json  *result;
+        std::string     cache;
+        bool            ok = false;         // the transfer succeeded and delivered JSON
+    };
+
     virtual         bool            readFromCache() = 0;
-    virtual         bool            readFromApi() = 0;
+    virtual         void            apiRequests(std::vector<ApiRequest>& requests) = 0;
+    virtual         bool            readResponses(const std::vector<ApiRequest>& requests) = 0;
     virtual         bool            verifyData() = 0;
-    ProgramOptions&                 m_options;
+                    Task<bool>      readFromApi();
+                    Task<bool>      requestApi();
+                    void            applyAlmanac();
+    const CFG&                      m_cfg;              // must outlive the handler
     DataPoint                       m_DataPoint;
     DailyForecast                   m_daily[3];         // 3 days, might be desireable to have this customizable
+    std::vector<ForecastPoint>      m_timeline;         // complete hourly and daily forecast for recording
     nlohmann::json                  result_current, result_forecast;
 
     std::string                     m_currentCache, m_ForecastCache;
-    void writeToDB();
+    std::atomic<bool>               m_cancel{false};    // abort running requests, see cancel()
 
   private:
     std::string                     db_path;
+    std::shared_ptr<HistoryBackend> m_history;          // a TimeSeriesLog is shared, see TimeSeriesLog::get()
+    std::unique_ptr<HistoryDB>      m_healthDB;         // provider health when history() is no HistoryDB
+    bool                            m_unchanged = false;    // same observation as the last recorded one
+    bool                            m_pending = false;      // the published snapshot is not yet recorded
+    bool                            m_prepared = false;     // prepare() done
+    const TimeZone                  *m_tz = nullptr;        // cfg.timezone, see timeZone()
+    std::vector<SunEvents>          m_sun;              // precomputed by setAlmanac(), from m_sunDay on
+    int64_t                         m_sunDay = 0;
 };
 
 #endif //__DATAHANDLER_H_
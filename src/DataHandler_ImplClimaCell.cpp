@@ -33,7 +33,7 @@
  * c'tor for DataHandler. Sets up database path and dispatches
  * data reading, either from cache or from the network.
  */
-DataHandler_ImplClimaCell::DataHandler_ImplClimaCell() : DataHandler(),
+DataHandler_ImplClimaCell::DataHandler_ImplClimaCell(const CFG& cfg) : DataHandler(cfg),
     /*
      * map weatherCodes to weather conditions.
      */
@@ -96,12 +96,14 @@ bool DataHandler_ImplClimaCell::readFromCache()
     current_buffer << current.rdbuf();
     current.close();
     this->result_current = json::parse(current_buffer.str().c_str());
-    LOG_F(INFO, "Attempting to read forecast from cache: %s", this->m_ForecastCache.c_str());
-    std::ifstream forecast(this->m_ForecastCache);
-    forecast_buffer << forecast.rdbuf();
-    forecast.close();
-    this->result_forecast = json::parse(forecast_buffer.str().c_str());
-    if(!this->result_current["data"].empty() && !this->result_forecast["data"].empty()) {
+    if(this->wantForecast()) {
+        LOG_F(INFO, "Attempting to read forecast from cache: %s", this->m_ForecastCache.c_str());
+        std::ifstream forecast(this->m_ForecastCache);
+        forecast_buffer << forecast.rdbuf();
+        forecast.close();
+        this->result_forecast = json::parse(forecast_buffer.str().c_str());
+    }
+    if(!this->result_current["data"].empty() && (!this->wantForecast() || !this->result_forecast["data"].empty())) {
         LOG_F(INFO, "Cache read successful.");
         this->populateSnapshot();
         return true;
@@ -110,18 +112,16 @@ bool DataHandler_ImplClimaCell::readFromCache()
 }
 
 /**
- * fetch data from network API and populate the json object
+ * the API requests for ClimaCell.
  * unlike darksky, which allowed for a single-call request with all data,
  * ClimaCell does not. We need to perform two requests. One detail request for the
  * current weather, and one forecast request to get data for the next 3-5 days.
- *
- * @return      - true if successful.
+ * Both are sent at the same time. The forecast is skipped when no forecast days
+ * are wanted and the sun can be computed locally (see wantForecast()).
  */
-bool DataHandler_ImplClimaCell::readFromApi()
+void DataHandler_ImplClimaCell::apiRequests(std::vector<ApiRequest>& requests)
 {
-    const CFG& cfg = m_options.getConfig();
-    bool fSuccess_current = true;
-    bool fSuccess_forecast = true;
+    const CFG& cfg = this->m_cfg;
     std::string baseurl("https://data.climacell.co/v4/timelines?&apikey=");
     baseurl.append(cfg.apikey);
     baseurl.append("&location=");
@@ -136,47 +136,48 @@ bool DataHandler_ImplClimaCell::readFromApi()
     current.append("cloudCeiling,humidity,precipitationIntensity,dewPoint&timesteps=current&units=metric");
     //std::cout << current << std::endl;
 
+    requests.push_back({current, &this->result_current, this->m_currentCache});
+    if(!this->wantForecast())
+        return;
+
     std::string daily(baseurl);
-    daily.append("&fields=weatherCode,temperatureMax,temperatureMin,sunriseTime,sunsetTime,moonPhase,");
+    daily.append("&fields=weatherCode,temperatureMax,temperatureMin,sunriseTime,sunsetTime,");
     daily.append("precipitationType,precipitationProbability&timesteps=1d&startTime=");
 
-    if(cfg.debug) {
-        printf("Debug Mode: Attempting to fetch weather from %s\n", ProgramOptions::api_readable_names[cfg.apiProvider]);
-    }
-
     /*
      * figure out the startTime parameter for the forcast. It needs to be UTC and tomorrow
      */
 
-    GDateTime *g = g_date_time_new_now_local();                  // now
+    tm now_tm;
+    this->timeZone().toLocal(time(0), now_tm);
+    int64_t today = utils::daysFromCivil(now_tm.tm_year + 1900, now_tm.tm_mon + 1, now_tm.tm_mday);
 
-    char cl[128];
-    snprintf(cl, 40, "%04d-%02d-%02dT23:00:00Z",
-             g_date_time_get_year(g),
-             g_date_time_get_month(g), g_date_time_get_day_of_month(g));
-
-    std::string _tmp(cl);
-    daily.append(_tmp);
+    char cl[32];
+    utils::formatISO8601(static_cast<time_t>(today * 86400 + 23 * 3600), cl, sizeof(cl));
+    daily.append(cl);
 
     /*
      * calculate the end date, we need 5 days at max for our forecast
      */
-    GDateTime *g_end = g_date_time_add_days(g, 5);     // 5 days forecast
-    snprintf(cl, 40, "%04d-%02d-%02dT06:00:00Z",
-             g_date_time_get_year(g_end),
-             g_date_time_get_month(g_end), g_date_time_get_day_of_month(g_end));
+    utils::formatISO8601(static_cast<time_t>((today + 5) * 86400 + 6 * 3600), cl, sizeof(cl));
+    daily.append("&endTime=");
+    daily.append(cl);
 
-    g_date_time_unref(g_end);
-    g_date_time_unref(g);
+    requests.push_back({daily, &this->result_forecast, this->m_ForecastCache});
+}
 
-    daily.append("&endTime=");
-    _tmp.assign(cl);
-    daily.append(_tmp);
-    const char *url = current.c_str();
+/**
+ * evaluate the responses to the current and the forecast request and
+ * populate the json object.
+ *
+ * @return      - true if successful.
+ */
+bool DataHandler_ImplClimaCell::readResponses(const std::vector<ApiRequest>& requests)
+{
+    bool fSuccess_current = true;
+    bool fSuccess_forecast = true;
 
-    auto result = utils::curl_fetch(current.c_str(), this->result_current,
-                                    this->m_currentCache, m_options.getConfig().skipcache);
-    if(result) {
+    if(requests[0].ok) {
         if (!this->result_current["cod"].empty()) {         // field "cod" means error
             LOG_F(INFO,
                   "readFromApi(): Failure, error code = %d, error message = %s",
@@ -192,21 +193,20 @@ bool DataHandler_ImplClimaCell::readFromApi()
         fSuccess_current = false;
     }
     // now the daily forecast
-
-    result = utils::curl_fetch(daily.c_str(), this->result_forecast,
-                                    this->m_ForecastCache, m_options.getConfig().skipcache);
-    if(result) {
-        if (!this->result_current["cod"].empty()) {         // field "cod" means error
+    if(requests.size() < 2) {
+        fSuccess_forecast = true;
+    } else if(requests[1].ok) {
+        if (!this->result_forecast["cod"].empty()) {        // field "cod" means error
             LOG_F(INFO,
                   "readFromApi(): Failure, error code = %d, error message = %s",
-                  this->result_current["cod"].get<int>(),
-                  this->result_current["message"].get<std::string>().c_str());
+                  this->result_forecast["cod"].get<int>(),
+                  this->result_forecast["message"].get<std::string>().c_str());
             return false;
         }
         /**
          * validation
          */
-        fSuccess_forecast = !this->result_current["data"].empty();
+        fSuccess_forecast = !this->result_forecast["data"].empty();
     } else {
         fSuccess_forecast = false;
     }
@@ -229,23 +229,31 @@ void DataHandler_ImplClimaCell::populateSnapshot()
 {
     // shortcuts
     nlohmann::json& d =     this->result_current["data"]["timelines"][0]["intervals"][0]["values"];
-    nlohmann::json& df =    this->result_forecast["data"]["timelines"][0]["intervals"][0]["values"];
+    // today of the 1d timeline, empty when it was not requested (see wantForecast()). Looked up
+    // without operator[], which would add the path to result_forecast
+    static const nlohmann::json none = nlohmann::json::object();
+    static const nlohmann::json::json_pointer today("/data/timelines/0/intervals/0/values");
+    const nlohmann::json& df = this->result_forecast.contains(today) ? this->result_forecast.at(today) : none;
     DataPoint& p = this->m_DataPoint;
-    const CFG& cfg = this->m_options.getConfig();
-    char tmp[128];
+    const CFG& cfg = this->m_cfg;
+    const TimeZone& tz = this->timeZone();
 
     if(d["weatherCode"].empty())
         return; // datapoint likely not valid
 
     p.weatherCode = d["weatherCode"].is_number() ? d["weatherCode"].get<int>() : 0;
-    snprintf(p.timeZone, SIZEOF(p.timeZone), "%s", m_options.getConfig().timezone.c_str());
+    snprintf(p.timeZone, SIZEOF(p.timeZone), "%s", this->m_cfg.timezone.empty() ? "Local" : this->m_cfg.timezone.c_str());
 
-    p.timeRecorded = time(0);
-    tm *now = localtime(&p.timeRecorded);
-    snprintf(p.timeRecordedAsText, 19, "%02d:%02d", now->tm_hour, now->tm_min);
+    // the start of the current interval is the observation time
+    nlohmann::json& interval = this->result_current["data"]["timelines"][0]["intervals"][0];
+    p.timeRecorded = interval["startTime"].is_string() ?
+      utils::ISOToUnixtime(interval["startTime"].get_ref<const std::string&>()) : time(0);
+    tm now;
+    tz.toLocal(p.timeRecorded, now);
+    snprintf(p.timeRecordedAsText, 19, "%02d:%02d", now.tm_hour, now.tm_min);
 
     p.dewPoint = d["dewPoint"].is_number() ?
-      this->convertTemperature(d["dewPoint"].get<double>(), cfg.temp_unit).first : 0.0f;
+      d["dewPoint"].get<double>() : 0.0f;
 
     p.humidity = d["humidity"].is_number() ?
       d["humidity"].get<double>() : 0.0f;
@@ -257,44 +265,32 @@ void DataHandler_ImplClimaCell::populateSnapshot()
       d["precipitationIntensity"].get<double>() : 0.0f;
 
     p.temperature = d["temperature"].is_number() ?
-      this->convertTemperature(d["temperature"].get<double>(), cfg.temp_unit).first : 0.0f;
+      d["temperature"].get<double>() : 0.0f;
 
     p.temperatureApparent = d["temperatureApparent"].is_number() ?
-      this->convertTemperature(d["temperatureApparent"].get<double>(), cfg.temp_unit).first : 0;
-
-    p.temperatureMin = df["temperatureMin"].is_number() ?
-      this->convertTemperature(df["temperatureMin"].get<double>(),
-        cfg.temp_unit).first : 0;
+      d["temperatureApparent"].get<double>() : 0;
 
-    p.temperatureMax = df["temperatureMax"].is_number() ?
-      this->convertTemperature(df["temperatureMax"].get<double>(),
-        cfg.temp_unit).first : 0;
+    p.temperatureMin = utils::number_or(df, "temperatureMin");
+    p.temperatureMax = utils::number_or(df, "temperatureMax");
 
-    p.visibility = d["visibility"].is_number() ? this->convertVis(d["visibility"].get<double>()) : 0.0f;
+    p.visibility = d["visibility"].is_number() ? d["visibility"].get<double>() : 0.0f;
     p.pressureSeaLevel = d["pressureSeaLevel"].is_number() ?
-      this->convertPressure(d["pressureSeaLevel"].get<double>()) : 0.0f;
+      d["pressureSeaLevel"].get<double>() : 0.0f;
 
-    p.windSpeed = d["windSpeed"].is_number() ? this->convertWindspeed(d["windSpeed"].get<double>()) : 0.0f;
+    p.windSpeed = d["windSpeed"].is_number() ? d["windSpeed"].get<double>() : 0.0f;
     p.windDirection = d["windDirection"].is_number() ? d["windDirection"].get<int>() : 0;
-    p.windGust = d["windGust"].is_number() ? this->convertWindspeed(d["windGust"].get<double>()) : 0.0f;
+    p.windGust = d["windGust"].is_number() ? d["windGust"].get<double>() : 0.0f;
 
-    auto wind = this->degToBearing(p.windDirection);
-    snprintf(p.windBearing, 9, "%s", wind.first.c_str());
-    snprintf(p.windUnit, 9, "%s", wind.second.c_str());
+    snprintf(p.windBearing, 9, "%s", DataHandler::degToBearing(p.windDirection));
+    snprintf(p.windUnit, 9, "%s", "m/s");
 
-    p.sunsetTime = df["sunsetTime"].is_string() ?
-      utils::ISOToUnixtime(df["sunsetTime"].get<std::string>(), 0) : 0;
-    p.sunriseTime= df["sunriseTime"].is_string() ?
-      utils::ISOToUnixtime(df["sunriseTime"].get<std::string>(), 0) : 0;
+    auto sunset = df.find("sunsetTime"), sunrise = df.find("sunriseTime");
+    p.sunsetTime = sunset != df.end() && sunset->is_string() ?
+      utils::ISOToUnixtime(sunset->get_ref<const std::string&>()) : 0;
+    p.sunriseTime = sunrise != df.end() && sunrise->is_string() ?
+      utils::ISOToUnixtime(sunrise->get_ref<const std::string&>()) : 0;
 
-    p.is_day = (p.sunriseTime < p.timeRecorded < p.sunsetTime);
-
-    tm *sunset = localtime(&p.sunsetTime);
-    snprintf(tmp, 100, "%02d:%02d", sunset->tm_hour, sunset->tm_min);
-    snprintf(p.sunsetTimeAsString, 19, "%s", tmp);
-    tm *sunrise = localtime(&p.sunriseTime);
-    snprintf(tmp, 100, "%02d:%02d", sunrise->tm_hour, sunrise->tm_min);
-    snprintf(p.sunriseTimeAsString, 19, "%s", tmp);
+    this->applyAlmanac();
 
     p.precipitationType = d["precipitationType"].is_number() ? d["precipitationType"].get<int>() : 0;
     snprintf(p.precipitationTypeAsString, 19, "%s", this->getPrecipType(p.precipitationType));
@@ -306,9 +302,6 @@ void DataHandler_ImplClimaCell::populateSnapshot()
     p.cloudBase = d["cloudBase"].is_number() ? d["cloudBase"].get<double>() : 0;
     p.cloudCeiling = d["cloudCeiling"].is_number() ? d["cloudCeiling"].get<double>() : 0;
 
-    p.moonPhase = this->result_forecast["data"]["timelines"][0]["intervals"][0]["values"]["moonPhase"].is_number() ?
-      this->result_forecast["data"]["timelines"][0]["intervals"][0]["values"]["moonPhase"].get<int>() : 0;
-
     p.valid = true;
     LOG_F(INFO, "DataHandler::populateSnapshot(): snapshot populated successfully.");
 #if __clang_major__ >= 8
@@ -319,7 +312,7 @@ void DataHandler_ImplClimaCell::populateSnapshot()
     p.haveUVI = false;
     DailyForecast* daily = this->m_daily;
 
-    for(int i = 0; i < 3; i++) {
+    for(int i = 0; i < std::min(cfg.forecastDays, 3); i++) {
         int weatherCode = this->result_forecast["data"]["timelines"][0]["intervals"][i
           + 1]["values"]["weatherCode"].is_number() ?
                           this->result_forecast["data"]["timelines"][0]["intervals"][i
@@ -341,13 +334,15 @@ void DataHandler_ImplClimaCell::populateSnapshot()
                                   this->result_forecast["data"]["timelines"][0]["intervals"][i
                                     + 1]["values"]["temperatureMin"].get<double>() : 0.0f;
 
-        GDateTime *g =
-          g_date_time_new_from_iso8601(result_forecast["data"]["timelines"][0]["intervals"][i
-            + 1]["values"]["sunriseTime"].is_string() ?
-            result_forecast["data"]["timelines"][0]["intervals"][i +1 ]["values"]["sunriseTime"].get<std::string>().c_str() : 0, 0);
-
-        gint weekday = g_date_time_get_day_of_week(g);
-        g_date_time_unref(g);
+        nlohmann::json& sunrise = result_forecast["data"]["timelines"][0]["intervals"][i + 1]["values"]["sunriseTime"];
+        time_t t = 0;
+        int weekday = 0;
+        if(sunrise.is_string()) {
+            const std::string& iso = sunrise.get_ref<const std::string&>();
+            if(utils::parseISO8601(iso.data(), iso.size(), t)) {
+                weekday = utils::weekday(t, tz.offset(t));
+            }
+        }
 
         if (weekday >= 1 && weekday <= 7) {
             snprintf(daily[i].weekDay, 5, "%s", DataHandler::weekDays[weekday - 1]);
@@ -355,11 +350,47 @@ void DataHandler_ImplClimaCell::populateSnapshot()
             snprintf(daily[i].weekDay, 5, "%s", DataHandler::weekDays[7]);       // print "invalid"
         }
     }
-    if(this->m_options.getConfig().debug) {
+
+    /*
+     * the daily timeline, recorded in the forecast table
+     */
+    this->m_timeline.clear();
+    static const nlohmann::json::json_pointer intervals("/data/timelines/0/intervals");
+    if(this->result_forecast.contains(intervals)) {
+        for(auto& interval : this->result_forecast.at(intervals)) {
+            nlohmann::json& v = interval["values"];
+            ForecastPoint f = {
+                .validTime = interval["startTime"].is_string() ?
+                             utils::ISOToUnixtime(interval["startTime"].get_ref<const std::string&>()) : 0,
+                .resolution = 86400,
+                .weatherCode = static_cast<int>(utils::number_or(v, "weatherCode", 0)),
+                .temperature = NAN,
+                .temperatureMin = utils::number_or(v, "temperatureMin"),
+                .temperatureMax = utils::number_or(v, "temperatureMax"),
+                .pop = utils::number_or(v, "precipitationProbability"),
+                .precipitationIntensity = NAN, .windSpeed = NAN, .windDirection = 0,
+                .humidity = NAN, .pressure = NAN, .cloudCover = NAN };
+            this->m_timeline.push_back(f);
+        }
+    }
+    if(this->m_cfg.debug) {
         this->dumpSnapshot();
     }
 }
 
+/**
+ * the 1d timeline is needed for the forecast days, the temperature range
+ * of today and for sunrise and sunset when the location has no coordinates.
+ * Runs with --forecastDays 0 for a location given as latitude and longitude
+ * only need the current conditions, the temperature range of today is then
+ * unknown (NAN).
+ */
+bool DataHandler_ImplClimaCell::wantForecast() const
+{
+    double lat, lon;
+    return this->m_cfg.forecastDays > 0 || !almanac::coordinates(this->m_cfg, lat, lon);
+}
+
 const char *DataHandler_ImplClimaCell::getCondition(int weatherCode)
 {
     if(DataHandler_ImplClimaCell::m_conditions.find(weatherCode) != DataHandler_ImplClimaCell::m_icons.end()) {
@@ -31,11 +31,12 @@
 
 class DataHandler_ImplClimaCell : public DataHandler {
   public:
-    DataHandler_ImplClimaCell();
+    explicit DataHandler_ImplClimaCell(const CFG& cfg);
     ~DataHandler_ImplClimaCell() {}
 
     virtual bool readFromCache() override;
-    virtual bool readFromApi() override;
+    virtual void apiRequests(std::vector<ApiRequest>& requests) override;
+    virtual bool readResponses(const std::vector<ApiRequest>& requests) override;
     virtual bool verifyData() override;
 
     const char*                         getCondition        (int weatherCode);
@@ -43,6 +44,7 @@ class DataHandler_ImplClimaCell : public DataHandler {
 
     char getCode            (const int weatherCode, const bool daylight = true);
     void populateSnapshot   ();
+    bool wantForecast       () const;
 
     static constexpr const char *precipType[] = { "", "Rain", "Snow", "Freezing Rain", "Ice Pellets" };
   private:
@@ -100,14 +100,12 @@ char DataHandler_ImplOWM::getCode(const int weatherCode, const bool daylight)
 }
 
 /**
- * implements the API request for OpenWeatherMap. They support single
- * call semantics for getting current + daily forecast.
- *
- * @return      - true if successful.
+ * the API request for OpenWeatherMap. They support single call semantics
+ * for getting current + daily forecast.
  */
-bool DataHandler_ImplOWM::readFromApi()
+void DataHandler_ImplOWM::apiRequests(std::vector<ApiRequest>& requests)
 {
-    const CFG& cfg = m_options.getConfig();
+    const CFG& cfg = this->m_cfg;
     // TODO: this needs to be an option for it might be subject to change.
     std::string baseurl("http://api.openweathermap.org/data/2.5/onecall?appid=");
     baseurl.append(cfg.apikey);
@@ -115,15 +113,17 @@ bool DataHandler_ImplOWM::readFromApi()
 
     std::string current(baseurl);
     current.append("&exclude=minutely&units=metric");
+    requests.push_back({current, &this->result_current, this->m_currentCache});
+}
 
-    const char *url = current.c_str();
-    if (cfg.debug) {
-        printf("Debug Mode: Attempting to fetch weather from %s\n",
-               ProgramOptions::api_readable_names[cfg.apiProvider]);
-    }
-    auto result = utils::curl_fetch(current.c_str(), this->result_current,
-                                    this->m_currentCache, m_options.getConfig().skipcache);
-    if(result) {
+/**
+ * evaluate the response of the request.
+ *
+ * @return      - true if successful.
+ */
+bool DataHandler_ImplOWM::readResponses(const std::vector<ApiRequest>& requests)
+{
+    if(requests[0].ok) {
         if (!this->result_current["cod"].empty()) {         // field "cod" means error
             LOG_F(INFO,
                   "readFromApi(): Failure, error code = %d, error message = %s",
@@ -171,9 +171,9 @@ bool DataHandler_ImplOWM::readFromCache()
 void DataHandler_ImplOWM::populateSnapshot()
 {
     nlohmann::json& d = this->result_current["current"];
-    const CFG& cfg = this->m_options.getConfig();
+    const CFG& cfg = this->m_cfg;
+    const TimeZone& tz = this->timeZone();
     DataPoint& p = this->m_DataPoint;
-    char tmp[128];
     p.weatherCode = d["weather"][0]["id"].is_number() ? d["weather"][0]["id"].get<int>() : 800;
 
     snprintf(p.timeZone, 127, "%s", this->result_current["timezone"].is_string() ?
@@ -181,11 +181,12 @@ void DataHandler_ImplOWM::populateSnapshot()
 
     p.timeRecorded = d["dt"].is_number() ? d["dt"].get<int>() : time(0);
 
-    tm *now = localtime(&p.timeRecorded);
-    snprintf(p.timeRecordedAsText, 19, "%02d:%02d/%s", now->tm_hour, now->tm_min, cfg.apiProviderString.c_str());
+    tm now;
+    tz.toLocal(p.timeRecorded, now);
+    snprintf(p.timeRecordedAsText, 19, "%02d:%02d/%s", now.tm_hour, now.tm_min, cfg.apiProviderString.c_str());
 
     p.dewPoint = d["dew_point"].is_number() ?
-                 this->convertTemperature(d["dew_point"].get<double>(), cfg.temp_unit).first : 0.0f;
+                 d["dew_point"].get<double>() : 0.0f;
 
     p.humidity = d["humidity"].is_number() ? d["humidity"].get<double>() : 0.0f;
 
@@ -208,44 +209,34 @@ void DataHandler_ImplOWM::populateSnapshot()
     }
 
     p.temperature = d["temp"].is_number() ?
-                    this->convertTemperature(d["temp"].get<double>(), cfg.temp_unit).first : 0.0f;
+                    d["temp"].get<double>() : 0.0f;
 
     p.temperatureApparent = d["feels_like"].is_number() ?
-                            this->convertTemperature(d["feels_like"].get<double>(), cfg.temp_unit).first : 0;
+                            d["feels_like"].get<double>() : 0;
 
     p.temperatureMin = this->result_current["daily"][0]["temp"]["min"].is_number() ?
-                       this->convertTemperature(this->result_current["daily"][0]["temp"]["min"].get<double>(),
-                                                cfg.temp_unit).first : 0;
+                       this->result_current["daily"][0]["temp"]["min"].get<double>() : 0;
 
     p.temperatureMax = this->result_current["daily"][0]["temp"]["max"].is_number() ?
-                       this->convertTemperature(this->result_current["daily"][0]["temp"]["max"].get<double>(),
-                                                cfg.temp_unit).first : 0;
+                       this->result_current["daily"][0]["temp"]["max"].get<double>() : 0;
 
     // OWM reports vis in meters not miles or km
-    p.visibility = d["visibility"].is_number() ? this->convertVis(d["visibility"].get<double>() / 1000) : 0.0f;
+    p.visibility = d["visibility"].is_number() ? d["visibility"].get<double>() / 1000 : 0.0f;
 
     p.pressureSeaLevel = d["pressure"].is_number() ?
-                         this->convertPressure(d["pressure"].get<double>()) : 0.0f;
+                         d["pressure"].get<double>() : 0.0f;
 
-    p.windSpeed = d["wind_speed"].is_number() ? this->convertWindspeed(d["wind_speed"].get<double>()) : 0.0f;
+    p.windSpeed = d["wind_speed"].is_number() ? d["wind_speed"].get<double>() : 0.0f;
     p.windDirection = d["wind_deg"].is_number() ? d["wind_deg"].get<int>() : 0;
-    p.windGust = d["wind_gust"].is_number() ? this->convertWindspeed(d["wind_gust"].get<double>()) : 0.0f;
+    p.windGust = d["wind_gust"].is_number() ? d["wind_gust"].get<double>() : 0.0f;
 
-    auto wind = this->degToBearing(p.windDirection);
-    snprintf(p.windBearing, 9, "%s", wind.first.c_str());
-    snprintf(p.windUnit, 9, "%s", wind.second.c_str());
+    snprintf(p.windBearing, 9, "%s", DataHandler::degToBearing(p.windDirection));
+    snprintf(p.windUnit, 9, "%s", "m/s");
 
     p.sunsetTime = d["sunset"].is_number() ? d["sunset"].get<int>() : 0;
     p.sunriseTime= d["sunrise"].is_number() ? d["sunrise"].get<int>() : 0;
 
-    p.is_day = (p.sunriseTime < p.timeRecorded < p.sunsetTime);
-
-    tm *sunset = localtime(&p.sunsetTime);
-    snprintf(tmp, 100, "%02d:%02d", sunset->tm_hour, sunset->tm_min);
-    snprintf(p.sunsetTimeAsString, 19, "%s", tmp);
-    tm *sunrise = localtime(&p.sunriseTime);
-    snprintf(tmp, 100, "%02d:%02d", sunrise->tm_hour, sunrise->tm_min);
-    snprintf(p.sunriseTimeAsString, 19, "%s", tmp);
+    this->applyAlmanac();
 
     snprintf(p.conditionAsString, 99, "%s", d["weather"][0]["main"].is_string() ?
       d["weather"][0]["main"].get<std::string>().c_str() : "Unknown");
@@ -271,11 +262,47 @@ void DataHandler_ImplOWM::populateSnapshot()
 
         time_t date = jdaily[i +1]["dt"].is_number() ? jdaily[i +1]["dt"].get<unsigned long>() : 0;
 
-        tm *tmdate = localtime(&date);
-        strftime(daily[i].weekDay, 9, "%a", tmdate);
+        tm tmdate;
+        tz.toLocal(date, tmdate);
+        strftime(daily[i].weekDay, 9, "%a", &tmdate);
     }
     p.weatherSymbol = this->getCode(p.weatherCode, p.is_day);
     p.valid = true;
+
+    /*
+     * the full hourly and daily timelines, recorded in the forecast table
+     */
+    this->m_timeline.clear();
+    for(auto& h : this->result_current["hourly"]) {
+        ForecastPoint f = {
+            .validTime = static_cast<time_t>(utils::number_or(h, "dt", 0)), .resolution = 3600,
+            .weatherCode = static_cast<int>(utils::number_or(h["weather"][0], "id", 0)),
+            .temperature = utils::number_or(h, "temp"), .temperatureMin = NAN, .temperatureMax = NAN,
+            .pop = utils::number_or(h, "pop"),
+            .precipitationIntensity = h.contains("rain") ? utils::number_or(h["rain"], "1h") :
+                                      h.contains("snow") ? utils::number_or(h["snow"], "1h") : 0.0,
+            .windSpeed = utils::number_or(h, "wind_speed"),
+            .windDirection = static_cast<int>(utils::number_or(h, "wind_deg", 0)),
+            .humidity = utils::number_or(h, "humidity"), .pressure = utils::number_or(h, "pressure"),
+            .cloudCover = utils::number_or(h, "clouds") };
+        this->m_timeline.push_back(f);
+    }
+    for(auto& day : jdaily) {
+        // OWM reports the daily amount of precipitation in mm
+        ForecastPoint f = {
+            .validTime = static_cast<time_t>(utils::number_or(day, "dt", 0)), .resolution = 86400,
+            .weatherCode = static_cast<int>(utils::number_or(day["weather"][0], "id", 0)),
+            .temperature = utils::number_or(day["temp"], "day"),
+            .temperatureMin = utils::number_or(day["temp"], "min"),
+            .temperatureMax = utils::number_or(day["temp"], "max"),
+            .pop = utils::number_or(day, "pop"),
+            .precipitationIntensity = utils::number_or(day, "rain", 0) + utils::number_or(day, "snow", 0),
+            .windSpeed = utils::number_or(day, "wind_speed"),
+            .windDirection = static_cast<int>(utils::number_or(day, "wind_deg", 0)),
+            .humidity = utils::number_or(day, "humidity"), .pressure = utils::number_or(day, "pressure"),
+            .cloudCover = utils::number_or(day, "clouds") };
+        this->m_timeline.push_back(f);
+    }
 }
 
 /**
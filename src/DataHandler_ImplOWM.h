@@ -31,10 +31,11 @@
 
 class DataHandler_ImplOWM : public DataHandler {
   public:
-    DataHandler_ImplOWM() : DataHandler() { }
+    explicit DataHandler_ImplOWM(const CFG& cfg) : DataHandler(cfg) { }
 
     virtual bool    readFromCache() override;
-    virtual bool    readFromApi() override;
+    virtual void    apiRequests(std::vector<ApiRequest>& requests) override;
+    virtual bool    readResponses(const std::vector<ApiRequest>& requests) override;
     virtual bool    verifyData() override;
 
     void    populateSnapshot();
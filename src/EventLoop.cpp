@@ -0,0 +1,204 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "EventLoop.h"
+#include <mutex>
+#include "utils.h"
+
+EventLoop::EventLoop()
+{
+    // curl_global_init() is not thread-safe, it runs once before the first multi handle
+    static std::once_flag curl_init;
+    std::call_once(curl_init, []() {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        atexit(curl_global_cleanup);
+    });
+    this->m_multi = curl_multi_init();
+}
+
+EventLoop::~EventLoop()
+{
+    this->m_tasks.clear();
+    for(CURL *easy : this->m_idle)
+        curl_easy_cleanup(easy);
+    if(this->m_multi)
+        curl_multi_cleanup(this->m_multi);
+}
+
+/**
+ * the loop of the calling thread.
+ */
+EventLoop& EventLoop::current()
+{
+    thread_local EventLoop loop;
+    return loop;
+}
+
+/**
+ * start a GET request.
+ *
+ * @param url       - the document URI
+ * @param cancel    - when given, the transfer is aborted as soon as it
+ *                    becomes true (checked at least every poll_timeout ms,
+ *                    it may be set from other threads)
+ * @return          - the transfer, co_await it for the response
+ */
+EventLoop::Transfer EventLoop::fetch(const std::string& url, const std::atomic<bool> *cancel)
+{
+    auto request = std::make_unique<Request>();
+    CURL *curl = this->acquire();
+
+    if(!curl || !this->m_multi) {
+        if(curl)
+            this->release(curl);
+        request->response.code = CURLE_FAILED_INIT;
+        request->done = true;
+        return Transfer(*this, std::move(request));
+    }
+    request->easy = curl;
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, utils::curl_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &request->response.body);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, EventLoop::connect_timeout);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, EventLoop::transfer_timeout);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, request.get());
+    request->cancel = cancel;
+    curl_multi_add_handle(this->m_multi, curl);
+    this->m_active.push_back(request.get());
+    // get the name lookup and the connect going before the caller does anything else
+    int running;
+    curl_multi_perform(this->m_multi, &running);
+    return Transfer(*this, std::move(request));
+}
+
+/**
+ * run task as soon as run() gets to it. The loop owns the task.
+ */
+void EventLoop::spawn(Task<void> task)
+{
+    this->m_ready.push_back(task.handle());
+    this->m_tasks.push_back(std::move(task));
+}
+
+/**
+ * run all spawned tasks to completion.
+ */
+void EventLoop::run()
+{
+    while(true) {
+        while(!this->m_ready.empty()) {
+            auto h = this->m_ready.front();
+            this->m_ready.pop_front();
+            h.resume();
+        }
+        std::erase_if(this->m_tasks, [](const Task<void>& t) { return t.done(); });
+        if(this->m_tasks.empty())
+            break;
+        if(this->m_active.empty()) {
+            LOG_F(INFO, "EventLoop::run(): %zu tasks wait for nothing, giving up on them", this->m_tasks.size());
+            this->m_tasks.clear();
+            break;
+        }
+
+        this->checkCancelled();
+        if(!this->m_ready.empty())
+            continue;
+        int running = 0;
+        curl_multi_perform(this->m_multi, &running);
+        int queued;
+        while(CURLMsg *msg = curl_multi_info_read(this->m_multi, &queued)) {
+            if(msg->msg == CURLMSG_DONE)
+                this->finish(msg->easy_handle, msg->data.result);
+        }
+        if(this->m_ready.empty())
+            curl_multi_poll(this->m_multi, nullptr, 0, EventLoop::poll_timeout, nullptr);
+    }
+}
+
+/**
+ * a transfer ended, wake up the coroutine waiting for it.
+ */
+void EventLoop::finish(CURL *easy, CURLcode code)
+{
+    Request *request = nullptr;
+
+    curl_easy_getinfo(easy, CURLINFO_PRIVATE, reinterpret_cast<char **>(&request));
+    curl_multi_remove_handle(this->m_multi, easy);
+    std::erase(this->m_active, request);
+    request->response.code = code;
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &request->response.status);
+    request->easy = nullptr;
+    request->done = true;
+    this->release(easy);
+    if(code == CURLE_ABORTED_BY_CALLBACK)
+        LOG_F(INFO, "EventLoop::finish(): transfer cancelled");
+    else if(code != CURLE_OK)
+        LOG_F(INFO, "EventLoop::finish(): transfer failed, %s", curl_easy_strerror(code));
+    if(request->waiter)
+        this->m_ready.push_back(request->waiter);
+}
+
+/**
+ * the Transfer was dropped before the response arrived.
+ */
+void EventLoop::abort(Request& request)
+{
+    if(!request.easy)
+        return;
+    curl_multi_remove_handle(this->m_multi, request.easy);
+    std::erase(this->m_active, &request);
+    this->release(request.easy);
+    request.easy = nullptr;
+}
+
+/**
+ * end the transfers whose cancel flag is set.
+ */
+void EventLoop::checkCancelled()
+{
+    std::vector<Request *> cancelled;
+
+    for(Request *request : this->m_active) {
+        if(request->cancel && request->cancel->load())
+            cancelled.push_back(request);
+    }
+    for(Request *request : cancelled)
+        this->finish(request->easy, CURLE_ABORTED_BY_CALLBACK);
+}
+
+CURL *EventLoop::acquire()
+{
+    if(this->m_idle.empty())
+        return curl_easy_init();
+    CURL *easy = this->m_idle.back();
+    this->m_idle.pop_back();
+    return easy;
+}
+
+void EventLoop::release(CURL *easy)
+{
+    curl_easy_reset(easy);
+    this->m_idle.push_back(easy);
+}
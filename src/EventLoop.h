@@ -0,0 +1,139 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_EVENTLOOP_H_
+#define FETCHWEATHER_SRC_EVENTLOOP_H_
+
+#include "pch.h"
+#include <atomic>
+#include <deque>
+#include "Task.h"
+
+/*
+ * single threaded scheduler for Tasks on top of a curl multi handle.
+ *
+ * Coroutines await HTTP transfers (fetch()) or give other coroutines a turn
+ * (yield()). Everything runs on the thread calling run(), any number of
+ * transfers are in flight at the same time. Between the coroutine steps,
+ * run() drives the transfers and sleeps in curl_multi_poll() until a socket
+ * is ready.
+ *
+ * current() is the loop of the calling thread. It lives as long as the
+ * thread, so the connection cache of the multi handle is reused by later
+ * requests (i.e. the refreshes of --daemon).
+ */
+class EventLoop {
+  public:
+    struct Response {
+        CURLcode        code = CURLE_OK;
+        long            status = 0;         // HTTP status
+        std::string     body;
+    };
+
+  private:
+    struct Request {
+        CURL                    *easy = nullptr;
+        const std::atomic<bool> *cancel = nullptr;
+        Response                response;
+        bool                    done = false;
+        std::coroutine_handle<> waiter;
+    };
+
+  public:
+    /*
+     * a running transfer. It is on its way when fetch() returns, co_await yields
+     * the Response once it has ended. Destroying an unfinished Transfer
+     * aborts it.
+     */
+    class Transfer {
+      public:
+        Transfer(EventLoop& loop, std::unique_ptr<Request> request) : m_loop(&loop), m_request(std::move(request)) {}
+        Transfer(Transfer&&) = default;
+        Transfer& operator=(Transfer&&) = default;
+        ~Transfer() { if(m_request && !m_request->done) m_loop->abort(*m_request); }
+
+        bool        await_ready() const noexcept { return m_request->done; }
+        void        await_suspend(std::coroutine_handle<> h) noexcept { m_request->waiter = h; }
+        Response    await_resume() { return std::move(m_request->response); }
+
+      private:
+        EventLoop                   *m_loop;
+        std::unique_ptr<Request>    m_request;
+    };
+
+    struct Yield {
+        EventLoop&  loop;
+        bool        await_ready() const noexcept { return false; }
+        void        await_suspend(std::coroutine_handle<> h) { loop.m_ready.push_back(h); }
+        void        await_resume() noexcept {}
+    };
+
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    static EventLoop&   current();
+
+    Transfer    fetch(const std::string& url, const std::atomic<bool> *cancel = nullptr);
+    Yield       yield() { return Yield{*this}; }
+    void        spawn(Task<void> task);
+    void        run();
+
+    /**
+     * run task and everything spawned so far to completion. Must not be
+     * called from a coroutine running on this loop.
+     */
+    template<typename T>
+    T run(Task<T> task)
+    {
+        T result{};
+        this->spawn(EventLoop::store(std::move(task), result));
+        this->run();
+        return result;
+    }
+
+    static constexpr int    poll_timeout = 250;         // ms, also the cadence of the cancel checks
+    static constexpr long   connect_timeout = 10;       // seconds
+    static constexpr long   transfer_timeout = 60;      // seconds
+
+  private:
+    template<typename T>
+    static Task<void> store(Task<T> task, T& result) { result = co_await task; }
+
+    void    abort(Request& request);
+    void    checkCancelled();
+    void    finish(CURL *easy, CURLcode code);
+    CURL    *acquire();
+    void    release(CURL *easy);
+
+    CURLM                               *m_multi = nullptr;
+    std::vector<CURL *>                 m_idle;             // easy handles for reuse
+    std::deque<std::coroutine_handle<>> m_ready;
+    std::vector<Task<void>>             m_tasks;
+    std::vector<Request *>              m_active;           // transfers in flight
+};
+
+#endif //FETCHWEATHER_SRC_EVENTLOOP_H_
@@ -24,96 +24,104 @@
 
 #include "FetchWeatherApp.h"
 #include "options.h"
-#include "DataHandler_ImplOWM.h"
-#include "DataHandler_ImplClimaCell.h"
+#include "Startup.h"
 
-void FetchWeatherApp::run()
+FetchWeatherApp::~FetchWeatherApp()
 {
-    bool    extended_checks_failed = false;
-    char    msg[256];
-    int     runresult = 0;
-
-    loguru::g_stderr_verbosity = loguru::Verbosity_OFF;
-    loguru::init(this->m_argc, this->m_argv);
-    ProgramOptions &opt = ProgramOptions::getInstance();
-
-    const CFG& cfg = opt.getConfig();
-
-    auto result = opt.parse(this->m_argc, this->m_argv);
-    LOG_F(INFO, "main(): The result from ProgramOptions::parse() was: %d", result);
-    // catch the help
-    if (0 == result) {
-        exit(0);
-        //this->m_app->exit(result);
+    if(this->m_worker) {
+        this->m_handler->cancel();
+        this->m_worker->quit();
+        this->m_worker->wait();
+        delete this->m_workerContext;
     }
+}
 
-    if (1 == result) {
-        // --version or -V parameter was given. Print version information and exit.
-        opt.print_version();
-        exit(0);
-        //this->m_app->exit(0);
-    }
+void FetchWeatherApp::run()
+{
+    int     rc = 0;
 
-    if(cfg.debug) {
-        opt.dumpOptions();
-    }
+    Startup::init(this->m_argc, this->m_argv);
+    const CFG& cfg = ProgramOptions::getInstance().getConfig();
 
-    /* more sanity checks */
+    if(Startup::dispatch(cfg, rc)) {
+        this->m_app->exit(rc);
+        return;
+    }
 
-    if(cfg.offline && cfg.skipcache) {
-        /* ignoring both online mode and the cache does not make sense */
-        printf("The options --offline and --skipcache are mutually exclusive\n"
-               "and cannot be used together.");
-        LOG_F(INFO, "main(): The options --offline and --skipcache cannot be used together");
-        this->m_app->exit(-1);
+    if(!cfg.daemon) {
+        this->m_app->exit(Startup::runOnce(cfg));
+        return;
     }
-    if(cfg.silent && cfg.output_file.length() == 0) {
-        /* --silent without a filename for dumping the output does not make sense
-         * either
-         */
-        printf("The option --silent requires a filename specified with --output.");
-        LOG_F(INFO, "main(): --silent option was specified without using --output");
+
+    this->m_handler = DataHandler::create(cfg);
+    if(!this->m_handler) {
+        LOG_F(INFO, "No valid Provider selected. exiting.");
         this->m_app->exit(-1);
+        return;
     }
 
-    if(cfg.apikey.length() == 0) {
-        LOG_F(INFO, "main(): Api KEY missing. Aborting.");
-        extended_checks_failed = true;
-        printf("\nThe API Key is missing. You must specify it with --apikey=your_key.\n");
+    if(cfg.serve) {
+        this->m_server = std::make_unique<SnapshotServer>(this->m_handler.get());
+        if(!this->m_server->listen(cfg.socketPath)) {
+            printf("Cannot listen on the --serve socket, see the log for details.\n");
+            this->m_app->exit(-1);
+            return;
+        }
     }
 
-    if(cfg.location.length() == 0 && cfg.lat.length() == 0 && cfg.lon.length() == 0) {
-        LOG_F(INFO, "main(): Location is missing. Aborting.");
-        extended_checks_failed = true;
-        printf("No location given. Option --loc=LOCATION is mandatory, where LOCATION\n"
-               "is either in LAT,LON form or a location ID created on your ClimaCell dashboard.\n");
+    this->m_worker = new QThread(this);
+    this->m_workerContext = new QObject;
+    this->m_workerContext->moveToThread(this->m_worker);
+    this->m_worker->start();
 
-    }
+    LOG_F(INFO, "main(): daemon mode, refreshing every %d s (+/- %d s)", cfg.interval, cfg.jitter);
+    this->cycle();
+}
 
-    if(extended_checks_failed) {
-        this->m_app->exit(-1);
-    }
+/**
+ * one refresh in --daemon mode: fetch, write all outputs, record the
+ * snapshot, hand it to the --serve socket and schedule the next cycle.
+ * The handler (and with it the history database and compiled templates),
+ * the curl handle and the parsed options are reused by all cycles.
+ *
+ * The refresh runs on m_worker, so the --serve socket keeps answering
+ * from its cached responses meanwhile. The handler belongs to the worker
+ * until refreshed() is called back on this thread.
+ */
+void FetchWeatherApp::cycle()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    if(this->m_server)
+        this->m_server->suspend();
+    QMetaObject::invokeMethod(this->m_workerContext, [this, start]() {
+        int rc = this->m_handler->run();
+        this->m_handler->writeToDB();
+        QMetaObject::invokeMethod(this, [this, rc, start]() { this->refreshed(rc, start); }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+}
 
-    switch(cfg.apiProvider) {
-        case ProgramOptions::API_CLIMACELL: {
-            DataHandler_ImplClimaCell dh;
-            runresult = dh.run();
-            break;
-        }
-        case ProgramOptions::API_OWM: {
-            DataHandler_ImplOWM dh;
-            runresult = dh.run();
-            break;
-        }
-        default:
-            LOG_F(INFO, "No valid Provider selected. exiting.");
-            runresult = -1;
-            break;
-    }
-    //QString foo("Affen");
-    //emit testsignal(&foo);
+/**
+ * a refresh has finished, publish it and schedule the next cycle. It is
+ * due interval +/- jitter seconds after the start of this one, or
+ * retry_interval seconds after a failed one.
+ */
+void FetchWeatherApp::refreshed(int rc, std::chrono::steady_clock::time_point start)
+{
+    const CFG& cfg = ProgramOptions::getInstance().getConfig();
+
+    if(this->m_server)
+        this->m_server->publish(rc == 0);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::uniform_int_distribution<long> jitter(-1000L * cfg.jitter, 1000L * cfg.jitter);
+    long delay = 1000L * (rc == 0 ? cfg.interval : std::min(cfg.interval, FetchWeatherApp::retry_interval)) +
+                 jitter(this->m_random) - elapsed.count();
+    delay = std::max(delay, 1000L);
 
-    this->m_app->exit(cfg.debug ? -1 : runresult);
+    LOG_F(INFO, "FetchWeatherApp::refreshed(): refresh %s after %ld ms, next in %.1f s",
+          rc == 0 ? "done" : "failed", static_cast<long>(elapsed.count()), delay / 1000.0);
+    QTimer::singleShot(static_cast<int>(delay), this, &FetchWeatherApp::cycle);
 }
 
 void FetchWeatherApp::testSlot(QString* msg)
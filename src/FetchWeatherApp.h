@@ -26,6 +26,10 @@
 #define FETCHWEATHER_SRC_FETCHWEATHERAPP_H_
 
 #include "pch.h"
+#include <random>
+#include <QtCore>
+#include "DataHandler.h"
+#include "SnapshotServer.h"
 
 Q_DECLARE_METATYPE(std::string)
 
@@ -43,9 +47,11 @@ class FetchWeatherApp : public QObject {
         QObject::connect(this, &FetchWeatherApp::testsignal, this, &FetchWeatherApp::testSlot, Qt::QueuedConnection);
         QObject::connect(this, &FetchWeatherApp::testsignal, this, &FetchWeatherApp::testSlot1);
     }
+    ~FetchWeatherApp();
 
   public slots:
     void run();
+    void cycle();
 
   signals:
     void finished(int rc);
@@ -55,6 +61,14 @@ class FetchWeatherApp : public QObject {
     int                 m_argc;
     char**              m_argv;
     QCoreApplication*   m_app;
+    std::unique_ptr<DataHandler>    m_handler;      // kept between cycles in --daemon mode
+    std::unique_ptr<SnapshotServer> m_server;       // --serve
+    std::mt19937        m_random{std::random_device{}()};
+    QThread             *m_worker = nullptr;        // runs the refreshes in --daemon mode, see cycle()
+    QObject             *m_workerContext = nullptr; // lives in m_worker, refreshes are queued to it
+
+    static constexpr int    retry_interval = 60;    // seconds until the next attempt after a failed cycle
+    void                refreshed(int rc, std::chrono::steady_clock::time_point start);
     // normal methods can be slots in Qt 5
     void                testSlot(QString* msg);
     void                testSlot1(QString* msg);
@@ -22,46 +22,132 @@
  * SOFTWARE.
  */
 
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "FileDumper.h"
+#include "OutputFormat.h"
+#include "OutputTemplate.h"
 
 FileDumper::FileDumper(DataHandler* h) :
     m_dataPoint(h->getDataPoint()),
     m_Handler(h),
-    m_Options(ProgramOptions::getInstance())
+    m_config(h->config())
 { }
 
+/**
+ * write the output to the file given with --output.
+ */
 void FileDumper::dump()
 {
-    const CFG& cfg = m_Options.getConfig();
-    bool  fPathValid = true;
+    const CFG& cfg = this->m_config;
+
+    this->dump(cfg.output_file, cfg.units, m_Handler->layout(cfg.templateFile), cfg.format);
+}
+
+/**
+ * write the output rendered with the given units to a file in the data
+ * directory.
+ *
+ * The output is rendered into memory first. If the file already has this
+ * content, it is left alone (no write, no inotify event for conky).
+ * Otherwise the output goes into a temporary file in the same directory
+ * which is renamed over the old one, so readers never see a partially
+ * written file.
+ *
+ * @param file          - file name, relative to the data directory
+ * @param units         - the unit profile to render in
+ * @param layout        - the output template
+ * @param format        - the output format, layout is used for TEXT only
+ * @return              - false if the file could not be written.
+ */
+bool FileDumper::dump(const std::string& file, const UnitProfile& units, const OutputTemplate& layout,
+                      OutputFormat::Kind format)
+{
+    const CFG& cfg = this->m_config;
 
     fs::path filename;
-    fs::path outfile(cfg.output_file);
+    fs::path outfile(file);
     if(outfile.is_absolute()) {
-        LOG_F(INFO, "DataHandler::run(): The output file path is an absolute path."
+        LOG_F(INFO, "FileDumper::dump(): The output file path is an absolute path."
                     " This is not allowed.");
-        fPathValid = false;
-    } else {
-        filename.assign(cfg.data_dir_path);
-        filename.append(cfg.output_file);
+        return false;
     }
+    filename.assign(cfg.data_dir_path);
+    filename.append(file);
     if(fs::is_directory(filename)) {
-        LOG_F(INFO, "DataHandler::run(): The output file path is an existing directory."
+        LOG_F(INFO, "FileDumper::dump(): The output file path is an existing directory."
                     " This is not allowed.");
-        fPathValid = false;
-    } else if (fPathValid){
-        FILE *f = fopen(filename.c_str(), "w");
-        if(NULL != f) {
-            m_Handler->doOutput(f);
-            fclose(f);
-            LOG_F(INFO, "DataHandler::run(): Dumping to: %s,", filename.c_str());
-        } else {
-            LOG_F(INFO, "DataHandler::run(): Unable to open the specified dump file (%s)."
-                        " No data was written.",
-                  filename.c_str());
-        }
-    } else {
-        LOG_F(INFO, "DataHandler::run(): The output file was not properly specified."
-                    " No data dump was written.");
+        return false;
+    }
+
+    OutputFormat::render(format, *m_Handler, units, layout, this->m_buffer);
+    if(FileDumper::sameContent(filename.string(), this->m_buffer)) {
+        LOG_F(INFO, "FileDumper::dump(): Output unchanged, keeping %s", filename.c_str());
+        return true;
+    }
+    if(!FileDumper::replace(filename.string(), this->m_buffer)) {
+        LOG_F(INFO, "FileDumper::dump(): Unable to write the specified dump file (%s): %s."
+                    " No data was written.", filename.c_str(), strerror(errno));
+        return false;
+    }
+    LOG_F(INFO, "FileDumper::dump(): Dumping to: %s,", filename.c_str());
+    return true;
+}
+
+/**
+ * compare a file byte by byte with content. Output files are small, they
+ * are read in one go.
+ */
+bool FileDumper::sameContent(const std::string& path, const std::string& content)
+{
+    struct stat st;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0)
+        return false;
+    bool same = false;
+    if(fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == content.size()) {
+        std::string current(content.size(), '\0');
+        same = ::read(fd, current.data(), current.size()) == static_cast<ssize_t>(current.size()) &&
+               memcmp(current.data(), content.data(), current.size()) == 0;
+    }
+    ::close(fd);
+    return same;
+}
+
+/**
+ * atomically replace path with content: write a temporary file next to it,
+ * then rename() it into place. The new file gets the default permissions
+ * (0666 minus umask), like the fopen() used before.
+ */
+bool FileDumper::replace(const std::string& path, const std::string& content)
+{
+    std::string tmp = path + ".XXXXXX";
+    int fd = mkstemp(tmp.data());
+
+    if(fd < 0)
+        return false;
+    mode_t mask = umask(0);
+    umask(mask);
+    bool ok = fchmod(fd, 0666 & ~mask) == 0;
+    const char *p = content.data();
+    size_t left = content.size();
+    while(ok && left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if(n < 0 && errno == EINTR)
+            continue;
+        ok = n > 0;
+        p += n;
+        left -= n;
+    }
+    ok = (::close(fd) == 0) && ok;
+    if(!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        int err = errno;
+        unlink(tmp.c_str());
+        errno = err;
+        return false;
     }
+    return true;
 }
@@ -33,11 +33,17 @@ class FileDumper {
     FileDumper(DataHandler* p);
 
     void        dump();
+    bool        dump(const std::string& file, const UnitProfile& units, const OutputTemplate& layout,
+                     OutputFormat::Kind format = OutputFormat::TEXT);
+
+    static bool sameContent(const std::string& path, const std::string& content);
+    static bool replace(const std::string& path, const std::string& content);
 
   private:
     const DataPoint&    m_dataPoint;
-    ProgramOptions&     m_Options;
+    const CFG&          m_config;
     DataHandler*        m_Handler;
+    std::string         m_buffer;       // rendered output, reused for all files
 };
 
 #endif //FETCHWEATHER_SRC_FILEDUMPER_H_
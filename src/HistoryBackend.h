@@ -0,0 +1,110 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FETCHWEATHER_SRC_HISTORYBACKEND_H_
+#define FETCHWEATHER_SRC_HISTORYBACKEND_H_
+
+#include "pch.h"
+#include "DataHandler.h"
+
+/*
+ * one row of the history table with a fixed size and layout. This is what
+ * the backends exchange and what the time series log stores on disk, so
+ * the layout must not change without bumping TimeSeriesLog::version.
+ */
+struct HistoryRecord {
+    int64_t         timestamp;
+    uint64_t        fingerprint;
+    int64_t         sunrise, sunset;
+    double          temperature, feelslike, dewpoint, humidity, pressure, windspeed, windgust,
+                    visibility, precip_probability, precip_intensity, cloudCover, cloudBase,
+                    cloudCeiling, uvindex, tempMin, tempMax;
+    int32_t         windbearing, moonPhase;
+    int32_t         location_id, provider_id;
+    char            icon;
+    char            precip_type[15];
+    char            summary[48];
+    char            _reserved[16];
+
+    static HistoryRecord fromDataPoint(const DataPoint& d);
+};
+static_assert(sizeof(HistoryRecord) == 256, "HistoryRecord must stay 256 bytes");
+
+/*
+ * the history columns which carry a unit. They are recorded metric, older
+ * versions recorded them in the units configured at the time (see
+ * HistoryDB::convertLegacy()).
+ */
+struct UnitColumn {
+    const char              *name;
+    double HistoryRecord::*member;
+    UnitProfile::Quantity   quantity;
+};
+
+static constexpr UnitColumn unit_columns[] = {
+    {"temperature", &HistoryRecord::temperature, UnitProfile::TEMPERATURE},
+    {"feelslike", &HistoryRecord::feelslike, UnitProfile::TEMPERATURE},
+    {"dewpoint", &HistoryRecord::dewpoint, UnitProfile::TEMPERATURE},
+    {"tempMin", &HistoryRecord::tempMin, UnitProfile::TEMPERATURE},
+    {"tempMax", &HistoryRecord::tempMax, UnitProfile::TEMPERATURE},
+    {"windspeed", &HistoryRecord::windspeed, UnitProfile::SPEED},
+    {"windgust", &HistoryRecord::windgust, UnitProfile::SPEED},
+    {"visibility", &HistoryRecord::visibility, UnitProfile::VISIBILITY},
+    {"pressure", &HistoryRecord::pressure, UnitProfile::PRESSURE} };
+
+/*
+ * storage for weather history. HistoryDB (SQLite) is the default,
+ * TimeSeriesLog is a memory mapped log for high-frequency recording that
+ * bulk loads into the database periodically.
+ */
+class HistoryBackend {
+  public:
+    virtual ~HistoryBackend() = default;
+
+    /*
+     * retention in days for each tier, 0 keeps the data forever.
+     */
+    struct RetentionPolicy {
+        int     raw_days = 14;
+        int     hourly_days = 365;
+        int     daily_days = 0;
+        bool    archive = true;     // move expired raw rows into the cold archive instead of dropping them
+    };
+
+    virtual bool    open() = 0;
+    virtual bool    isDuplicate(const DataPoint& d) = 0;
+    virtual bool    insert(const DataPoint& d, const std::vector<ForecastPoint>& timeline) = 0;
+    /*
+     * call fn for every record of the default location and provider with
+     * from <= timestamp <= to in ascending time order. fn returns false
+     * to stop the scan.
+     */
+    virtual bool    scan(time_t from, time_t to, const std::function<bool(const HistoryRecord&)>& fn) = 0;
+    /*
+     * periodic work (retention, bulk loading). Cheap unless due or forced.
+     */
+    virtual bool    maintenance(const RetentionPolicy& policy, bool force = false) = 0;
+};
+
+#endif //FETCHWEATHER_SRC_HISTORYBACKEND_H_
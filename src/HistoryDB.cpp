@@ -0,0 +1,1478 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Database recording of weather snapshots and the rollup tables built from them.
+ */
+
+#include <algorithm>
+#include <limits>
+#include "utils.h"
+#include "HistoryDB.h"
+
+HistoryDB::HistoryDB(const std::string& path, const std::string& location, const std::string& provider) :
+    m_path(path), m_location(location), m_provider(provider)
+{
+}
+
+/**
+ * open the database, create missing tables and compile all statements.
+ *
+ * @return      - true if the database is ready for inserts.
+ */
+bool HistoryDB::open()
+{
+    if(this->m_db)
+        return true;
+
+    LOG_F(INFO, "HistoryDB::open(): attempting to open: %s", this->m_path.c_str());
+    auto rc = sqlite3_open(this->m_path.c_str(), &this->m_db);
+    if(rc) {
+        LOG_F(INFO, "Unable to open the SQLite Database at %s. The error message was %s.",
+              this->m_path.c_str(), sqlite3_errmsg(this->m_db));
+        this->close();
+        return false;
+    }
+    LOG_F(INFO, "Database openend successfully");
+    // other processes or --batch workers may be writing at the same time
+    sqlite3_busy_timeout(this->m_db, HistoryDB::busy_timeout);
+
+    /*
+     * auto_vacuum can only be switched on before the first table is created,
+     * compact() converts existing databases.
+     */
+    this->exec("PRAGMA auto_vacuum = INCREMENTAL");
+
+    if(!this->createSchema() || !this->prepareStatements()) {
+        this->close();
+        return false;
+    }
+    if(this->hasLegacy()) {
+        LOG_F(INFO, "HistoryDB::open(): %s holds history recorded by an older version in unknown units. It is left "
+              "out of scans, rollups and exports until converted with --legacyUnits", this->m_path.c_str());
+    }
+    return true;
+}
+
+void HistoryDB::close()
+{
+    sqlite3_finalize(this->m_insert);
+    sqlite3_finalize(this->m_insertForecast);
+    sqlite3_finalize(this->m_getLast);
+    sqlite3_finalize(this->m_setLast);
+    sqlite3_finalize(this->m_scan);
+    sqlite3_finalize(this->m_getWatermark);
+    sqlite3_finalize(this->m_setWatermark);
+    for(auto& stmt : this->m_rollup) {
+        sqlite3_finalize(stmt);
+        stmt = nullptr;
+    }
+    this->m_insert = this->m_insertForecast = this->m_getLast = this->m_setLast = this->m_scan = this->m_getWatermark = this->m_setWatermark = nullptr;
+    if(this->m_db) {
+        sqlite3_close(this->m_db);
+        this->m_db = nullptr;
+    }
+    this->m_archive.reset();
+}
+
+bool HistoryDB::exec(const char *sql)
+{
+    char *err = 0;
+
+    // no callback, statements like PRAGMA incremental_vacuum return rows nobody wants on stdout
+    if(sqlite3_exec(this->m_db, sql, 0, 0, &err) != SQLITE_OK) {
+        LOG_F(INFO, "HistoryDB::exec(): DB error: %s", err);
+        sqlite3_free(err);
+        return false;
+    }
+    return true;
+}
+
+bool HistoryDB::createSchema()
+{
+    auto sql = R"(CREATE TABLE IF NOT EXISTS locations
+      (
+          id INTEGER PRIMARY KEY,
+          name TEXT NOT NULL UNIQUE
+      );
+      CREATE TABLE IF NOT EXISTS providers
+      (
+          id INTEGER PRIMARY KEY,
+          code TEXT NOT NULL UNIQUE
+      );
+      CREATE TABLE IF NOT EXISTS history
+      (
+          id INTEGER PRIMARY KEY AUTOINCREMENT,
+          timestamp INTEGER DEFAULT 0,
+          summary TEXT NOT NULL DEFAULT 'unknown',
+          icon TEXT NOT NULL DEFAULT 'unknown',
+          temperature REAL NOT NULL DEFAULT 0.0,
+          feelslike REAL NOT NULL DEFAULT 0.0,
+          dewpoint REAL DEFAULT 0.0,
+          windbearing INTEGER DEFAULT 0,
+          windspeed REAL DEFAULT 0.0,
+          windgust REAL DEFAULT 0.0,
+          humidity REAL DEFAULT 0.0,
+          visibility REAL DEFAULT 0.0,
+          pressure REAL DEFAULT 1013.0,
+          precip_probability REAL DEFAULT 0.0,
+          precip_intensity REAL DEFAULT 0.0,
+          precip_type TEXT DEFAULT 'none',
+          cloudCover REAL DEFAULT 0.0,
+          cloudBase REAL DEFAULT 0.0,
+          cloudCeiling REAL DEFAULT 0.0,
+          moonPhase INTEGER DEFAULT 0,
+          uvindex INTEGER DEFAULT 0,
+          sunrise INTEGER DEFAULT 0,
+          sunset INTEGER DEFAULT 0,
+          tempMax REAL DEFAULT 0.0,
+          tempMin REAL DEFAULT 0.0,
+          location_id INTEGER NOT NULL REFERENCES locations(id),
+          provider_id INTEGER NOT NULL REFERENCES providers(id)
+      );
+      CREATE TABLE IF NOT EXISTS forecast
+      (
+          location_id INTEGER NOT NULL,
+          provider_id INTEGER NOT NULL,
+          issued INTEGER NOT NULL,
+          resolution INTEGER NOT NULL,
+          valid INTEGER NOT NULL,
+          code INTEGER,
+          temperature REAL,
+          tempMin REAL,
+          tempMax REAL,
+          precip_probability REAL,
+          precip_intensity REAL,
+          windspeed REAL,
+          windbearing INTEGER,
+          humidity REAL,
+          pressure REAL,
+          cloudCover REAL,
+          PRIMARY KEY(location_id, provider_id, issued, resolution, valid)
+      ) WITHOUT ROWID;
+      CREATE TABLE IF NOT EXISTS last_observation
+      (
+          location_id INTEGER NOT NULL,
+          provider_id INTEGER NOT NULL,
+          observed INTEGER NOT NULL,
+          fingerprint INTEGER NOT NULL,
+          PRIMARY KEY(location_id, provider_id)
+      ) WITHOUT ROWID;
+      CREATE TABLE IF NOT EXISTS meta
+      (
+          key TEXT PRIMARY KEY,
+          value INTEGER DEFAULT 0
+      );
+      CREATE TABLE IF NOT EXISTS provider_race
+      (
+          location_id INTEGER NOT NULL,
+          provider_id INTEGER NOT NULL,
+          races INTEGER NOT NULL DEFAULT 0,
+          wins INTEGER NOT NULL DEFAULT 0,
+          finished INTEGER NOT NULL DEFAULT 0,
+          failures INTEGER NOT NULL DEFAULT 0,
+          latency_sum REAL NOT NULL DEFAULT 0.0,
+          latency_max REAL NOT NULL DEFAULT 0.0,
+          last_race INTEGER NOT NULL DEFAULT 0,
+          PRIMARY KEY(location_id, provider_id)
+      ) WITHOUT ROWID;
+      CREATE TABLE IF NOT EXISTS provider_health
+      (
+          provider_id INTEGER PRIMARY KEY,
+          latency REAL NOT NULL DEFAULT 0.0,
+          errors REAL NOT NULL DEFAULT 0.0,
+          samples INTEGER NOT NULL DEFAULT 0,
+          failures INTEGER NOT NULL DEFAULT 0,
+          open_until INTEGER NOT NULL DEFAULT 0,
+          cooldown INTEGER NOT NULL DEFAULT 0,
+          updated INTEGER NOT NULL DEFAULT 0
+      );
+    )";
+
+    // an up to date database is opened without taking the write lock
+    int version = this->userVersion();
+    if(version >= HistoryDB::schema_version) {
+        this->m_locationId = this->locationId(this->m_location);
+        this->m_providerId = this->providerId(this->m_provider);
+        return this->m_locationId != 0 && this->m_providerId != 0;
+    }
+    if(!this->exec("BEGIN IMMEDIATE"))
+        return false;
+    if(!this->exec(sql)) {
+        LOG_F(INFO, "HistoryDB::createSchema(): unable to create the history table");
+        this->exec("ROLLBACK");
+        return false;
+    }
+    this->m_locationId = this->locationId(this->m_location);
+    this->m_providerId = this->providerId(this->m_provider);
+    if(this->m_locationId == 0 || this->m_providerId == 0 || !this->migrateSchema()) {
+        this->exec("ROLLBACK");
+        return false;
+    }
+
+    for(const auto& tier : HistoryDB::rollup_tiers) {
+        std::string rollup("CREATE TABLE IF NOT EXISTS ");
+        rollup.append(tier.table).append("(location_id INTEGER NOT NULL, provider_id INTEGER NOT NULL,"
+                                         " bucket INTEGER NOT NULL, count INTEGER NOT NULL DEFAULT 0,"
+                                         " last_ts INTEGER NOT NULL DEFAULT 0");
+        for(const auto metric : HistoryDB::rollup_metrics) {
+            rollup.append(", ").append(metric).append("_min REAL");
+            rollup.append(", ").append(metric).append("_max REAL");
+            rollup.append(", ").append(metric).append("_sum REAL");
+            rollup.append(", ").append(metric).append("_last REAL");
+        }
+        rollup.append(", PRIMARY KEY(location_id, provider_id, bucket)) WITHOUT ROWID");
+        if(!this->exec(rollup.c_str())) {
+            LOG_F(INFO, "HistoryDB::createSchema(): unable to create the rollup table %s", tier.table);
+            this->exec("ROLLBACK");
+            return false;
+        }
+        // copy buckets from a table renamed by migrateSchema()
+        std::string legacy(tier.table);
+        legacy.append("_legacy");
+        if(this->hasColumn(legacy.c_str(), "bucket")) {
+            std::string copy("INSERT INTO ");
+            copy.append(tier.table).append(" SELECT ").append(std::to_string(this->m_locationId)).append(", ")
+                .append(std::to_string(this->m_providerId)).append(", * FROM ").append(legacy)
+                .append("; DROP TABLE ").append(legacy);
+            if(!this->exec(copy.c_str())) {
+                this->exec("ROLLBACK");
+                return false;
+            }
+        }
+    }
+    if(!this->markLegacyRows(version)) {
+        this->exec("ROLLBACK");
+        return false;
+    }
+    this->exec("CREATE INDEX IF NOT EXISTS history_source_time ON history(location_id, provider_id, timestamp)");
+    this->exec(("PRAGMA user_version = " + std::to_string(HistoryDB::schema_version)).c_str());
+    return this->exec("COMMIT");
+}
+
+/**
+ * @return      - PRAGMA user_version, 0 for a new database or on error.
+ */
+int HistoryDB::userVersion()
+{
+    sqlite3_stmt    *stmt = 0;
+    int             version = 0;
+
+    if(sqlite3_prepare_v2(this->m_db, "PRAGMA user_version", -1, &stmt, 0) == SQLITE_OK
+       && sqlite3_step(stmt) == SQLITE_ROW)
+        version = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+bool HistoryDB::hasColumn(const char *table, const char *column)
+{
+    sqlite3_stmt    *stmt = 0;
+    bool            found = false;
+
+    if(sqlite3_prepare_v2(this->m_db, "SELECT 1 FROM pragma_table_info(?) WHERE name = ?",
+                          -1, &stmt, 0) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, column, -1, SQLITE_STATIC);
+        found = sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+/**
+ * upgrade databases written by older versions. Existing records are
+ * assigned to the default location and provider. Adding the history columns
+ * with a default value does not rewrite the table, the rollup tables are
+ * small enough to be copied into their new layout.
+ *
+ * @return      - false if the migration failed (the caller rolls back).
+ */
+bool HistoryDB::migrateSchema()
+{
+    const std::string location_id = std::to_string(this->m_locationId);
+    const std::string provider_id = std::to_string(this->m_providerId);
+
+    if(!this->hasColumn("history", "location_id")) {
+        LOG_F(INFO, "HistoryDB::migrateSchema(): adding location and provider to history (%s, %s)",
+              this->m_location.c_str(), this->m_provider.c_str());
+        std::string sql("ALTER TABLE history ADD COLUMN location_id INTEGER NOT NULL DEFAULT ");
+        sql.append(location_id).append("; ALTER TABLE history ADD COLUMN provider_id INTEGER NOT NULL DEFAULT ")
+           .append(provider_id);
+        if(!this->exec(sql.c_str()))
+            return false;
+    }
+    for(const auto& tier : HistoryDB::rollup_tiers) {
+        if(!this->hasColumn(tier.table, "bucket") || this->hasColumn(tier.table, "location_id"))
+            continue;
+        LOG_F(INFO, "HistoryDB::migrateSchema(): moving %s to the new layout", tier.table);
+        std::string legacy(tier.table);
+        legacy.append("_legacy");
+        std::string sql("ALTER TABLE ");
+        sql.append(tier.table).append(" RENAME TO ").append(legacy);
+        if(!this->exec(sql.c_str()))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * schema 4: the history is metric. Older versions recorded temperatures,
+ * speeds, visibility and pressure in the units configured at the time.
+ * Remember where their rows end (last id, archive size) and move their
+ * rollup buckets aside into <tier>_unconverted, so nothing new is mixed
+ * with them. convertLegacy() takes it from there.
+ *
+ * @param version   - user_version before the upgrade
+ * @return          - false on database errors (the caller rolls back).
+ */
+bool HistoryDB::markLegacyRows(int version)
+{
+    sqlite3_stmt    *stmt = 0;
+    sqlite3_int64   last_id = 0;
+
+    if(version >= 4)
+        return true;
+    if(sqlite3_prepare_v2(this->m_db, "SELECT ifnull(max(id), 0) FROM history", -1, &stmt, 0) == SQLITE_OK
+       && sqlite3_step(stmt) == SQLITE_ROW)
+        last_id = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    sqlite3_int64 archived = this->getMeta("archive_size");
+    if(last_id == 0 && archived == 0)
+        return true;
+
+    LOG_F(INFO, "HistoryDB::markLegacyRows(): rows up to id %lld and %lld archived bytes are in unknown units",
+          static_cast<long long>(last_id), static_cast<long long>(archived));
+    for(const auto& tier : HistoryDB::rollup_tiers) {
+        std::string sql("CREATE TABLE ");
+        sql.append(tier.table).append("_unconverted AS SELECT * FROM ").append(tier.table)
+           .append("; DELETE FROM ").append(tier.table);
+        if(!this->exec(sql.c_str()))
+            return false;
+    }
+    sqlite3_int64 watermark = this->getMeta("rollup_watermark");
+    return this->setMeta("legacy_id", last_id) && this->setMeta("legacy_watermark", watermark)
+           && this->setMeta("legacy_archive_size", archived)
+           && this->setMeta("rollup_watermark", std::max(watermark, last_id));
+}
+
+/**
+ * @return      - true if there are rows in unknown units, see convertLegacy().
+ */
+bool HistoryDB::hasLegacy()
+{
+    return this->getMeta("legacy_units") == 0
+           && (this->getMeta("legacy_id") != 0 || this->getMeta("legacy_archive_size") != 0);
+}
+
+/**
+ * convert the rows recorded by older versions to metric, once. Raw rows and
+ * the rollup buckets moved aside by markLegacyRows() are rewritten, raw
+ * rows which never made it into the rollups are folded in. Archived rows
+ * are converted when they are read, the units are kept for that.
+ *
+ * @param units     - the units the older version was configured with
+ * @param converted - receives the number of raw rows converted
+ * @return          - false on database errors, nothing is changed then.
+ */
+bool HistoryDB::convertLegacy(const UnitProfile& units, sqlite3_int64& converted)
+{
+    converted = 0;
+    if(!this->m_db)
+        return false;
+    if(!this->exec("BEGIN IMMEDIATE"))
+        return false;
+    // checked inside the transaction, another process may just have converted
+    if(!this->hasLegacy()) {
+        this->exec("COMMIT");
+        return true;
+    }
+
+    sqlite3_int64 last_id = this->getMeta("legacy_id");
+    sqlite3_int64 watermark = this->getMeta("legacy_watermark");
+
+    // column = (column - offset * times) / scale, sums carry the offset once per value
+    auto to_metric = [&units](const UnitColumn& column, const std::string& name, const char *times) {
+        const auto& unit = units.unit(column.quantity);
+        char expr[160];
+        snprintf(expr, sizeof(expr), "%s = (%s - %.17g%s) / %.17g", name.c_str(), name.c_str(),
+                 unit.offset, times, unit.scale);
+        return std::string(expr);
+    };
+
+    std::string sql("UPDATE history SET ");
+    for(const auto& column : unit_columns) {
+        sql.append(&column == unit_columns ? "" : ", ").append(to_metric(column, column.name, ""));
+    }
+    sql.append(" WHERE id <= ").append(std::to_string(last_id));
+    bool ok = this->exec(sql.c_str());
+    converted = sqlite3_changes(this->m_db);
+
+    for(size_t i = 0; ok && i < std::size(HistoryDB::rollup_tiers); i++) {
+        const std::string table = std::string(HistoryDB::rollup_tiers[i].table) + "_unconverted";
+        if(!this->hasColumn(table.c_str(), "bucket"))
+            continue;
+        std::string update;
+        for(const auto& column : unit_columns) {
+            const std::string name = column.name;
+            if(std::find(std::begin(HistoryDB::rollup_metrics), std::end(HistoryDB::rollup_metrics), name)
+               == std::end(HistoryDB::rollup_metrics))
+                continue;
+            update.append(update.empty() ? "UPDATE " + table + " SET " : ", ")
+                  .append(to_metric(column, name + "_min", "")).append(", ")
+                  .append(to_metric(column, name + "_max", "")).append(", ")
+                  .append(to_metric(column, name + "_last", "")).append(", ")
+                  .append(to_metric(column, name + "_sum", " * count"));
+        }
+        update.append("; INSERT INTO ").append(HistoryDB::rollup_tiers[i].table).append(" SELECT * FROM ")
+              .append(table).append(" WHERE true ON CONFLICT(location_id, provider_id, bucket) DO UPDATE SET ")
+              .append(this->rollupMergeSQL()).append("; DROP TABLE ").append(table);
+        ok = this->exec(update.c_str());
+    }
+    // raw rows which were not part of the rollups yet
+    for(size_t i = 0; ok && i < std::size(HistoryDB::rollup_tiers); i++) {
+        sqlite3_stmt *stmt = 0;
+        std::string fold = this->buildRollupSQL(HistoryDB::rollup_tiers[i]);
+        ok = sqlite3_prepare_v2(this->m_db, fold.c_str(), -1, &stmt, 0) == SQLITE_OK;
+        if(ok) {
+            sqlite3_bind_int64(stmt, 1, watermark);
+            sqlite3_bind_int64(stmt, 2, last_id);
+            ok = sqlite3_step(stmt) == SQLITE_DONE;
+        }
+        sqlite3_finalize(stmt);
+    }
+    if(!ok || !this->setMeta("legacy_units", units.code()) || !this->setMeta("legacy_id", 0)
+       || !this->exec("COMMIT")) {
+        LOG_F(INFO, "HistoryDB::convertLegacy(): conversion failed: %s", sqlite3_errmsg(this->m_db));
+        this->exec("ROLLBACK");
+        converted = 0;
+        return false;
+    }
+    LOG_F(INFO, "HistoryDB::convertLegacy(): %lld rows converted", static_cast<long long>(converted));
+    return true;
+}
+
+/**
+ * look up the integer key for a location or provider name, creating it
+ * when necessary.
+ *
+ * @return      - the key, 0 on database errors.
+ */
+int HistoryDB::keyFor(const char *table, const std::string& name, std::map<std::string, int>& cache)
+{
+    sqlite3_stmt    *stmt = 0;
+    int             key = 0;
+
+    if(auto it = cache.find(name); it != cache.end())
+        return it->second;
+
+    const char  *column = strcmp(table, "locations") ? "code" : "name";
+    std::string select("SELECT id FROM ");
+    select.append(table).append(" WHERE ").append(column).append(" = ?1");
+    std::string sql("INSERT OR IGNORE INTO ");
+    sql.append(table).append("(").append(column).append(") VALUES(?1); ").append(select);
+
+    bool        ok = true;
+    // look the key up first, the INSERT needs the write lock
+    for(const std::string *query : {&select, &sql}) {
+        const char  *tail = query->c_str();
+        // the INSERT is followed by a SELECT which returns the key
+        while(ok && tail && *tail) {
+            ok = sqlite3_prepare_v2(this->m_db, tail, -1, &stmt, &tail) == SQLITE_OK;
+            if(ok && stmt) {
+                sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
+                if(sqlite3_step(stmt) == SQLITE_ROW) {
+                    key = sqlite3_column_int(stmt, 0);
+                    cache[name] = key;
+                }
+            }
+            sqlite3_finalize(stmt);
+            stmt = 0;
+        }
+        if(key || !ok)
+            break;
+    }
+    if(!ok) {
+        LOG_F(INFO, "HistoryDB::keyFor(): prepare stmt, error: %s", sqlite3_errmsg(this->m_db));
+    }
+    return key;
+}
+
+/**
+ * build the statement that folds all history rows newer than the rollup
+ * watermark (parameter 1) into the buckets of the given tier. New rows are
+ * aggregated per bucket first, so a bulk load costs one upsert per bucket
+ * rather than one per row. The _last values come from the newest row of
+ * each bucket, the last_ts column makes them independent of insertion order.
+ */
+std::string HistoryDB::buildRollupSQL(const RollupTier& tier) const
+{
+    const std::string period = std::to_string(tier.period);
+    std::string columns("location_id, provider_id, bucket, count, last_ts"), values, aggregates;
+
+    values.append("g.location_id, g.provider_id, g.bucket, g.count, g.last_ts");
+    aggregates.append("location_id, provider_id, (timestamp / ").append(period).append(") * ").append(period)
+              .append(" AS bucket, count(*) AS count, max(timestamp) AS last_ts");
+
+    for(const std::string metric : HistoryDB::rollup_metrics) {
+        columns.append(", ").append(metric).append("_min, ").append(metric).append("_max, ")
+               .append(metric).append("_sum, ").append(metric).append("_last");
+        values.append(", g.").append(metric).append("_min, g.").append(metric).append("_max, g.")
+              .append(metric).append("_sum, l.").append(metric);
+        aggregates.append(", min(").append(metric).append(") AS ").append(metric).append("_min")
+                  .append(", max(").append(metric).append(") AS ").append(metric).append("_max")
+                  .append(", sum(").append(metric).append(") AS ").append(metric).append("_sum");
+    }
+
+    /*
+     * NOT INDEXED keeps the planner from walking history_source_time for the
+     * GROUP BY instead of the rowid range. WHERE true keeps the ON of the
+     * join apart from ON CONFLICT.
+     */
+    std::string sql("INSERT INTO ");
+    sql.append(tier.table).append("(").append(columns).append(") SELECT ").append(values)
+       .append(" FROM (SELECT a.*, (SELECT id FROM history WHERE location_id = a.location_id"
+               " AND provider_id = a.provider_id AND timestamp = a.last_ts AND id > ?1 AND id <= ?2"
+               " ORDER BY id DESC LIMIT 1)"
+               " AS last_id FROM (SELECT ").append(aggregates)
+       .append(" FROM history NOT INDEXED WHERE id > ?1 AND id <= ?2 GROUP BY location_id, provider_id, bucket) a) g"
+               " JOIN history l ON l.id = g.last_id"
+               " WHERE true ON CONFLICT(location_id, provider_id, bucket) DO UPDATE SET ")
+       .append(this->rollupMergeSQL());
+    return sql;
+}
+
+/**
+ * the SET clause merging an excluded bucket into an existing one.
+ */
+std::string HistoryDB::rollupMergeSQL() const
+{
+    std::string updates("count = count + excluded.count");
+
+    for(const std::string metric : HistoryDB::rollup_metrics) {
+        updates.append(", ").append(metric).append("_min = min(").append(metric)
+               .append("_min, excluded.").append(metric).append("_min)");
+        updates.append(", ").append(metric).append("_max = max(").append(metric)
+               .append("_max, excluded.").append(metric).append("_max)");
+        updates.append(", ").append(metric).append("_sum = ").append(metric)
+               .append("_sum + excluded.").append(metric).append("_sum");
+        updates.append(", ").append(metric).append("_last = CASE WHEN excluded.last_ts >= last_ts THEN excluded.")
+               .append(metric).append("_last ELSE ").append(metric).append("_last END");
+    }
+    updates.append(", last_ts = max(last_ts, excluded.last_ts)");
+    return updates;
+}
+
+bool HistoryDB::prepareStatements()
+{
+    std::string insert("INSERT INTO history(");
+    insert.append(HistoryDB::history_columns).append(") VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)");
+    std::string scan("SELECT ");
+    scan.append(HistoryDB::history_columns).append(" FROM history WHERE location_id = ? AND provider_id = ? "
+                                                   "AND timestamp BETWEEN ? AND ? AND id > ")
+        .append(HistoryDB::legacy_limit).append(" ORDER BY timestamp");
+
+    auto rc = sqlite3_prepare_v2(this->m_db, insert.c_str(), -1, &this->m_insert, 0);
+    if(rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(this->m_db, scan.c_str(), -1, &this->m_scan, 0);
+    }
+    if(rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(this->m_db,
+                                "INSERT OR REPLACE INTO forecast(location_id, provider_id, issued, resolution, valid,"
+                                "code, temperature, tempMin, tempMax, precip_probability, precip_intensity,"
+                                "windspeed, windbearing, humidity, pressure, cloudCover)"
+                                "VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)", -1, &this->m_insertForecast, 0);
+    }
+    if(rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(this->m_db, "SELECT observed, fingerprint FROM last_observation "
+                                            "WHERE location_id = ? AND provider_id = ?", -1, &this->m_getLast, 0);
+    }
+    if(rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(this->m_db, "INSERT OR REPLACE INTO last_observation(location_id, provider_id,"
+                                            "observed, fingerprint) VALUES(?,?,?,?)", -1, &this->m_setLast, 0);
+    }
+    if(rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(this->m_db, "SELECT value FROM meta WHERE key = 'rollup_watermark'",
+                                -1, &this->m_getWatermark, 0);
+    }
+    if(rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(this->m_db,
+                                "INSERT INTO meta(key, value) VALUES('rollup_watermark', "
+                                "(SELECT ifnull(max(id), 0) FROM history)) "
+                                "ON CONFLICT(key) DO UPDATE SET value = excluded.value",
+                                -1, &this->m_setWatermark, 0);
+    }
+    for(size_t i = 0; rc == SQLITE_OK && i < std::size(HistoryDB::rollup_tiers); i++) {
+        std::string sql = this->buildRollupSQL(HistoryDB::rollup_tiers[i]);
+        rc = sqlite3_prepare_v2(this->m_db, sql.c_str(), -1, &this->m_rollup[i], 0);
+    }
+    if(rc != SQLITE_OK) {
+        LOG_F(INFO, "HistoryDB::prepareStatements(): prepare stmt, error: %s", sqlite3_errmsg(this->m_db));
+        return false;
+    }
+    LOG_F(INFO, "HistoryDB::prepareStatements(): sqlite3_prepare_v2() succeeded. Statements compiled");
+    return true;
+}
+
+/**
+ * fold all history rows above the watermark into the rollup tiers and
+ * advance the watermark. Must be called inside a transaction. On a
+ * database recorded by older versions, the first call aggregates the
+ * complete existing history.
+ *
+ * @return      - true if all tiers were updated.
+ */
+bool HistoryDB::updateRollups()
+{
+    sqlite3_int64 watermark = 0;
+
+    if(sqlite3_step(this->m_getWatermark) == SQLITE_ROW) {
+        watermark = sqlite3_column_int64(this->m_getWatermark, 0);
+    }
+    sqlite3_reset(this->m_getWatermark);
+
+    for(auto stmt : this->m_rollup) {
+        sqlite3_bind_int64(stmt, 1, watermark);
+        sqlite3_bind_int64(stmt, 2, std::numeric_limits<sqlite3_int64>::max());
+        auto rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if(rc != SQLITE_DONE) {
+            LOG_F(INFO, "HistoryDB::updateRollups(): sqlite3_step error: %s", sqlite3_errmsg(this->m_db));
+            return false;
+        }
+    }
+    auto rc = sqlite3_step(this->m_setWatermark);
+    sqlite3_reset(this->m_setWatermark);
+    return rc == SQLITE_DONE;
+}
+
+/**
+ * check whether the snapshot is the same observation as the last one
+ * recorded for this location and provider.
+ *
+ * @return      - true if observation time and fingerprint both match.
+ */
+bool HistoryDB::isDuplicate(const DataPoint& d, int location_id, int provider_id)
+{
+    bool duplicate = false;
+
+    if(!this->m_db)
+        return false;
+    sqlite3_bind_int(this->m_getLast, 1, location_id);
+    sqlite3_bind_int(this->m_getLast, 2, provider_id);
+    if(sqlite3_step(this->m_getLast) == SQLITE_ROW) {
+        duplicate = sqlite3_column_int64(this->m_getLast, 0) == d.timeRecorded &&
+                    static_cast<uint64_t>(sqlite3_column_int64(this->m_getLast, 1)) == d.fingerprint;
+    }
+    sqlite3_reset(this->m_getLast);
+    return duplicate;
+}
+
+/**
+ * record the forecast timeline, one execution of the prepared statement per
+ * step. Must be called inside a transaction.
+ */
+bool HistoryDB::insertForecast(const std::vector<ForecastPoint>& timeline, time_t issued,
+                               int location_id, int provider_id)
+{
+    sqlite3_stmt *stmt = this->m_insertForecast;
+
+    // missing values are stored as NULL
+    auto bind_value = [stmt](int index, double value) {
+        if(std::isnan(value))
+            sqlite3_bind_null(stmt, index);
+        else
+            sqlite3_bind_double(stmt, index, value);
+    };
+
+    sqlite3_bind_int(stmt, 1, location_id);
+    sqlite3_bind_int(stmt, 2, provider_id);
+    sqlite3_bind_int64(stmt, 3, issued);
+    for(const auto& f : timeline) {
+        sqlite3_bind_int(stmt, 4, f.resolution);
+        sqlite3_bind_int64(stmt, 5, f.validTime);
+        sqlite3_bind_int(stmt, 6, f.weatherCode);
+        bind_value(7, f.temperature);
+        bind_value(8, f.temperatureMin);
+        bind_value(9, f.temperatureMax);
+        bind_value(10, f.pop);
+        bind_value(11, f.precipitationIntensity);
+        bind_value(12, f.windSpeed);
+        sqlite3_bind_int(stmt, 13, f.windDirection);
+        bind_value(14, f.humidity);
+        bind_value(15, f.pressure);
+        bind_value(16, f.cloudCover);
+
+        auto rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if(rc != SQLITE_DONE) {
+            LOG_F(INFO, "HistoryDB::insertForecast(): sqlite3_step error: %s", sqlite3_errmsg(this->m_db));
+            return false;
+        }
+    }
+    LOG_F(INFO, "HistoryDB::insertForecast(): %zu forecast steps recorded", timeline.size());
+    return true;
+}
+
+/**
+ * convert a snapshot into the fixed history layout.
+ */
+HistoryRecord HistoryRecord::fromDataPoint(const DataPoint& d)
+{
+    HistoryRecord r = {
+        .timestamp = d.timeRecorded, .fingerprint = d.fingerprint,
+        .sunrise = d.sunriseTime, .sunset = d.sunsetTime,
+        .temperature = d.temperature, .feelslike = d.temperatureApparent, .dewpoint = d.dewPoint,
+        .humidity = d.humidity, .pressure = d.pressureSeaLevel, .windspeed = d.windSpeed,
+        .windgust = d.windGust, .visibility = d.visibility,
+        .precip_probability = d.precipitationProbability, .precip_intensity = d.precipitationIntensity,
+        .cloudCover = d.cloudCover, .cloudBase = d.cloudBase, .cloudCeiling = d.cloudCeiling,
+        .uvindex = d.uvIndex, .tempMin = d.temperatureMin, .tempMax = d.temperatureMax,
+        .windbearing = static_cast<int32_t>(d.windDirection), .moonPhase = d.moonPhase,
+        .location_id = 0, .provider_id = 0, .icon = d.weatherSymbol };
+    snprintf(r.precip_type, sizeof(r.precip_type), "%s", d.precipitationTypeAsString);
+    snprintf(r.summary, sizeof(r.summary), "%s", d.conditionAsString);
+    return r;
+}
+
+/**
+ * bind and execute the history insert for one record. Must be called inside
+ * a transaction.
+ */
+bool HistoryDB::insertRecord(const HistoryRecord& r)
+{
+    sqlite3_stmt *stmt = this->m_insert;
+
+    sqlite3_bind_int64(stmt, 1, r.timestamp);
+    sqlite3_bind_text(stmt, 2, r.summary, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, &r.icon, 1, SQLITE_STATIC);
+    sqlite3_bind_double(stmt, 4, r.temperature);
+    sqlite3_bind_double(stmt, 5, r.feelslike);
+    sqlite3_bind_double(stmt, 6, r.dewpoint);
+    sqlite3_bind_int(stmt, 7, r.windbearing);
+    sqlite3_bind_double(stmt, 8, r.windspeed);
+    sqlite3_bind_double(stmt, 9, r.windgust);
+    sqlite3_bind_double(stmt, 10, r.humidity);
+    sqlite3_bind_double(stmt, 11, r.visibility);
+    sqlite3_bind_double(stmt, 12, r.pressure);
+    sqlite3_bind_double(stmt, 13, r.precip_probability);
+    sqlite3_bind_double(stmt, 14, r.precip_intensity);
+    sqlite3_bind_text(stmt, 15, r.precip_type, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 16, static_cast<int>(r.uvindex));
+    sqlite3_bind_int64(stmt, 17, r.sunrise);
+    sqlite3_bind_int64(stmt, 18, r.sunset);
+    sqlite3_bind_double(stmt, 19, r.cloudBase);
+    sqlite3_bind_double(stmt, 20, r.cloudCover);
+    sqlite3_bind_double(stmt, 21, r.cloudCeiling);
+    sqlite3_bind_int(stmt, 22, r.moonPhase);
+    sqlite3_bind_double(stmt, 23, r.tempMin);
+    sqlite3_bind_double(stmt, 24, r.tempMax);
+    sqlite3_bind_int(stmt, 25, r.location_id);
+    sqlite3_bind_int(stmt, 26, r.provider_id);
+
+    auto rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if(rc != SQLITE_DONE) {
+        LOG_F(INFO, "HistoryDB::insertRecord(): sqlite3_step error: %s", sqlite3_errmsg(this->m_db));
+        return false;
+    }
+    return true;
+}
+
+bool HistoryDB::setLastObservation(const HistoryRecord& r)
+{
+    sqlite3_bind_int(this->m_setLast, 1, r.location_id);
+    sqlite3_bind_int(this->m_setLast, 2, r.provider_id);
+    sqlite3_bind_int64(this->m_setLast, 3, r.timestamp);
+    sqlite3_bind_int64(this->m_setLast, 4, static_cast<sqlite3_int64>(r.fingerprint));
+    auto rc = sqlite3_step(this->m_setLast);
+    sqlite3_reset(this->m_setLast);
+    if(rc != SQLITE_DONE) {
+        LOG_F(INFO, "HistoryDB::setLastObservation(): sqlite3_step error: %s", sqlite3_errmsg(this->m_db));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * record a snapshot and its forecast timeline and update the rollups in a
+ * single transaction.
+ *
+ * @param d             - the populated snapshot
+ * @param timeline      - forecast steps, may be empty
+ * @param location_id   - key from locationId()
+ * @param provider_id   - key from providerId()
+ * @return              - true if the insert was committed.
+ */
+bool HistoryDB::insert(const DataPoint& d, const std::vector<ForecastPoint>& timeline,
+                       int location_id, int provider_id)
+{
+    HistoryRecord r = HistoryRecord::fromDataPoint(d);
+
+    r.location_id = location_id;
+    r.provider_id = provider_id;
+    if(!this->m_db || !this->exec("BEGIN IMMEDIATE"))
+        return false;
+
+    if(!this->insertRecord(r) || !this->updateRollups()
+       || !this->insertForecast(timeline, d.timeRecorded, location_id, provider_id)
+       || !this->setLastObservation(r) || !this->exec("COMMIT")) {
+        this->exec("ROLLBACK");
+        return false;
+    }
+    LOG_F(INFO, "HistoryDB::insert(): sqlite3_step() succeeded. Insert done.");
+    return true;
+}
+
+/**
+ * bulk insert of records in one transaction, the rollups are updated once
+ * at the end.
+ *
+ * @param records       - records in ascending time order
+ * @param count         - number of records
+ * @param location_id   - key from locationId(), overrides the records' value
+ * @param provider_id   - key from providerId(), overrides the records' value
+ * @return              - true if the batch was committed.
+ */
+bool HistoryDB::insertRecords(const HistoryRecord *records, size_t count, int location_id, int provider_id)
+{
+    HistoryRecord r;
+
+    if(count == 0)
+        return true;
+    if(!this->m_db || !this->exec("BEGIN IMMEDIATE"))
+        return false;
+
+    for(size_t i = 0; i < count; i++) {
+        r = records[i];
+        r.location_id = location_id;
+        r.provider_id = provider_id;
+        if(!this->insertRecord(r)) {
+            this->exec("ROLLBACK");
+            return false;
+        }
+    }
+    if(!this->updateRollups() || !this->setLastObservation(r) || !this->exec("COMMIT")) {
+        this->exec("ROLLBACK");
+        return false;
+    }
+    LOG_F(INFO, "HistoryDB::insertRecords(): %zu records inserted", count);
+    return true;
+}
+
+/**
+ * insert records keeping their location and provider, skipping those already
+ * recorded for the same location, provider and time. Used for imports, so
+ * last_observation is left alone.
+ *
+ * @return      - the number of records inserted, -1 if the batch failed and
+ *                was rolled back.
+ */
+long HistoryDB::importRecords(const HistoryRecord *records, size_t count)
+{
+    sqlite3_stmt    *exists = 0;
+    long            inserted = 0;
+
+    if(!this->m_db || sqlite3_prepare_v2(this->m_db, "SELECT 1 FROM history WHERE location_id = ? "
+                                         "AND provider_id = ? AND timestamp = ?", -1, &exists, 0) != SQLITE_OK)
+        return -1;
+    if(!this->exec("BEGIN IMMEDIATE")) {
+        sqlite3_finalize(exists);
+        return -1;
+    }
+    for(size_t i = 0; i < count; i++) {
+        sqlite3_bind_int(exists, 1, records[i].location_id);
+        sqlite3_bind_int(exists, 2, records[i].provider_id);
+        sqlite3_bind_int64(exists, 3, records[i].timestamp);
+        auto rc = sqlite3_step(exists);
+        sqlite3_reset(exists);
+        if(rc == SQLITE_ROW)
+            continue;
+        if(rc != SQLITE_DONE || !this->insertRecord(records[i])) {
+            inserted = -1;
+            break;
+        }
+        inserted++;
+    }
+    sqlite3_finalize(exists);
+    if(inserted < 0 || !this->updateRollups() || !this->exec("COMMIT")) {
+        this->exec("ROLLBACK");
+        return -1;
+    }
+    return inserted;
+}
+
+/**
+ * the cold archive next to the database, locked and with the index of all
+ * committed blocks. Release it with releaseArchive() when done.
+ *
+ * @param write     - create history.archive if it does not exist yet and
+ *                    lock it exclusively
+ * @return          - nullptr if there is no archive, it is unusable or
+ *                    locked by another process for too long
+ */
+ColdArchive* HistoryDB::archive(bool write)
+{
+    if(!this->m_archive) {
+        this->m_archive = std::make_unique<ColdArchive>(
+            std::filesystem::path(this->m_path).replace_extension(".archive").string());
+    }
+    ColdArchive *archive = this->m_archive.get();
+    if(!archive->open(write) || !archive->lock(write))
+        return nullptr;
+    // read after locking, a writer may have committed an export meanwhile
+    if(!archive->load(std::max<uint64_t>(this->getMeta("archive_size"), ColdArchive::file_header_size))) {
+        archive->unlock();
+        return nullptr;
+    }
+    UnitProfile units;
+    archive->setLegacy(this->getMeta("legacy_archive_size"),
+                       UnitProfile::fromCode(this->getMeta("legacy_units"), units) ? &units : nullptr);
+    return archive;
+}
+
+void HistoryDB::releaseArchive()
+{
+    if(this->m_archive)
+        this->m_archive->unlock();
+}
+
+/**
+ * read the current row of a statement selecting history_columns.
+ */
+void HistoryDB::readRecord(sqlite3_stmt *stmt, HistoryRecord& r)
+{
+    r.timestamp = sqlite3_column_int64(stmt, 0);
+    snprintf(r.summary, sizeof(r.summary), "%s", (const char *)sqlite3_column_text(stmt, 1));
+    r.icon = sqlite3_column_bytes(stmt, 2) > 0 ? ((const char *)sqlite3_column_text(stmt, 2))[0] : ' ';
+    r.temperature = sqlite3_column_double(stmt, 3);
+    r.feelslike = sqlite3_column_double(stmt, 4);
+    r.dewpoint = sqlite3_column_double(stmt, 5);
+    r.windbearing = sqlite3_column_int(stmt, 6);
+    r.windspeed = sqlite3_column_double(stmt, 7);
+    r.windgust = sqlite3_column_double(stmt, 8);
+    r.humidity = sqlite3_column_double(stmt, 9);
+    r.visibility = sqlite3_column_double(stmt, 10);
+    r.pressure = sqlite3_column_double(stmt, 11);
+    r.precip_probability = sqlite3_column_double(stmt, 12);
+    r.precip_intensity = sqlite3_column_double(stmt, 13);
+    snprintf(r.precip_type, sizeof(r.precip_type), "%s",
+             sqlite3_column_text(stmt, 14) ? (const char *)sqlite3_column_text(stmt, 14) : "");
+    r.uvindex = sqlite3_column_double(stmt, 15);
+    r.sunrise = sqlite3_column_int64(stmt, 16);
+    r.sunset = sqlite3_column_int64(stmt, 17);
+    r.cloudBase = sqlite3_column_double(stmt, 18);
+    r.cloudCover = sqlite3_column_double(stmt, 19);
+    r.cloudCeiling = sqlite3_column_double(stmt, 20);
+    r.moonPhase = sqlite3_column_int(stmt, 21);
+    r.tempMin = sqlite3_column_double(stmt, 22);
+    r.tempMax = sqlite3_column_double(stmt, 23);
+    r.location_id = sqlite3_column_int(stmt, 24);
+    r.provider_id = sqlite3_column_int(stmt, 25);
+}
+
+/**
+ * read the history of the default location and provider. Archived and
+ * live rows are merged by timestamp.
+ */
+bool HistoryDB::scan(time_t from, time_t to, const std::function<bool(const HistoryRecord&)>& fn)
+{
+    sqlite3_stmt    *stmt = this->m_scan;
+    HistoryRecord   r = {}, cold = {};
+    bool            more = true, have_cold = false;
+    int             rc;
+
+    if(!this->m_db)
+        return false;
+
+    // the archive stays locked during the scan, an export cannot move rows out from under it
+    ColdArchive *archive = this->archive();
+    if(!archive && this->hasArchive()) {
+        LOG_F(INFO, "HistoryDB::scan(): the archive cannot be read");
+        return false;
+    }
+    ColdArchive::Cursor cursor = archive ? archive->select(this->m_locationId, this->m_providerId, from, to)
+                                         : ColdArchive::Cursor();
+    have_cold = cursor.next(cold);
+
+    sqlite3_bind_int(stmt, 1, this->m_locationId);
+    sqlite3_bind_int(stmt, 2, this->m_providerId);
+    sqlite3_bind_int64(stmt, 3, from);
+    sqlite3_bind_int64(stmt, 4, to);
+    while(more && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        HistoryDB::readRecord(stmt, r);
+        while(more && have_cold && cold.timestamp <= r.timestamp) {
+            more = fn(cold);
+            have_cold = cursor.next(cold);
+        }
+        more = more && fn(r);
+    }
+    sqlite3_reset(stmt);
+    while(more && have_cold) {
+        more = fn(cold);
+        have_cold = cursor.next(cold);
+    }
+    this->releaseArchive();
+    return rc == SQLITE_ROW || rc == SQLITE_DONE;
+}
+
+/**
+ * count one --race result of a provider for the default location.
+ *
+ * @param provider      - provider code
+ * @param result        - how the request ended
+ * @param latency_ms    - time until the provider delivered valid data, only
+ *                        used for WON and FINISHED
+ */
+bool HistoryDB::recordRace(const std::string& provider, RaceResult result, double latency_ms)
+{
+    sqlite3_stmt    *stmt = 0;
+    int             provider_id = this->providerId(provider);
+    bool            finished = result == RACE_WON || result == RACE_FINISHED;
+    int             rc;
+
+    if(!this->m_db || provider_id == 0)
+        return false;
+    rc = sqlite3_prepare_v2(this->m_db,
+        "INSERT INTO provider_race(location_id, provider_id, races, wins, finished, failures, latency_sum,"
+        " latency_max, last_race) VALUES(?1, ?2, 1, ?3, ?4, ?5, ?6, ?6, ?7) "
+        "ON CONFLICT(location_id, provider_id) DO UPDATE SET races = races + 1, wins = wins + excluded.wins,"
+        " finished = finished + excluded.finished, failures = failures + excluded.failures,"
+        " latency_sum = latency_sum + excluded.latency_sum, latency_max = max(latency_max, excluded.latency_max),"
+        " last_race = excluded.last_race", -1, &stmt, 0);
+    if(rc == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, this->m_locationId);
+        sqlite3_bind_int(stmt, 2, provider_id);
+        sqlite3_bind_int(stmt, 3, result == RACE_WON);
+        sqlite3_bind_int(stmt, 4, finished);
+        sqlite3_bind_int(stmt, 5, result == RACE_FAILED);
+        sqlite3_bind_double(stmt, 6, finished ? latency_ms : 0.0);
+        sqlite3_bind_int64(stmt, 7, time(0));
+        rc = sqlite3_step(stmt);
+    }
+    sqlite3_finalize(stmt);
+    if(rc != SQLITE_DONE) {
+        LOG_F(INFO, "HistoryDB::recordRace(): DB error: %s", sqlite3_errmsg(this->m_db));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * the --race statistics of all providers for the default location, most
+ * wins first.
+ */
+bool HistoryDB::raceStats(std::vector<RaceStats>& stats)
+{
+    sqlite3_stmt    *stmt = 0;
+
+    stats.clear();
+    if(!this->m_db || sqlite3_prepare_v2(this->m_db,
+        "SELECT p.code, r.races, r.wins, r.finished, r.failures, r.latency_sum, r.latency_max, r.last_race"
+        " FROM provider_race r JOIN providers p ON p.id = r.provider_id WHERE r.location_id = ?"
+        " ORDER BY r.wins DESC, p.code", -1, &stmt, 0) != SQLITE_OK)
+        return false;
+    sqlite3_bind_int(stmt, 1, this->m_locationId);
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        RaceStats& s = stats.emplace_back();
+        s.provider = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+        s.races = sqlite3_column_int64(stmt, 1);
+        s.wins = sqlite3_column_int64(stmt, 2);
+        s.finished = sqlite3_column_int64(stmt, 3);
+        s.failures = sqlite3_column_int64(stmt, 4);
+        s.latency_sum = sqlite3_column_double(stmt, 5);
+        s.latency_max = sqlite3_column_double(stmt, 6);
+        s.last_race = sqlite3_column_int64(stmt, 7);
+    }
+    sqlite3_finalize(stmt);
+    return true;
+}
+
+/**
+ * the recorded health of a provider endpoint. Providers without a row
+ * keep the defaults (no samples, circuit closed).
+ */
+bool HistoryDB::loadHealth(const std::string& provider, ProviderHealth& health)
+{
+    health = ProviderHealth();
+    return this->m_db && HistoryDB::selectHealth(this->m_db, provider, health);
+}
+
+bool HistoryDB::selectHealth(sqlite3 *db, const std::string& provider, ProviderHealth& health)
+{
+    sqlite3_stmt    *stmt = 0;
+
+    if(sqlite3_prepare_v2(db,
+        "SELECT h.latency, h.errors, h.samples, h.failures, h.open_until, h.cooldown FROM provider_health h"
+        " JOIN providers p ON p.id = h.provider_id WHERE p.code = ?", -1, &stmt, 0) != SQLITE_OK)
+        return false;
+    sqlite3_bind_text(stmt, 1, provider.c_str(), -1, SQLITE_STATIC);
+    if(sqlite3_step(stmt) == SQLITE_ROW) {
+        health.latency = sqlite3_column_double(stmt, 0);
+        health.errors = sqlite3_column_double(stmt, 1);
+        health.samples = sqlite3_column_int64(stmt, 2);
+        health.failures = sqlite3_column_int(stmt, 3);
+        health.open_until = sqlite3_column_int64(stmt, 4);
+        health.cooldown = sqlite3_column_int(stmt, 5);
+    }
+    sqlite3_finalize(stmt);
+    return true;
+}
+
+/**
+ * loadHealth() without opening the database for writing: no schema check,
+ * no prepared statements. This is all the circuit breaker needs before a
+ * request goes out.
+ *
+ * @return      - false if the database cannot be read. health keeps the
+ *                defaults when the provider has no row (or there is no
+ *                database yet).
+ */
+bool HistoryDB::readHealth(const std::string& path, const std::string& provider, ProviderHealth& health)
+{
+    sqlite3 *db = nullptr;
+
+    health = ProviderHealth();
+    if(sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return !std::filesystem::exists(path);
+    }
+    sqlite3_busy_timeout(db, HistoryDB::busy_timeout);
+    bool ok = HistoryDB::selectHealth(db, provider, health);
+    sqlite3_close(db);
+    return ok;
+}
+
+/**
+ * record the outcome of a request. The row is read again inside the
+ * write transaction and the outcome is applied to that copy, so updates
+ * of concurrent runs for the same provider are not lost.
+ *
+ * @param provider      - provider code
+ * @param ok            - whether the request succeeded
+ * @param latency_ms    - time the request took
+ * @param now           - time of the outcome
+ * @param health        - receives the updated health
+ * @return              - false on a database error
+ */
+bool HistoryDB::saveHealth(const std::string& provider, bool ok, double latency_ms, time_t now,
+                           ProviderHealth& health)
+{
+    sqlite3_stmt    *stmt = 0;
+    int             provider_id = this->providerId(provider);
+    int             rc;
+
+    if(!this->m_db || provider_id == 0 || !this->exec("BEGIN IMMEDIATE"))
+        return false;
+    health = ProviderHealth();
+    if(!HistoryDB::selectHealth(this->m_db, provider, health)) {
+        LOG_F(INFO, "HistoryDB::saveHealth(): DB error: %s", sqlite3_errmsg(this->m_db));
+        this->exec("ROLLBACK");
+        return false;
+    }
+    health.update(ok, latency_ms, now);
+    rc = sqlite3_prepare_v2(this->m_db,
+        "INSERT OR REPLACE INTO provider_health(provider_id, latency, errors, samples, failures, open_until,"
+        " cooldown, updated) VALUES(?, ?, ?, ?, ?, ?, ?, ?)", -1, &stmt, 0);
+    if(rc == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, provider_id);
+        sqlite3_bind_double(stmt, 2, health.latency);
+        sqlite3_bind_double(stmt, 3, health.errors);
+        sqlite3_bind_int64(stmt, 4, health.samples);
+        sqlite3_bind_int(stmt, 5, health.failures);
+        sqlite3_bind_int64(stmt, 6, health.open_until);
+        sqlite3_bind_int(stmt, 7, health.cooldown);
+        sqlite3_bind_int64(stmt, 8, now);
+        rc = sqlite3_step(stmt);
+    }
+    sqlite3_finalize(stmt);
+    if(rc != SQLITE_DONE || !this->exec("COMMIT")) {
+        LOG_F(INFO, "HistoryDB::saveHealth(): DB error: %s", sqlite3_errmsg(this->m_db));
+        this->exec("ROLLBACK");
+        return false;
+    }
+    return true;
+}
+
+sqlite3_int64 HistoryDB::getMeta(const char *key)
+{
+    sqlite3_stmt    *stmt = 0;
+    sqlite3_int64   value = 0;
+
+    if(sqlite3_prepare_v2(this->m_db, "SELECT value FROM meta WHERE key = ?", -1, &stmt, 0) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+        if(sqlite3_step(stmt) == SQLITE_ROW) {
+            value = sqlite3_column_int64(stmt, 0);
+        }
+    }
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+bool HistoryDB::setMeta(const char *key, sqlite3_int64 value)
+{
+    sqlite3_stmt    *stmt = 0;
+    int             rc;
+
+    rc = sqlite3_prepare_v2(this->m_db, "INSERT INTO meta(key, value) VALUES(?, ?) "
+                                        "ON CONFLICT(key) DO UPDATE SET value = excluded.value", -1, &stmt, 0);
+    if(rc == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, value);
+        rc = sqlite3_step(stmt);
+    }
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE;
+}
+
+/**
+ * run a DELETE statement repeatedly, each time in its own short transaction,
+ * until it no longer removes rows. The statement must limit itself to
+ * compact_chunk rows and take the cutoff as parameter 1.
+ *
+ * @return      - false on any database error.
+ */
+bool HistoryDB::deleteChunked(const char *sql, sqlite3_int64 cutoff)
+{
+    sqlite3_stmt    *stmt = 0;
+    int             deleted = 0, total = 0;
+    bool            failed = false;
+
+    if(sqlite3_prepare_v2(this->m_db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        LOG_F(INFO, "HistoryDB::deleteChunked(): prepare stmt, error: %s", sqlite3_errmsg(this->m_db));
+        return false;
+    }
+    sqlite3_bind_int64(stmt, 1, cutoff);
+    sqlite3_bind_int(stmt, 2, HistoryDB::compact_chunk);
+    do {
+        if(!this->exec("BEGIN IMMEDIATE")) {
+            failed = true;
+            break;
+        }
+        auto rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if(rc != SQLITE_DONE) {
+            LOG_F(INFO, "HistoryDB::deleteChunked(): sqlite3_step error: %s", sqlite3_errmsg(this->m_db));
+            this->exec("ROLLBACK");
+            failed = true;
+            break;
+        }
+        deleted = sqlite3_changes(this->m_db);
+        if(!this->exec("COMMIT")) {
+            this->exec("ROLLBACK");
+            failed = true;
+            break;
+        }
+        total += deleted;
+    } while(deleted > 0);
+    sqlite3_finalize(stmt);
+    LOG_F(INFO, "HistoryDB::deleteChunked(): %d rows removed", total);
+    return !failed;
+}
+
+/**
+ * export all raw rows older than cutoff into the cold archive and delete
+ * them. The archive is synced before the export is recorded in meta
+ * (archive_size, archive_pending), so a crash either leaves blocks beyond
+ * archive_size which the next export cuts off, or a pending delete which
+ * the next pass finishes. Rows are never lost or archived twice.
+ *
+ * The archive stays locked exclusively for the whole pass, concurrent
+ * passes of other processes wait and then start from the new archive_size.
+ *
+ * @return      - true if the rows were archived and removed.
+ */
+bool HistoryDB::archiveRaw(sqlite3_int64 cutoff)
+{
+    ColdArchive *archive = this->archive(true);
+    if(!archive)
+        return false;
+    bool ok = this->exportRaw(archive, cutoff);
+    this->releaseArchive();
+    return ok;
+}
+
+/**
+ * the export of archiveRaw(), the archive is locked and its index holds
+ * the committed blocks.
+ */
+bool HistoryDB::exportRaw(ColdArchive *archive, sqlite3_int64 cutoff)
+{
+    sqlite3_stmt                *stmt = 0;
+    std::vector<HistoryRecord>  batch;
+    HistoryRecord               r = {};
+    sqlite3_int64               max_id = this->getMeta("rollup_watermark");
+    size_t                      total = 0;
+    int                         rc;
+
+    if(this->getMeta("archive_pending"))
+        return false;
+
+    // cut off whatever an interrupted export left behind the committed blocks
+    if(!archive->truncate(archive->size()))
+        return false;
+
+    std::string sql("SELECT ");
+    sql.append(HistoryDB::history_columns).append(" FROM history WHERE timestamp < ?1 AND id <= ?2 AND id > ")
+       .append(HistoryDB::legacy_limit).append(" ORDER BY location_id, provider_id, timestamp");
+    if(sqlite3_prepare_v2(this->m_db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) {
+        LOG_F(INFO, "HistoryDB::exportRaw(): prepare stmt, error: %s", sqlite3_errmsg(this->m_db));
+        return false;
+    }
+    sqlite3_bind_int64(stmt, 1, cutoff);
+    sqlite3_bind_int64(stmt, 2, max_id);
+    batch.reserve(ColdArchive::block_records);
+    bool ok = true;
+    while(ok && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        HistoryDB::readRecord(stmt, r);
+        if(!batch.empty() && (batch.size() == ColdArchive::block_records || batch[0].location_id != r.location_id
+                              || batch[0].provider_id != r.provider_id)) {
+            ok = archive->append(batch.data(), batch.size());
+            total += batch.size();
+            batch.clear();
+        }
+        batch.push_back(r);
+    }
+    sqlite3_finalize(stmt);
+    if(ok && !batch.empty()) {
+        ok = archive->append(batch.data(), batch.size());
+        total += batch.size();
+    }
+    if(!ok || rc != SQLITE_DONE || !archive->sync()) {
+        LOG_F(INFO, "HistoryDB::exportRaw(): export failed, nothing deleted");
+        return false;
+    }
+    if(total == 0)
+        return true;
+
+    if(!this->exec("BEGIN IMMEDIATE"))
+        return false;
+    if(!this->setMeta("archive_size", archive->size()) || !this->setMeta("archive_pending", cutoff)
+       || !this->setMeta("archive_pending_id", max_id) || !this->exec("COMMIT")) {
+        this->exec("ROLLBACK");
+        return false;
+    }
+    LOG_F(INFO, "HistoryDB::exportRaw(): %zu rows archived", total);
+    return this->deleteArchived();
+}
+
+/**
+ * delete the rows of the last export from the history table.
+ */
+bool HistoryDB::deleteArchived()
+{
+    std::string sql("DELETE FROM history WHERE id IN (SELECT id FROM history WHERE timestamp < ?1 AND id <= "
+                    "(SELECT value FROM meta WHERE key = 'archive_pending_id') AND id > ");
+    sql.append(HistoryDB::legacy_limit).append(" LIMIT ?2)");
+    if(!this->deleteChunked(sql.c_str(), this->getMeta("archive_pending")))
+        return false;
+    return this->setMeta("archive_pending", 0);
+}
+
+/**
+ * apply the retention policy. Raw rows are only removed after they have been
+ * folded into the rollups (and exported into the archive, unless disabled), expired rollup buckets are removed per tier and
+ * the freed pages are returned to the file system in bounded steps, so every
+ * pass stays cheap. Unless forced, a pass runs at most once per
+ * compact_interval.
+ *
+ * @param policy    - retention per tier
+ * @param force     - run even when the last pass was recent (--compact)
+ * @return          - true if the pass completed or was not due.
+ */
+bool HistoryDB::compact(const RetentionPolicy& policy, bool force)
+{
+    sqlite3_stmt    *stmt = 0;
+    time_t          now = time(0);
+    bool            result = true;
+    int             auto_vacuum = 0;
+
+    if(!this->m_db)
+        return false;
+
+    if(!force && now - this->getMeta("last_compaction") < HistoryDB::compact_interval)
+        return true;
+
+    LOG_F(INFO, "HistoryDB::compact(): retention raw = %d, hourly = %d, daily = %d days",
+          policy.raw_days, policy.hourly_days, policy.daily_days);
+
+    if(sqlite3_prepare_v2(this->m_db, "PRAGMA auto_vacuum", -1, &stmt, 0) == SQLITE_OK
+       && sqlite3_step(stmt) == SQLITE_ROW) {
+        auto_vacuum = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    if(auto_vacuum != 2) {
+        // one-time conversion of databases created without incremental auto_vacuum
+        LOG_F(INFO, "HistoryDB::compact(): converting database to incremental auto_vacuum");
+        this->exec("PRAGMA auto_vacuum = INCREMENTAL");
+        this->exec("VACUUM");
+    }
+
+    // make sure nothing gets deleted before it is part of the rollups
+    if(!this->exec("BEGIN IMMEDIATE"))
+        return false;
+    if(!this->updateRollups()) {
+        this->exec("ROLLBACK");
+        return false;
+    }
+    this->exec("COMMIT");
+
+    // rows of an export which was interrupted before they were all deleted
+    if(this->getMeta("archive_pending")) {
+        result &= this->deleteArchived();
+    }
+    if(policy.raw_days > 0 && policy.archive) {
+        result &= this->archiveRaw(now - policy.raw_days * 86400LL);
+    } else if(policy.raw_days > 0) {
+        std::string sql("DELETE FROM history WHERE id IN (SELECT id FROM history WHERE timestamp < ?1 AND id <= "
+                        "(SELECT value FROM meta WHERE key = 'rollup_watermark') AND id > ");
+        sql.append(HistoryDB::legacy_limit).append(" LIMIT ?2)");
+        result &= this->deleteChunked(sql.c_str(), now - policy.raw_days * 86400LL);
+    }
+    if(policy.raw_days > 0) {
+        // forecasts follow the raw retention
+        result &= this->deleteChunked("DELETE FROM forecast WHERE (location_id, provider_id, issued, resolution, valid) "
+                                      "IN (SELECT location_id, provider_id, issued, resolution, valid FROM forecast "
+                                      "WHERE issued < ?1 LIMIT ?2)",
+                                      now - policy.raw_days * 86400LL);
+    }
+    const int tier_days[] = { policy.hourly_days, policy.daily_days };
+    for(size_t i = 0; i < std::size(HistoryDB::rollup_tiers); i++) {
+        if(tier_days[i] > 0) {
+            std::string sql("DELETE FROM ");
+            sql.append(HistoryDB::rollup_tiers[i].table)
+               .append(" WHERE (location_id, provider_id, bucket) IN (SELECT location_id, provider_id, bucket FROM ")
+               .append(HistoryDB::rollup_tiers[i].table).append(" WHERE bucket < ?1 LIMIT ?2)");
+            result &= this->deleteChunked(sql.c_str(), now - tier_days[i] * 86400LL);
+        }
+    }
+
+    std::string vacuum("PRAGMA incremental_vacuum(");
+    vacuum.append(std::to_string(HistoryDB::vacuum_pages)).append(")");
+    this->exec(vacuum.c_str());
+    this->exec("PRAGMA optimize");
+
+    if(result) {
+        this->setMeta("last_compaction", now);
+    }
+    return result;
+}
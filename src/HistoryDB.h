@@ -0,0 +1,188 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FETCHWEATHER_SRC_HISTORYDB_H_
+#define FETCHWEATHER_SRC_HISTORYDB_H_
+
+#include "pch.h"
+#include "DataHandler.h"
+#include "HistoryBackend.h"
+#include "ColdArchive.h"
+#include "ProviderHealth.h"
+
+/*
+ * HistoryDB wraps history.sqlite3. Besides the raw history table, it
+ * maintains hourly and daily rollup tables (count, min, max, sum and last
+ * value per metric). They are updated in the same transaction as each raw
+ * insert, so long-range queries can read a few hundred buckets instead of
+ * scanning every recorded snapshot.
+ *
+ * Every record belongs to a location and a provider. Both are stored as
+ * small integer keys into the locations and providers tables. The location
+ * and provider given to the constructor are the defaults for insert() and
+ * own all records from databases created before these columns existed.
+ *
+ * The forecast timeline of each fetch goes into the forecast table, keyed
+ * by issue time (the time of the snapshot) and valid time. It is written
+ * with the snapshot in one transaction.
+ *
+ * last_observation holds observation time and fingerprint of the latest
+ * record per location and provider. Providers often deliver the same
+ * observation for several polls, isDuplicate() allows to skip them.
+ *
+ * Raw rows leaving the retention are exported into a ColdArchive
+ * (history.archive) before compact() deletes them. scan() merges both tiers.
+ *
+ * All values are metric since schema 4. Rows recorded by older versions
+ * hold them in the units configured back then, which the database does not
+ * know. They are left out of scans, exports, rollups and compaction until
+ * convertLegacy() converts them with units declared by the user.
+ */
+class HistoryDB : public HistoryBackend {
+  public:
+    HistoryDB(const std::string& path, const std::string& location, const std::string& provider);
+    ~HistoryDB() { this->close(); }
+
+    bool    open() override;
+    void    close();
+    bool    insert(const DataPoint& d, const std::vector<ForecastPoint>& timeline) override
+    { return this->insert(d, timeline, m_locationId, m_providerId); }
+    bool    insert(const DataPoint& d, const std::vector<ForecastPoint>& timeline,
+                   int location_id, int provider_id);
+    bool    insertRecords(const HistoryRecord *records, size_t count, int location_id, int provider_id);
+    long    importRecords(const HistoryRecord *records, size_t count);
+    bool    updateRollups();
+    bool    isDuplicate(const DataPoint& d) override { return this->isDuplicate(d, m_locationId, m_providerId); }
+    bool    isDuplicate(const DataPoint& d, int location_id, int provider_id);
+    bool    scan(time_t from, time_t to, const std::function<bool(const HistoryRecord&)>& fn) override;
+    bool    maintenance(const RetentionPolicy& policy, bool force = false) override
+    { return this->compact(policy, force); }
+    bool    compact(const RetentionPolicy& policy, bool force = false);
+    int     locationId(const std::string& name) { return this->keyFor("locations", name, m_locations); }
+    int     providerId(const std::string& code) { return this->keyFor("providers", code, m_providers); }
+    sqlite3 *handle() { return m_db; }
+
+    /*
+     * --race statistics per location and provider. Latencies are in ms and
+     * only cover requests which delivered valid data (finished, including
+     * wins). Requests cancelled because another provider was faster count
+     * as races only.
+     */
+    enum RaceResult { RACE_WON, RACE_FINISHED, RACE_FAILED, RACE_CANCELLED };
+    struct RaceStats {
+        std::string     provider;
+        sqlite3_int64   races, wins, finished, failures;
+        double          latency_sum, latency_max;
+        sqlite3_int64   last_race;
+    };
+    bool    recordRace(const std::string& provider, RaceResult result, double latency_ms);
+    bool    raceStats(std::vector<RaceStats>& stats);
+    bool    loadHealth(const std::string& provider, ProviderHealth& health);
+    static bool readHealth(const std::string& path, const std::string& provider, ProviderHealth& health);
+    bool    saveHealth(const std::string& provider, bool ok, double latency_ms, time_t now,
+                       ProviderHealth& health);
+    ColdArchive *archive(bool write = false);
+    void    releaseArchive();
+    bool    hasArchive() { return this->getMeta("archive_size") != 0; }    // an export was committed
+    bool    hasLegacy();
+    bool    convertLegacy(const UnitProfile& units, sqlite3_int64& converted);
+
+    /*
+     * the history columns in the order used for binding and reading records
+     */
+    static constexpr const char *history_columns =
+        "timestamp, summary, icon, temperature, feelslike, dewpoint, windbearing, windspeed, windgust, "
+        "humidity, visibility, pressure, precip_probability, precip_intensity, precip_type, uvindex, "
+        "sunrise, sunset, cloudBase, cloudCover, cloudCeiling, moonPhase, tempMin, tempMax, "
+        "location_id, provider_id";
+
+    struct RollupTier {
+        const char  *table;
+        int         period;         // bucket length in seconds
+    };
+
+    static constexpr RollupTier rollup_tiers[] = { {"history_hourly", 3600},
+                                                   {"history_daily", 86400} };
+    /*
+     * history columns aggregated by the rollup tables. Each one gets a
+     * _min, _max, _sum and _last column in every tier. All raw rows carry
+     * all metrics, so a single count per bucket is sufficient.
+     */
+    static constexpr const char *rollup_metrics[] = {
+        "temperature", "feelslike", "dewpoint", "humidity", "pressure", "windspeed",
+        "windgust", "visibility", "precip_intensity", "precip_probability",
+        "cloudCover", "uvindex" };
+
+    /*
+     * rows with an id above this are metric, compare with id > legacy_limit.
+     * legacy_id is 0 unless there are rows in unknown units.
+     */
+    static constexpr const char *legacy_limit = "ifnull((SELECT value FROM meta WHERE key = 'legacy_id'), 0)";
+
+    static constexpr int    compact_chunk = 5000;           // rows deleted per transaction
+    static constexpr int    compact_interval = 86400;       // seconds between automatic passes
+    static constexpr int    vacuum_pages = 4096;            // pages reclaimed per pass
+    static constexpr int    schema_version = 4;             // PRAGMA user_version
+    static constexpr int    busy_timeout = 30000;           // ms to wait for a lock held by another writer
+
+  private:
+    bool    exec(const char *sql);
+    bool    insertRecord(const HistoryRecord& r);
+    bool    setLastObservation(const HistoryRecord& r);
+    bool    deleteChunked(const char *sql, sqlite3_int64 cutoff);
+    bool    archiveRaw(sqlite3_int64 cutoff);
+    bool    exportRaw(ColdArchive *archive, sqlite3_int64 cutoff);
+    bool    deleteArchived();
+    static bool selectHealth(sqlite3 *db, const std::string& provider, ProviderHealth& health);
+    static void readRecord(sqlite3_stmt *stmt, HistoryRecord& r);
+    sqlite3_int64   getMeta(const char *key);
+    bool            setMeta(const char *key, sqlite3_int64 value);
+    bool    createSchema();
+    int     userVersion();
+    bool    insertForecast(const std::vector<ForecastPoint>& timeline, time_t issued,
+                           int location_id, int provider_id);
+    bool    migrateSchema();
+    bool    markLegacyRows(int version);
+    bool    hasColumn(const char *table, const char *column);
+    int     keyFor(const char *table, const std::string& name, std::map<std::string, int>& cache);
+    bool    prepareStatements();
+    std::string buildRollupSQL(const RollupTier& tier) const;
+    std::string rollupMergeSQL() const;
+
+    std::string         m_path, m_location, m_provider;
+    std::unique_ptr<ColdArchive>    m_archive;
+    int                 m_locationId = 0, m_providerId = 0;
+    std::map<std::string, int>  m_locations, m_providers;
+    sqlite3             *m_db = nullptr;
+    sqlite3_stmt        *m_insert = nullptr;
+    sqlite3_stmt        *m_insertForecast = nullptr;
+    sqlite3_stmt        *m_getLast = nullptr;
+    sqlite3_stmt        *m_setLast = nullptr;
+    sqlite3_stmt        *m_getWatermark = nullptr;
+    sqlite3_stmt        *m_setWatermark = nullptr;
+    sqlite3_stmt        *m_scan = nullptr;
+    sqlite3_stmt        *m_rollup[std::size(rollup_tiers)] = {};
+};
+
+#endif //FETCHWEATHER_SRC_HISTORYDB_H_
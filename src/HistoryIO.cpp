@@ -0,0 +1,807 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <charconv>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include "HistoryIO.h"
+
+namespace {
+
+enum Kind { INT64, INT32, REAL, TEXT, ICON, LOCATION, PROVIDER };
+
+struct Field {
+    const char  *name;
+    Kind        kind;
+    size_t      offset, size;
+    int         quantity = UnitProfile::QUANTITIES;     // converted by --exportUnits
+};
+
+/*
+ * the exported columns in file order. location and provider are exported
+ * by name instead of their keys.
+ */
+const Field fields[] = {
+    { "timestamp", INT64, offsetof(HistoryRecord, timestamp), sizeof(int64_t) },
+    { "location", LOCATION, 0, 0 },
+    { "provider", PROVIDER, 0, 0 },
+    { "summary", TEXT, offsetof(HistoryRecord, summary), sizeof(HistoryRecord::summary) },
+    { "icon", ICON, offsetof(HistoryRecord, icon), 1 },
+    { "temperature", REAL, offsetof(HistoryRecord, temperature), sizeof(double), UnitProfile::TEMPERATURE },
+    { "feelslike", REAL, offsetof(HistoryRecord, feelslike), sizeof(double), UnitProfile::TEMPERATURE },
+    { "dewpoint", REAL, offsetof(HistoryRecord, dewpoint), sizeof(double), UnitProfile::TEMPERATURE },
+    { "windbearing", INT32, offsetof(HistoryRecord, windbearing), sizeof(int32_t) },
+    { "windspeed", REAL, offsetof(HistoryRecord, windspeed), sizeof(double), UnitProfile::SPEED },
+    { "windgust", REAL, offsetof(HistoryRecord, windgust), sizeof(double), UnitProfile::SPEED },
+    { "humidity", REAL, offsetof(HistoryRecord, humidity), sizeof(double) },
+    { "visibility", REAL, offsetof(HistoryRecord, visibility), sizeof(double), UnitProfile::VISIBILITY },
+    { "pressure", REAL, offsetof(HistoryRecord, pressure), sizeof(double), UnitProfile::PRESSURE },
+    { "precip_probability", REAL, offsetof(HistoryRecord, precip_probability), sizeof(double) },
+    { "precip_intensity", REAL, offsetof(HistoryRecord, precip_intensity), sizeof(double) },
+    { "precip_type", TEXT, offsetof(HistoryRecord, precip_type), sizeof(HistoryRecord::precip_type) },
+    { "uvindex", REAL, offsetof(HistoryRecord, uvindex), sizeof(double) },
+    { "sunrise", INT64, offsetof(HistoryRecord, sunrise), sizeof(int64_t) },
+    { "sunset", INT64, offsetof(HistoryRecord, sunset), sizeof(int64_t) },
+    { "cloudBase", REAL, offsetof(HistoryRecord, cloudBase), sizeof(double) },
+    { "cloudCover", REAL, offsetof(HistoryRecord, cloudCover), sizeof(double) },
+    { "cloudCeiling", REAL, offsetof(HistoryRecord, cloudCeiling), sizeof(double) },
+    { "moonPhase", INT32, offsetof(HistoryRecord, moonPhase), sizeof(int32_t) },
+    { "tempMin", REAL, offsetof(HistoryRecord, tempMin), sizeof(double), UnitProfile::TEMPERATURE },
+    { "tempMax", REAL, offsetof(HistoryRecord, tempMax), sizeof(double), UnitProfile::TEMPERATURE } };
+
+constexpr int field_count = static_cast<int>(std::size(fields));
+
+int fieldIndex(std::string_view name)
+{
+    for(int i = 0; i < field_count; i++) {
+        if(name == fields[i].name)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * buffered writer on a file descriptor
+ */
+class OutputBuffer {
+  public:
+    OutputBuffer(int fd, HistoryIO::Format format) : m_fd(fd), m_format(format)
+    {
+        m_buf.reserve(HistoryIO::buffer_size);
+    }
+
+    bool flush()
+    {
+        const char *p = m_buf.data();
+        size_t left = m_buf.size();
+        while(m_ok && left > 0) {
+            ssize_t n = ::write(m_fd, p, left);
+            if(n < 0 && errno == EINTR)
+                continue;
+            m_ok = n > 0;
+            p += n;
+            left -= n;
+        }
+        m_buf.clear();
+        return m_ok;
+    }
+
+    void put(char c) { m_buf.push_back(c); }
+    void append(const char *s, size_t n) { m_buf.append(s, n); }
+    void append(const char *s) { m_buf.append(s); }
+
+    template <typename T> void number(T v)
+    {
+        char tmp[32];
+        auto result = std::to_chars(tmp, tmp + sizeof(tmp), v);
+        m_buf.append(tmp, result.ptr);
+    }
+
+    void null() { if(m_format == HistoryIO::JSONL) m_buf.append("null"); }
+
+    void real(double v)
+    {
+        if(std::isfinite(v))
+            number(v);
+        else
+            null();
+    }
+
+    void text(const char *s, size_t n)
+    {
+        if(m_format == HistoryIO::CSV) {
+            if(std::string_view(s, n).find_first_of(",\"\r\n") == std::string_view::npos) {
+                m_buf.append(s, n);
+                return;
+            }
+            put('"');
+            for(size_t i = 0; i < n; i++) {
+                if(s[i] == '"')
+                    put('"');
+                put(s[i]);
+            }
+            put('"');
+            return;
+        }
+        put('"');
+        for(size_t i = 0; i < n; i++) {
+            unsigned char c = s[i];
+            if(c == '"' || c == '\\') {
+                put('\\');
+                put(c);
+            } else if(c < 0x20) {
+                char tmp[8];
+                snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+                m_buf.append(tmp);
+            } else {
+                put(c);
+            }
+        }
+        put('"');
+    }
+
+    void beginRow() { if(m_format == HistoryIO::JSONL) put('{'); }
+    void beginField(int i)
+    {
+        if(i > 0)
+            put(',');
+        if(m_format == HistoryIO::JSONL) {
+            put('"');
+            m_buf.append(fields[i].name);
+            m_buf.append("\":");
+        }
+    }
+    bool endRow()
+    {
+        if(m_format == HistoryIO::JSONL)
+            put('}');
+        put('\n');
+        return m_buf.size() < HistoryIO::buffer_size - 4096 || flush();
+    }
+
+    bool ok() const { return m_ok; }
+
+  private:
+    int                 m_fd;
+    HistoryIO::Format   m_format;
+    std::string         m_buf;
+    bool                m_ok = true;
+};
+
+/*
+ * one parsed input value. null is set for JSON null and empty CSV fields.
+ */
+struct Value {
+    std::string_view    text;
+    bool                null;
+};
+
+/*
+ * split a CSV line into values. Quoted values are unescaped into scratch,
+ * which must not be modified until the values are consumed.
+ */
+bool splitCSV(std::string_view line, std::vector<Value>& values, std::string& scratch)
+{
+    values.clear();
+    scratch.clear();
+    scratch.reserve(line.size());
+    size_t i = 0;
+    for(;;) {
+        if(i < line.size() && line[i] == '"') {
+            size_t start = scratch.size();
+            for(i++; i < line.size(); i++) {
+                if(line[i] == '"') {
+                    if(i + 1 < line.size() && line[i + 1] == '"') {
+                        scratch.push_back('"');
+                        i++;
+                    } else {
+                        break;
+                    }
+                } else {
+                    scratch.push_back(line[i]);
+                }
+            }
+            if(i++ >= line.size())
+                return false;           // unterminated quote
+            values.push_back({ std::string_view(scratch.data() + start, scratch.size() - start), false });
+        } else {
+            size_t end = line.find(',', i);
+            if(end == std::string_view::npos)
+                end = line.size();
+            values.push_back({ line.substr(i, end - i), end == i });
+            i = end;
+        }
+        if(i >= line.size())
+            return true;
+        if(line[i] != ',')
+            return false;
+        i++;
+    }
+}
+
+/*
+ * minimal parser for the flat JSON objects of a JSON Lines file: string,
+ * number, boolean and null values, no nesting.
+ */
+class FlatJSON {
+  public:
+    bool parse(std::string_view line)
+    {
+        m_p = line.data();
+        m_end = line.data() + line.size();
+        m_keys.clear();
+        m_values.clear();
+        m_scratch.clear();
+        m_scratch.reserve(line.size());
+
+        skip();
+        if(!consume('{'))
+            return false;
+        skip();
+        if(consume('}'))
+            return true;
+        do {
+            std::string_view key, text;
+            skip();
+            if(!string(key))
+                return false;
+            skip();
+            if(!consume(':'))
+                return false;
+            skip();
+            bool null = false;
+            if(m_p < m_end && *m_p == '"') {
+                if(!string(text))
+                    return false;
+            } else {
+                const char *start = m_p;
+                while(m_p < m_end && *m_p != ',' && *m_p != '}' && !isspace(static_cast<unsigned char>(*m_p)))
+                    m_p++;
+                text = std::string_view(start, m_p - start);
+                null = text == "null";
+                if(text.empty())
+                    return false;
+            }
+            m_keys.push_back(key);
+            m_values.push_back({ text, null });
+            skip();
+        } while(consume(','));
+        return consume('}');
+    }
+
+    const std::vector<std::string_view>& keys() const { return m_keys; }
+    const std::vector<Value>& values() const { return m_values; }
+
+  private:
+    void skip()
+    {
+        while(m_p < m_end && isspace(static_cast<unsigned char>(*m_p)))
+            m_p++;
+    }
+
+    bool consume(char c)
+    {
+        if(m_p < m_end && *m_p == c) {
+            m_p++;
+            return true;
+        }
+        return false;
+    }
+
+    bool string(std::string_view& out)
+    {
+        if(!consume('"'))
+            return false;
+        const char *start = m_p;
+        while(m_p < m_end && *m_p != '"' && *m_p != '\\')
+            m_p++;
+        if(m_p < m_end && *m_p == '"') {
+            out = std::string_view(start, m_p++ - start);
+            return true;
+        }
+        // escapes present, unescape into the scratch buffer
+        size_t begin = m_scratch.size();
+        m_scratch.append(start, m_p - start);
+        while(m_p < m_end && *m_p != '"') {
+            if(*m_p != '\\') {
+                m_scratch.push_back(*m_p++);
+                continue;
+            }
+            if(++m_p == m_end)
+                return false;
+            char c = *m_p++;
+            switch(c) {
+                case 'n': m_scratch.push_back('\n'); break;
+                case 't': m_scratch.push_back('\t'); break;
+                case 'r': m_scratch.push_back('\r'); break;
+                case 'b': m_scratch.push_back('\b'); break;
+                case 'f': m_scratch.push_back('\f'); break;
+                case 'u': {
+                    unsigned int cp = 0;
+                    if(m_end - m_p < 4 || std::from_chars(m_p, m_p + 4, cp, 16).ptr != m_p + 4)
+                        return false;
+                    m_p += 4;
+                    if(cp < 0x80) {
+                        m_scratch.push_back(static_cast<char>(cp));
+                    } else if(cp < 0x800) {
+                        m_scratch.push_back(static_cast<char>(0xc0 | cp >> 6));
+                        m_scratch.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+                    } else {
+                        m_scratch.push_back(static_cast<char>(0xe0 | cp >> 12));
+                        m_scratch.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+                        m_scratch.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+                    }
+                    break;
+                }
+                default: m_scratch.push_back(c); break;
+            }
+        }
+        if(!consume('"'))
+            return false;
+        out = std::string_view(m_scratch.data() + begin, m_scratch.size() - begin);
+        return true;
+    }
+
+    const char                      *m_p = nullptr, *m_end = nullptr;
+    std::vector<std::string_view>   m_keys;
+    std::vector<Value>              m_values;
+    std::string                     m_scratch;
+};
+
+/*
+ * store value into the record field. Returns false for values which are
+ * present but cannot be parsed.
+ */
+bool setField(HistoryRecord& r, const Field& f, const Value& v)
+{
+    char *dest = reinterpret_cast<char *>(&r) + f.offset;
+    const char *begin = v.text.data(), *end = v.text.data() + v.text.size();
+
+    switch(f.kind) {
+        case INT64:
+        case INT32: {
+            int64_t n = 0;
+            if(!v.null && std::from_chars(begin, end, n).ptr != end) {
+                double d = 0;
+                if(std::from_chars(begin, end, d).ptr != end)
+                    return false;
+                n = static_cast<int64_t>(d);
+            }
+            if(f.kind == INT64) {
+                memcpy(dest, &n, sizeof(int64_t));
+            } else {
+                int32_t i = static_cast<int32_t>(n);
+                memcpy(dest, &i, sizeof(int32_t));
+            }
+            return true;
+        }
+        case REAL: {
+            double d = 0;
+            if(!v.null && std::from_chars(begin, end, d).ptr != end)
+                return false;
+            memcpy(dest, &d, sizeof(double));
+            return true;
+        }
+        case TEXT:
+            snprintf(dest, f.size, "%.*s", static_cast<int>(v.text.size()), v.null ? "" : begin);
+            return true;
+        case ICON:
+            *dest = (v.null || v.text.empty()) ? ' ' : v.text[0];
+            return true;
+        default:
+            return true;
+    }
+}
+
+}
+
+/**
+ * the format given with --historyFormat, or derived from the file name.
+ */
+HistoryIO::Format HistoryIO::formatFor(const std::string& path, const std::string& format)
+{
+    if(!format.empty())
+        return format == "jsonl" ? HistoryIO::JSONL : HistoryIO::CSV;
+    auto ext = std::filesystem::path(path).extension();
+    return (ext == ".jsonl" || ext == ".ndjson" || ext == ".json") ? HistoryIO::JSONL : HistoryIO::CSV;
+}
+
+/**
+ * write all history records with from <= timestamp <= to, archived ones
+ * first.
+ *
+ * @param path  - output file, - for stdout
+ * @return      - the number of records written, -1 on error.
+ */
+long HistoryIO::exportTo(const std::string& path, time_t from, time_t to)
+{
+    std::map<int, std::string>  locations, providers;
+    sqlite3_stmt                *stmt = 0;
+    long                        count = 0;
+    bool                        damaged = false;
+    double                      scale[field_count], offset[field_count];
+
+    // resolve the conversion of every column, values are written as v * scale + offset
+    for(int i = 0; i < field_count; i++) {
+        if(fields[i].quantity < UnitProfile::QUANTITIES) {
+            const auto& unit = this->m_units.unit(static_cast<UnitProfile::Quantity>(fields[i].quantity));
+            scale[i] = unit.scale;
+            offset[i] = unit.offset;
+        } else {
+            scale[i] = 1.0;
+            offset[i] = 0.0;
+        }
+    }
+
+    int fd = path == "-" ? STDOUT_FILENO : ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        LOG_F(INFO, "HistoryIO::exportTo(): unable to open %s (%s)", path.c_str(), strerror(errno));
+        return -1;
+    }
+    OutputBuffer out(fd, this->m_format);
+
+    if(this->m_format == HistoryIO::CSV) {
+        for(int i = 0; i < field_count; i++) {
+            if(i > 0)
+                out.put(',');
+            out.append(fields[i].name);
+        }
+        out.put('\n');
+    }
+
+    // archived records, location and provider names are resolved from the database. The archive
+    // stays locked until the live rows are read, an export cannot move rows between the two
+    ColdArchive *archive = this->m_db.archive();
+    if(!archive && this->m_db.hasArchive()) {
+        LOG_F(INFO, "HistoryIO::exportTo(): the archive cannot be read");
+        damaged = true;
+    }
+    if(archive) {
+        for(auto [table, map] : { std::pair{"SELECT id, name FROM locations", &locations},
+                                  std::pair{"SELECT id, code FROM providers", &providers} }) {
+            if(sqlite3_prepare_v2(this->m_db.handle(), table, -1, &stmt, 0) == SQLITE_OK) {
+                while(sqlite3_step(stmt) == SQLITE_ROW) {
+                    (*map)[sqlite3_column_int(stmt, 0)] = (const char *)sqlite3_column_text(stmt, 1);
+                }
+            }
+            sqlite3_finalize(stmt);
+            stmt = 0;
+        }
+        std::vector<HistoryRecord> records;
+        for(const auto& block : archive->blocks()) {
+            if(!out.ok())
+                break;
+            if(block.header.max_ts < from || block.header.min_ts > to)
+                continue;
+            // export what can be read, but do not report a partial export as success
+            if(!archive->read(block, records)) {
+                LOG_F(INFO, "HistoryIO::exportTo(): %u archived records at offset %llu are damaged and not exported",
+                      block.header.count, static_cast<unsigned long long>(block.offset));
+                damaged = true;
+                continue;
+            }
+            for(const auto& r : records) {
+                if(r.timestamp < from || r.timestamp > to)
+                    continue;
+                out.beginRow();
+                for(int i = 0; i < field_count; i++) {
+                    const Field& f = fields[i];
+                    const char *src = reinterpret_cast<const char *>(&r) + f.offset;
+                    out.beginField(i);
+                    switch(f.kind) {
+                        case INT64: { int64_t v; memcpy(&v, src, sizeof(v)); out.number(v); break; }
+                        case INT32: { int32_t v; memcpy(&v, src, sizeof(v)); out.number(v); break; }
+                        case REAL: { double v; memcpy(&v, src, sizeof(v)); out.real(v * scale[i] + offset[i]); break; }
+                        case TEXT: out.text(src, strnlen(src, f.size)); break;
+                        case ICON: out.text(src, 1); break;
+                        case LOCATION: out.text(locations[r.location_id].data(), locations[r.location_id].size()); break;
+                        case PROVIDER: out.text(providers[r.provider_id].data(), providers[r.provider_id].size()); break;
+                    }
+                }
+                count++;
+                if(!out.endRow())
+                    break;
+            }
+        }
+    }
+
+    std::string sql("SELECT ");
+    for(int i = 0; i < field_count; i++) {
+        sql.append(i ? ", " : "");
+        sql.append(fields[i].kind == LOCATION ? "l.name" : fields[i].kind == PROVIDER ? "p.code" : "h.");
+        if(fields[i].kind != LOCATION && fields[i].kind != PROVIDER)
+            sql.append(fields[i].name);
+    }
+    sql.append(" FROM history h JOIN locations l ON l.id = h.location_id JOIN providers p ON p.id = h.provider_id "
+               "WHERE h.timestamp BETWEEN ?1 AND ?2 AND h.id > ").append(HistoryDB::legacy_limit).append(" ORDER BY h.id");
+    if(sqlite3_prepare_v2(this->m_db.handle(), sql.c_str(), -1, &stmt, 0) != SQLITE_OK) {
+        LOG_F(INFO, "HistoryIO::exportTo(): prepare stmt, error: %s", sqlite3_errmsg(this->m_db.handle()));
+        this->m_db.releaseArchive();
+        if(fd != STDOUT_FILENO)
+            ::close(fd);
+        return -1;
+    }
+    sqlite3_bind_int64(stmt, 1, from);
+    sqlite3_bind_int64(stmt, 2, to);
+    int rc = SQLITE_DONE;
+    while(out.ok() && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        out.beginRow();
+        for(int i = 0; i < field_count; i++) {
+            out.beginField(i);
+            switch(sqlite3_column_type(stmt, i)) {
+                case SQLITE_INTEGER:
+                    out.number(static_cast<int64_t>(sqlite3_column_int64(stmt, i)));
+                    break;
+                case SQLITE_FLOAT:
+                    out.real(sqlite3_column_double(stmt, i) * scale[i] + offset[i]);
+                    break;
+                case SQLITE_NULL:
+                    out.null();
+                    break;
+                default:
+                    out.text((const char *)sqlite3_column_text(stmt, i), sqlite3_column_bytes(stmt, i));
+                    break;
+            }
+        }
+        count++;
+        out.endRow();
+    }
+    sqlite3_finalize(stmt);
+    this->m_db.releaseArchive();
+    bool ok = out.flush() && rc == SQLITE_DONE && !damaged;
+    if(fd != STDOUT_FILENO)
+        ok &= ::close(fd) == 0;
+    if(!ok) {
+        LOG_F(INFO, "HistoryIO::exportTo(): export to %s failed", path.c_str());
+        return -1;
+    }
+    LOG_F(INFO, "HistoryIO::exportTo(): %ld records written to %s", count, path.c_str());
+    return count;
+}
+
+/**
+ * load a CSV or JSON Lines file into the history table.
+ *
+ * @param path      - input file, - for stdin
+ * @param location  - location for records without one
+ * @param provider  - provider for records without one
+ * @return          - the number of records inserted, -1 on error.
+ */
+long HistoryIO::importFrom(const std::string& path, const std::string& location, const std::string& provider)
+{
+    std::vector<HistoryRecord>  batch;
+    std::vector<Value>          values;
+    std::vector<int>            columns;        // CSV column -> field, JSON: field of the n-th key last seen
+    std::string                 scratch, loc, prov, last_loc, last_prov;
+    FlatJSON                    json;
+    char                        *line = nullptr;
+    size_t                      cap = 0;
+    ssize_t                     len;
+    long                        inserted = 0, errors = 0, lineno = 0;
+    int                         loc_id = 0, prov_id = 0, synchronous = 2;
+    sqlite3_stmt                *stmt = 0;
+    sqlite3                     *db = this->m_db.handle();
+
+    FILE *fp = path == "-" ? stdin : fopen(path.c_str(), "r");
+    if(!fp) {
+        LOG_F(INFO, "HistoryIO::importFrom(): unable to open %s (%s)", path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    // the data is in the input file, a crash during the load costs nothing but a rerun
+    if(sqlite3_prepare_v2(db, "PRAGMA synchronous", -1, &stmt, 0) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        synchronous = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_exec(db, "PRAGMA synchronous = OFF", 0, 0, 0);
+    sqlite3_exec(db, "PRAGMA cache_size = -65536", 0, 0, 0);
+
+    batch.reserve(HistoryIO::import_batch);
+    auto flush = [this, &batch, &inserted]() {
+        long n = batch.empty() ? 0 : this->m_db.importRecords(batch.data(), batch.size());
+        batch.clear();
+        if(n < 0)
+            return false;
+        inserted += n;
+        return true;
+    };
+
+    bool ok = true;
+    while(ok && (len = getline(&line, &cap, fp)) >= 0) {
+        std::string_view text(line, len);
+        lineno++;
+        while(!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+            text.remove_suffix(1);
+        if(text.empty())
+            continue;
+
+        HistoryRecord r = {};
+        r.icon = ' ';
+        loc.clear();
+        prov.clear();
+        bool valid = true;
+        if(this->m_format == HistoryIO::CSV) {
+            if(!splitCSV(text, values, scratch)) {
+                valid = false;
+            } else if(columns.empty()) {
+                for(const auto& v : values) {
+                    columns.push_back(fieldIndex(v.text));
+                }
+                if(std::find(columns.begin(), columns.end(), 0) == columns.end()) {
+                    LOG_F(INFO, "HistoryIO::importFrom(): %s has no timestamp column", path.c_str());
+                    ok = false;
+                }
+                continue;
+            }
+            for(size_t i = 0; valid && i < values.size() && i < columns.size(); i++) {
+                if(columns[i] < 0)
+                    continue;
+                const Field& f = fields[columns[i]];
+                if(f.kind == LOCATION)
+                    loc.assign(values[i].text);
+                else if(f.kind == PROVIDER)
+                    prov.assign(values[i].text);
+                else
+                    valid = setField(r, f, values[i]);
+            }
+        } else {
+            valid = json.parse(text);
+            const auto& keys = json.keys();
+            if(columns.size() < keys.size())
+                columns.resize(keys.size(), -1);
+            for(size_t i = 0; valid && i < keys.size(); i++) {
+                // records usually repeat the key order of the previous line
+                if(columns[i] < 0 || keys[i] != fields[columns[i]].name)
+                    columns[i] = fieldIndex(keys[i]);
+                if(columns[i] < 0)
+                    continue;
+                const Field& f = fields[columns[i]];
+                const Value& v = json.values()[i];
+                if(f.kind == LOCATION)
+                    loc.assign(v.null ? "" : v.text);
+                else if(f.kind == PROVIDER)
+                    prov.assign(v.null ? "" : v.text);
+                else
+                    valid = setField(r, f, v);
+            }
+        }
+        if(!valid || r.timestamp == 0) {
+            if(errors++ < 10)
+                LOG_F(INFO, "HistoryIO::importFrom(): %s:%ld: invalid record, skipped", path.c_str(), lineno);
+            continue;
+        }
+
+        if(loc.empty())
+            loc = location;
+        if(prov.empty())
+            prov = provider;
+        if(loc != last_loc || loc_id == 0) {
+            loc_id = this->m_db.locationId(loc);
+            last_loc = loc;
+        }
+        if(prov != last_prov || prov_id == 0) {
+            prov_id = this->m_db.providerId(prov);
+            last_prov = prov;
+        }
+        r.location_id = loc_id;
+        r.provider_id = prov_id;
+        batch.push_back(r);
+        if(batch.size() == HistoryIO::import_batch)
+            ok = flush();
+    }
+    ok = ok && flush();
+
+    free(line);
+    if(fp != stdin)
+        fclose(fp);
+    std::string restore("PRAGMA synchronous = ");
+    restore.append(std::to_string(synchronous));
+    sqlite3_exec(db, restore.c_str(), 0, 0, 0);
+
+    if(errors) {
+        fprintf(stderr, "%ld invalid records in %s were skipped, see the log for details\n", errors, path.c_str());
+    }
+    if(!ok) {
+        LOG_F(INFO, "HistoryIO::importFrom(): import of %s failed after %ld records", path.c_str(), inserted);
+        return -1;
+    }
+    LOG_F(INFO, "HistoryIO::importFrom(): %ld records inserted from %s", inserted, path.c_str());
+    return inserted;
+}
+
+/**
+ * --import and --export. Runs the import first when both are given.
+ *
+ * @return      - 0 on success, -1 otherwise (used as exit code)
+ */
+int HistoryIO::run(const CFG& cfg)
+{
+    std::string db_path(cfg.data_dir_path), location(cfg.location);
+
+    db_path.append("/history.sqlite3");
+    if(location.empty() && !cfg.lat.empty())
+        location = cfg.lat + "," + cfg.lon;
+    if(location.empty())
+        location = "unknown";
+
+    HistoryDB db(db_path, location, cfg.apiProviderString);
+    if(!db.open()) {
+        fprintf(stderr, "Unable to open the history database %s\n", db_path.c_str());
+        return -1;
+    }
+
+    if(!cfg.legacyUnits.empty()) {
+        UnitProfile units = UnitProfile::metric();
+        sqlite3_int64 converted = 0;
+        if(!UnitProfile::parse(cfg.legacyUnits, units)) {
+            fprintf(stderr, "Invalid --legacyUnits %s. Expected TEMP[,SPEED[,VIS[,PRESSURE]]], e.g. F,mph,mi,inhg\n",
+                    cfg.legacyUnits.c_str());
+            return -1;
+        }
+        if(!db.hasLegacy()) {
+            fprintf(stderr, "The history in %s holds no records of older versions to convert.\n", db_path.c_str());
+        } else if(!db.convertLegacy(units, converted)) {
+            fprintf(stderr, "Converting the history of older versions failed, see the log for details.\n");
+            return -1;
+        } else {
+            fprintf(stderr, "%lld records of older versions converted from %s\n", static_cast<long long>(converted),
+                    cfg.legacyUnits.c_str());
+        }
+    }
+    if(!cfg.importPath.empty()) {
+        HistoryIO io(db, HistoryIO::formatFor(cfg.importPath, cfg.historyFormat));
+        auto start = std::chrono::steady_clock::now();
+        long n = io.importFrom(cfg.importPath, location, cfg.apiProviderString);
+        if(n < 0) {
+            fprintf(stderr, "Import from %s failed.\n", cfg.importPath.c_str());
+            return -1;
+        }
+        fprintf(stderr, "%ld records imported from %s in %.2f s\n", n, cfg.importPath.c_str(),
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    if(!cfg.exportPath.empty()) {
+        UnitProfile units = UnitProfile::metric();
+        if(!cfg.exportUnits.empty() && !UnitProfile::parse(cfg.exportUnits, units)) {
+            fprintf(stderr, "Invalid --exportUnits %s. Expected TEMP[,SPEED[,VIS[,PRESSURE]]], e.g. F,mph,mi,inhg\n",
+                    cfg.exportUnits.c_str());
+            return -1;
+        }
+        if(db.hasLegacy()) {
+            fprintf(stderr, "History recorded by older versions is not exported, its units are unknown.\n"
+                            "Convert it once with --legacyUnits.\n");
+        }
+        HistoryIO io(db, HistoryIO::formatFor(cfg.exportPath, cfg.historyFormat), units);
+        auto start = std::chrono::steady_clock::now();
+        long n = io.exportTo(cfg.exportPath, cfg.exportFrom, cfg.exportTo ? cfg.exportTo : time(0));
+        if(n < 0) {
+            fprintf(stderr, "Export to %s failed.\n", cfg.exportPath.c_str());
+            return -1;
+        }
+        fprintf(stderr, "%ld records exported to %s in %.2f s\n", n, cfg.exportPath.c_str(),
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_HISTORYIO_H_
+#define FETCHWEATHER_SRC_HISTORYIO_H_
+
+#include "pch.h"
+#include "options.h"
+#include "HistoryDB.h"
+
+/*
+ * bulk export and import of the raw history as CSV (with a header line) or
+ * JSON Lines (one flat object per record).
+ *
+ * Exports stream rows from sqlite3_step() (and archive blocks) through a
+ * large output buffer, numbers are formatted with std::to_chars. Imports map
+ * columns by name, unknown columns are ignored and missing ones default to
+ * 0 (location and provider to the configured ones). Rows are loaded in
+ * batches of import_batch per transaction with synchronous=OFF. Rows
+ * already recorded for the same location, provider and time are skipped,
+ * so an import can be repeated.
+ *
+ * The history is recorded in metric units. Exports can be converted into
+ * another unit profile (--exportUnits), imports must be metric.
+ */
+class HistoryIO {
+  public:
+    enum Format { CSV, JSONL };
+
+    HistoryIO(HistoryDB& db, Format format, const UnitProfile& units = UnitProfile::metric())
+        : m_db(db), m_format(format), m_units(units) {}
+
+    long    exportTo(const std::string& path, time_t from, time_t to);
+    long    importFrom(const std::string& path, const std::string& location, const std::string& provider);
+
+    static Format   formatFor(const std::string& path, const std::string& format);
+    static int      run(const CFG& cfg);
+
+    static constexpr size_t import_batch = 100000;          // records per transaction
+    static constexpr size_t buffer_size = 1 << 20;           // output buffer
+
+  private:
+    HistoryDB&  m_db;
+    Format      m_format;
+    UnitProfile m_units;            // for exports
+};
+
+#endif //FETCHWEATHER_SRC_HISTORYIO_H_
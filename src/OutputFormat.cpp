@@ -0,0 +1,387 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <charconv>
+#include <cstddef>
+#include "OutputFormat.h"
+#include "OutputTemplate.h"
+#include "DataHandler.h"
+#include "options.h"
+
+namespace {
+
+enum Type { REAL, INT32, TIME };
+
+struct Metric {
+    const char  *name;              // JSON key and Influx field
+    const char  *prometheus;        // metric name without the weather_ prefix
+    const char  *help;
+    Type        type;
+    size_t      offset;             // into DataPoint
+    int         quantity;           // unit conversion for JSON and Influx
+    double      base;               // factor into the Prometheus base unit
+};
+
+constexpr int none = UnitProfile::QUANTITIES;
+
+#define METRIC(name, prom, help, type, member, q, base) { name, prom, help, type, offsetof(DataPoint, member), q, base }
+
+/*
+ * the numeric values of a snapshot in output order.
+ */
+const Metric metrics[] = {
+    METRIC("temperature", "temperature_celsius", "Air temperature.", REAL, temperature, UnitProfile::TEMPERATURE, 1),
+    METRIC("feelslike", "apparent_temperature_celsius", "Apparent (feels like) temperature.", REAL,
+           temperatureApparent, UnitProfile::TEMPERATURE, 1),
+    METRIC("dewpoint", "dewpoint_celsius", "Dew point.", REAL, dewPoint, UnitProfile::TEMPERATURE, 1),
+    METRIC("tempMin", "temperature_min_celsius", "Minimum temperature of the day.", REAL, temperatureMin,
+           UnitProfile::TEMPERATURE, 1),
+    METRIC("tempMax", "temperature_max_celsius", "Maximum temperature of the day.", REAL, temperatureMax,
+           UnitProfile::TEMPERATURE, 1),
+    METRIC("humidity", "relative_humidity_percent", "Relative humidity.", REAL, humidity, none, 1),
+    METRIC("pressure", "pressure_sea_level_pascals", "Air pressure at sea level.", REAL, pressureSeaLevel,
+           UnitProfile::PRESSURE, 100),
+    METRIC("windspeed", "wind_speed_meters_per_second", "Wind speed.", REAL, windSpeed, UnitProfile::SPEED, 1),
+    METRIC("windgust", "wind_gust_meters_per_second", "Wind gust speed.", REAL, windGust, UnitProfile::SPEED, 1),
+    METRIC("windbearing", "wind_direction_degrees", "Wind direction.", INT32, windDirection, none, 1),
+    METRIC("visibility", "visibility_meters", "Visibility.", REAL, visibility, UnitProfile::VISIBILITY, 1000),
+    METRIC("precip_probability", "precipitation_probability_percent", "Probability of precipitation.", REAL,
+           precipitationProbability, none, 1),
+    METRIC("precip_intensity", "precipitation_intensity_millimeters_per_hour", "Precipitation intensity.", REAL,
+           precipitationIntensity, none, 1),
+    METRIC("cloudCover", "cloud_cover_percent", "Cloud cover.", REAL, cloudCover, none, 1),
+    METRIC("cloudBase", "cloud_base_meters", "Cloud base.", REAL, cloudBase, none, 1000),
+    METRIC("cloudCeiling", "cloud_ceiling_meters", "Cloud ceiling.", REAL, cloudCeiling, none, 1000),
+    METRIC("uvindex", "uv_index", "UV index.", REAL, uvIndex, none, 1),
+    METRIC("moonPhase", "moon_phase", "Moon phase, 0 = new moon, 4 = full moon.", INT32, moonPhase, none, 1),
+    METRIC("weatherCode", "condition_code", "Provider specific weather condition code.", INT32, weatherCode, none, 1),
+    METRIC("timestamp", "observation_timestamp_seconds", "Time of the observation.", TIME, timeRecorded, none, 1),
+    METRIC("sunrise", "sunrise_timestamp_seconds", "Time of sunrise.", TIME, sunriseTime, none, 1),
+    METRIC("sunset", "sunset_timestamp_seconds", "Time of sunset.", TIME, sunsetTime, none, 1),
+    METRIC("dawn", "civil_dawn_timestamp_seconds", "Begin of civil twilight.", TIME, dawnTime, none, 1),
+    METRIC("dusk", "civil_dusk_timestamp_seconds", "End of civil twilight.", TIME, duskTime, none, 1) };
+
+#undef METRIC
+
+constexpr int days = 3;             // DataHandler::m_daily
+
+/*
+ * the metric value of m in the snapshot, NAN if the provider does not
+ * deliver it. Times of 0 (no sunrise in polar night) are missing as well.
+ */
+double value(const DataPoint& d, const Metric& m)
+{
+    const char *src = reinterpret_cast<const char *>(&d) + m.offset;
+
+    if(m.offset == offsetof(DataPoint, uvIndex) && !d.haveUVI)
+        return NAN;
+    switch(m.type) {
+        case INT32: { int32_t v; memcpy(&v, src, sizeof(v)); return v; }
+        case TIME: { time_t v; memcpy(&v, src, sizeof(v)); return v ? static_cast<double>(v) : NAN; }
+        default: { double v; memcpy(&v, src, sizeof(v)); return v; }
+    }
+}
+
+void number(std::string& out, double v)
+{
+    char tmp[32];
+    auto result = std::to_chars(tmp, tmp + sizeof(tmp), v);
+    out.append(tmp, result.ptr);
+}
+
+void integer(std::string& out, int64_t v)
+{
+    char tmp[24];
+    auto result = std::to_chars(tmp, tmp + sizeof(tmp), v);
+    out.append(tmp, result.ptr);
+}
+
+/*
+ * append s, prefixing every character in special with a backslash. \n is
+ * written as \\n.
+ */
+void escaped(std::string& out, std::string_view s, std::string_view special)
+{
+    for(char c : s) {
+        if(c == '\n') {
+            out.append("\\n");
+            continue;
+        }
+        if(special.find(c) != std::string_view::npos)
+            out.push_back('\\');
+        out.push_back(c);
+    }
+}
+
+void jsonString(std::string& out, std::string_view s)
+{
+    out.push_back('"');
+    for(unsigned char c : s) {
+        if(c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if(c < 0x20) {
+            char tmp[8];
+            snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+            out.append(tmp);
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+void jsonNumber(std::string& out, double v)
+{
+    if(std::isfinite(v))
+        number(out, v);
+    else
+        out.append("null");
+}
+
+double converted(const UnitProfile& units, const Metric& m, double v)
+{
+    return m.quantity == none ? v : units.convert(static_cast<UnitProfile::Quantity>(m.quantity), v);
+}
+
+}
+
+/**
+ * render the output in the given format into out (previous content is
+ * discarded).
+ */
+void OutputFormat::render(Kind kind, const DataHandler& handler, const UnitProfile& units,
+                          const OutputTemplate& layout, std::string& out)
+{
+    switch(kind) {
+        case JSON: OutputFormat::renderJSON(handler, units, out); break;
+        case PROMETHEUS: OutputFormat::renderPrometheus(handler, out); break;
+        case INFLUX: OutputFormat::renderInflux(handler, units, out); break;
+        default: layout.render(handler, units, out); break;
+    }
+}
+
+void OutputFormat::renderJSON(const DataHandler& handler, const UnitProfile& units, std::string& out)
+{
+    const CFG&          cfg = handler.config();
+    const DataPoint&    d = handler.getDataPoint();
+
+    out.clear();
+    out.reserve(2048);
+    out.append("{\"location\":");
+    jsonString(out, handler.locationKey());
+    out.append(",\"provider\":");
+    jsonString(out, cfg.apiProviderString);
+    out.append(",\"timezone\":");
+    jsonString(out, cfg.timezone);
+    out.append(",\"units\":{\"temperature\":");
+    jsonString(out, units.unit(UnitProfile::TEMPERATURE).label);
+    out.append(",\"speed\":");
+    jsonString(out, units.unit(UnitProfile::SPEED).label);
+    out.append(",\"visibility\":");
+    jsonString(out, units.unit(UnitProfile::VISIBILITY).label);
+    out.append(",\"pressure\":");
+    jsonString(out, units.unit(UnitProfile::PRESSURE).label);
+
+    out.append("},\"current\":{");
+    for(const auto& m : metrics) {
+        out.push_back('"');
+        out.append(m.name);
+        out.append("\":");
+        jsonNumber(out, converted(units, m, value(d, m)));
+        out.push_back(',');
+    }
+    out.append("\"time\":");
+    jsonString(out, d.timeRecordedAsText);
+    out.append(",\"summary\":");
+    jsonString(out, d.conditionAsString);
+    out.append(",\"icon\":");
+    jsonString(out, std::string_view(&d.weatherSymbol, 1));
+    out.append(",\"precip_type\":");
+    jsonString(out, d.precipitationTypeAsString);
+    out.append(",\"winddir\":");
+    jsonString(out, d.windBearing);
+    out.append(",\"is_day\":");
+    out.append(d.is_day ? "true" : "false");
+
+    out.append("},\"daily\":[");
+    for(int i = 0; i < days; i++) {
+        const DailyForecast& day = handler.getDaily(i);
+        out.append(i ? ",{\"weekday\":" : "{\"weekday\":");
+        jsonString(out, day.weekDay);
+        out.append(",\"icon\":");
+        jsonString(out, std::string_view(&day.code, 1));
+        out.append(",\"low\":");
+        jsonNumber(out, units.temperature(day.temperatureMin));
+        out.append(",\"high\":");
+        jsonNumber(out, units.temperature(day.temperatureMax));
+        out.append(",\"pop\":");
+        jsonNumber(out, day.pop);
+        out.push_back('}');
+    }
+    out.append("]}\n");
+}
+
+void OutputFormat::renderPrometheus(const DataHandler& handler, std::string& out)
+{
+    const CFG&          cfg = handler.config();
+    const DataPoint&    d = handler.getDataPoint();
+    std::string         labels("location=\"");
+
+    escaped(labels, handler.locationKey(), "\\\"");
+    labels.append("\",provider=\"");
+    escaped(labels, cfg.apiProviderString, "\\\"");
+    labels.push_back('"');
+
+    auto family = [&out](const char *name, const char *help) {
+        out.append("# HELP weather_").append(name).append(" ").append(help);
+        out.append("\n# TYPE weather_").append(name).append(" gauge\n");
+    };
+
+    out.clear();
+    out.reserve(4096);
+    for(const auto& m : metrics) {
+        double v = value(d, m);
+        family(m.prometheus, m.help);
+        out.append("weather_").append(m.prometheus).append("{").append(labels).append("} ");
+        if(std::isnan(v))
+            out.append("NaN");
+        else
+            number(out, v * m.base);
+        out.push_back('\n');
+    }
+
+    family("info", "Text values of the current conditions, always 1.");
+    out.append("weather_info{").append(labels).append(",summary=\"");
+    escaped(out, d.conditionAsString, "\\\"");
+    out.append("\",icon=\"");
+    escaped(out, std::string_view(&d.weatherSymbol, 1), "\\\"");
+    out.append("\",precip_type=\"");
+    escaped(out, d.precipitationTypeAsString, "\\\"");
+    out.append("\",winddir=\"");
+    escaped(out, d.windBearing, "\\\"");
+    out.append("\"} 1\n");
+
+    struct { const char *name, *help; } forecast[] = {
+        { "forecast_temperature_min_celsius", "Forecast minimum temperature, day 0 is today." },
+        { "forecast_temperature_max_celsius", "Forecast maximum temperature, day 0 is today." },
+        { "forecast_precipitation_probability_percent", "Forecast probability of precipitation." } };
+    for(size_t f = 0; f < std::size(forecast); f++) {
+        family(forecast[f].name, forecast[f].help);
+        for(int i = 0; i < days; i++) {
+            const DailyForecast& day = handler.getDaily(i);
+            double v = f == 0 ? day.temperatureMin : f == 1 ? day.temperatureMax : day.pop;
+            out.append("weather_").append(forecast[f].name).append("{").append(labels).append(",day=\"");
+            integer(out, i);
+            out.append("\"} ");
+            if(std::isnan(v))
+                out.append("NaN");
+            else
+                number(out, v);
+            out.push_back('\n');
+        }
+    }
+}
+
+void OutputFormat::renderInflux(const DataHandler& handler, const UnitProfile& units, std::string& out)
+{
+    const CFG&          cfg = handler.config();
+    const DataPoint&    d = handler.getDataPoint();
+    std::string         tags(",location=");
+    char                sep;
+
+    escaped(tags, handler.locationKey(), ",= \\");
+    tags.append(",provider=");
+    escaped(tags, cfg.apiProviderString, ",= \\");
+
+    out.clear();
+    out.reserve(2048);
+    out.append("weather").append(tags);
+    sep = ' ';
+    for(const auto& m : metrics) {
+        double v = value(d, m);
+        if(std::isnan(v) || m.offset == offsetof(DataPoint, timeRecorded))
+            continue;
+        out.push_back(sep);
+        out.append(m.name).push_back('=');
+        if(m.type == REAL) {
+            number(out, converted(units, m, v));
+        } else {
+            integer(out, static_cast<int64_t>(v));
+            out.push_back('i');
+        }
+        sep = ',';
+    }
+    for(auto [name, text] : { std::pair<const char *, std::string_view>{ "summary", d.conditionAsString },
+                              { "icon", std::string_view(&d.weatherSymbol, 1) },
+                              { "precip_type", d.precipitationTypeAsString },
+                              { "winddir", d.windBearing } }) {
+        out.push_back(sep);
+        out.append(name).append("=\"");
+        escaped(out, text, "\"\\");
+        out.push_back('"');
+        sep = ',';
+    }
+    out.push_back(' ');
+    integer(out, static_cast<int64_t>(d.timeRecorded));
+    out.append("000000000\n");
+
+    for(int i = 0; i < days; i++) {
+        const DailyForecast& day = handler.getDaily(i);
+        out.append("weather_forecast").append(tags).append(",day=");
+        integer(out, i);
+        sep = ' ';
+        for(auto [name, v] : { std::pair<const char *, double>{ "low", units.temperature(day.temperatureMin) },
+                               { "high", units.temperature(day.temperatureMax) },
+                               { "pop", day.pop } }) {
+            if(std::isnan(v))
+                continue;
+            out.push_back(sep);
+            out.append(name).push_back('=');
+            number(out, v);
+            sep = ',';
+        }
+        out.push_back(sep);
+        out.append("weekday=\"");
+        escaped(out, day.weekDay, "\"\\");
+        out.append("\" ");
+        integer(out, static_cast<int64_t>(d.timeRecorded));
+        out.append("000000000\n");
+    }
+}
+
+/**
+ * @return      - false if name is not one of names[].
+ */
+bool OutputFormat::parse(const std::string& name, Kind& kind)
+{
+    for(size_t i = 0; i < std::size(OutputFormat::names); i++) {
+        if(name == OutputFormat::names[i]) {
+            kind = static_cast<Kind>(i);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,66 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_OUTPUTFORMAT_H_
+#define FETCHWEATHER_SRC_OUTPUTFORMAT_H_
+
+#include "pch.h"
+#include "UnitProfile.h"
+
+class DataHandler;
+class OutputTemplate;
+
+/*
+ * the output formats. TEXT renders a template (the conky layout by
+ * default), the others are machine-readable and generated directly from
+ * the snapshot and the daily forecast:
+ *
+ * JSON         one object with the current conditions and the daily
+ *              forecast, values in the unit profile, labels under "units".
+ * PROMETHEUS   node_exporter textfile format. Metric names carry their unit
+ *              and use base units (celsius, meters, pascals...), the unit
+ *              profile is ignored.
+ * INFLUX       InfluxDB line protocol, measurements weather and
+ *              weather_forecast with location and provider tags, values
+ *              in the unit profile.
+ *
+ * Numbers are formatted with std::to_chars (shortest representation).
+ */
+class OutputFormat {
+  public:
+    enum Kind { TEXT, JSON, PROMETHEUS, INFLUX };
+
+    static void render(Kind kind, const DataHandler& handler, const UnitProfile& units,
+                       const OutputTemplate& layout, std::string& out);
+    static void renderJSON(const DataHandler& handler, const UnitProfile& units, std::string& out);
+    static void renderPrometheus(const DataHandler& handler, std::string& out);
+    static void renderInflux(const DataHandler& handler, const UnitProfile& units, std::string& out);
+
+    static bool parse(const std::string& name, Kind& kind);
+
+    static constexpr const char *names[] = { "text", "json", "prometheus", "influx" };
+};
+
+#endif //FETCHWEATHER_SRC_OUTPUTFORMAT_H_
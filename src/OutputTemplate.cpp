@@ -0,0 +1,503 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <charconv>
+#include <cstddef>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <unistd.h>
+#include "OutputTemplate.h"
+#include "options.h"
+#include "utils.h"
+
+namespace {
+
+enum Source : uint8_t { SNAPSHOT, DAY, CONTEXT };
+enum Kind : uint8_t { REAL, INT, TIME, CHAR, STRING, BOOL, UNIT, TIMEZONE, LOCATION, PROVIDER };
+
+struct Field {
+    const char  *name;
+    Source      source;
+    Kind        kind;
+    size_t      offset;             // into DataPoint or DailyForecast
+    int         quantity;           // unit conversion, QUANTITIES = none
+    int         decimals;           // default for REAL fields without quantity
+};
+
+constexpr int none = UnitProfile::QUANTITIES;
+
+#define SNAP(name, kind, member, q, dec) { name, SNAPSHOT, kind, offsetof(DataPoint, member), q, dec }
+#define DAILY(name, kind, member, q, dec) { name, DAY, kind, offsetof(DailyForecast, member), q, dec }
+
+/*
+ * all fields a template can use. Daily forecast fields are written as
+ * day0.low ... day2.low in templates.
+ */
+const Field fields[] = {
+    SNAP("temperature", REAL, temperature, UnitProfile::TEMPERATURE, 1),
+    SNAP("feelslike", REAL, temperatureApparent, UnitProfile::TEMPERATURE, 1),
+    SNAP("dewpoint", REAL, dewPoint, UnitProfile::TEMPERATURE, 1),
+    SNAP("tempMin", REAL, temperatureMin, UnitProfile::TEMPERATURE, 1),
+    SNAP("tempMax", REAL, temperatureMax, UnitProfile::TEMPERATURE, 1),
+    SNAP("windspeed", REAL, windSpeed, UnitProfile::SPEED, 1),
+    SNAP("windgust", REAL, windGust, UnitProfile::SPEED, 1),
+    SNAP("visibility", REAL, visibility, UnitProfile::VISIBILITY, 1),
+    SNAP("pressure", REAL, pressureSeaLevel, UnitProfile::PRESSURE, 0),
+    SNAP("humidity", REAL, humidity, none, 1),
+    SNAP("precip_probability", REAL, precipitationProbability, none, 0),
+    SNAP("precip_intensity", REAL, precipitationIntensity, none, 1),
+    SNAP("cloudCover", REAL, cloudCover, none, 0),
+    SNAP("cloudBase", REAL, cloudBase, none, 0),
+    SNAP("cloudCeiling", REAL, cloudCeiling, none, 0),
+    SNAP("uvindex", REAL, uvIndex, none, 1),
+    SNAP("windbearing", INT, windDirection, none, 0),
+    SNAP("moonPhase", INT, moonPhase, none, 0),
+    SNAP("weatherCode", INT, weatherCode, none, 0),
+    SNAP("timestamp", TIME, timeRecorded, none, 0),
+    SNAP("icon", CHAR, weatherSymbol, none, 0),
+    SNAP("summary", STRING, conditionAsString, none, 0),
+    SNAP("precip_type", STRING, precipitationTypeAsString, none, 0),
+    SNAP("winddir", STRING, windBearing, none, 0),
+    SNAP("time", STRING, timeRecordedAsText, none, 0),
+    SNAP("sunrise", STRING, sunriseTimeAsString, none, 0),
+    SNAP("sunset", STRING, sunsetTimeAsString, none, 0),
+    SNAP("dawn", STRING, dawnTimeAsString, none, 0),
+    SNAP("dusk", STRING, duskTimeAsString, none, 0),
+    SNAP("moon", STRING, moonPhaseAsString, none, 0),
+    SNAP("is_day", BOOL, is_day, none, 0),
+    SNAP("have_uvi", BOOL, haveUVI, none, 0),
+    DAILY("day.icon", CHAR, code, none, 0),
+    DAILY("day.low", REAL, temperatureMin, UnitProfile::TEMPERATURE, 1),
+    DAILY("day.high", REAL, temperatureMax, UnitProfile::TEMPERATURE, 1),
+    DAILY("day.pop", REAL, pop, none, 0),
+    DAILY("day.weekday", STRING, weekDay, none, 0),
+    { "temperature_unit", CONTEXT, UNIT, 0, UnitProfile::TEMPERATURE, 0 },
+    { "speed_unit", CONTEXT, UNIT, 0, UnitProfile::SPEED, 0 },
+    { "visibility_unit", CONTEXT, UNIT, 0, UnitProfile::VISIBILITY, 0 },
+    { "pressure_unit", CONTEXT, UNIT, 0, UnitProfile::PRESSURE, 0 },
+    { "timezone", CONTEXT, TIMEZONE, 0, none, 0 },
+    { "location", CONTEXT, LOCATION, 0, none, 0 },
+    { "provider", CONTEXT, PROVIDER, 0, none, 0 } };
+
+#undef SNAP
+#undef DAILY
+
+constexpr int days = 3;             // DataHandler::m_daily
+
+/*
+ * find a field by name, dayN.xxx sets day.
+ */
+int fieldIndex(std::string_view name, int& day)
+{
+    std::string key(name);
+
+    day = 0;
+    if(name.size() > 5 && name.substr(0, 3) == "day" && isdigit(static_cast<unsigned char>(name[3])) &&
+       name[4] == '.') {
+        day = name[3] - '0';
+        if(day >= days)
+            return -1;
+        key = "day" + std::string(name.substr(4));
+    }
+    for(size_t i = 0; i < std::size(fields); i++) {
+        if(key == fields[i].name && (fields[i].source == DAY) == (key != name))
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+/*
+ * identifies the field table, compiled templates refer to it by index.
+ */
+uint64_t fieldsHash()
+{
+    uint64_t hash = utils::fnv1a(nullptr, 0);
+    for(const auto& f : fields) {
+        hash = utils::fnv1a(f.name, strlen(f.name), hash);
+        hash = utils::fnv1a(&f.kind, sizeof(f.kind), hash);
+    }
+    return hash;
+}
+
+struct CacheHeader {
+    char        magic[8];
+    uint64_t    fields_hash;
+    int64_t     source_mtime, source_size;
+    uint32_t    code_count, literal_size;
+    uint64_t    size_hint;
+};
+
+constexpr char cache_magic[8] = "FWTPL01";
+
+}
+
+/*
+ * the conky layout, line numbers are those used by the conky configuration.
+ */
+const char * const OutputTemplate::default_layout =
+    "** Begin output **\n"
+    "{icon}\n"
+    "{temperature}{temperature_unit}\n"
+    "{day0.icon}\n{day0.low}\n{day0.high}\n{day0.weekday}\n"
+    "{day1.icon}\n{day1.low}\n{day1.high}\n{day1.weekday}\n"
+    "{day2.icon}\n{day2.low}\n{day2.high}\n{day2.weekday}\n"
+    "{feelslike}{temperature_unit}\n"                                                       // 16
+    "{dewpoint}{temperature_unit}\n"                                                        // 17
+    "Humidity: {humidity:.1}\n"                                                             // 18
+    "{pressure} {pressure_unit}\n"                                                          // 19
+    "{windspeed} {speed_unit}\n"                                                            // 20
+    "{if precip_intensity}{precip_type} ({precip_intensity:.1}mm/1h){else}PoP: {precip_probability:.0}%{end}\n" // 21
+    "{visibility} {visibility_unit}\n"                                                      // 22
+    "{sunrise}\n"                                                                           // 23
+    "{sunset}\n"                                                                            // 24
+    "{winddir}\n"                                                                           // 25
+    "{time}\n"                                                                              // 26
+    "{summary}{if cloudCover} ({cloudCover:.0}% cov.){end}\n"                               // 27
+    "{timezone}\n"                                                                          // 28
+    "{tempMin}{temperature_unit}\n"                                                         // 29
+    "{tempMax}{temperature_unit}\n"                                                         // 30
+    "{if have_uvi}UV: {uvindex:.1}{else} {end}\n"                                           // 31
+    "** end data **\n"                                                                      // 32
+    "{cloudCover:.0} (Clouds)\n"
+    "{cloudBase:.0} (Cloudbase)\n"
+    "{cloudCeiling:.0} (Cloudceil)\n"
+    "{moonPhase} (Moon)\n";
+
+/**
+ * compile a template into the instruction list.
+ *
+ * @param source    - the template text
+ * @param error     - receives a description of the first error
+ * @return          - false if the template is invalid, the previous
+ *                    instructions are kept in that case.
+ */
+bool OutputTemplate::compile(std::string_view source, std::string& error)
+{
+    std::vector<Instruction>    code;
+    std::string                 literals, text;
+    std::vector<std::pair<size_t, bool>>    blocks;     // open {if}: jump to patch, {else} seen
+    size_t                      fields_used = 0;
+
+    auto fail = [&source, &error](size_t pos, const std::string& msg) {
+        error = "line " + std::to_string(std::count(source.begin(), source.begin() + pos, '\n') + 1) + ": " + msg;
+        return false;
+    };
+    auto flush = [&code, &literals, &text]() {
+        if(text.empty())
+            return;
+        code.push_back({ .op = TEXT, .arg = static_cast<uint32_t>(literals.size()),
+                         .len = static_cast<uint32_t>(text.size()) });
+        literals.append(text);
+        text.clear();
+    };
+
+    for(size_t i = 0; i < source.size();) {
+        if(source[i] != '{') {
+            text.push_back(source[i++]);
+            continue;
+        }
+        if(i + 1 < source.size() && source[i + 1] == '{') {
+            text.push_back('{');
+            i += 2;
+            continue;
+        }
+        size_t end = source.find('}', i);
+        if(end == std::string_view::npos)
+            return fail(i, "unterminated {");
+        std::string tag(utils::trim_copy(std::string(source.substr(i + 1, end - i - 1))));
+        size_t pos = i;
+        i = end + 1;
+        flush();
+
+        if(tag.compare(0, 3, "if ") == 0) {
+            std::string_view name(tag);
+            name.remove_prefix(3);
+            while(!name.empty() && name.front() == ' ')
+                name.remove_prefix(1);
+            bool negate = !name.empty() && name.front() == '!';
+            if(negate)
+                name.remove_prefix(1);
+            int day, field = fieldIndex(name, day);
+            if(field < 0)
+                return fail(pos, "unknown field " + std::string(name));
+            blocks.emplace_back(code.size(), false);
+            code.push_back({ .op = JUMP_UNLESS, .negate = negate, .day = static_cast<uint8_t>(day),
+                             .field = static_cast<uint16_t>(field) });
+        } else if(tag == "else") {
+            if(blocks.empty() || blocks.back().second)
+                return fail(pos, "{else} without {if}");
+            code.push_back({ .op = JUMP });
+            code[blocks.back().first].arg = static_cast<uint32_t>(code.size());
+            blocks.back() = { code.size() - 1, true };
+        } else if(tag == "end") {
+            if(blocks.empty())
+                return fail(pos, "{end} without {if}");
+            code[blocks.back().first].arg = static_cast<uint32_t>(code.size());
+            blocks.pop_back();
+        } else {
+            std::string_view name(tag), format;
+            int decimals = -1;
+            if(auto colon = name.find(':'); colon != std::string_view::npos) {
+                format = name.substr(colon + 1);
+                name = name.substr(0, colon);
+                if(format.size() < 2 || format[0] != '.' ||
+                   std::from_chars(format.data() + 1, format.data() + format.size(), decimals).ptr !=
+                       format.data() + format.size() || decimals < 0 || decimals > 15)
+                    return fail(pos, "invalid format " + std::string(format) + " (expected .N, N = 0..15)");
+            }
+            int day, field = fieldIndex(name, day);
+            if(field < 0)
+                return fail(pos, "unknown field " + std::string(name));
+            code.push_back({ .op = FIELD, .decimals = static_cast<int8_t>(decimals),
+                             .day = static_cast<uint8_t>(day), .field = static_cast<uint16_t>(field) });
+            fields_used++;
+        }
+    }
+    flush();
+    if(!blocks.empty())
+        return fail(source.size(), "missing {end}");
+
+    this->m_code = std::move(code);
+    this->m_literals = std::move(literals);
+    this->m_sizeHint = this->m_literals.size() + fields_used * 16;
+    return true;
+}
+
+/**
+ * render the template for the current snapshot of handler.
+ *
+ * @param out   - receives the output, previous content is discarded.
+ */
+void OutputTemplate::render(const DataHandler& handler, const UnitProfile& units, std::string& out) const
+{
+    const CFG&          cfg = handler.config();
+    const DataPoint&    d = handler.getDataPoint();
+    char                tmp[400];
+
+    out.clear();
+    out.reserve(this->m_sizeHint);
+
+    for(size_t pc = 0; pc < this->m_code.size();) {
+        const Instruction& ins = this->m_code[pc++];
+        if(ins.op == TEXT) {
+            out.append(this->m_literals, ins.arg, ins.len);
+            continue;
+        }
+        if(ins.op == JUMP) {
+            pc = ins.arg;
+            continue;
+        }
+
+        const Field& f = fields[ins.field];
+        const char *src = f.source == DAY ? reinterpret_cast<const char *>(&handler.getDaily(ins.day)) + f.offset
+                                          : reinterpret_cast<const char *>(&d) + f.offset;
+        double value = 0;
+        const char *text = nullptr;
+        switch(f.kind) {
+            case REAL: memcpy(&value, src, sizeof(double)); break;
+            case INT: { int32_t v; memcpy(&v, src, sizeof(v)); value = v; break; }
+            case TIME: { time_t v; memcpy(&v, src, sizeof(v)); value = static_cast<double>(v); break; }
+            case CHAR: tmp[0] = *src; tmp[1] = 0; text = tmp; break;
+            case STRING: text = src; break;
+            case BOOL: value = *reinterpret_cast<const bool *>(src); break;
+            case UNIT: text = units.unit(static_cast<UnitProfile::Quantity>(f.quantity)).label; break;
+            case TIMEZONE: text = cfg.timezone.c_str(); break;
+            case LOCATION: break;
+            case PROVIDER: text = cfg.apiProviderString.c_str(); break;
+        }
+
+        if(ins.op == JUMP_UNLESS) {
+            bool truth = f.kind == LOCATION ? true : text ? *text != 0 : (value != 0 && !std::isnan(value));
+            if(truth == static_cast<bool>(ins.negate))
+                pc = ins.arg;
+            continue;
+        }
+
+        // FIELD
+        if(f.kind == LOCATION) {
+            out.append(handler.locationKey());
+        } else if(text) {
+            out.append(text);
+        } else if(f.kind == REAL) {
+            int decimals = ins.decimals;
+            if(f.quantity != none) {
+                const auto& unit = units.unit(static_cast<UnitProfile::Quantity>(f.quantity));
+                value = value * unit.scale + unit.offset;
+                decimals = decimals < 0 ? unit.decimals : decimals;
+            }
+            auto result = std::to_chars(tmp, tmp + sizeof(tmp), value, std::chars_format::fixed,
+                                        decimals < 0 ? f.decimals : decimals);
+            out.append(tmp, result.ec == std::errc() ? result.ptr : tmp);
+        } else {
+            auto result = std::to_chars(tmp, tmp + sizeof(tmp), static_cast<int64_t>(value));
+            out.append(tmp, result.ptr);
+        }
+    }
+}
+
+/**
+ * the built-in conky layout.
+ */
+const OutputTemplate& OutputTemplate::builtin()
+{
+    static const OutputTemplate instance = []() {
+        OutputTemplate t;
+        std::string error;
+        if(!t.compile(OutputTemplate::default_layout, error))
+            LOG_F(ERROR, "OutputTemplate::builtin(): %s", error.c_str());
+        return t;
+    }();
+    return instance;
+}
+
+/**
+ * the compiled template for a --template file, loaded on first use and
+ * shared by all handlers.
+ *
+ * @return      - nullptr if the template cannot be loaded. Failures are
+ *                cached as well.
+ */
+const OutputTemplate *OutputTemplate::get(const std::string& path, const std::string& config_dir)
+{
+    static std::mutex lock;
+    static std::map<std::string, std::unique_ptr<OutputTemplate>> layouts;
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto it = layouts.find(path);
+    if(it != layouts.end())
+        return it->second.get();
+
+    auto layout = std::make_unique<OutputTemplate>();
+    if(!layout->load(OutputTemplate::resolve(path, config_dir), config_dir))
+        layout.reset();
+    return layouts.emplace(path, std::move(layout)).first->second.get();
+}
+
+/**
+ * template files given as relative path are looked up in the current
+ * directory first, then in the config directory.
+ */
+std::string OutputTemplate::resolve(const std::string& path, const std::string& config_dir)
+{
+    std::error_code ec;
+    fs::path p(path);
+
+    if(p.is_relative() && !fs::exists(p, ec))
+        p = fs::path(config_dir) / p;
+    return fs::absolute(p, ec).string();
+}
+
+/**
+ * load a template file, from the cache if the compiled version is still
+ * current, otherwise compile it and update the cache.
+ *
+ * @param path      - the template file, see resolve()
+ * @param cache_dir - where compiled templates are kept
+ * @return          - false if the template cannot be read or is invalid.
+ */
+bool OutputTemplate::load(const std::string& path, const std::string& cache_dir)
+{
+    struct stat st;
+    char        name[64];
+
+    if(stat(path.c_str(), &st) != 0) {
+        LOG_F(INFO, "OutputTemplate::load(): cannot access %s (%s)", path.c_str(), strerror(errno));
+        return false;
+    }
+    snprintf(name, sizeof(name), "template-%016llx.cache",
+             static_cast<unsigned long long>(utils::fnv1a(path.data(), path.size())));
+    std::string cache_path = (fs::path(cache_dir) / name).string();
+    if(this->readCache(cache_path, st))
+        return true;
+
+    std::ifstream f(path, std::ios::binary);
+    std::string source((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    std::string error;
+    if(!f.good() && !f.eof()) {
+        LOG_F(INFO, "OutputTemplate::load(): cannot read %s", path.c_str());
+        return false;
+    }
+    if(!this->compile(source, error)) {
+        LOG_F(INFO, "OutputTemplate::load(): %s: %s", path.c_str(), error.c_str());
+        fprintf(stderr, "Invalid template %s, %s\n", path.c_str(), error.c_str());
+        return false;
+    }
+    LOG_F(INFO, "OutputTemplate::load(): compiled %s, %zu instructions", path.c_str(), this->m_code.size());
+    this->writeCache(cache_path, st);
+    return true;
+}
+
+bool OutputTemplate::readCache(const std::string& path, const struct stat& st)
+{
+    CacheHeader h;
+    std::ifstream f(path, std::ios::binary);
+
+    if(!f.read(reinterpret_cast<char *>(&h), sizeof(h)) || memcmp(h.magic, cache_magic, sizeof(h.magic)) != 0 ||
+       h.fields_hash != fieldsHash() || h.source_size != st.st_size ||
+       h.source_mtime != st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec)
+        return false;
+
+    std::vector<Instruction> code(h.code_count);
+    std::string literals(h.literal_size, '\0');
+    if(!f.read(reinterpret_cast<char *>(code.data()), code.size() * sizeof(Instruction)) ||
+       !f.read(literals.data(), literals.size()))
+        return false;
+    // never trust the file with indices
+    for(const auto& ins : code) {
+        if((ins.op == TEXT && static_cast<size_t>(ins.arg) + ins.len > literals.size()) ||
+           (ins.op != TEXT && (ins.field >= std::size(fields) || ins.day >= days)) ||
+           ((ins.op == JUMP || ins.op == JUMP_UNLESS) && ins.arg > code.size()) || ins.op > JUMP)
+            return false;
+    }
+    this->m_code = std::move(code);
+    this->m_literals = std::move(literals);
+    this->m_sizeHint = h.size_hint;
+    return true;
+}
+
+void OutputTemplate::writeCache(const std::string& path, const struct stat& st) const
+{
+    CacheHeader h = {};
+    std::string tmp(path + ".tmp");
+
+    memcpy(h.magic, cache_magic, sizeof(h.magic));
+    h.fields_hash = fieldsHash();
+    h.source_mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    h.source_size = st.st_size;
+    h.code_count = static_cast<uint32_t>(this->m_code.size());
+    h.literal_size = static_cast<uint32_t>(this->m_literals.size());
+    h.size_hint = this->m_sizeHint;
+
+    std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+    f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    f.write(reinterpret_cast<const char *>(this->m_code.data()), this->m_code.size() * sizeof(Instruction));
+    f.write(this->m_literals.data(), this->m_literals.size());
+    f.close();
+    if(!f || rename(tmp.c_str(), path.c_str()) != 0) {
+        LOG_F(INFO, "OutputTemplate::writeCache(): cannot write %s", path.c_str());
+        unlink(tmp.c_str());
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_OUTPUTTEMPLATE_H_
+#define FETCHWEATHER_SRC_OUTPUTTEMPLATE_H_
+
+#include "pch.h"
+#include <sys/stat.h>
+#include "DataHandler.h"
+#include "UnitProfile.h"
+
+/*
+ * user defined output layout (--template). A template is plain text with
+ * placeholders:
+ *
+ *   {temperature}               a field, converted to the unit profile
+ *   {pressure:.2}               with an explicit number of decimals
+ *   {temperature_unit}          the unit label (also speed_, visibility_, pressure_unit)
+ *   {day1.high}                 daily forecasts, day0 to day2
+ *   {if precip_intensity}..{else}..{end}   conditional, {if !field} negates
+ *   {{                          a literal {
+ *
+ * Numbers are true when not 0, texts when not empty. See fields[] in
+ * OutputTemplate.cpp for all field names. The built-in layout (the conky
+ * format) is defined the same way, see default_layout.
+ *
+ * A template is compiled once into a flat list of instructions with a
+ * literal pool. Compiled templates are cached in the config directory and
+ * reused as long as size and modification time of the source match.
+ * get() loads every template file only once per process.
+ */
+class OutputTemplate {
+  public:
+    bool    compile(std::string_view source, std::string& error);
+    bool    load(const std::string& path, const std::string& cache_dir);
+    void    render(const DataHandler& handler, const UnitProfile& units, std::string& out) const;
+
+    static const OutputTemplate&    builtin();
+    static const OutputTemplate    *get(const std::string& path, const std::string& config_dir);
+    static std::string              resolve(const std::string& path, const std::string& config_dir);
+
+    static const char * const default_layout;
+
+  private:
+    enum Op : uint8_t { TEXT, FIELD, JUMP_UNLESS, JUMP };
+
+    struct Instruction {
+        Op          op;
+        uint8_t     negate;         // JUMP_UNLESS: jump if the field is true
+        int8_t      decimals;       // FIELD: -1 = default
+        uint8_t     day;            // daily forecast fields: the day
+        uint16_t    field;          // index into fields[]
+        uint16_t    _pad;
+        uint32_t    arg, len;       // TEXT: offset and length in m_literals, JUMPs: target
+    };
+    static_assert(sizeof(Instruction) == 16, "instructions are cached as they are");
+
+    bool    readCache(const std::string& path, const struct stat& st);
+    void    writeCache(const std::string& path, const struct stat& st) const;
+
+    std::vector<Instruction>    m_code;
+    std::string                 m_literals;
+    size_t                      m_sizeHint = 0;
+};
+
+#endif //FETCHWEATHER_SRC_OUTPUTTEMPLATE_H_
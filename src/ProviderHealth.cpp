@@ -0,0 +1,168 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "ProviderHealth.h"
+#include "DataHandler.h"
+#include "HistoryDB.h"
+
+/**
+ * account for one API request.
+ *
+ * @param ok            - the request delivered valid data
+ * @param latency_ms    - time until the request ended
+ * @param now           - time of the request
+ */
+void ProviderHealth::update(bool ok, double latency_ms, time_t now)
+{
+    double weight = this->samples == 0 ? 1.0 : ProviderHealth::alpha;
+
+    this->samples++;
+    this->errors += weight * ((ok ? 0.0 : 1.0) - this->errors);
+    if(ok) {
+        this->latency = this->latency == 0.0 ? latency_ms : this->latency + weight * (latency_ms - this->latency);
+        this->failures = 0;
+        this->open_until = 0;
+        this->cooldown = 0;
+        return;
+    }
+    this->failures++;
+    // a failed probe re-opens the circuit at once
+    if(this->open_until != 0 || this->failures >= ProviderHealth::failure_threshold) {
+        this->cooldown = this->cooldown ? std::min(2 * this->cooldown, ProviderHealth::max_cooldown)
+                                        : ProviderHealth::base_cooldown;
+        this->open_until = now + this->cooldown;
+    }
+}
+
+/**
+ * the expected cost of a request in ms, lower is better. Failures are
+ * weighted with failure_penalty.
+ */
+double ProviderHealth::score() const
+{
+    if(this->samples == 0)
+        return 0.0;
+    return this->latency + this->errors * ProviderHealth::failure_penalty;
+}
+
+/**
+ * --provider auto
+ *
+ * @return      - 0 on success, -1 otherwise (used as exit code)
+ */
+int ProviderRouter::run(const CFG& cfg)
+{
+    struct Candidate {
+        CFG                             cfg;        // referenced by handler
+        std::unique_ptr<DataHandler>    handler;
+        ProviderHealth                  health;
+    };
+    std::vector<std::unique_ptr<Candidate>> candidates;
+    time_t      now = time(0);
+    int         rc = -1;
+
+    for(const char *provider : ProviderRouter::providers) {
+        auto c = std::make_unique<Candidate>();
+        if(!ProgramOptions::providerConfig(cfg, provider, c->cfg) || !(c->handler = DataHandler::create(c->cfg))) {
+            LOG_F(INFO, "ProviderRouter::run(): skipping %s, no API key", provider);
+            continue;
+        }
+        if(HistoryDB *db = c->handler->healthDB())
+            db->loadHealth(provider, c->health);
+        candidates.push_back(std::move(c));
+    }
+    if(candidates.empty()) {
+        fprintf(stderr, "No provider has an API key. Put the keys into %s/XX.key, where XX is the provider.\n",
+                cfg.config_dir_path.c_str());
+        return -1;
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) {
+        return a->health.score() < b->health.score();
+    });
+
+    Candidate *source = nullptr;
+    if(!cfg.offline) {
+        for(auto& c : candidates) {
+            if(!c->health.allow(now)) {
+                LOG_F(INFO, "ProviderRouter::run(): %s skipped, circuit open", c->cfg.apiProviderString.c_str());
+                continue;
+            }
+            LOG_F(INFO, "ProviderRouter::run(): requesting %s (score %.0f)", c->cfg.apiProviderString.c_str(),
+                  c->health.score());
+            if(c->handler->fetch(DataHandler::API)) {
+                source = c.get();
+                break;
+            }
+        }
+    }
+    if(!source && (cfg.offline || !cfg.skipcache)) {
+        for(auto& c : candidates) {
+            if(c->handler->fetch(DataHandler::CACHE)) {
+                LOG_F(INFO, "ProviderRouter::run(): using the %s cache", c->cfg.apiProviderString.c_str());
+                source = c.get();
+                break;
+            }
+        }
+    }
+    if(source) {
+        rc = source->handler->publish();
+        source->handler->writeToDB();
+    } else {
+        LOG_F(INFO, "ProviderRouter::run(): no provider delivered, giving up");
+    }
+    return rc;
+}
+
+/**
+ * --health, print the health of all providers.
+ *
+ * @return      - 0 on success, -1 otherwise (used as exit code)
+ */
+int ProviderRouter::printHealth(const CFG& cfg)
+{
+    std::string db_path(cfg.data_dir_path), location(cfg.location);
+    time_t      now = time(0);
+
+    db_path.append("/history.sqlite3");
+    if(location.empty())
+        location = cfg.lat + "," + cfg.lon;
+    HistoryDB db(db_path, location, cfg.apiProviderString);
+    if(!db.open()) {
+        fprintf(stderr, "Unable to read the provider health from %s\n", db_path.c_str());
+        return -1;
+    }
+    printf("%-10s %8s %9s %9s %9s  %s\n", "provider", "requests", "mean ms", "errors", "score", "circuit");
+    for(const char *provider : ProviderRouter::providers) {
+        ProviderHealth h;
+        db.loadHealth(provider, h);
+        printf("%-10s %8lld %9.0f %8.1f%% %9.0f  ", provider, static_cast<long long>(h.samples), h.latency,
+               100.0 * h.errors, h.score());
+        if(h.allow(now))
+            printf(h.open_until ? "half-open\n" : "closed\n");
+        else
+            printf("open for %lds\n", static_cast<long>(h.open_until - now));
+    }
+    return 0;
+}
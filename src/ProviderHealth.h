@@ -0,0 +1,80 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_PROVIDERHEALTH_H_
+#define FETCHWEATHER_SRC_PROVIDERHEALTH_H_
+
+#include "pch.h"
+#include "options.h"
+
+/*
+ * health of a provider endpoint, kept in history.sqlite3 across runs and
+ * updated after every API request.
+ *
+ * latency and errors are exponentially weighted moving averages (weight
+ * alpha for the newest request) of the time until valid data arrived and
+ * of the failure rate.
+ *
+ * The circuit breaker opens after failure_threshold consecutive failures:
+ * no requests are sent to the provider for cooldown seconds, the cache is
+ * used instead. The first request after that is a probe. If it succeeds
+ * the circuit closes, otherwise it opens again for twice as long (at most
+ * max_cooldown).
+ */
+struct ProviderHealth {
+    double      latency = 0.0;          // ms, successful requests only
+    double      errors = 0.0;           // 0..1
+    int64_t     samples = 0;
+    int         failures = 0;           // consecutive
+    int64_t     open_until = 0;         // unix time, 0 = circuit closed
+    int         cooldown = 0;           // seconds the circuit was opened for the last time
+
+    bool        allow(time_t now) const { return open_until == 0 || now >= open_until; }
+    void        update(bool ok, double latency_ms, time_t now);
+    double      score() const;
+
+    static constexpr double alpha = 0.3;
+    static constexpr int    failure_threshold = 3;
+    static constexpr int    base_cooldown = 300;
+    static constexpr int    max_cooldown = 3600;
+    static constexpr double failure_penalty = 10000.0;  // ms, the connect timeout a failing request costs
+};
+
+/*
+ * --provider auto: request the provider with the best score among those
+ * with a key file and a closed circuit, and the next one when it fails.
+ * Providers without a recorded request score 0 and are tried first, so
+ * every provider gets measured. When all requests fail or all circuits
+ * are open, the caches are tried in the same order.
+ */
+class ProviderRouter {
+  public:
+    static int  run(const CFG& cfg);
+    static int  printHealth(const CFG& cfg);
+
+    static constexpr const char *providers[] = { "CC", "OWM" };    // providers with a DataHandler
+};
+
+#endif //FETCHWEATHER_SRC_PROVIDERHEALTH_H_
@@ -0,0 +1,179 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "ProviderRace.h"
+#include "EventLoop.h"
+#include "HistoryDB.h"
+
+/**
+ * add a provider to the race.
+ *
+ * @param provider      - provider short code
+ * @return              - false for unknown providers, duplicates and
+ *                        providers without an API key
+ */
+bool ProviderRace::add(const std::string& provider)
+{
+    if(std::any_of(this->m_racers.begin(), this->m_racers.end(),
+                   [&provider](const auto& r) { return r->cfg.apiProviderString == provider; }))
+        return false;
+
+    auto racer = std::make_unique<Racer>();
+    if(!ProgramOptions::providerConfig(this->m_base, provider, racer->cfg) ||
+       !(racer->handler = DataHandler::create(racer->cfg))) {
+        LOG_F(INFO, "ProviderRace::add(): cannot race %s, no API key or unsupported", provider.c_str());
+        return false;
+    }
+    this->m_racers.push_back(std::move(racer));
+    return true;
+}
+
+/**
+ * start all requests, publish the first valid response and record the
+ * outcome.
+ *
+ * @return              - 0 on success, -1 otherwise (used as exit code)
+ */
+int ProviderRace::run()
+{
+    EventLoop& loop = EventLoop::current();
+
+    this->m_start = std::chrono::steady_clock::now();
+    for(auto& racer : this->m_racers)
+        loop.spawn(this->race(*racer));
+    loop.run();
+
+    if(!this->m_winner) {
+        Racer *primary = this->m_racers.front().get();
+        LOG_F(INFO, "ProviderRace::run(): no provider delivered, trying the %s cache",
+              primary->cfg.apiProviderString.c_str());
+        if(!this->m_base.skipcache && primary->handler->fetch(DataHandler::CACHE))
+            this->m_rc = primary->handler->publish();
+    }
+
+    for(auto& r : this->m_racers)
+        r->handler->writeToDB();
+    if(!this->m_base.debug)
+        this->record(this->m_winner);
+    return this->m_rc;
+}
+
+/**
+ * request one provider. The first one delivering valid data cancels the
+ * others and publishes at once, before the cancelled requests wind down.
+ */
+Task<void> ProviderRace::race(Racer& r)
+{
+    r.ok = co_await r.handler->fetchAsync(DataHandler::API);
+    r.done = true;
+    r.latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->m_start).count();
+    if(!r.ok || this->m_winner)
+        co_return;
+
+    this->m_winner = &r;
+    for(auto& other : this->m_racers) {
+        if(!other->done) {
+            other->cancelled = true;
+            other->handler->cancel();
+        }
+    }
+    LOG_F(INFO, "ProviderRace::run(): %s won after %.0f ms", r.cfg.apiProviderString.c_str(), r.latency);
+    this->m_rc = r.handler->publish();
+}
+
+/**
+ * count the outcome of this race for every provider.
+ */
+void ProviderRace::record(const Racer *winner)
+{
+    const Racer *primary = this->m_racers.front().get();
+    std::string db_path(this->m_base.data_dir_path);
+
+    db_path.append("/history.sqlite3");
+    HistoryDB db(db_path, primary->handler->locationKey(), primary->cfg.apiProviderString);
+    if(!db.open())
+        return;
+    for(const auto& r : this->m_racers) {
+        auto result = r.get() == winner ? HistoryDB::RACE_WON :
+                      r->cancelled ? HistoryDB::RACE_CANCELLED :
+                      r->ok ? HistoryDB::RACE_FINISHED : HistoryDB::RACE_FAILED;
+        LOG_F(INFO, "ProviderRace::record(): %s %s after %.0f ms", r->cfg.apiProviderString.c_str(),
+              result == HistoryDB::RACE_WON ? "won" : result == HistoryDB::RACE_CANCELLED ? "cancelled" :
+              result == HistoryDB::RACE_FINISHED ? "finished" : "failed", r->latency);
+        db.recordRace(r->cfg.apiProviderString, result, r->latency);
+    }
+}
+
+/**
+ * --race
+ *
+ * @return      - 0 on success, -1 otherwise (used as exit code)
+ */
+int ProviderRace::run(const CFG& cfg)
+{
+    ProviderRace race(cfg);
+
+    if(!race.add(cfg.apiProviderString)) {
+        fprintf(stderr, "The provider %s cannot take part in the race.\n", cfg.apiProviderString.c_str());
+        return -1;
+    }
+    for(const auto& provider : cfg.race) {
+        if(provider != cfg.apiProviderString && !race.add(provider)) {
+            fprintf(stderr, "The provider %s cannot take part in the race. Is there an API key in %s/%s.key?\n",
+                    provider.c_str(), cfg.config_dir_path.c_str(), provider.c_str());
+            return -1;
+        }
+    }
+    return race.run();
+}
+
+/**
+ * --raceStats, print the race statistics of the location.
+ *
+ * @return      - 0 on success, -1 otherwise (used as exit code)
+ */
+int ProviderRace::printStats(const CFG& cfg)
+{
+    std::string db_path(cfg.data_dir_path), location(cfg.location);
+    std::vector<HistoryDB::RaceStats> stats;
+
+    db_path.append("/history.sqlite3");
+    if(location.empty())
+        location = cfg.lat + "," + cfg.lon;
+    HistoryDB db(db_path, location, cfg.apiProviderString);
+    if(!db.open() || !db.raceStats(stats)) {
+        fprintf(stderr, "Unable to read the race statistics from %s\n", db_path.c_str());
+        return -1;
+    }
+    printf("Races for %s\n\n%-10s %8s %8s %9s %9s %9s %9s\n", location.c_str(), "provider", "races", "wins",
+           "win rate", "mean ms", "max ms", "failures");
+    for(const auto& s : stats) {
+        printf("%-10s %8lld %8lld %8.1f%% %9.0f %9.0f %9lld\n", s.provider.c_str(),
+               static_cast<long long>(s.races), static_cast<long long>(s.wins),
+               s.races ? 100.0 * s.wins / s.races : 0.0, s.finished ? s.latency_sum / s.finished : 0.0,
+               s.latency_max, static_cast<long long>(s.failures));
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_PROVIDERRACE_H_
+#define FETCHWEATHER_SRC_PROVIDERRACE_H_
+
+#include "pch.h"
+#include "DataHandler.h"
+
+/*
+ * --race: request several providers at the same time and publish the first
+ * response that passes verifyData(). --provider always takes part. All
+ * requests run as coroutines on the EventLoop of the calling thread. The
+ * requests of the slower providers are cancelled, their caches keep the
+ * previous response. When no provider delivers, the cache of --provider
+ * is used as usual (unless --skipcache).
+ *
+ * The outcome for every provider (won, finished, failed or cancelled) and
+ * the time until it delivered valid data are counted per location in
+ * history.sqlite3, --raceStats shows them.
+ */
+class ProviderRace {
+  public:
+    explicit ProviderRace(const CFG& cfg) : m_base(cfg) {}
+
+    bool    add(const std::string& provider);
+    int     run();
+
+    static int  run(const CFG& cfg);
+    static int  printStats(const CFG& cfg);
+
+  private:
+    struct Racer {
+        CFG                             cfg;        // referenced by handler
+        std::unique_ptr<DataHandler>    handler;
+        bool                            done = false, ok = false, cancelled = false;
+        double                          latency = 0.0;      // ms until the request ended
+    };
+
+    Task<void>  race(Racer& racer);
+    void        record(const Racer *winner);
+
+    const CFG&                          m_base;
+    std::vector<std::unique_ptr<Racer>> m_racers;           // the first one is --provider
+    std::chrono::steady_clock::time_point   m_start;
+    Racer                               *m_winner = nullptr;
+    int                                 m_rc = -1;          // result of publishing the winner
+};
+
+#endif //FETCHWEATHER_SRC_PROVIDERRACE_H_
@@ -0,0 +1,90 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_SNAPSHOTPROTOCOL_H_
+#define FETCHWEATHER_SRC_SNAPSHOTPROTOCOL_H_
+
+/*
+ * The protocol between fetchweather --serve and fetchweather-query. This
+ * header is shared by both and must stay free of Qt, CLI11 and loguru (no
+ * pch.h), the client links nothing but libc.
+ *
+ * A client connects to the Unix domain socket and sends one request line
+ *
+ *      [FORMAT[ UNITS]]\n
+ *
+ * FORMAT is text, json, prometheus or influx, UNITS a unit list like
+ * F,mph,mi,inhg (relative to the units of the server). An empty line asks
+ * for the format and units the server was started with. The answer is
+ *
+ *      OK <length>\n<length bytes of rendered output>
+ *   or ERR <message>\n
+ *
+ * after which the server closes the connection.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+namespace snapshot_protocol {
+    constexpr size_t    max_request = 256;          // request line including the newline
+    constexpr int       timeout_ms = 200;           // per connection, for both sides
+    constexpr int       client_timeout_ms = 2000;   // the client waits longer, the server may be rendering
+
+    /**
+     * the directory of the default socket without $XDG_RUNTIME_DIR. It is
+     * private to the user (0700) and created by the server, a socket directly
+     * in /tmp could be put there by anybody before the server starts.
+     *
+     * @return              - the length of the path, as snprintf()
+     */
+    inline int fallback_dir(char *buf, size_t len)
+    {
+        return snprintf(buf, len, "/tmp/fetchweather-%u", static_cast<unsigned>(getuid()));
+    }
+
+    /**
+     * the default socket path, $XDG_RUNTIME_DIR/fetchweather.sock or
+     * /tmp/fetchweather-UID/fetchweather.sock without a runtime directory.
+     *
+     * @param buf           - receives the path
+     * @param len           - size of buf
+     * @return              - false if the path does not fit
+     */
+    inline bool default_socket_path(char *buf, size_t len)
+    {
+        const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+        char dir[64];
+        if(!runtime_dir || !*runtime_dir) {
+            fallback_dir(dir, sizeof(dir));
+            runtime_dir = dir;
+        }
+        int n = snprintf(buf, len, "%s/fetchweather.sock", runtime_dir);
+        return n > 0 && static_cast<size_t>(n) < len;
+    }
+}
+
+#endif //FETCHWEATHER_SRC_SNAPSHOTPROTOCOL_H_
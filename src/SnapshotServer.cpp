@@ -0,0 +1,290 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <QTimer>
+#include "SnapshotServer.h"
+#include "SnapshotProtocol.h"
+#include "OutputFormat.h"
+
+SnapshotServer::SnapshotServer(DataHandler *handler, QObject *parent) : QObject(parent), m_handler(handler)
+{ }
+
+SnapshotServer::~SnapshotServer()
+{
+    for(auto& client : this->m_clients)
+        ::close(client.first);
+    if(this->m_fd >= 0) {
+        ::close(this->m_fd);
+        unlink(this->m_path.c_str());
+    }
+}
+
+/**
+ * create the socket and start accepting connections from the event loop.
+ * A stale socket file left by a killed server is replaced, a live one is
+ * not.
+ *
+ * @param path          - socket path, empty for the default
+ * @return              - false if the socket cannot be created
+ */
+bool SnapshotServer::listen(const std::string& path)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+
+    if(path.empty()) {
+        char dir[64];
+        if(!snapshot_protocol::default_socket_path(addr.sun_path, sizeof(addr.sun_path)))
+            return false;
+        int n = snapshot_protocol::fallback_dir(dir, sizeof(dir));
+        if(strncmp(addr.sun_path, dir, n) == 0 && addr.sun_path[n] == '/' && !SnapshotServer::privateDir(dir))
+            return false;
+    } else if(path.size() < sizeof(addr.sun_path)) {
+        memcpy(addr.sun_path, path.c_str(), path.size());
+    } else {
+        LOG_F(INFO, "SnapshotServer::listen(): socket path %s is too long", path.c_str());
+        return false;
+    }
+    this->m_path = addr.sun_path;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return false;
+    int rc = bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    if(rc != 0 && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool live = probe >= 0 && ::connect(probe, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0;
+        if(probe >= 0)
+            ::close(probe);
+        if(live) {
+            LOG_F(INFO, "SnapshotServer::listen(): another server is listening on %s", addr.sun_path);
+            ::close(fd);
+            return false;
+        }
+        unlink(addr.sun_path);
+        rc = bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    }
+    if(rc != 0 || chmod(addr.sun_path, 0600) != 0 || ::listen(fd, 16) != 0) {
+        LOG_F(INFO, "SnapshotServer::listen(): cannot listen on %s: %s", addr.sun_path, strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    this->m_fd = fd;
+    this->m_notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    QObject::connect(this->m_notifier, SIGNAL(activated(int)), this, SLOT(accept()));
+    LOG_F(INFO, "SnapshotServer::listen(): listening on %s", addr.sun_path);
+    return true;
+}
+
+/**
+ * create the directory for the default socket in /tmp, or make sure an
+ * existing one belongs to the user and is not accessible by others.
+ *
+ * @return              - false if the directory cannot be used
+ */
+bool SnapshotServer::privateDir(const char *dir)
+{
+    struct stat st;
+
+    if(mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        LOG_F(INFO, "SnapshotServer::privateDir(): cannot create %s: %s", dir, strerror(errno));
+        return false;
+    }
+    if(lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+        LOG_F(INFO, "SnapshotServer::privateDir(): %s is not a private directory of this user, not using it", dir);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * a refresh has started on the worker thread and owns the handler until
+ * publish(). Cached responses are still answered, nothing new is rendered.
+ */
+void SnapshotServer::suspend()
+{
+    this->m_valid = false;
+}
+
+/**
+ * a refresh has finished. A valid snapshot replaces all cached responses,
+ * after a failed one the cached responses are kept, but no new ones are
+ * rendered.
+ */
+void SnapshotServer::publish(bool valid)
+{
+    if(valid)
+        this->m_responses.clear();
+    this->m_valid = valid;
+}
+
+/**
+ * the listening socket is readable, take all pending connections. Most
+ * clients have sent their request by now and are answered right away,
+ * the others are left to clientReady().
+ */
+void SnapshotServer::accept()
+{
+    int fd;
+
+    while((fd = accept4(this->m_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 || errno == EINTR) {
+        if(fd < 0)
+            continue;
+        if(this->m_clients.size() >= SnapshotServer::max_clients) {
+            ::close(fd);
+            continue;
+        }
+        Client& client = this->m_clients[fd];
+        client.serial = ++this->m_serial;
+        QTimer::singleShot(snapshot_protocol::timeout_ms, this, [this, fd, serial = client.serial]() {
+            auto it = this->m_clients.find(fd);
+            if(it != this->m_clients.end() && it->second.serial == serial)
+                this->drop(fd);
+        });
+        this->clientReady(fd);
+    }
+}
+
+/**
+ * read what a client has sent so far and, once the request line is
+ * complete, send as much of the response as the socket takes. Never
+ * blocks, the notifiers call again when there is more to do.
+ */
+void SnapshotServer::clientReady(int fd)
+{
+    auto it = this->m_clients.find(fd);
+    if(it == this->m_clients.end())
+        return;
+    Client& client = it->second;
+
+    if(client.response.empty()) {
+        char buf[snapshot_protocol::max_request];
+        size_t eol = std::string::npos;
+        while(eol == std::string::npos && client.request.size() < snapshot_protocol::max_request) {
+            ssize_t n = recv(fd, buf, snapshot_protocol::max_request - client.request.size(), 0);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                this->watch(fd, client, false);
+                return;
+            }
+            if(n <= 0) {
+                this->drop(fd);
+                return;
+            }
+            client.request.append(buf, n);
+            eol = client.request.find('\n');
+        }
+        client.response = eol != std::string::npos ? this->respond(client.request.substr(0, eol))
+                                                   : std::string("ERR request too long\n");
+    }
+    while(client.sent < client.response.size()) {
+        ssize_t n = send(fd, client.response.data() + client.sent, client.response.size() - client.sent, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            this->watch(fd, client, true);
+            return;
+        }
+        if(n <= 0)
+            break;
+        client.sent += n;
+    }
+    this->drop(fd);
+}
+
+/**
+ * wait for a client to become readable (or writable), nothing else.
+ */
+void SnapshotServer::watch(int fd, Client& client, bool write)
+{
+    QSocketNotifier *&notifier = write ? client.writer : client.reader;
+    if(!notifier) {
+        notifier = new QSocketNotifier(fd, write ? QSocketNotifier::Write : QSocketNotifier::Read, this);
+        QObject::connect(notifier, SIGNAL(activated(int)), this, SLOT(clientReady(int)));
+    }
+    notifier->setEnabled(true);
+    if(QSocketNotifier *other = write ? client.reader : client.writer)
+        other->setEnabled(false);
+}
+
+/**
+ * close a connection. The notifiers may be the ones calling us, so they
+ * are only disabled here and deleted from the event loop.
+ */
+void SnapshotServer::drop(int fd)
+{
+    auto it = this->m_clients.find(fd);
+    if(it == this->m_clients.end())
+        return;
+    for(QSocketNotifier *notifier : { it->second.reader, it->second.writer }) {
+        if(notifier) {
+            notifier->setEnabled(false);
+            notifier->deleteLater();
+        }
+    }
+    ::close(fd);
+    this->m_clients.erase(it);
+}
+
+/**
+ * the complete response for a request line, rendered on the first request
+ * after a snapshot was published.
+ */
+const std::string& SnapshotServer::respond(const std::string& request)
+{
+    const CFG& cfg = this->m_handler->config();
+
+    auto it = this->m_responses.find(request);
+    if(it != this->m_responses.end())
+        return it->second;
+    if(!this->m_valid)
+        return this->m_error = "ERR no snapshot available\n";
+
+    std::string name = request.substr(0, request.find(' '));
+    std::string spec = name.size() < request.size() ? request.substr(name.size() + 1) : "";
+    if(!name.empty() && name.back() == '\r')
+        name.pop_back();
+    if(!spec.empty() && spec.back() == '\r')
+        spec.pop_back();
+    OutputFormat::Kind kind = cfg.format;
+    UnitProfile units = cfg.units;
+    if(!name.empty() && !OutputFormat::parse(name, kind))
+        return this->m_error = "ERR unknown format " + name + "\n";
+    if(!spec.empty() && !UnitProfile::parse(spec, units))
+        return this->m_error = "ERR invalid units " + spec + "\n";
+
+    std::string payload;
+    OutputFormat::render(kind, *this->m_handler, units, this->m_handler->layout(cfg.templateFile), payload);
+    if(this->m_responses.size() >= SnapshotServer::max_responses)
+        this->m_responses.clear();
+    std::string& response = this->m_responses[request];
+    response = "OK " + std::to_string(payload.size()) + "\n" + payload;
+    return response;
+}
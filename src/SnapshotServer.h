@@ -0,0 +1,97 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_SNAPSHOTSERVER_H_
+#define FETCHWEATHER_SRC_SNAPSHOTSERVER_H_
+
+#include "pch.h"
+#include <QObject>
+#include <QSocketNotifier>
+#include "DataHandler.h"
+
+/*
+ * answers snapshot queries on a Unix domain socket (--serve), see
+ * SnapshotProtocol.h for the protocol.
+ *
+ * Responses are rendered from the DataHandler on the first request for a
+ * format and unit list and kept until the next snapshot is published, so
+ * repeated queries (conky asking every few seconds) are a single write().
+ * While a refresh runs (see suspend()) and after a failed one, the handler
+ * may hold partial data. The server then keeps answering from the
+ * responses already rendered, but does not render new ones until a valid
+ * snapshot is published again.
+ *
+ * Connections are non-blocking and driven by socket notifiers, a client
+ * that stalls holds up nobody else and is dropped after
+ * snapshot_protocol::timeout_ms.
+ */
+class SnapshotServer : public QObject {
+  Q_OBJECT
+
+  public:
+    SnapshotServer(DataHandler *handler, QObject *parent = nullptr);
+    ~SnapshotServer();
+
+    bool    listen(const std::string& path);
+    void    suspend();
+    void    publish(bool valid);
+    size_t  cached() const { return m_responses.size(); }
+
+  public slots:
+    void    accept();
+
+  private slots:
+    void    clientReady(int fd);
+
+  private:
+    struct Client {
+        std::string         request;                // received so far
+        std::string         response;               // complete response, once the request line is in
+        size_t              sent = 0;
+        unsigned            serial = 0;             // tells a reused fd from the timed out one
+        QSocketNotifier     *reader = nullptr;
+        QSocketNotifier     *writer = nullptr;
+    };
+
+    void                watch(int fd, Client& client, bool write);
+    void                drop(int fd);
+    const std::string&  respond(const std::string& request);
+    static bool         privateDir(const char *dir);
+
+    static constexpr size_t max_responses = 32;     // distinct requests cached per snapshot
+    static constexpr size_t max_clients = 64;       // open connections, more are refused
+
+    DataHandler         *m_handler;
+    QSocketNotifier     *m_notifier = nullptr;
+    int                 m_fd = -1;
+    bool                m_valid = false;            // the handler holds a complete snapshot
+    std::string         m_path;
+    std::map<std::string, std::string>  m_responses;    // request line -> complete response
+    std::string         m_error;                        // ERR responses are not cached
+    std::map<int, Client>   m_clients;                  // open connections by fd
+    unsigned            m_serial = 0;
+};
+
+#endif //FETCHWEATHER_SRC_SNAPSHOTSERVER_H_
@@ -0,0 +1,223 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "Startup.h"
+#include "Benchmark.h"
+#include "HistoryIO.h"
+#include "OutputTemplate.h"
+#include "Batch.h"
+#include "ProviderRace.h"
+#include "ProviderHealth.h"
+
+/**
+ * set up logging and parse the command line. Exits for --help and
+ * --version.
+ */
+void Startup::init(int argc, char **argv)
+{
+    loguru::g_stderr_verbosity = loguru::Verbosity_OFF;
+    loguru::init(argc, argv);
+    ProgramOptions &opt = ProgramOptions::getInstance();
+
+    const CFG& cfg = opt.getConfig();
+
+    auto result = opt.parse(argc, argv);
+    LOG_F(INFO, "main(): The result from ProgramOptions::parse() was: %d", result);
+    // catch the help
+    if (0 == result) {
+        exit(0);
+    }
+
+    if (1 == result) {
+        // --version or -V parameter was given. Print version information and exit.
+        opt.print_version();
+        exit(0);
+    }
+
+    if(cfg.debug) {
+        opt.dumpOptions();
+    }
+}
+
+/**
+ * the sanity checks and all modes which run once and do not need a
+ * handler for --provider.
+ *
+ * @param cfg   - the parsed options
+ * @param rc    - receives the exit code when the request was handled
+ * @return      - true if the request was handled (or rejected) and the
+ *                program should exit with rc
+ */
+bool Startup::dispatch(const CFG& cfg, int& rc)
+{
+    bool    extended_checks_failed = false;
+    bool    batch = false;
+
+    if(cfg.benchmark.length()) {
+        rc = bench::run(cfg.benchmark);
+        return true;
+    }
+
+    if(cfg.importPath.length() || cfg.exportPath.length() || cfg.legacyUnits.length()) {
+        rc = HistoryIO::run(cfg);
+        return true;
+    }
+
+    if(cfg.raceStats) {
+        rc = ProviderRace::printStats(cfg);
+        return true;
+    }
+
+    if(cfg.health) {
+        rc = ProviderRouter::printHealth(cfg);
+        return true;
+    }
+
+    batch = !cfg.batchFile.empty() || !cfg.sites.empty();
+
+    /* more sanity checks */
+
+    if(cfg.offline && cfg.skipcache) {
+        /* ignoring both online mode and the cache does not make sense */
+        printf("The options --offline and --skipcache are mutually exclusive\n"
+               "and cannot be used together.");
+        LOG_F(INFO, "main(): The options --offline and --skipcache cannot be used together");
+        rc = -1;
+        return true;
+    }
+    if(cfg.silent && cfg.output_file.length() == 0 && cfg.outputAs.empty() && !cfg.serve && !batch) {
+        /* --silent without a filename for dumping the output does not make sense
+         * either
+         */
+        printf("The option --silent requires a filename specified with --output or --outputAs\n"
+               "unless --serve is used.");
+        LOG_F(INFO, "main(): --silent option was specified without using --output");
+        rc = -1;
+        return true;
+    }
+
+    for(const auto& spec : cfg.outputAs) {
+        OutputSpec output;
+        if(!ProgramOptions::parseOutputSpec(spec, cfg, output)) {
+            LOG_F(INFO, "main(): invalid --outputAs %s", spec.c_str());
+            extended_checks_failed = true;
+            printf("\nInvalid --outputAs %s. Expected FILE[=UNITS][:FORMAT|:TEMPLATE], for example\n"
+                   "weather_us.txt=F,mph,mi,inhg or weather.json\n", spec.c_str());
+        }
+    }
+
+    // compile the templates now, so errors are reported before anything is fetched. The
+    // handlers use the same compiled templates later, see OutputTemplate::get()
+    std::set<std::string> layouts;
+    if(!cfg.templateFile.empty())
+        layouts.insert(cfg.templateFile);
+    for(const auto& output : cfg.outputProfiles) {
+        if(!output.layout.empty())
+            layouts.insert(output.layout);
+    }
+    for(const auto& path : layouts) {
+        if(!OutputTemplate::get(path, cfg.config_dir_path)) {
+            extended_checks_failed = true;
+            printf("\nThe template %s cannot be used, see above or the log for details.\n", path.c_str());
+        }
+    }
+
+    if(cfg.apikey.length() == 0 && !cfg.autoProvider) {
+        LOG_F(INFO, "main(): Api KEY missing. Aborting.");
+        extended_checks_failed = true;
+        printf("\nThe API Key is missing. You must specify it with --apikey=your_key.\n");
+    }
+
+    if(cfg.location.length() == 0 && cfg.lat.length() == 0 && cfg.lon.length() == 0 && !batch) {
+        LOG_F(INFO, "main(): Location is missing. Aborting.");
+        extended_checks_failed = true;
+        printf("No location given. Option --loc=LOCATION is mandatory, where LOCATION\n"
+               "is either in LAT,LON form or a location ID created on your ClimaCell dashboard.\n");
+
+    }
+
+    if(cfg.daemon && cfg.interval < 60) {
+        LOG_F(INFO, "main(): --interval %d is too short", cfg.interval);
+        extended_checks_failed = true;
+        printf("\nThe --interval must be at least 60 seconds.\n");
+    }
+
+    if(batch && cfg.daemon) {
+        LOG_F(INFO, "main(): batch mode cannot be combined with --daemon or --serve");
+        extended_checks_failed = true;
+        printf("\n--batch and --site cannot be combined with --daemon or --serve.\n");
+    }
+
+    if(!cfg.race.empty() && (cfg.offline || cfg.daemon || batch)) {
+        LOG_F(INFO, "main(): --race cannot be combined with --offline, --daemon, --serve or batch mode");
+        extended_checks_failed = true;
+        printf("\n--race cannot be combined with --offline, --daemon, --serve, --batch or --site.\n");
+    }
+
+    if(cfg.autoProvider && (!cfg.race.empty() || cfg.daemon || batch)) {
+        LOG_F(INFO, "main(): --provider auto cannot be combined with --race, --daemon, --serve or batch mode");
+        extended_checks_failed = true;
+        printf("\n--provider auto cannot be combined with --race, --daemon, --serve, --batch or --site.\n");
+    }
+
+    if(extended_checks_failed) {
+        rc = -1;
+        return true;
+    }
+
+    if(cfg.autoProvider) {
+        rc = ProviderRouter::run(cfg);
+        return true;
+    }
+
+    if(!cfg.race.empty()) {
+        rc = ProviderRace::run(cfg);
+        return true;
+    }
+
+    if(batch) {
+        rc = Batch::run(cfg);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * fetch once, write all outputs and record the snapshot.
+ *
+ * @return      - the exit code
+ */
+int Startup::runOnce(const CFG& cfg)
+{
+    auto handler = DataHandler::create(cfg);
+    if(!handler) {
+        LOG_F(INFO, "No valid Provider selected. exiting.");
+        return -1;
+    }
+    int runresult = handler->run();
+    handler.reset();                    // records the snapshot
+    return cfg.debug ? -1 : runresult;
+}
@@ -0,0 +1,127 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_TASK_H_
+#define FETCHWEATHER_SRC_TASK_H_
+
+#include "pch.h"
+#include <coroutine>
+#include <exception>
+#include <optional>
+
+/*
+ * a lazily started coroutine returning T. Awaiting a Task starts it, the
+ * awaiting coroutine is resumed when it returns. Top level tasks are run by
+ * EventLoop::spawn() or EventLoop::run().
+ *
+ * The code base does not use exceptions, one escaping a coroutine
+ * terminates the program.
+ */
+template<typename T> class Task;
+
+namespace task_detail {
+    struct PromiseBase {
+        std::coroutine_handle<> continuation;
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        void unhandled_exception() noexcept { std::terminate(); }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            template<typename P>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+            {
+                auto next = h.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+    };
+
+    template<typename T>
+    struct Promise : PromiseBase {
+        std::optional<T>    value;
+
+        Task<T> get_return_object() noexcept;
+        void    return_value(T v) { value = std::move(v); }
+        T       result() { return std::move(*value); }
+    };
+
+    template<>
+    struct Promise<void> : PromiseBase {
+        Task<void> get_return_object() noexcept;
+        void    return_void() noexcept {}
+        void    result() {}
+    };
+}
+
+template<typename T = void>
+class Task {
+  public:
+    using promise_type = task_detail::Promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    Task() = default;
+    explicit Task(handle_type h) : m_handle(h) {}
+    Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept
+    {
+        if(this != &other) {
+            if(m_handle)
+                m_handle.destroy();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { if(m_handle) m_handle.destroy(); }
+
+    bool        done() const { return !m_handle || m_handle.done(); }
+    handle_type handle() const { return m_handle; }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_handle.promise().continuation = awaiting;
+        return m_handle;
+    }
+    T await_resume() { return m_handle.promise().result(); }
+
+  private:
+    handle_type     m_handle = nullptr;
+};
+
+namespace task_detail {
+    template<typename T>
+    Task<T> Promise<T>::get_return_object() noexcept
+    { return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this)); }
+
+    inline Task<void> Promise<void>::get_return_object() noexcept
+    { return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this)); }
+}
+
+#endif //FETCHWEATHER_SRC_TASK_H_
@@ -0,0 +1,426 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * The memory mapped time series log (--historyBackend=tslog).
+ */
+
+#include <atomic>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "HistoryDB.h"
+#include "TimeSeriesLog.h"
+
+TimeSeriesLog::TimeSeriesLog(const std::string& path, const std::string& db_path,
+                             const std::string& location, const std::string& provider) :
+    m_path(path), m_dbPath(db_path), m_location(location), m_provider(provider)
+{
+}
+
+/**
+ * the log file for a location and provider, inside the data directory.
+ */
+std::string TimeSeriesLog::pathFor(const std::string& data_dir, const std::string& location,
+                                   const std::string& provider)
+{
+    char hash[20];
+
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(utils::fnv1a(location.c_str(), location.length())));
+    std::string path(data_dir);
+    path.append("/history.").append(provider).append(".").append(hash).append(".tslog");
+    return path;
+}
+
+/**
+ * the log for path, shared by all handlers of the process which record
+ * the same location and provider (batch sites, the daemon and its
+ * refreshes). Logs are closed when the last handler is gone.
+ */
+std::shared_ptr<TimeSeriesLog> TimeSeriesLog::get(const std::string& path, const std::string& db_path,
+                                                  const std::string& location, const std::string& provider)
+{
+    static std::mutex lock;
+    static std::map<std::string, std::weak_ptr<TimeSeriesLog>> logs;
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto& entry = logs[path];
+    auto log = entry.lock();
+    if(!log) {
+        log = std::make_shared<TimeSeriesLog>(path, db_path, location, provider);
+        entry = log;
+    }
+    return log;
+}
+
+/**
+ * open or create the log. The lock is taken on a separate PATH.lock file
+ * because trim() replaces the log file itself, a process waiting for a
+ * lock on the old file would append to a file which no longer exists.
+ *
+ * @return      - true if the log is mapped and valid.
+ */
+bool TimeSeriesLog::open()
+{
+    if(this->m_base)
+        return true;
+
+    if(this->m_lockFd < 0) {
+        std::string lock(this->m_path);
+        lock.append(".lock");
+        this->m_lockFd = ::open(lock.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if(this->m_lockFd < 0) {
+            LOG_F(INFO, "TimeSeriesLog::open(): unable to open %s (%s)", lock.c_str(), strerror(errno));
+            return false;
+        }
+    }
+    if(!this->lock())
+        return false;
+    bool ok = this->mapFile(true);
+    this->unlock();
+    return ok;
+}
+
+/**
+ * open and map the log file.
+ *
+ * @param create    - create the file when it does not exist, the caller
+ *                    holds the lock.
+ */
+bool TimeSeriesLog::mapFile(bool create)
+{
+    struct stat st;
+
+    this->m_fd = ::open(this->m_path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0600);
+    if(this->m_fd < 0 || fstat(this->m_fd, &st) != 0) {
+        LOG_F(INFO, "TimeSeriesLog::mapFile(): unable to open %s (%s)", this->m_path.c_str(), strerror(errno));
+        this->unmap();
+        return false;
+    }
+    this->m_dev = st.st_dev;
+    this->m_ino = st.st_ino;
+
+    if(static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        if(!create || !this->map(TimeSeriesLog::grow_records)) {
+            this->unmap();
+            return false;
+        }
+        memset(this->m_header, 0, sizeof(Header));
+        memcpy(this->m_header->magic, "FWTSLOG", 8);
+        this->m_header->version = TimeSeriesLog::version;
+        this->m_header->record_size = sizeof(HistoryRecord);
+        snprintf(this->m_header->location, sizeof(this->m_header->location), "%s", this->m_location.c_str());
+        snprintf(this->m_header->provider, sizeof(this->m_header->provider), "%s", this->m_provider.c_str());
+        LOG_F(INFO, "TimeSeriesLog::mapFile(): created %s", this->m_path.c_str());
+        return true;
+    }
+
+    if(!this->map((st.st_size - sizeof(Header)) / sizeof(HistoryRecord))) {
+        this->unmap();
+        return false;
+    }
+    if(memcmp(this->m_header->magic, "FWTSLOG", 8) != 0 || this->m_header->version != TimeSeriesLog::version
+       || this->m_header->record_size != sizeof(HistoryRecord)
+       || this->m_header->count > this->m_capacity) {
+        LOG_F(INFO, "TimeSeriesLog::mapFile(): %s is not a valid log (version %u)", this->m_path.c_str(),
+              this->m_header->version);
+        this->unmap();
+        return false;
+    }
+    return true;
+}
+
+void TimeSeriesLog::close()
+{
+    this->unmap();
+    if(this->m_lockFd >= 0) {
+        ::close(this->m_lockFd);
+    }
+    this->m_lockFd = -1;
+}
+
+/**
+ * take the lock for writing. Another process holds it only for one write
+ * or maintenance pass, after lock_attempts the write is given up rather
+ * than blocking the event loop.
+ */
+bool TimeSeriesLog::lock()
+{
+    for(int i = 0; i < TimeSeriesLog::lock_attempts; i++) {
+        if(flock(this->m_lockFd, LOCK_EX | LOCK_NB) == 0)
+            return true;
+        if(errno != EWOULDBLOCK && errno != EINTR)
+            break;
+        usleep(TimeSeriesLog::lock_wait_ms * 1000);
+    }
+    LOG_F(INFO, "TimeSeriesLog::lock(): unable to lock %s.lock (%s), giving up", this->m_path.c_str(),
+          strerror(errno));
+    return false;
+}
+
+void TimeSeriesLog::unlock()
+{
+    flock(this->m_lockFd, LOCK_UN);
+}
+
+/**
+ * follow what other processes did to the log since it was mapped: a log
+ * replaced by trim() is opened again, one grown by append() is mapped with
+ * its new size.
+ *
+ * @return      - false if the log is gone or cannot be mapped.
+ */
+bool TimeSeriesLog::refresh()
+{
+    struct stat st;
+
+    if(stat(this->m_path.c_str(), &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header))
+        return false;
+    if(!this->m_base || st.st_dev != this->m_dev || st.st_ino != this->m_ino) {
+        this->unmap();
+        return this->mapFile(false);
+    }
+    size_t capacity = (st.st_size - sizeof(Header)) / sizeof(HistoryRecord);
+    return capacity <= this->m_capacity || this->map(capacity);
+}
+
+/**
+ * unmap and close the log file, the lock file stays open.
+ */
+void TimeSeriesLog::unmap()
+{
+    if(this->m_base) {
+        munmap(this->m_base, sizeof(Header) + this->m_capacity * sizeof(HistoryRecord));
+    }
+    if(this->m_fd >= 0) {
+        ::close(this->m_fd);
+    }
+    this->m_base = nullptr;
+    this->m_header = nullptr;
+    this->m_fd = -1;
+    this->m_capacity = 0;
+    this->m_index.clear();
+}
+
+/**
+ * (re)map the file with room for capacity records, growing the file when
+ * necessary.
+ */
+bool TimeSeriesLog::map(size_t capacity)
+{
+    size_t length = sizeof(Header) + capacity * sizeof(HistoryRecord);
+
+    if(this->m_base) {
+        munmap(this->m_base, sizeof(Header) + this->m_capacity * sizeof(HistoryRecord));
+        this->m_base = nullptr;
+        this->m_header = nullptr;
+    }
+    if(capacity > this->m_capacity && ftruncate(this->m_fd, length) != 0) {
+        LOG_F(INFO, "TimeSeriesLog::map(): unable to grow %s (%s)", this->m_path.c_str(), strerror(errno));
+        return false;
+    }
+    void *base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, this->m_fd, 0);
+    if(base == MAP_FAILED) {
+        LOG_F(INFO, "TimeSeriesLog::map(): mmap failed (%s)", strerror(errno));
+        return false;
+    }
+    this->m_base = static_cast<char *>(base);
+    this->m_header = reinterpret_cast<Header *>(base);
+    this->m_capacity = capacity;
+    return true;
+}
+
+bool TimeSeriesLog::isDuplicate(const DataPoint& d)
+{
+    if(!this->refresh() || this->m_header->count == 0)
+        return false;
+    const HistoryRecord& last = this->records()[this->m_header->count - 1];
+    return last.timestamp == d.timeRecorded && last.fingerprint == d.fingerprint;
+}
+
+bool TimeSeriesLog::insert(const DataPoint& d, const std::vector<ForecastPoint>& timeline)
+{
+    if(!this->lock())
+        return false;
+    bool ok = this->refresh() && this->append(HistoryRecord::fromDataPoint(d));
+    this->unlock();
+    return ok;
+}
+
+/**
+ * append a record. The record is written before the count is advanced, a
+ * reader never sees a partial record. Does not lock, see insert().
+ *
+ * @return      - false if the log is not open, the file cannot grow or the
+ *                record is older than the last one.
+ */
+bool TimeSeriesLog::append(const HistoryRecord& r)
+{
+    if(!this->m_header)
+        return false;
+
+    uint64_t count = this->m_header->count;
+    if(count > 0 && r.timestamp < this->records()[count - 1].timestamp) {
+        LOG_F(INFO, "TimeSeriesLog::append(): record older than the end of the log, dropped");
+        return false;
+    }
+    if(count == this->m_capacity && !this->map(this->m_capacity + TimeSeriesLog::grow_records))
+        return false;
+
+    this->records()[count] = r;
+    std::atomic_thread_fence(std::memory_order_release);
+    this->m_header->count = count + 1;
+    if(!this->m_index.empty() && count % TimeSeriesLog::index_stride == 0) {
+        this->m_index.emplace_back(r.timestamp, count);
+    }
+    return true;
+}
+
+/**
+ * range scan. The sparse index narrows the start down to index_stride
+ * records, from there the records are read sequentially.
+ */
+bool TimeSeriesLog::scan(time_t from, time_t to, const std::function<bool(const HistoryRecord&)>& fn)
+{
+    if(!this->refresh())
+        return false;
+
+    const HistoryRecord *r = this->records();
+    const uint64_t count = this->m_header->count;
+
+    for(uint64_t i = this->m_index.size() * TimeSeriesLog::index_stride; i < count; i += TimeSeriesLog::index_stride) {
+        this->m_index.emplace_back(r[i].timestamp, i);
+    }
+    auto it = std::lower_bound(this->m_index.begin(), this->m_index.end(), static_cast<int64_t>(from),
+                               [](const auto& entry, int64_t ts) { return entry.first < ts; });
+    uint64_t i = (it == this->m_index.begin()) ? 0 : std::prev(it)->second;
+
+    for(; i < count && r[i].timestamp <= to; i++) {
+        if(r[i].timestamp >= from && !fn(r[i]))
+            break;
+    }
+    return true;
+}
+
+/**
+ * load all records which are not yet in history.sqlite3 in one transaction.
+ * Does not lock, see maintenance().
+ *
+ * @return      - true if the database is up to date with the log.
+ */
+bool TimeSeriesLog::bulkLoad()
+{
+    if(!this->m_header)
+        return false;
+
+    uint64_t count = this->m_header->count, loaded = this->m_header->loaded;
+    if(loaded < count) {
+        HistoryDB db(this->m_dbPath, this->m_header->location, this->m_header->provider);
+        if(!db.open() || !db.insertRecords(this->records() + loaded, count - loaded,
+                                           db.locationId(this->m_header->location),
+                                           db.providerId(this->m_header->provider))) {
+            LOG_F(INFO, "TimeSeriesLog::bulkLoad(): loading %s failed", this->m_path.c_str());
+            return false;
+        }
+        this->m_header->loaded = count;
+        LOG_F(INFO, "TimeSeriesLog::bulkLoad(): %llu records loaded into %s",
+              static_cast<unsigned long long>(count - loaded), this->m_dbPath.c_str());
+    }
+    this->m_header->last_load = time(0);
+    msync(this->m_base, sizeof(Header), MS_ASYNC);
+    return true;
+}
+
+/**
+ * bulk load into SQLite, apply the retention policy there and drop loaded
+ * records older than the raw retention from the log.
+ */
+bool TimeSeriesLog::maintenance(const RetentionPolicy& policy, bool force)
+{
+    if(!this->m_header || !this->lock())
+        return false;
+    // another process may have loaded the log in the meantime
+    bool ok = this->refresh();
+    bool due = ok && (force || time(0) - this->m_header->last_load >= TimeSeriesLog::load_interval);
+    if(due)
+        ok = this->bulkLoad();
+    this->unlock();
+    if(!due || !ok)
+        return ok;
+
+    // compacting the database does not need the lock
+    HistoryDB db(this->m_dbPath, this->m_header->location, this->m_header->provider);
+    bool result = db.open() && db.compact(policy, force);
+    if(policy.raw_days > 0) {
+        if(!this->lock())
+            return false;
+        result &= this->refresh() && this->trim(time(0) - policy.raw_days * 86400LL);
+        this->unlock();
+    }
+    return result;
+}
+
+/**
+ * remove loaded records older than cutoff. Only done when at least half of
+ * the log can go, the remaining records are written into a new file which
+ * replaces the log.
+ */
+bool TimeSeriesLog::trim(int64_t cutoff)
+{
+    const HistoryRecord *r = this->records();
+    const uint64_t count = this->m_header->count;
+    uint64_t drop = std::lower_bound(r, r + this->m_header->loaded, cutoff,
+                                     [](const HistoryRecord& rec, int64_t ts) { return rec.timestamp < ts; }) - r;
+
+    if(drop == 0 || drop < count / 2)
+        return true;
+
+    std::string tmp(this->m_path);
+    tmp.append(".tmp");
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd < 0)
+        return false;
+
+    Header h = *this->m_header;
+    h.count -= drop;
+    h.loaded -= drop;
+    bool ok = ::write(fd, &h, sizeof(h)) == sizeof(h);
+    size_t bytes = (count - drop) * sizeof(HistoryRecord);
+    ok = ok && ::write(fd, r + drop, bytes) == static_cast<ssize_t>(bytes);
+    ok = ok && fsync(fd) == 0;
+    ::close(fd);
+    if(!ok || rename(tmp.c_str(), this->m_path.c_str()) != 0) {
+        LOG_F(INFO, "TimeSeriesLog::trim(): unable to rewrite %s", this->m_path.c_str());
+        unlink(tmp.c_str());
+        return false;
+    }
+    LOG_F(INFO, "TimeSeriesLog::trim(): %llu expired records removed", static_cast<unsigned long long>(drop));
+    this->unmap();
+    return this->mapFile(false);
+}
@@ -0,0 +1,112 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FETCHWEATHER_SRC_TIMESERIESLOG_H_
+#define FETCHWEATHER_SRC_TIMESERIESLOG_H_
+
+#include "pch.h"
+#include <sys/types.h>
+#include "HistoryBackend.h"
+
+/*
+ * Append-only, memory mapped log of HistoryRecords for one location and
+ * provider (--historyBackend=tslog). Recording an observation is a memcpy
+ * into the mapping, no SQLite involved. Records are kept in ascending time
+ * order, a sparse index (every index_stride-th timestamp) is built on the
+ * first range scan.
+ *
+ * maintenance() bulk loads all records not yet in history.sqlite3 in one
+ * transaction (at most once per load_interval unless forced) and afterwards
+ * drops records beyond the raw retention from the front of the log.
+ * Forecast timelines are not kept by the log.
+ *
+ * Writers (insert(), maintenance()) lock PATH.lock for the duration of the
+ * write only and give up after lock_attempts. Afterwards they follow what
+ * other processes did to the log: a grown file is mapped again, one
+ * replaced by trim() is reopened. Handlers of one process share the log,
+ * see get().
+ */
+class TimeSeriesLog : public HistoryBackend {
+  public:
+    TimeSeriesLog(const std::string& path, const std::string& db_path,
+                  const std::string& location, const std::string& provider);
+    ~TimeSeriesLog() { this->close(); }
+
+    bool    open() override;
+    void    close();
+    bool    isDuplicate(const DataPoint& d) override;
+    bool    insert(const DataPoint& d, const std::vector<ForecastPoint>& timeline) override;
+    bool    append(const HistoryRecord& r);
+    bool    scan(time_t from, time_t to, const std::function<bool(const HistoryRecord&)>& fn) override;
+    bool    maintenance(const RetentionPolicy& policy, bool force = false) override;
+    bool    bulkLoad();
+    size_t  size() const { return m_header ? m_header->count : 0; }
+
+    static std::string pathFor(const std::string& data_dir, const std::string& location,
+                               const std::string& provider);
+    static std::shared_ptr<TimeSeriesLog>   get(const std::string& path, const std::string& db_path,
+                                                const std::string& location, const std::string& provider);
+
+    static constexpr uint32_t   version = 1;
+    static constexpr size_t     grow_records = 4096;        // file growth step
+    static constexpr size_t     index_stride = 64;          // records per sparse index entry
+    static constexpr int        load_interval = 3600;       // seconds between automatic bulk loads
+    static constexpr int        lock_attempts = 50;         // tries to take the lock, ...
+    static constexpr int        lock_wait_ms = 100;         // ... this far apart
+
+  private:
+    struct Header {
+        char        magic[8];
+        uint32_t    version;
+        uint32_t    record_size;
+        uint64_t    count;              // records in the log
+        uint64_t    loaded;             // records already loaded into SQLite
+        int64_t     last_load;
+        char        location[256];
+        char        provider[16];
+        char        _reserved[4096 - 312];
+    };
+    static_assert(sizeof(Header) == 4096, "the header occupies exactly one page");
+
+    bool            map(size_t capacity);
+    bool            mapFile(bool create);
+    void            unmap();
+    bool            refresh();
+    bool            lock();
+    void            unlock();
+    bool            trim(int64_t cutoff);
+    HistoryRecord*  records() const { return reinterpret_cast<HistoryRecord *>(m_base + sizeof(Header)); }
+
+    std::string     m_path, m_dbPath, m_location, m_provider;
+    int             m_fd = -1;
+    int             m_lockFd = -1;                          // PATH.lock, locked while writing
+    dev_t           m_dev = 0;                              // the mapped file, see refresh()
+    ino_t           m_ino = 0;
+    char            *m_base = nullptr;
+    Header          *m_header = nullptr;
+    size_t          m_capacity = 0;
+    std::vector<std::pair<int64_t, uint64_t>>   m_index;    // sparse (timestamp, record number)
+};
+
+#endif //FETCHWEATHER_SRC_TIMESERIESLOG_H_
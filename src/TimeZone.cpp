@@ -0,0 +1,433 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <cstring>
+#include "TimeZone.h"
+#include "utils.h"
+
+namespace {
+    int64_t be32(const unsigned char *p)
+    {
+        return static_cast<int32_t>(static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16
+                                    | static_cast<uint32_t>(p[2]) << 8 | p[3]);
+    }
+
+    int64_t be64(const unsigned char *p)
+    {
+        return static_cast<int64_t>(static_cast<uint64_t>(static_cast<uint32_t>(be32(p))) << 32
+                                    | static_cast<uint32_t>(be32(p + 4)));
+    }
+
+    /*
+     * a date in a POSIX TZ rule: Jn (1-365, February 29th is never
+     * counted), n (0-365) or Mm.w.d (day d of week w of month m, week 5
+     * is the last one). time is the local time of the change in seconds.
+     */
+    struct RuleDate {
+        char    kind = 'M';
+        int     month = 0, week = 0, day = 0;
+        int     time = 7200;
+    };
+
+    bool isLeap(int y) { return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0; }
+
+    int64_t dayOf(const RuleDate& r, int year)
+    {
+        int64_t jan1 = utils::daysFromCivil(year, 1, 1);
+
+        if(r.kind == 'J')
+            return jan1 + r.day - 1 + (isLeap(year) && r.day >= 60 ? 1 : 0);
+        if(r.kind == 'N')
+            return jan1 + r.day;
+
+        int64_t first = utils::daysFromCivil(year, r.month, 1);
+        int64_t next = utils::daysFromCivil(r.month == 12 ? year + 1 : year, r.month % 12 + 1, 1);
+        int wd = static_cast<int>(((first + 4) % 7 + 7) % 7);       // 0 = Sunday
+        int64_t day = first + (r.day - wd + 7) % 7 + 7 * (r.week - 1);
+        while(day >= next)
+            day -= 7;
+        return day;
+    }
+
+    bool parseNumber(const char *&p, int& value, int max_digits)
+    {
+        int n = 0;
+        value = 0;
+        while(n < max_digits && *p >= '0' && *p <= '9') {
+            value = value * 10 + (*p++ - '0');
+            n++;
+        }
+        return n > 0;
+    }
+
+    /*
+     * [+-]hh[:mm[:ss]], hours may have up to three digits (RFC 8536 rule
+     * times range from -167 to 167 hours).
+     */
+    bool parseTime(const char *&p, int& seconds)
+    {
+        int sign = 1, h, m = 0, s = 0;
+        if(*p == '+' || *p == '-')
+            sign = *p++ == '-' ? -1 : 1;
+        if(!parseNumber(p, h, 3))
+            return false;
+        if(*p == ':') {
+            p++;
+            if(!parseNumber(p, m, 2))
+                return false;
+            if(*p == ':') {
+                p++;
+                if(!parseNumber(p, s, 2))
+                    return false;
+            }
+        }
+        seconds = sign * (h * 3600 + m * 60 + s);
+        return true;
+    }
+
+    bool parseName(const char *&p, std::string& name)
+    {
+        const char *start = p;
+        if(*p == '<') {
+            start = ++p;
+            while(*p && *p != '>')
+                p++;
+            if(*p != '>')
+                return false;
+            name.assign(start, p++ - start);
+        } else {
+            while((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z'))
+                p++;
+            name.assign(start, p - start);
+        }
+        return name.size() >= 3;
+    }
+
+    bool parseDate(const char *&p, RuleDate& r)
+    {
+        if(*p == 'M') {
+            p++;
+            r.kind = 'M';
+            if(!parseNumber(p, r.month, 2) || *p++ != '.' || !parseNumber(p, r.week, 1) || *p++ != '.'
+               || !parseNumber(p, r.day, 1) || r.month < 1 || r.month > 12 || r.week < 1 || r.week > 5
+               || r.day > 6)
+                return false;
+        } else {
+            r.kind = 'N';
+            if(*p == 'J') {
+                p++;
+                r.kind = 'J';
+            }
+            if(!parseNumber(p, r.day, 3) || r.day > 365 || (r.kind == 'J' && r.day < 1))
+                return false;
+        }
+        if(*p == '/') {
+            p++;
+            return parseTime(p, r.time);
+        }
+        return true;
+    }
+}
+
+/**
+ * the time zone name, loaded on first use. name is a zone from the tz
+ * database (Europe/Vienna), an absolute path to a TZif file, a POSIX TZ
+ * rule (CET-1CEST,M3.5.0,M10.5.0/3) or empty for the system time zone
+ * (/etc/localtime). TZDIR overrides the location of the database.
+ *
+ * @param name      - the time zone
+ * @return          - never nullptr. Zones which cannot be loaded are UTC.
+ */
+const TimeZone *TimeZone::get(const std::string& name)
+{
+    static std::mutex lock;
+    static std::map<std::string, std::unique_ptr<TimeZone>> zones;
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto it = zones.find(name);
+    if(it != zones.end())
+        return it->second.get();
+
+    std::unique_ptr<TimeZone> tz(new TimeZone(name));
+    std::string path;
+    if(name.empty()) {
+        path = "/etc/localtime";
+    } else if(name[0] == '/') {
+        path = name;
+    } else if(name.find("..") == std::string::npos) {
+        const char *dir = getenv("TZDIR");
+        path.assign(dir && *dir ? dir : TimeZone::zoneinfo).append("/").append(name);
+    }
+    if(path.empty() || !tz->load(path)) {
+        tz->m_types.clear();
+        tz->m_transitions.clear();
+        tz->m_abbr.clear();
+        if(name.empty() || !tz->parseRule(name.c_str())) {
+            LOG_F(INFO, "TimeZone::get(): Unable to load time zone %s, using UTC", name.c_str());
+            tz->m_types.clear();
+            tz->m_transitions.clear();
+            tz->m_abbr.clear();
+            tz->addType(0, false, "UTC");
+        }
+    }
+    tz->buildIndex();
+    LOG_F(INFO, "TimeZone::get(): %s loaded, %zu transitions", name.c_str(), tz->m_transitions.size());
+    return zones.emplace(name, std::move(tz)).first->second.get();
+}
+
+/**
+ * convert t to the broken down local time, like localtime_r().
+ */
+void TimeZone::toLocal(time_t t, tm& result) const
+{
+    const Type& type = m_types[this->typeAt(t)];
+    int64_t local = static_cast<int64_t>(t) + type.offset;
+    int64_t days = (local >= 0 ? local : local - 86399) / 86400;
+    int64_t secs = local - days * 86400;
+    int year;
+    unsigned month, day;
+
+    utils::civilFromDays(days, year, month, day);
+    result.tm_year = year - 1900;
+    result.tm_mon = static_cast<int>(month) - 1;
+    result.tm_mday = static_cast<int>(day);
+    result.tm_hour = static_cast<int>(secs / 3600);
+    result.tm_min = static_cast<int>(secs / 60 % 60);
+    result.tm_sec = static_cast<int>(secs % 60);
+    result.tm_wday = static_cast<int>(((days + 4) % 7 + 7) % 7);
+    result.tm_yday = static_cast<int>(days - utils::daysFromCivil(year, 1, 1));
+    result.tm_isdst = type.isdst ? 1 : 0;
+    result.tm_gmtoff = type.offset;
+    result.tm_zone = m_abbr.c_str() + type.abbr;
+}
+
+/**
+ * read a TZif file.
+ *
+ * @return      - false if it cannot be read or is no valid TZif file.
+ */
+bool TimeZone::load(const std::string& path)
+{
+    std::ifstream f(path, std::ios::binary);
+    if(!f)
+        return false;
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    if(!this->parseTZif(data.data(), data.size())) {
+        LOG_F(INFO, "TimeZone::load(): %s is no valid TZif file", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * parse the TZif data (RFC 8536). Version 2 and later files are read from
+ * the 64bit section and their footer rule extends the transitions.
+ */
+bool TimeZone::parseTZif(const unsigned char *data, size_t len)
+{
+    const unsigned char *end = data + len, *h = data;
+    size_t timesize = 4;
+
+    auto body = [&timesize](const unsigned char *h) -> size_t {
+        return be32(h + 32) * timesize + be32(h + 32) + be32(h + 36) * 6 + be32(h + 40)
+               + be32(h + 28) * (timesize + 4) + be32(h + 24) + be32(h + 20);
+    };
+
+    if(len < 44 || memcmp(data, "TZif", 4) != 0)
+        return false;
+    if(data[4] >= '2') {
+        size_t v1 = 44 + body(data);
+        if(len < v1 + 44 || memcmp(data + v1, "TZif", 4) != 0)
+            return false;
+        h = data + v1;
+        timesize = 8;
+    }
+    int64_t timecnt = be32(h + 32), typecnt = be32(h + 36), charcnt = be32(h + 40);
+    if(timecnt < 0 || typecnt < 1 || typecnt > 256 || charcnt < 0 || static_cast<size_t>(end - h) < 44 + body(h))
+        return false;
+
+    const unsigned char *times = h + 44;
+    const unsigned char *idx = times + timecnt * timesize;
+    const unsigned char *types = idx + timecnt;
+    const unsigned char *chars = types + typecnt * 6;
+
+    m_abbr.assign(reinterpret_cast<const char *>(chars), charcnt);
+    m_abbr.push_back(0);
+    for(int64_t i = 0; i < typecnt; i++) {
+        const unsigned char *t = types + i * 6;
+        if(t[5] >= charcnt)
+            return false;
+        m_types.push_back({ static_cast<int32_t>(be32(t)), t[4] != 0, t[5] });
+    }
+    for(int64_t i = 0; i < timecnt; i++) {
+        if(idx[i] >= typecnt)
+            return false;
+        m_transitions.push_back({ timesize == 8 ? be64(times + i * 8) : be32(times + i * 4), idx[i] });
+    }
+
+    const unsigned char *footer = h + 44 + body(h);
+    if(timesize == 8 && footer < end && *footer == '\n') {
+        const unsigned char *nl = static_cast<const unsigned char *>(memchr(footer + 1, '\n', end - footer - 1));
+        if(nl && nl > footer + 1) {
+            std::string rule(reinterpret_cast<const char *>(footer + 1), nl - footer - 1);
+            if(!this->parseRule(rule.c_str()))
+                LOG_F(INFO, "TimeZone::parseTZif(): Ignoring invalid rule %s", rule.c_str());
+        }
+    }
+    return true;
+}
+
+/**
+ * the local time type with offset, DST flag and abbreviation, added if it
+ * does not exist yet.
+ *
+ * @return      - its index in m_types
+ */
+int TimeZone::addType(int32_t offset, bool isdst, const std::string& abbr)
+{
+    for(size_t i = 0; i < m_types.size(); i++) {
+        const Type& t = m_types[i];
+        if(t.offset == offset && t.isdst == isdst && abbr == m_abbr.c_str() + t.abbr)
+            return static_cast<int>(i);
+    }
+    size_t pos = m_abbr.find(abbr + '\0');
+    if(pos == std::string::npos) {
+        pos = m_abbr.size();
+        m_abbr.append(abbr).push_back(0);
+    }
+    m_types.push_back({ offset, isdst, static_cast<uint16_t>(pos) });
+    return static_cast<int>(m_types.size() - 1);
+}
+
+/**
+ * parse a POSIX TZ rule (std offset [dst [offset] [,start[/time],end[/time]]])
+ * and generate its transitions after the last known one up to max_year.
+ * A rule without DST only adds its type when there are no transitions.
+ */
+bool TimeZone::parseRule(const char *rule)
+{
+    const char *p = rule;
+    std::string std_name, dst_name;
+    int std_off, dst_off;
+    RuleDate start, end;
+
+    if(!parseName(p, std_name) || !parseTime(p, std_off))
+        return false;
+    std_off = -std_off;                 // POSIX offsets count west of Greenwich
+    if(*p == 0) {
+        if(m_transitions.empty() && m_types.empty())
+            this->addType(std_off, false, std_name);
+        return true;
+    }
+    if(!parseName(p, dst_name))
+        return false;
+    dst_off = std_off + 3600;
+    if(*p != ',' && *p != 0) {
+        if(!parseTime(p, dst_off))
+            return false;
+        dst_off = -dst_off;
+    }
+    if(*p == 0) {
+        const char *us = ",M3.2.0,M11.1.0";
+        p = us;
+    }
+    if(*p++ != ',' || !parseDate(p, start) || *p++ != ',' || !parseDate(p, end) || *p != 0)
+        return false;
+
+    int std_type = this->addType(std_off, false, std_name);
+    int dst_type = this->addType(dst_off, true, dst_name);
+    int64_t last = m_transitions.empty() ? INT64_MIN : m_transitions.back().at;
+    int year = 1970;
+    if(!m_transitions.empty()) {
+        unsigned m, d;
+        int64_t t = last;
+        utils::civilFromDays((t >= 0 ? t : t - 86399) / 86400, year, m, d);
+    }
+    for(; year <= TimeZone::max_year; year++) {
+        Transition on = { dayOf(start, year) * 86400 + start.time - std_off, dst_type };
+        Transition off = { dayOf(end, year) * 86400 + end.time - dst_off, std_type };
+        if(off.at < on.at)
+            std::swap(on, off);
+        for(const Transition& t : { on, off }) {
+            if(t.at > last)
+                m_transitions.push_back(t);
+        }
+    }
+    return true;
+}
+
+/**
+ * fill m_index, see the class description
+ */
+void TimeZone::buildIndex()
+{
+    const int64_t size = 1LL << TimeZone::bucket_shift;
+    const int64_t buckets = utils::daysFromCivil(TimeZone::max_year + 1, 1, 1) * 86400 / size + 1;
+
+    m_index.resize(buckets);
+    for(int64_t b = 0; b < buckets; b++) {
+        int64_t from = b * size;
+        auto it = std::upper_bound(m_transitions.begin(), m_transitions.end(), from,
+                                   [](int64_t t, const Transition& tr) { return t < tr.at; });
+        Bucket& bucket = m_index[b];
+        bucket.before = static_cast<uint16_t>(it == m_transitions.begin() ? 0 : (it - 1)->type);
+        bucket.after = bucket.before;
+        bucket.at = INT64_MAX;
+        if(it != m_transitions.end() && it->at < from + size) {
+            bucket.at = it->at;
+            bucket.after = static_cast<uint16_t>(it->type);
+            if(it + 1 != m_transitions.end() && (it + 1)->at < from + size)
+                bucket.at = INT64_MIN;
+        }
+    }
+}
+
+/**
+ * @return      - index of the local time type in effect at t
+ */
+int TimeZone::typeAt(time_t t) const
+{
+    uint64_t b = static_cast<uint64_t>(t) >> TimeZone::bucket_shift;
+    if(t >= 0 && b < m_index.size()) {
+        const Bucket& bucket = m_index[b];
+        if(bucket.at != INT64_MIN)
+            return t >= bucket.at ? bucket.after : bucket.before;
+    }
+    return this->search(t);
+}
+
+/**
+ * binary search for the type in effect at t. Before the first transition,
+ * the first type applies.
+ */
+int TimeZone::search(int64_t t) const
+{
+    auto it = std::upper_bound(m_transitions.begin(), m_transitions.end(), t,
+                               [](int64_t t, const Transition& tr) { return t < tr.at; });
+    return it == m_transitions.begin() ? 0 : (it - 1)->type;
+}
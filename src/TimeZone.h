@@ -0,0 +1,92 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_TIMEZONE_H_
+#define FETCHWEATHER_SRC_TIMEZONE_H_
+
+#include "pch.h"
+
+/*
+ * a time zone loaded from the system tz database (TZif files, RFC 8536),
+ * used to convert timestamps to the local time of a location (--tz)
+ * without localtime() and the process-global TZ.
+ *
+ * All UTC offset transitions are read from the file. Transitions after the
+ * last one in the file are generated from the POSIX TZ rule in its footer
+ * up to max_year. An index with one entry per 2^bucket_shift seconds from
+ * 1970 to max_year holds the local time type at the start of each bucket
+ * and the (single) transition inside it, so offset() is a constant-time
+ * lookup. Buckets with more than one transition and times outside the
+ * indexed range fall back to a binary search.
+ *
+ * Zones are loaded once by get() and never destroyed or modified
+ * afterwards, so the pointers can be kept and used from any thread
+ * without locking.
+ */
+class TimeZone {
+  public:
+    static const TimeZone *get(const std::string& name);
+
+    int                 offset(time_t t) const { return m_types[this->typeAt(t)].offset; }
+    void                toLocal(time_t t, tm& result) const;
+    const std::string&  name() const { return m_name; }
+
+    static constexpr int        max_year = 2100;
+    static constexpr int        bucket_shift = 20;          // ~12 days, transitions are further apart
+    static constexpr const char *zoneinfo = "/usr/share/zoneinfo";
+
+  private:
+    explicit TimeZone(const std::string& name) : m_name(name) {}
+
+    struct Type {
+        int32_t     offset;                 // seconds east of UTC
+        bool        isdst;
+        uint16_t    abbr;                   // index into m_abbr
+    };
+    struct Transition {
+        int64_t     at;
+        int         type;
+    };
+    struct Bucket {
+        int64_t     at;                     // transition in the bucket, INT64_MAX if none, INT64_MIN if several
+        uint16_t    before, after;          // type before and after it
+    };
+
+    bool    load(const std::string& path);
+    bool    parseTZif(const unsigned char *data, size_t len);
+    bool    parseRule(const char *rule);
+    int     addType(int32_t offset, bool isdst, const std::string& abbr);
+    void    buildIndex();
+    int     typeAt(time_t t) const;
+    int     search(int64_t t) const;
+
+    std::string                 m_name;
+    std::vector<Type>           m_types;
+    std::vector<Transition>     m_transitions;
+    std::string                 m_abbr;     // 0-terminated abbreviations
+    std::vector<Bucket>         m_index;
+};
+
+#endif //FETCHWEATHER_SRC_TIMEZONE_H_
@@ -0,0 +1,135 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "UnitProfile.h"
+
+namespace {
+
+std::pair<const UnitProfile::Unit *, size_t> tableFor(UnitProfile::Quantity q)
+{
+    switch(q) {
+        case UnitProfile::TEMPERATURE:
+            return { UnitProfile::temperature_units, std::size(UnitProfile::temperature_units) };
+        case UnitProfile::SPEED:
+            return { UnitProfile::speed_units, std::size(UnitProfile::speed_units) };
+        case UnitProfile::VISIBILITY:
+            return { UnitProfile::visibility_units, std::size(UnitProfile::visibility_units) };
+        case UnitProfile::PRESSURE:
+            return { UnitProfile::pressure_units, std::size(UnitProfile::pressure_units) };
+        default:
+            return { nullptr, 0 };
+    }
+}
+
+}
+
+/**
+ * look up a unit by name. Temperature units are matched by their first
+ * letter, case-insensitive (c, C, Celsius...).
+ *
+ * @return      - the table entry or nullptr if the unit is not recognized.
+ */
+const UnitProfile::Unit *UnitProfile::find(Quantity q, std::string_view name)
+{
+    auto [table, count] = tableFor(q);
+
+    if(name.empty()) {
+        return nullptr;
+    }
+    for(size_t i = 0; i < count; i++) {
+        if(q == TEMPERATURE ? toupper(static_cast<unsigned char>(name[0])) == table[i].name[0]
+                            : name == table[i].name) {
+            return &table[i];
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * the canonical units, nothing is converted.
+ */
+UnitProfile UnitProfile::metric()
+{
+    UnitProfile profile;
+    profile.units[SPEED] = &speed_units[0];
+    return profile;
+}
+
+/**
+ * parse a profile in the form TEMP[,SPEED[,VIS[,PRESSURE]]], e.g.
+ * F,mph,mi,inhg. Omitted units keep the value already in profile.
+ *
+ * @return      - false if one of the units is not recognized.
+ */
+bool UnitProfile::parse(const std::string& spec, UnitProfile& profile)
+{
+    UnitProfile result = profile;
+    std::string_view rest(spec);
+    int q = TEMPERATURE;
+
+    do {
+        auto pos = rest.find(',');
+        auto item = rest.substr(0, pos);
+        rest = pos == std::string_view::npos ? std::string_view() : rest.substr(pos + 1);
+        if(q == QUANTITIES || !(result.units[q] = UnitProfile::find(static_cast<Quantity>(q), item)))
+            return false;
+        q++;
+    } while(!rest.empty());
+    profile = result;
+    return true;
+}
+
+/**
+ * the profile as a single integer, one byte per quantity holding the table
+ * index of its unit + 1. For storing a profile in the history database,
+ * never 0.
+ */
+int64_t UnitProfile::code() const
+{
+    int64_t code = 0;
+
+    for(int q = 0; q < QUANTITIES; q++) {
+        auto [table, count] = tableFor(static_cast<Quantity>(q));
+        code |= static_cast<int64_t>(this->units[q] - table + 1) << (8 * q);
+    }
+    return code;
+}
+
+/**
+ * the profile stored by code().
+ *
+ * @return      - false if the code does not describe a valid profile.
+ */
+bool UnitProfile::fromCode(int64_t code, UnitProfile& profile)
+{
+    for(int q = 0; q < QUANTITIES; q++) {
+        auto [table, count] = tableFor(static_cast<Quantity>(q));
+        size_t index = (code >> (8 * q)) & 0xff;
+        if(index == 0 || index > count)
+            return false;
+        profile.units[q] = &table[index - 1];
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef FETCHWEATHER_SRC_UNITPROFILE_H_
+#define FETCHWEATHER_SRC_UNITPROFILE_H_
+
+#include "pch.h"
+
+/*
+ * the units a snapshot is rendered in. Snapshots, forecasts and the history
+ * are always metric (°C, m/s, km, hPa), conversion only happens while
+ * rendering, so one fetch can be rendered in any number of profiles.
+ *
+ * Unit names are resolved once (when the options are validated or a
+ * profile is parsed) into entries of the unit tables below. Converting a
+ * value is then a multiply-add with the factors of the entry.
+ */
+struct UnitProfile {
+    enum Quantity { TEMPERATURE, SPEED, VISIBILITY, PRESSURE, QUANTITIES };
+
+    struct Unit {
+        const char  *name;          // as given on the command line
+        const char  *label;         // as rendered
+        double      scale, offset;  // value = metric * scale + offset
+        int         decimals;       // precision for output
+    };
+
+    static constexpr Unit temperature_units[] = { {"C", "\xc2\xb0" "C", 1.0, 0.0, 1},
+                                                  {"F", "\xc2\xb0" "F", 9.0 / 5.0, 32.0, 1} };
+    static constexpr Unit speed_units[] = { {"m/s", "m/s", 1.0, 0.0, 1},
+                                            {"kts", "kts", 1.944, 0.0, 1},
+                                            {"km/h", "km/h", 3.6, 0.0, 1},
+                                            {"mph", "mph", 2.237, 0.0, 1} };
+    static constexpr Unit visibility_units[] = { {"km", "km", 1.0, 0.0, 1},
+                                                 {"mi", "mi", 1.0 / 1.609, 0.0, 1} };
+    static constexpr Unit pressure_units[] = { {"hPa", "hPa", 1.0, 0.0, 0},
+                                               {"inhg", "InHg", 1.0 / 33.863886666667, 0.0, 2} };
+
+    const Unit  *units[QUANTITIES] = { &temperature_units[0], &speed_units[2],
+                                       &visibility_units[0], &pressure_units[0] };
+
+    double      convert(Quantity q, double metric) const
+    { return metric * this->units[q]->scale + this->units[q]->offset; }
+    double      temperature(double celsius) const { return this->convert(TEMPERATURE, celsius); }
+    double      speed(double ms) const { return this->convert(SPEED, ms); }
+    double      visibility(double km) const { return this->convert(VISIBILITY, km); }
+    double      pressure(double hPa) const { return this->convert(PRESSURE, hPa); }
+    double      toMetric(Quantity q, double value) const
+    { return (value - this->units[q]->offset) / this->units[q]->scale; }
+    const Unit& unit(Quantity q) const { return *this->units[q]; }
+    static UnitProfile  metric();
+    static const Unit   *find(Quantity q, std::string_view name);
+    static bool         parse(const std::string& spec, UnitProfile& profile);
+    int64_t             code() const;
+    static bool         fromCode(int64_t code, UnitProfile& profile);
+};
+
+#endif //FETCHWEATHER_SRC_UNITPROFILE_H_
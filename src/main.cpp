@@ -31,8 +31,6 @@ int main(int argc, char **argv)
     a.setApplicationName("fetchweather");
     a.setApplicationVersion("0.2");
 
-    ProgramOptions& opt = ProgramOptions::getInstance();
-    opt.setAppObject(&a);
     FetchWeatherApp w(&a, argc, argv);
     QObject::connect(&w, &FetchWeatherApp::finished, &a, &QCoreApplication::quit);
     QTimer::singleShot(0, &w, SLOT(run()));
@@ -0,0 +1,48 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "options.h"
+#include "Startup.h"
+
+/*
+ * fetchweather-lite: the same program without QCoreApplication and the
+ * Qt event loop, for one-shot invocations (conky, cron). --daemon and
+ * --serve are not available.
+ */
+int main(int argc, char **argv)
+{
+    int rc = 0;
+
+    Startup::init(argc, argv);
+    const CFG& cfg = ProgramOptions::getInstance().getConfig();
+
+    if(Startup::dispatch(cfg, rc))
+        return rc;
+    if(cfg.daemon) {
+        printf("--daemon and --serve need the Qt build of fetchweather.\n");
+        return -1;
+    }
+    return Startup::runOnce(cfg);
+}
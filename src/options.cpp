@@ -22,6 +22,7 @@
  * SOFTWARE.
  */
 
+#include <mutex>
 #include "utils.h"
 #include "options.h"
 
@@ -31,12 +32,11 @@ ProgramOptions::ProgramOptions() :
      .apiProvider = 0, .temp_unit = 'C', .temp_unit_raw = "C",
      .config_dir_path = "", .apikeyFile = "", .apikey = "", .apiProviderString = "",
      .vis_unit = "km", .speed_unit = "km/h", .pressure_unit = "hPa",
-     .output_file = "", .location="", .timezone="Europe/Vienna",
+     .output_file = "", .location="", .timezone="",
      .offline = false, .nocache = false, .skipcache = false,
      .silent = false, .debug = false, .dumptofile = false,
      .forecastDays = 3
-    },
-    m_Parser{}
+    }
 {
     this->_init();
 }
@@ -62,7 +62,8 @@ void ProgramOptions::_init()
     m_oCommand.add_option("--provider,-p", this->m_config.apiProviderString,
                           "Set the API provider.\n"
                           "Allowed values: CC (ClimaCell), OWM (OpenWeatherMap) or VC (VisualCrossing)\n"
-                          "Default is ClimaCell. This option is case-sensitive!");
+                          "Default is ClimaCell. This option is case-sensitive!\n"
+                          "auto picks the fastest healthy provider with a key file, see --health.");
 
     // TODO location
     /*
@@ -81,9 +82,25 @@ void ProgramOptions::_init()
                           this->m_config.lon,
                           "Set the longitude part of the location for API providers who need separate\n"
                           "latitude and longitude parameters. Format example: --lon=16.1222795");
-    m_oCommand.add_option("--tz", this->m_config.timezone, "Set the time zone, e.g. Europe/Berlin");
+    m_oCommand.add_option("--tz", this->m_config.timezone,
+                          "Set the time zone, e.g. Europe/Berlin. Default is the system time zone.");
     m_oCommand.add_option("--output,-o", this->m_config.output_file,
                           "Also write result to this file. Does not imply --silent.");
+    m_oCommand.add_option("--outputAs", this->m_config.outputAs,
+                          "Also write the result to FILE[=UNITS][:FORMAT|:TEMPLATE]. May be repeated,\n"
+                          "all outputs are rendered from the same fetch. UNITS is\n"
+                          "temperature[,speed[,vis[,pressure]]], omitted units are taken from the unit\n"
+                          "options. FORMAT is one of the --format values, TEMPLATE a layout file.\n"
+                          "Files ending in .json, .prom and .lp default to json, prometheus and influx.\n"
+                          "Examples: weather_us.txt=F,mph,mi,inhg  weather.prom  weather.dat=C:json");
+    m_oCommand.add_option("--format", this->m_config.outputFormat,
+                          "Output format: text (default, the layout given with --template), json,\n"
+                          "prometheus (node_exporter textfile) or influx (line protocol).")
+        ->check(CLI::IsMember({"text", "json", "prometheus", "influx"}));
+    m_oCommand.add_option("--template", this->m_config.templateFile,
+                          "Output layout template. Relative paths are looked up in the current\n"
+                          "directory, then in the config directory. Default is the built-in\n"
+                          "layout for the conky configuration.");
 
     m_oCommand.add_option("--tempUnit", this->m_config.temp_unit_raw,
                           "Unit to output the temperature: C or F, default is C.");
@@ -96,6 +113,240 @@ void ProgramOptions::_init()
     m_oCommand.add_option("--forecastDays,-d", this->m_config.forecastDays,
                           "Number of days to record daily forecasts. Defaults to 3\n"
                           "Maximum depends on the Weather API provider.");
+    m_oCommand.add_option("--retainRaw", this->m_config.retainRaw,
+                          "Days to keep raw history records. Older records remain available\n"
+                          "in the hourly and daily rollups. 0 keeps them forever, default is 14.");
+    m_oCommand.add_option("--retainHourly", this->m_config.retainHourly,
+                          "Days to keep hourly rollups. 0 keeps them forever, default is 365.");
+    m_oCommand.add_option("--retainDaily", this->m_config.retainDaily,
+                          "Days to keep daily rollups. Default is 0 (forever).");
+    m_oCommand.add_flag("--compact", this->m_config.compact,
+                        "Apply the retention policy to the history database now. This\n"
+                        "otherwise happens automatically once a day. With --historyBackend=tslog\n"
+                        "this also loads the log into the database.");
+    m_oCommand.add_flag("--noarchive", this->m_config.noarchive,
+                        "Delete raw history records leaving the retention instead of moving\n"
+                        "them into the compressed archive (history.archive).");
+    m_oCommand.add_option("--historyBackend", this->m_config.historyBackend,
+                          "Where to record history. sqlite (default) writes every snapshot to\n"
+                          "history.sqlite3, tslog appends to a memory mapped log which is\n"
+                          "loaded into history.sqlite3 once an hour.")->check(CLI::IsMember({"sqlite", "tslog"}));
+    m_oCommand.add_option("--export", this->m_config.exportPath,
+                          "Export the recorded history to a file (- for stdout) and exit.");
+    m_oCommand.add_option("--import", this->m_config.importPath,
+                          "Import history from a file (- for stdin) and exit. Columns are matched\n"
+                          "by name, records already present are skipped.");
+    m_oCommand.add_option("--historyFormat", this->m_config.historyFormat,
+                          "Format for --export and --import: csv or jsonl. Default is derived\n"
+                          "from the file name (.jsonl, .ndjson, .json), otherwise csv.")
+        ->check(CLI::IsMember({"csv", "jsonl"}));
+    m_oCommand.add_option("--exportUnits", this->m_config.exportUnits,
+                          "Convert --export into these units (temperature[,speed[,vis[,pressure]]],\n"
+                          "e.g. F,mph,mi,inhg). Default is metric (C, m/s, km, hPa) as recorded.");
+    m_oCommand.add_option("--legacyUnits", this->m_config.legacyUnits,
+                          "Convert history recorded by older versions to metric and exit. They\n"
+                          "stored values in the --tempUnit, --speedUnit, --visUnit and --pressureUnit\n"
+                          "used at the time, give these here (e.g. F,mph,mi,inhg). Until then, that\n"
+                          "history is left out of rollups and exports.");
+    m_oCommand.add_option("--from", this->m_config.exportFrom,
+                          "Export only records recorded at or after this time (unix time).");
+    m_oCommand.add_option("--to", this->m_config.exportTo,
+                          "Export only records recorded at or before this time (unix time).");
+    m_oCommand.add_flag("--daemon", this->m_config.daemon,
+                          "Stay resident and refresh every --interval seconds. All outputs are\n"
+                          "rewritten after each refresh, the history database stays open.");
+    m_oCommand.add_option("--interval", this->m_config.interval,
+                          "Seconds between refreshes in --daemon mode. Default is 900, minimum 60.");
+    m_oCommand.add_option("--jitter", this->m_config.jitter,
+                          "Random variation of the --interval in seconds (+/-), default is 30.");
+    m_oCommand.add_flag("--serve", this->m_config.serve,
+                          "Like --daemon, but also answer snapshot queries from fetchweather-query\n"
+                          "on a Unix domain socket.");
+    m_oCommand.add_option("--socket", this->m_config.socketPath,
+                          "The socket for --serve. Default is $XDG_RUNTIME_DIR/fetchweather.sock,\n"
+                          "or /tmp/fetchweather-UID/fetchweather.sock without a runtime directory.");
+    m_oCommand.add_option("--batch", this->m_config.batchFile,
+                          "Fetch all locations listed in this file, one NAME LOCATION [TIMEZONE] per\n"
+                          "line, and write the outputs of each to the subdirectory NAME of the data\n"
+                          "directory. Sites without TIMEZONE use --tz.");
+    m_oCommand.add_option("--site", this->m_config.sites,
+                          "Add a location to the batch, in the form NAME=LOCATION[@TIMEZONE]. May be\n"
+                          "repeated and combined with --batch.");
+    m_oCommand.add_option("--jobs,-j", this->m_config.jobs,
+                          "Number of locations fetched concurrently in batch mode, default is 8.")
+                          ->check(CLI::Range(1, 256));
+    m_oCommand.add_option("--race", this->m_config.race,
+                          "Request all these providers at the same time and use the first valid\n"
+                          "response, e.g. --race CC,OWM. Keys for providers other than --provider\n"
+                          "are read from their key files.")
+        ->delimiter(',')->check(CLI::IsMember({"CC", "OWM"}));
+    m_oCommand.add_flag("--raceStats", this->m_config.raceStats,
+                          "Show win rates and latencies of the providers for this location and exit.");
+    m_oCommand.add_flag("--health", this->m_config.health,
+                          "Show latency, error rate and circuit state of the providers and exit.");
+    m_oCommand.add_option("--benchmark", this->m_config.benchmark,
+                          "Run a benchmark and exit. Available: history, archive, transfer, startup, iso8601, timezone, almanac");
+}
+
+/**
+ * read the API key of a provider from CONFIG_DIR/XX.key, where XX is the
+ * provider short code (i.e. CC.key holds the key for ClimaCell).
+ *
+ * @param provider      - provider short code
+ * @param path          - receives the path of the key file
+ * @return              - the key, empty when there is no key file
+ */
+std::string ProgramOptions::readKeyFile(const std::string& provider, std::string& path) const
+{
+    std::string line;
+
+    path.assign(m_config.config_dir_path);
+    path.append("/").append(provider).append(".key");
+    LOG_F(INFO, "ProgramOptions::readKeyFile(): Attempting to read the API key from: %s", path.c_str());
+
+    std::ifstream f(path);
+    if(!f.fail()) {         // i dislike the overloaded ! for streams.
+        /*
+         * The first line is supposed to contain the api key, nothing else. Everyhing
+         * else is ignored.
+         */
+        std::getline(f, line);
+        utils::trim(line);
+    }
+    return line;
+}
+
+/**
+ * the API key for a provider. --apikey belongs to the --provider, all
+ * others (and all providers with --provider auto) need a key file.
+ */
+std::string ProgramOptions::apiKeyFor(const std::string& provider) const
+{
+    std::string path;
+
+    if(provider == m_config.apiProviderString && !m_config.autoProvider)
+        return m_config.apikey;
+    return this->readKeyFile(provider, path);
+}
+
+/**
+ * set the location of cfg. A LAT,LON location also sets --lat and --lon,
+ * which some providers need, any other location clears them.
+ */
+void ProgramOptions::setLocation(CFG& cfg, const std::string& location)
+{
+    auto comma = location.find(',');
+
+    cfg.location = location;
+    cfg.lat = comma == std::string::npos ? "" : location.substr(0, comma);
+    cfg.lon = comma == std::string::npos ? "" : location.substr(comma + 1);
+}
+
+/**
+ * create the cache and config directories. Nothing needs them before the
+ * first response arrives, so this runs while the request is in flight
+ * (see DataHandler::prepare()). The data directory itself is created with
+ * the log file.
+ */
+void ProgramOptions::createDirectories(const CFG& cfg)
+{
+    static std::once_flag once;
+
+    std::call_once(once, [&cfg]() {
+        fs::path path(cfg.data_dir_path + "/cache");
+        std::error_code ec;
+
+        if (bool res = fs::create_directories(path, ec)) {
+            LOG_F(INFO, "ProgramOptions::createDirectories(): create_directories result: %d : %s",
+                  ec.value(), ec.message().c_str());
+            if (0 == ec.value()) {
+                fs::permissions(path, fs::perms::owner_all, fs::perm_options::replace);
+                fs::permissions(path.parent_path(), fs::perms::owner_all, fs::perm_options::replace);
+            }
+        } else if (ec) {
+            LOG_F(INFO, "ProgramOptions::createDirectories(): Could not create the data directories.");
+            LOG_F(INFO, "ProgramOptions::createDirectories(): Attempted to create: %s", path.c_str());
+            LOG_F(INFO, "ProgramOptions::createDirectories(): Error code: %d : %s", ec.value(), ec.message().c_str());
+        }
+
+        if (bool res = fs::create_directories(fs::path(cfg.config_dir_path), ec)) {
+            LOG_F(INFO, "ProgramOptions::createDirectories(): Config directory %s created",
+                  cfg.config_dir_path.c_str());
+        }
+    });
+}
+
+/**
+ * derive the configuration for another provider from base.
+ *
+ * @param base          - the configuration to copy
+ * @param provider      - provider short code
+ * @param cfg           - receives the configuration
+ * @return              - false for unknown providers and providers without
+ *                        an API key
+ */
+bool ProgramOptions::providerConfig(const CFG& base, const std::string& provider, CFG& cfg)
+{
+    const auto& codes = ProgramOptions::api_shortcodes;
+    auto it = std::find(codes.begin(), codes.end(), provider);
+
+    if(it == codes.end())
+        return false;
+    cfg = base;
+    cfg.apiProvider = static_cast<unsigned int>(it - codes.begin());
+    cfg.apiProviderString = provider;
+    cfg.apikey = ProgramOptions::getInstance().apiKeyFor(provider);
+    // providers differ in the location parameters they use
+    if(cfg.lat.empty() && cfg.lon.empty())
+        ProgramOptions::setLocation(cfg, cfg.location);
+    else if(cfg.location.empty())
+        cfg.location = cfg.lat + "," + cfg.lon;
+    return !cfg.apikey.empty();
+}
+
+/**
+ * parse one --outputAs FILE[=UNITS][:FORMAT|:TEMPLATE]. Units omitted in
+ * UNITS are taken from the unit options. FORMAT is one of
+ * OutputFormat::names, anything else after the colon is a template file
+ * for the text format. Without either, the format is derived from the file
+ * extension (.json, .prom, .lp), otherwise --format and --template apply.
+ *
+ * @return      - false if the spec is malformed or a unit is not recognized.
+ */
+bool ProgramOptions::parseOutputSpec(const std::string& spec, const CFG& cfg, OutputSpec& output)
+{
+    auto eq = spec.find('=');
+    auto colon = spec.find(':', eq == std::string::npos ? 0 : eq);
+    auto end = std::min(eq, colon);
+
+    if(end == 0 || spec.empty())
+        return false;
+    output.file = spec.substr(0, end);
+    output.units = cfg.units;
+    output.layout = cfg.templateFile;
+    output.format = cfg.format;
+
+    if(colon != std::string::npos) {
+        std::string target = spec.substr(colon + 1);
+        if(target.empty())
+            return false;
+        if(!OutputFormat::parse(target, output.format)) {
+            output.format = OutputFormat::TEXT;
+            output.layout = target;
+        }
+    } else {
+        static const std::pair<const char *, OutputFormat::Kind> extensions[] = {
+            { ".json", OutputFormat::JSON }, { ".prom", OutputFormat::PROMETHEUS }, { ".lp", OutputFormat::INFLUX } };
+        auto ext = fs::path(output.file).extension();
+        for(const auto& [name, format] : extensions) {
+            if(ext == name)
+                output.format = format;
+        }
+    }
+    if(output.format != OutputFormat::TEXT)
+        output.layout.clear();
+    return eq == std::string::npos ||
+           UnitProfile::parse(spec.substr(eq + 1, colon == std::string::npos ? colon : colon - eq - 1), output.units);
 }
 
 /**
@@ -132,6 +383,12 @@ int ProgramOptions::parse(int argc, char **argv)
     const gchar *homedir = g_get_home_dir();
     const gchar *cfgdir = g_get_user_config_dir();
 
+    if(this->m_config.apiProviderString == "auto") {
+        // ProviderRouter picks the provider, CC stands in until then
+        this->m_config.autoProvider = true;
+        this->m_config.apiProviderString.assign("CC");
+        LOG_F(INFO, "ProgramOptions::parse(): API provider will be chosen automatically");
+    }
     if(this->m_config.apiProviderString.length() != 0) {
         bool found = false;
         unsigned pIndex = 0;
@@ -170,62 +427,22 @@ int ProgramOptions::parse(int argc, char **argv)
     this->logfile_path.append("/log.log");
     loguru::add_file(this->logfile_path.c_str(), loguru::Append, loguru::Verbosity_MAX);
 
-    std::string p(m_config.data_dir_path);
-    p.append("/cache");
-    fs::path path(p);
-    std::error_code ec;
-
-    if (bool res = fs::create_directories(path, ec)) {
-        LOG_F(INFO, "ProgramOptions::parse(): create_directories result: %d : %s",
-              ec.value(), ec.message().c_str());
-        if (0 == ec.value()) {
-            fs::permissions(path, fs::perms::owner_all, fs::perm_options::replace);
-            fs::permissions(path.parent_path(), fs::perms::owner_all, fs::perm_options::replace);
-        }
-    } else {
-        LOG_F(INFO, "ProgramOptions::parse(): Could not create the data directories. "
-                    "Maybe no permission or they exist?");
-        LOG_F(INFO, "ProgramOptions::parse(): Attempted to create: %s", path.c_str());
-        LOG_F(INFO, "ProgramOptions::parse(): Error code: %d : %s", ec.value(), ec.message().c_str());
-    }
-
-    if (bool res = fs::create_directories(fs::path(m_config.config_dir_path), ec)) {
-        LOG_F(INFO, "ProgramOptions::parse(): Config directory %s created",
-              m_config.config_dir_path.c_str());
-    }
     /*
      * try to read API key from a file, when present.
      * usually $HOME/.config/fetchweather/XX.key where XX is the API provider
      * i.e. CC.key holds the key for ClimaCell.
      */
-    this->keyfile_path.assign(m_config.config_dir_path);
-    this->keyfile_path.append("/").append(m_config.apiProviderString).append(".key");
-    LOG_F(INFO, "ProgramOptions::parse(): Attempting to read the API key from: %s",
-          this->keyfile_path.c_str());
-
-    std::ifstream f;
-
-    f.open(this->keyfile_path);
-    if(!f.fail()) {         // i dislike the overloaded ! for streams.
-        std::string line;
-        std::getline(f, line);
-        /*
-         * The first line is supposed to contain the api key, nothing else. Everyhing
-         * else is ignored.
-         */
-        if(line.length() > 0) {
-            utils::trim(line);
-            LOG_F(INFO, "ProgramOptions::parse(): An API key for Provider %s has been found: %s",
-                  m_config.apiProviderString.c_str(), line.c_str());
-            if(this->m_oCommand.get_option("--apikey")->count() == 0) {
-                LOG_F(INFO, "Setting this key as API key because none was supplied on the command line.");
-                m_config.apikey.assign(line);
-                this->fUseKeyfile = true;
-            } else {
-                LOG_F(INFO, "Ignoring the key, because the command line option --apikey takes precedence");
-            }
+    std::string line = this->readKeyFile(m_config.apiProviderString, this->keyfile_path);
+    if(line.length() > 0) {
+        LOG_F(INFO, "ProgramOptions::parse(): An API key for Provider %s has been found: %s",
+              m_config.apiProviderString.c_str(), line.c_str());
+        if(this->m_oCommand.get_option("--apikey")->count() == 0) {
+            LOG_F(INFO, "Setting this key as API key because none was supplied on the command line.");
+            m_config.apikey.assign(line);
+            this->fUseKeyfile = true;
+        } else {
+            LOG_F(INFO, "Ignoring the key, because the command line option --apikey takes precedence");
         }
-        f.close();
     } else {
         LOG_F(INFO, "ProgramOptions::parse(): No keyfile found for API provider %s",
               m_config.apiProviderString.c_str());
@@ -240,10 +457,12 @@ int ProgramOptions::parse(int argc, char **argv)
     if(!m_config.temp_unit_raw.empty()) {
         m_config.temp_unit = static_cast<char>(toupper(m_config.temp_unit_raw[0]));
     }
-    if(m_config.temp_unit != 'F' && m_config.temp_unit != 'C') {
+    if(!(m_config.units.units[UnitProfile::TEMPERATURE] =
+             UnitProfile::find(UnitProfile::TEMPERATURE, std::string_view(&m_config.temp_unit, 1)))) {
         snprintf(msg, 255, "Unrecognized temperature Unit %c (allowed are C or F). Reverting default",
                  m_config.temp_unit);
         m_config.temp_unit = 'C';
+        m_config.units.units[UnitProfile::TEMPERATURE] = &UnitProfile::temperature_units[0];
         if(m_config.debug) {
             printf("%s\n", msg);
         } else {
@@ -251,10 +470,11 @@ int ProgramOptions::parse(int argc, char **argv)
         }
     }
 
-    if(m_config.speed_unit != "m/s" && m_config.speed_unit != "km/h" && m_config.speed_unit != "kts" && m_config.speed_unit != "mph") {
+    if(!(m_config.units.units[UnitProfile::SPEED] = UnitProfile::find(UnitProfile::SPEED, m_config.speed_unit))) {
         snprintf(msg, 255, "Unrecognized speed unit %s (m/s, km/h, mph or knots). Reverting default.",
                  m_config.speed_unit.c_str());
         m_config.speed_unit.assign("km/h");
+        m_config.units.units[UnitProfile::SPEED] = &UnitProfile::speed_units[2];
         if(m_config.debug) {
             printf("%s\n", msg);
         } else {
@@ -262,10 +482,11 @@ int ProgramOptions::parse(int argc, char **argv)
         }
     }
 
-    if(m_config.vis_unit != "km" && m_config.vis_unit != "mi") {
+    if(!(m_config.units.units[UnitProfile::VISIBILITY] = UnitProfile::find(UnitProfile::VISIBILITY, m_config.vis_unit))) {
         snprintf(msg, 255, "Unrecognized visbility Unit %s (allowed are km or mi). Reverting default",
                  m_config.vis_unit.c_str());
         m_config.vis_unit.assign("km");
+        m_config.units.units[UnitProfile::VISIBILITY] = &UnitProfile::visibility_units[0];
         if(m_config.debug) {
             printf("%s\n", msg);
         } else {
@@ -273,16 +494,30 @@ int ProgramOptions::parse(int argc, char **argv)
         }
     }
 
-    if(m_config.pressure_unit != "hPa" && m_config.pressure_unit != "inhg") {
+    if(!(m_config.units.units[UnitProfile::PRESSURE] = UnitProfile::find(UnitProfile::PRESSURE, m_config.pressure_unit))) {
         snprintf(msg, 255, "Unrecognized pressure Unit %s (allowed are hPa or inhg). Reverting default",
                  m_config.pressure_unit.c_str());
         m_config.pressure_unit.assign("hPa");
+        m_config.units.units[UnitProfile::PRESSURE] = &UnitProfile::pressure_units[0];
         if(m_config.debug) {
             printf("%s\n", msg);
         } else {
             LOG_F(INFO, "%s", msg);
         }
     }
+
+    OutputFormat::parse(m_config.outputFormat, m_config.format);
+    if(m_config.serve) {
+        m_config.daemon = true;
+    }
+
+    // resolve the --outputAs profiles, invalid ones are reported by FetchWeatherApp::run()
+    for(const auto& spec : m_config.outputAs) {
+        OutputSpec output;
+        if(ProgramOptions::parseOutputSpec(spec, m_config, output)) {
+            m_config.outputProfiles.push_back(std::move(output));
+        }
+    }
     if(this->m_oCommand.get_option("--help")->count()) {
         printf("help was requested from CLI");
         return 0;
@@ -323,7 +558,7 @@ void ProgramOptions::dumpOptions()
     } else {
         printf("Location:                %s\n", m_config.location.c_str());
     }
-    printf("Timezone:                %s\n", m_config.timezone.c_str());
+    printf("Timezone:                %s\n", m_config.timezone.empty() ? "(system)" : m_config.timezone.c_str());
     printf("Units (Temp, Windspeed, Vis, Pressure): %c, %s, %s, %s\n", m_config.temp_unit,
            m_config.speed_unit.c_str(), m_config.vis_unit.c_str(), m_config.pressure_unit.c_str());
 }
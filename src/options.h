@@ -26,6 +26,18 @@
 #define __OPTIONS_H_
 
 #include "pch.h"
+#include "UnitProfile.h"
+#include "OutputFormat.h"
+
+/*
+ * one additional output file (--outputAs FILE[=UNITS][:FORMAT|:TEMPLATE])
+ */
+struct OutputSpec {
+    std::string file;
+    UnitProfile units;
+    std::string layout;         // template file, empty = the --template layout
+    OutputFormat::Kind format = OutputFormat::TEXT;
+};
 
 typedef struct _cfg {
     unsigned int apiProvider;
@@ -41,7 +53,13 @@ typedef struct _cfg {
     std::string vis_unit;
     std::string speed_unit;
     std::string pressure_unit;
+    UnitProfile units;                      // the unit options above, resolved
     std::string output_file;
+    std::string templateFile;               // output layout, empty = built-in conky layout
+    std::string outputFormat = "text";      // text, json, prometheus or influx
+    OutputFormat::Kind format = OutputFormat::TEXT;     // outputFormat, resolved
+    std::vector<std::string> outputAs;      // additional outputs, each with own units, format and layout
+    std::vector<OutputSpec> outputProfiles; // outputAs, resolved
     std::string location;
     std::string lat, lon;
     std::string timezone;
@@ -53,6 +71,31 @@ typedef struct _cfg {
     bool dumptofile;    // also write result to file, note that output_dir must be set and valid.
     bool cmd_version;       // display version
     int  forecastDays = 3;
+    int  retainRaw = 14;        // retention in days for raw history rows, 0 = forever
+    int  retainHourly = 365;    // retention for the hourly rollups
+    int  retainDaily = 0;       // retention for the daily rollups
+    bool compact = false;       // force a compaction pass of the history database
+    bool noarchive = false;     // drop expired raw history instead of archiving it
+    std::string historyBackend = "sqlite";  // sqlite or tslog
+    std::string benchmark;      // run the named benchmark instead of fetching
+    std::string exportPath, importPath;     // --export / --import history
+    std::string historyFormat;  // csv or jsonl, empty = derive from the file name
+    std::string exportUnits;    // unit profile for --export, empty = metric
+    std::string legacyUnits;    // units of history recorded by older versions, see HistoryDB::convertLegacy()
+    int64_t exportFrom = 0, exportTo = 0;   // time range for --export, 0 = unlimited
+    bool daemon = false;        // stay resident and refresh periodically
+    int  interval = 900;        // seconds between refreshes in daemon mode
+    int  jitter = 30;           // random +/- seconds added to every interval
+    bool serve = false;         // daemon mode answering snapshot queries on a socket
+    std::string socketPath;     // socket for --serve, empty = the default path
+    std::string batchFile;      // --batch, one NAME LOCATION per line
+    std::vector<std::string> sites;     // --site NAME=LOCATION
+    int  jobs = 8;              // concurrent sites in batch mode
+    std::string site;           // name of the location in batch mode, empty otherwise
+    std::vector<std::string> race;      // providers requested concurrently, first valid response wins
+    bool raceStats = false;     // print the --race statistics and exit
+    bool autoProvider = false;  // --provider auto, the provider is chosen by ProviderRouter
+    bool health = false;        // print the provider health and exit
 } CFG;
 
 class ProgramOptions {
@@ -68,18 +111,18 @@ class ProgramOptions {
         return instance;
     }
     int parse(int argc, char **argv);
+    static bool parseOutputSpec(const std::string& spec, const CFG& cfg, OutputSpec& output);
+    static void setLocation(CFG& cfg, const std::string& location);
+    static bool providerConfig(const CFG& base, const std::string& provider, CFG& cfg);
+    static void createDirectories(const CFG& cfg);
+    std::string apiKeyFor(const std::string& provider) const;
     void dumpOptions();
     void flush();
     void print_version();
-    QString q;
-    void setAppObject(QCoreApplication *the_app) { this->m_app = the_app; }
 
     const CFG &getConfig()
     { return this->m_config; }
 
-    const QCommandLineParser &getParser()
-    { return this->m_Parser; }
-
     const std::string &getLogFilePath()
     { return this->logfile_path; }
 
@@ -102,11 +145,10 @@ class ProgramOptions {
     CLI::App            m_oCommand;
     std::string         m_name;
     void                _init();
+    std::string         readKeyFile(const std::string& provider, std::string& path) const;
     unsigned int        counter;
     CFG                 m_config;
     std::string         logfile_path, keyfile_path;
     bool                fUseKeyfile = false;
-    QCommandLineParser  m_Parser;
-    QCoreApplication*   m_app;
 };
 #endif //__OPTIONS_H_
@@ -43,9 +43,6 @@
 #include "CLI/Config.hpp"
 #include "nlohmann/json/single_include/nlohmann/json.hpp"
 #include "loguru/loguru.hpp"
-#include <QCommandLineParser>
-#include <QtCore>
-#include <QObject>
 #include "conf.h"
 
 namespace fs = std::filesystem;
@@ -0,0 +1,160 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Alex Vie (silvercircle@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * fetchweather-query, the client for fetchweather --serve. Meant for conky:
+ *
+ *      ${execi 60 fetchweather-query}
+ *      ${execi 60 fetchweather-query json F,mph}
+ *
+ * prints the rendered snapshot and exits. It links nothing but libc, so
+ * there is no dynamic linking of Qt and friends, no option parsing
+ * framework and no log file, startup is the cost of an exec().
+ *
+ * usage: fetchweather-query [-S SOCKET] [FORMAT [UNITS]]
+ *
+ * exit status: 0 success, 1 the server answered with an error, 2 the
+ * server cannot be reached, runs as another user or the answer is
+ * incomplete.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "SnapshotProtocol.h"
+
+namespace {
+    bool write_all(int fd, const char *p, size_t len)
+    {
+        while(len > 0) {
+            ssize_t n = write(fd, p, len);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr = {};
+    const char *socket_path = nullptr;
+    char request[snapshot_protocol::max_request];
+    int arg = 1;
+
+    if(arg + 1 < argc && strcmp(argv[arg], "-S") == 0) {
+        socket_path = argv[arg + 1];
+        arg += 2;
+    }
+    if(argc - arg > 2 || (arg < argc && argv[arg][0] == '-')) {
+        fprintf(stderr, "usage: %s [-S SOCKET] [FORMAT [UNITS]]\n", argv[0]);
+        return 2;
+    }
+    int n = snprintf(request, sizeof(request), "%s%s%s\n", arg < argc ? argv[arg] : "",
+                     arg + 1 < argc ? " " : "", arg + 1 < argc ? argv[arg + 1] : "");
+    if(n < 0 || static_cast<size_t>(n) >= sizeof(request)) {
+        fprintf(stderr, "%s: request too long\n", argv[0]);
+        return 2;
+    }
+
+    addr.sun_family = AF_UNIX;
+    if(socket_path ? snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path) >=
+                     static_cast<int>(sizeof(addr.sun_path))
+                   : !snapshot_protocol::default_socket_path(addr.sun_path, sizeof(addr.sun_path))) {
+        fprintf(stderr, "%s: socket path too long\n", argv[0]);
+        return 2;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct timeval tv = { snapshot_protocol::client_timeout_ms / 1000,
+                          (snapshot_protocol::client_timeout_ms % 1000) * 1000 };
+    if(fd < 0 || setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0 ||
+       connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+       !write_all(fd, request, n)) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], addr.sun_path, strerror(errno));
+        return 2;
+    }
+    // only talk to a server of the same user, anybody could have created the socket
+    struct ucred peer = {};
+    socklen_t peer_len = sizeof(peer);
+    if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) != 0 || peer.uid != getuid()) {
+        fprintf(stderr, "%s: %s: the server is not running as this user\n", argv[0], addr.sun_path);
+        return 2;
+    }
+
+    /*
+     * the header line is read with the first chunk of the payload, the
+     * rest of the payload is copied to stdout as it arrives
+     */
+    char buf[65536];
+    size_t len = 0;
+    char *eol = nullptr;
+    while(!eol && len < sizeof(buf)) {
+        ssize_t r = read(fd, buf + len, sizeof(buf) - len);
+        if(r < 0 && errno == EINTR)
+            continue;
+        if(r <= 0)
+            break;
+        eol = static_cast<char *>(memchr(buf + len, '\n', r));
+        len += r;
+    }
+    if(!eol) {
+        fprintf(stderr, "%s: incomplete response\n", argv[0]);
+        return 2;
+    }
+    *eol = '\0';
+    if(strncmp(buf, "OK ", 3) != 0) {
+        fprintf(stderr, "%s: %s\n", argv[0], strncmp(buf, "ERR ", 4) == 0 ? buf + 4 : buf);
+        return 1;
+    }
+    unsigned long long left = strtoull(buf + 3, nullptr, 10);
+    const char *p = eol + 1;
+    size_t chunk = len - (p - buf);
+    while(left > 0) {
+        if(chunk == 0) {
+            ssize_t r = read(fd, buf, sizeof(buf));
+            if(r < 0 && errno == EINTR)
+                continue;
+            if(r <= 0) {
+                fprintf(stderr, "%s: incomplete response\n", argv[0]);
+                return 2;
+            }
+            p = buf;
+            chunk = r;
+        }
+        if(chunk > left)
+            chunk = left;
+        if(!write_all(STDOUT_FILENO, p, chunk))
+            return 2;
+        left -= chunk;
+        chunk = 0;
+    }
+    close(fd);
+    return 0;
+}
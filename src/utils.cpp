@@ -32,23 +32,171 @@
 
 namespace utils {
 
-  time_t ISOToUnixtime(const char *iso_string, GTimeZone *tz)
+  /**
+   * read exactly n decimal digits
+   */
+  static inline bool digits(const char *s, int n, int& value)
   {
-      GDateTime *g = g_date_time_new_from_iso8601(iso_string, tz);
+      value = 0;
+      for(int i = 0; i < n; i++) {
+          if(s[i] < '0' || s[i] > '9') {
+              return false;
+          }
+          value = value * 10 + (s[i] - '0');
+      }
+      return true;
+  }
 
-      time_t _unix = g_date_time_to_unix(g);
-      g_date_time_unref(g);
-      return _unix;
+  static inline void put2(char *p, unsigned v)
+  {
+      p[0] = static_cast<char>('0' + v / 10);
+      p[1] = static_cast<char>('0' + v % 10);
   }
 
+  /**
+   * parse an ISO-8601 / RFC 3339 timestamp in the extended format
+   * YYYY-MM-DDTHH:MM[:SS[.fraction]][Z|+HH:MM|+HHMM|+HH]. A missing zone
+   * designator means UTC, fractions of a second are ignored. A plain date
+   * (YYYY-MM-DD) is midnight UTC. Does not allocate.
+   *
+   * @param s         - the string, does not need to be 0-terminated
+   * @param len       - its length
+   * @param result    - receives the unix time
+   * @param offset    - if given, receives the UTC offset in seconds
+   * @return          - false if s is not a valid timestamp
+   */
+  bool parseISO8601(const char *s, size_t len, time_t& result, int *offset)
+  {
+      int year, month, day, hour = 0, minute = 0, second = 0, off = 0;
+      size_t i = 10;
 
-  time_t ISOToUnixtime(const std::string& iso_string, GTimeZone *tz)
+      if(len < 10 || !digits(s, 4, year) || s[4] != '-' || !digits(s + 5, 2, month) || s[7] != '-'
+         || !digits(s + 8, 2, day)) {
+          return false;
+      }
+      if(month < 1 || month > 12 || day < 1
+         || day > static_cast<int>(daysFromCivil(month == 12 ? year + 1 : year, month % 12 + 1, 1)
+                                   - daysFromCivil(year, month, 1))) {
+          return false;
+      }
+      if(len > 10) {
+          if((s[10] != 'T' && s[10] != 't' && s[10] != ' ') || len < 16 || !digits(s + 11, 2, hour)
+             || s[13] != ':' || !digits(s + 14, 2, minute)) {
+              return false;
+          }
+          i = 16;
+          if(i < len && s[i] == ':') {
+              if(len < 19 || !digits(s + 17, 2, second)) {
+                  return false;
+              }
+              i = 19;
+              if(i < len && (s[i] == '.' || s[i] == ',')) {
+                  size_t start = ++i;
+                  while(i < len && s[i] >= '0' && s[i] <= '9') {
+                      i++;
+                  }
+                  if(i == start) {
+                      return false;
+                  }
+              }
+          }
+          if(i < len) {
+              int oh = 0, om = 0;
+              if(s[i] == 'Z' || s[i] == 'z') {
+                  i++;
+              } else if(s[i] == '+' || s[i] == '-') {
+                  int sign = s[i] == '-' ? -1 : 1;
+                  size_t rest = len - i - 1;
+                  const char *o = s + i + 1;
+                  if(rest == 2 && digits(o, 2, oh)) {
+                      i += 3;
+                  } else if(rest == 4 && digits(o, 2, oh) && digits(o + 2, 2, om)) {
+                      i += 5;
+                  } else if(rest == 5 && digits(o, 2, oh) && o[2] == ':' && digits(o + 3, 2, om)) {
+                      i += 6;
+                  } else {
+                      return false;
+                  }
+                  if(oh > 23 || om > 59) {
+                      return false;
+                  }
+                  off = sign * (oh * 3600 + om * 60);
+              }
+          }
+          if(i != len || hour > 23 || minute > 59 || second > 60) {
+              return false;
+          }
+      }
+      result = static_cast<time_t>((daysFromCivil(year, month, day) * 86400) + hour * 3600 + minute * 60
+                                   + second - off);
+      if(offset) {
+          *offset = off;
+      }
+      return true;
+  }
+
+  /**
+   * format t as RFC 3339 timestamp (2021-05-01T06:00:00Z or with a numeric
+   * offset like 2021-05-01T08:00:00+02:00). Does not allocate.
+   *
+   * @param t         - unix time
+   * @param buf       - the output buffer, needs at least 26 bytes
+   * @param len       - its size
+   * @param offset    - UTC offset in seconds, 0 writes a "Z"
+   * @return          - length of the result without the terminating 0,
+   *                    0 if buf is too small.
+   */
+  size_t formatISO8601(time_t t, char *buf, size_t len, int offset)
   {
-      GDateTime *g = g_date_time_new_from_iso8601(iso_string.c_str(), tz);
+      int64_t local = static_cast<int64_t>(t) + offset;
+      int64_t days = (local >= 0 ? local : local - 86399) / 86400;
+      int64_t secs = local - days * 86400;
+      int year;
+      unsigned month, day;
 
-      time_t _unix = g_date_time_to_unix(g);
-      g_date_time_unref(g);
-      return _unix;
+      civilFromDays(days, year, month, day);
+      size_t n = offset ? 25 : 20;
+      if(len < n + 1 || year < 0 || year > 9999) {
+          return 0;
+      }
+      put2(buf, year / 100);
+      put2(buf + 2, year % 100);
+      buf[4] = '-';
+      put2(buf + 5, month);
+      buf[7] = '-';
+      put2(buf + 8, day);
+      buf[10] = 'T';
+      put2(buf + 11, secs / 3600);
+      buf[13] = ':';
+      put2(buf + 14, (secs / 60) % 60);
+      buf[16] = ':';
+      put2(buf + 17, secs % 60);
+      if(offset) {
+          unsigned a = offset < 0 ? -offset : offset;
+          buf[19] = offset < 0 ? '-' : '+';
+          put2(buf + 20, a / 3600);
+          buf[22] = ':';
+          put2(buf + 23, (a / 60) % 60);
+      } else {
+          buf[19] = 'Z';
+      }
+      buf[n] = 0;
+      return n;
+  }
+
+  /**
+   * @return        - unix time of the ISO-8601 timestamp, 0 if it is invalid.
+   */
+  time_t ISOToUnixtime(const char *iso_string)
+  {
+      time_t result;
+      return iso_string && parseISO8601(iso_string, strlen(iso_string), result) ? result : 0;
+  }
+
+  time_t ISOToUnixtime(const std::string& iso_string)
+  {
+      time_t result;
+      return parseISO8601(iso_string.data(), iso_string.size(), result) ? result : 0;
   }
 
   /**
@@ -62,7 +210,7 @@ namespace utils {
    */
   size_t curl_callback(void *contents, size_t size, size_t nmemb, std::string *s)
   {
-      s->append((char *)contents);
+      s->append(static_cast<const char *>(contents), size * nmemb);
       return size * nmemb;
   }
   
@@ -78,57 +226,44 @@ namespace utils {
   }
 
   /**
-   * fetch a document from the given url.
+   * check the result of a transfer and store the response.
    *
-   * @param url             - the document URI
+   * @param rc              - result of the transfer
+   * @param response        - the document received
    * @param parse_result    - json object to be parsed into
    * @param cache           - write the response to this cache file
    * @param skipcache       - skip the caching step (option --skipcache)
    * @return                - 0 for failure, 1 otherwise
    */
-  unsigned int curl_fetch(const char *url, nlohmann::json& parse_result, const std::string& cache,
-                          bool skipcache)
+  unsigned int curl_store(CURLcode rc, const std::string& response, nlohmann::json& parse_result,
+                          const std::string& cache, bool skipcache)
   {
       unsigned int result = 1;
-      std::string response;
-
-      curl_global_init(CURL_GLOBAL_DEFAULT);
-      CURL *curl = curl_easy_init();
-      if(curl) {
-          curl_easy_setopt(curl, CURLOPT_URL, url);
-          curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, utils::curl_callback);
-          curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-          curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10);
-          curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60);
 
-          auto rc = curl_easy_perform(curl);
-          if(rc != CURLE_OK) {
-              LOG_F(INFO, "curl_easy_perform() failed, return = %s", curl_easy_strerror(rc));
+      if(rc != CURLE_OK) {
+          LOG_F(INFO, "curl_store(): transfer failed, return = %s", curl_easy_strerror(rc));
+          result = 0;
+      } else {
+          try {
+              parse_result = json::parse(response.c_str());
+          } catch(nlohmann::detail::parse_error &p) {
+              LOG_F(INFO, "curl_store: JSON parse_error (%s)", p.what());
+              result = 0;
+          }
+          if(parse_result.empty()) {
+              LOG_F(INFO, "Current forecast: Request failed, no valid data received");
               result = 0;
           } else {
-              try {
-                  parse_result = json::parse(response.c_str());
-              } catch(nlohmann::detail::parse_error &p) {
-                  LOG_F(INFO, "curl_fetch: JSON parse_error (%s)", p.what());
-                  result = 0;
-              }
-              if(parse_result.empty()) {
-                  LOG_F(INFO, "Current forecast: Request failed, no valid data received");
-                  result = 0;
+              if(skipcache) {
+                  LOG_F(INFO, "Current forecast: Skipping cache refresh (--nocache option present)");
               } else {
-                  if(skipcache) {
-                      LOG_F(INFO, "Current forecast: Skipping cache refresh (--nocache option present)");
-                  } else {
-                      std::ofstream f(cache);
-                      f.write(response.c_str(), response.length());
-                      f.flush();
-                      f.close();
-                  }
+                  std::ofstream f(cache);
+                  f.write(response.c_str(), response.length());
+                  f.flush();
+                  f.close();
               }
           }
       }
-      curl_easy_cleanup(curl);
-      curl_global_cleanup();
       return result;
   }
 } // namespace utils
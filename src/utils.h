@@ -31,15 +31,84 @@
 #include <time.h>
 #include <glib-2.0/glib.h>
 #include <ctime>
+#include <cmath>
+#include <atomic>
 #include "pch.h"
 
 namespace utils {
-  time_t ISOToUnixtime(const char *iso_string, GTimeZone *tz = 0);
-  time_t ISOToUnixtime(const std::string& s, GTimeZone *tz = 0);
+  bool parseISO8601(const char *s, size_t len, time_t& result, int *offset = nullptr);
+  size_t formatISO8601(time_t t, char *buf, size_t len, int offset = 0);
+  time_t ISOToUnixtime(const char *iso_string);
+  time_t ISOToUnixtime(const std::string& s);
   size_t curl_callback(void *contents, size_t size, size_t nmemb, std::string *s);
   int sqlite_callback(void *NotUsed, int argc, char **argv, char **azColName);
-  unsigned int curl_fetch(const char *url, nlohmann::json& parse_result, const std::string& cache,
-                          bool skipcache = false);
+  unsigned int curl_store(CURLcode rc, const std::string& response, nlohmann::json& parse_result,
+                          const std::string& cache, bool skipcache = false);
+
+  /**
+   * days since 1970-01-01 for a date in the proleptic Gregorian calendar
+   * (H. Hinnant's days_from_civil). month is 1-12.
+   */
+  constexpr int64_t daysFromCivil(int64_t y, unsigned month, unsigned day)
+  {
+      y -= month <= 2;
+      const int64_t era = (y >= 0 ? y : y - 399) / 400;
+      const unsigned yoe = static_cast<unsigned>(y - era * 400);
+      const unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+      const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+      return era * 146097 + static_cast<int64_t>(doe) - 719468;
+  }
+
+  /**
+   * the reverse of daysFromCivil()
+   */
+  constexpr void civilFromDays(int64_t z, int& y, unsigned& month, unsigned& day)
+  {
+      z += 719468;
+      const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+      const unsigned doe = static_cast<unsigned>(z - era * 146097);
+      const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+      const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+      const unsigned mp = (5 * doy + 2) / 153;
+      day = doy - (153 * mp + 2) / 5 + 1;
+      month = mp < 10 ? mp + 3 : mp - 9;
+      y = static_cast<int>(yoe + era * 400 + (month <= 2));
+  }
+
+  /**
+   * ISO weekday (1 = Monday ... 7 = Sunday) of t at the given UTC offset
+   * in seconds.
+   */
+  constexpr int weekday(time_t t, int offset = 0)
+  {
+      int64_t s = static_cast<int64_t>(t) + offset;
+      int64_t days = (s >= 0 ? s : s - 86399) / 86400;
+      int64_t wd = (days + 3) % 7;                 // 1970-01-01 was a Thursday
+      return static_cast<int>(wd < 0 ? wd + 7 : wd) + 1;
+  }
+
+  /**
+   * 64bit FNV-1a hash, pass the previous result as seed to hash several
+   * values in a row.
+   */
+  inline uint64_t fnv1a(const void *data, size_t len, uint64_t seed = 14695981039346656037ULL)
+  {
+      const unsigned char *p = static_cast<const unsigned char *>(data);
+      for(size_t i = 0; i < len; i++) {
+          seed = (seed ^ p[i]) * 1099511628211ULL;
+      }
+      return seed;
+  }
+
+  /**
+   * return a numeric json value or the fallback when the field is missing
+   * or not a number.
+   */
+  inline double number_or(const nlohmann::json& j, const char *key, double fallback = NAN)
+  {
+      auto it = j.find(key);
+      return (it != j.end() && it->is_number()) ? it->get<double>() : fallback;
+  }
 
   /**
    * a couple of funtions to trim strings left, right and on both sides